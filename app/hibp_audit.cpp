@@ -0,0 +1,368 @@
+#include "digest.hpp"
+#include "flat_file.hpp"
+#include "hibp.hpp"
+#include "toc.hpp"
+#include <CLI/CLI.hpp>
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstddef>
+#include <cstdlib>
+#include <exception>
+#include <filesystem>
+#include <fmt/chrono.h> // IWYU pragma: keep
+#include <fmt/format.h>
+#include <fstream>
+#include <ios>
+#include <iostream>
+#include <istream>
+#include <memory>
+#include <optional>
+#include <ostream>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+struct cli_config_t {
+  std::string db_filename;
+  std::string input_filename;
+  std::string output_filename;
+  bool        force           = false;
+  bool        standard_input  = false;
+  bool        standard_output = false;
+  bool        ntlm            = false;
+  bool        sha1t64         = false;
+  bool        plain           = false;
+  bool        toc             = false;
+  unsigned    toc_bits        = 20; // 1Mega chapters
+  std::size_t max_memory      = 1000;
+};
+
+void define_options(CLI::App& app, cli_config_t& cli) {
+
+  app.add_option("db_filename", cli.db_filename,
+                 "The file that contains the binary database you downloaded")
+      ->required();
+
+  app.add_option("-i,--input", cli.input_filename,
+                 "A text file of the hashes to audit, one per line, in any order. Only the "
+                 "leading hash of each line is used, so `HASH` and `HASH:anything` both work.");
+
+  app.add_flag("--stdin", cli.standard_input,
+               "Instead of an input file read the hashes from standard_input.");
+
+  app.add_option("-o,--output", cli.output_filename,
+                 "The file that the pawned hashes and their counts will be written to");
+
+  app.add_flag("--stdout", cli.standard_output,
+               "Instead of an output file write output to standard output.");
+
+  app.add_flag("--ntlm", cli.ntlm, "Use ntlm hashes rather than sha1.");
+
+  app.add_flag("--sha1t64", cli.sha1t64,
+               "Use sha1 hashes truncated to 64bits rather than full sha1.");
+
+  app.add_flag("--plain", cli.plain,
+               "The input is plain text passwords, one per line, rather than hashes. They are "
+               "hashed many at a time, with SIMD where the cpu has it.");
+
+  app.add_flag("--toc", cli.toc,
+               "Use a table of contents to skip large gaps between hashes without disk reads.");
+
+  app.add_option("--toc-bits", cli.toc_bits,
+                 fmt::format("Specify how may bits to use for table of content mask. default {}",
+                             cli.toc_bits))
+      ->check(CLI::Range(15, 25));
+
+  app.add_option(
+      "--max-memory", cli.max_memory,
+      fmt::format("The maximum amount of memory used to sort the input hashes (in MB). Larger "
+                  "inputs are sorted on disk, next to the output file (or in the current "
+                  "directory with --stdout). (default = {}MB)",
+                  cli.max_memory))
+      ->check(CLI::PositiveNumber);
+
+  app.add_flag("-f,--force", cli.force, "Overwrite any existing output file!");
+}
+
+std::ifstream get_input_stream(const std::string& input_filename) {
+  auto input_stream = std::ifstream(input_filename);
+  if (!input_stream) {
+    throw std::runtime_error(fmt::format("Error opening '{}' for reading. Because: \"{}\".\n",
+                                         input_filename,
+                                         std::strerror(errno))); // NOLINT errno
+  }
+  return input_stream;
+}
+
+std::ofstream get_output_stream(const std::string& output_filename, bool force) {
+  if (!force && std::filesystem::exists(output_filename)) {
+    throw std::runtime_error(
+        fmt::format("File '{}' exists. Use `--force` to overwrite.", output_filename));
+  }
+
+  auto output_stream = std::ofstream(output_filename, std::ios_base::binary);
+  if (!output_stream) {
+    throw std::runtime_error(fmt::format("Error opening '{}' for writing. Because: \"{}\".\n",
+                                         output_filename,
+                                         std::strerror(errno))); // NOLINT errno
+  }
+  return output_stream;
+}
+
+// The needles, sorted by hash. Either in memory or, if they exceed `max_memory_bytes`, in a
+// binary flat_file sorted with `disksort`.
+template <hibp::pw_type PwType>
+struct sorted_needles {
+  std::vector<PwType>                          memdb;
+  std::unique_ptr<flat_file::database<PwType>> diskdb;
+  std::string                                  sorted_filename;
+  std::size_t                                  count = 0;
+
+  sorted_needles()                                 = default;
+  sorted_needles(const sorted_needles&)            = delete;
+  sorted_needles& operator=(const sorted_needles&) = delete;
+  sorted_needles(sorted_needles&&)                 = default;
+  sorted_needles& operator=(sorted_needles&&)      = default;
+
+  ~sorted_needles() {
+    if (!sorted_filename.empty()) {
+      diskdb.reset();
+      std::filesystem::remove(sorted_filename);
+    }
+  }
+
+  template <typename Func>
+  void for_each(Func&& func) {
+    if (diskdb) {
+      for (const auto& needle: *diskdb) func(needle);
+    } else {
+      for (const auto& needle: memdb) func(needle);
+    }
+  }
+};
+
+// hashes a chunk of plain text passwords, all at once
+template <hibp::pw_type PwType>
+void hash_passwords(const std::vector<std::string>& passwords, std::vector<PwType>& out) {
+  using digest_t = std::conditional_t<std::is_same_v<PwType, hibp::pawned_pw_ntlm>,
+                                      hibp::digest::ntlm_t, hibp::digest::sha1_t>;
+
+  const std::vector<std::string_view> texts(passwords.begin(), passwords.end());
+  std::vector<digest_t>               digests(texts.size());
+  if constexpr (std::is_same_v<digest_t, hibp::digest::ntlm_t>) {
+    hibp::digest::ntlm(texts, digests);
+  } else {
+    hibp::digest::sha1(texts, digests);
+  }
+  out.clear();
+  for (const auto& digest: digests) out.emplace_back(digest);
+}
+
+template <hibp::pw_type PwType>
+sorted_needles<PwType> read_needles(std::istream& input_stream, const std::string& spill_filename,
+                                    std::size_t max_memory_bytes, bool plain) {
+  sorted_needles<PwType> needles;
+
+  const std::size_t                             max_in_memory = max_memory_bytes / sizeof(PwType);
+  std::optional<flat_file::file_writer<PwType>> spill;
+
+  const auto add = [&](const PwType& needle) {
+    needles.memdb.push_back(needle);
+    ++needles.count;
+
+    if (needles.memdb.size() == max_in_memory) {
+      if (!spill) spill.emplace(spill_filename);
+      for (const auto& n: needles.memdb) spill->write(n);
+      needles.memdb.clear();
+    }
+  };
+
+  constexpr std::size_t    chunk_size = 4096; // passwords hashed per call
+  std::vector<std::string> passwords;
+  std::vector<PwType>      hashed;
+  const auto               hash_chunk = [&] {
+    hash_passwords(passwords, hashed);
+    for (const auto& needle: hashed) add(needle);
+    passwords.clear();
+  };
+
+  std::size_t line_number = 0;
+  for (std::string line; std::getline(input_stream, line);) {
+    ++line_number;
+    if (!line.empty() && line.back() == '\r') line.pop_back();
+    if (line.empty()) continue;
+
+    if (plain) {
+      passwords.push_back(std::move(line));
+      if (passwords.size() == chunk_size) hash_chunk();
+      continue;
+    }
+
+    std::string hash = line.substr(0, line.find(':'));
+    std::transform(hash.begin(), hash.end(), hash.begin(),
+                   [](unsigned char c) { return static_cast<char>(std::toupper(c)); });
+    if constexpr (std::is_same_v<PwType, hibp::pawned_pw_sha1t64>) {
+      // also accept full sha1 hashes, and truncate them
+      if (hibp::is_valid_hash<hibp::pawned_pw_sha1>(hash)) hash.resize(PwType::hash_str_size);
+    }
+    if (!hibp::is_valid_hash<PwType>(hash)) {
+      throw std::runtime_error(fmt::format("Invalid hash on line {}: '{}'", line_number, line));
+    }
+    add(PwType{hash});
+  }
+  if (!passwords.empty()) hash_chunk();
+
+  if (!spill) {
+    std::sort(needles.memdb.begin(), needles.memdb.end());
+    return needles;
+  }
+
+  for (const auto& needle: needles.memdb) spill->write(needle);
+  needles.memdb = {};
+  spill.reset(); // flush and close
+
+  std::cerr << fmt::format("{} hashes exceed --max-memory, sorting on disk\n", needles.count);
+  {
+    flat_file::database<PwType> unsorted(spill_filename, 4096 / sizeof(PwType));
+    needles.sorted_filename = unsorted.disksort({}, {}, max_memory_bytes);
+  }
+  std::filesystem::remove(spill_filename);
+  needles.diskdb = std::make_unique<flat_file::database<PwType>>(
+      needles.sorted_filename, (1U << 16U) / sizeof(PwType));
+  return needles;
+}
+
+// One ordered pass through the db: each (sorted) needle gallops forward from the position of the
+// previous one, so dense needles read the db sequentially and sparse needles skip ahead in
+// O(log(gap)) reads. With a toc, the search for each needle also starts no earlier than its
+// chapter, so large gaps cost no reads at all.
+template <hibp::pw_type PwType>
+std::size_t merge_join(auto& db, sorted_needles<PwType>& needles, std::ostream& output_stream,
+                       const cli_config_t& cli) {
+
+  std::size_t found = 0;
+  std::size_t start = 0;
+  bool        done  = false;
+
+  std::optional<PwType> prev;
+  needles.for_each([&](const PwType& needle) {
+    if (done || (prev && *prev == needle)) return; // skip duplicates
+    prev = needle;
+
+    std::size_t first = start;
+    std::size_t last  = db.number_records();
+    if (cli.toc) {
+      auto chapter = hibp::toc_chapter(needle, cli.toc_bits, last);
+      if (!chapter) {
+        done = true; // beyond the end of a partial toc, and so are all later needles
+        return;
+      }
+      first = std::max(start, chapter->first);
+      last  = chapter->second;
+    }
+    auto iter = flat_file::gallop_lower_bound(db.begin() + first, db.begin() + last, needle);
+    if (iter != db.begin() + last && *iter == needle) {
+      output_stream << *iter << '\n';
+      ++found;
+    }
+    start = static_cast<std::size_t>(iter - db.begin());
+  });
+  return found;
+}
+
+template <hibp::pw_type PwType>
+void audit(const cli_config_t& cli) {
+  std::istream* input_stream = &std::cin;
+  std::ifstream ifs;
+  if (!cli.standard_input) {
+    ifs          = get_input_stream(cli.input_filename);
+    input_stream = &ifs;
+  }
+
+  std::ostream* output_stream = &std::cout;
+  std::ofstream ofs;
+  if (!cli.standard_output) {
+    ofs           = get_output_stream(cli.output_filename, cli.force);
+    output_stream = &ofs;
+  }
+
+  if (cli.toc) {
+    hibp::toc_build<PwType>(cli.db_filename, cli.toc_bits);
+  }
+
+  using clk   = std::chrono::high_resolution_clock;
+  using fsecs = std::chrono::duration<double>;
+  auto start  = clk::now();
+
+  const std::string spill_filename =
+      cli.standard_output ? "hibp_audit.needles.bin" : cli.output_filename + ".needles";
+
+  auto needles = read_needles<PwType>(*input_stream, spill_filename, cli.max_memory * 1024 * 1024,
+                                      cli.plain);
+  std::cerr << fmt::format("{:30s} {:12d} in {:.3}\n",
+                           cli.plain ? "Read, hashed and sorted" : "Read and sorted hashes",
+                           needles.count,
+                           duration_cast<fsecs>(clk::now() - start));
+
+  start = clk::now();
+#ifdef FLAT_FILE_HAS_MMAP
+  const flat_file::mmap_database<PwType> db(cli.db_filename, flat_file::access_hint::sequential);
+#else
+  flat_file::database<PwType> db(cli.db_filename, (1U << 20U) / sizeof(PwType));
+#endif
+  const std::size_t found = merge_join(db, needles, *output_stream, cli);
+  std::cerr << fmt::format("{:30s} {:12d} in {:.3}\n", "Found pawned hashes", found,
+                           duration_cast<fsecs>(clk::now() - start));
+}
+
+void check_options(const cli_config_t& cli) {
+  if ((!cli.input_filename.empty() && cli.standard_input) ||
+      (cli.input_filename.empty() && !cli.standard_input)) {
+    throw std::runtime_error(
+        "Please use exactly one of -i|--input and --stdin, not both, and not neither.");
+  }
+
+  if ((!cli.output_filename.empty() && cli.standard_output) ||
+      (cli.output_filename.empty() && !cli.standard_output)) {
+    throw std::runtime_error("Please use exactly one of -o|--output and --stdout, not "
+                             "both, and not neither.");
+  }
+
+  if (cli.ntlm && cli.sha1t64) {
+    throw std::runtime_error("Please don't use --ntlm and --sha1t64 together.");
+  }
+
+  if (cli.toc && cli.standard_output) {
+    throw std::runtime_error(
+        "--toc reports progress on standard output, please use -o|--output with --toc.");
+  }
+}
+
+int main(int argc, char* argv[]) {
+  cli_config_t cli;
+
+  CLI::App app("Auditing a list of hashes against a 'Have I been pawned' binary database.");
+  define_options(app, cli);
+  CLI11_PARSE(app, argc, argv);
+
+  try {
+    check_options(cli);
+
+    if (cli.ntlm) {
+      audit<hibp::pawned_pw_ntlm>(cli);
+    } else if (cli.sha1t64) {
+      audit<hibp::pawned_pw_sha1t64>(cli);
+    } else {
+      audit<hibp::pawned_pw_sha1>(cli);
+    }
+
+  } catch (const std::exception& e) {
+    std::cerr << fmt::format("Error: {}\n", e.what());
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
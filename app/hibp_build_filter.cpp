@@ -1,73 +1,151 @@
 #include "arrcmp.hpp"
+#include "binfuse/filter.hpp"
 #include "binfuse/sharded_filter.hpp"
 #include "flat_file.hpp"
 #include "hibp.hpp"
+#include "pipeline.hpp"
 #include <CLI/CLI.hpp>
+#include <algorithm>
 #include <cstddef>
 #include <cstdint>
 #include <cstdlib>
+#include <cstring>
 #include <exception>
 #include <filesystem>
 #include <fmt/format.h>
-#include <fstream>
-#include <ios>
 #include <iostream>
+#include <optional>
 #include <stdexcept>
 #include <string>
+#include <vector>
 
 struct cli_config_t {
   std::string output_filename;
   std::string input_filename;
-  bool        force  = false;
-  bool        ntlm   = false;
-  bool        verify = true;
-  std::size_t limit  = -1; // ie max
+  bool        force     = false;
+  bool        ntlm      = false;
+  bool        sha1t64   = false;
+  bool        binfuse16 = false;
+  unsigned    threads   = 0;  // 0 => one per core
+  std::size_t limit     = -1; // ie max
 };
 
 void define_options(CLI::App& app, cli_config_t& cli) {
 
   app.add_option("-i,--input", cli.input_filename,
-                 "The file that the downloaded binary database will be read from");
+                 "The file that the downloaded binary database will be read from")
+      ->required();
 
   app.add_option("-o,--output", cli.output_filename,
-                 "The file that the downloaded binary database will be written to");
+                 "The file that the binary fuse filter will be written to")
+      ->required();
 
   app.add_option("-l,--limit", cli.limit,
                  "The maximum number of records that will be converted (default: all)");
 
-  // app.add_flag("--ntlm", cli.ntlm, "Use ntlm hashes rather than sha1.");
+  app.add_flag("--ntlm", cli.ntlm, "The input db has ntlm hashes, rather than sha1.");
+
+  app.add_flag("--sha1t64", cli.sha1t64, "The input db has sha1t64 hashes, rather than sha1.");
+
+  app.add_flag("--binfuse16", cli.binfuse16,
+               "Build a binary_fuse16 filter, rather than a binary_fuse8 filter, with a lower "
+               "false positive rate, at twice the size.");
+
+  app.add_option("--threads", cli.threads,
+                 "The number of threads building shards of the filter (default: 0 => one per "
+                 "core)");
 
   app.add_flag("-f,--force", cli.force, "Overwrite any existing output file!");
 }
 
-std::ifstream get_input_stream(const std::string& input_filename) {
-  auto input_stream = std::ifstream(input_filename);
-  if (!input_stream) {
-    throw std::runtime_error(fmt::format("Error opening '{}' for reading. Because: \"{}\".\n",
-                                         input_filename,
-                                         std::strerror(errno))); // NOLINT errno
+// the sharded filter's default, ie one shard for each value of a hash's first byte
+constexpr unsigned shard_bits = 8;
+constexpr unsigned shards     = 1U << shard_bits;
+
+// The [first, last) records of each shard, found by bisecting the sorted db.
+template <hibp::pw_type PwType>
+std::vector<std::size_t> shard_bounds(flat_file::database<PwType>& db, std::size_t db_size) {
+  std::vector<std::size_t> bounds{0};
+  for (unsigned shard = 1; shard != shards; ++shard) {
+    std::size_t lo = bounds.back();
+    std::size_t hi = db_size;
+    while (lo < hi) {
+      const std::size_t mid = lo + (hi - lo) / 2;
+      if (std::to_integer<unsigned>(db.get_record(mid).hash[0]) < shard) {
+        lo = mid + 1;
+      } else {
+        hi = mid;
+      }
+    }
+    bounds.push_back(lo);
   }
-  return input_stream;
+  bounds.push_back(db_size);
+  return bounds;
 }
 
+// Each shard is an independent filter, so they are built in parallel, from the keys of its range of
+// the db, which are read in order here. They are added to the sharded filter in order, and at most
+// a few per thread are held in memory, waiting their turn.
+template <hibp::pw_type PwType, typename FilterType, typename ShardedFilterType>
 void build(const cli_config_t& cli) {
-  flat_file::database<hibp::pawned_pw_sha1> db{cli.input_filename,
-                                               (1U << 16U) / sizeof(hibp::pawned_pw_sha1)};
+  flat_file::database<PwType> db{cli.input_filename, (1U << 16U) / sizeof(PwType)};
+  const std::size_t           db_size = std::min(db.number_records(), cli.limit);
+  const auto                  bounds  = shard_bounds(db, db_size);
 
-  unsigned count = 0;
+  if (std::filesystem::exists(cli.output_filename) && cli.force) {
+    std::filesystem::remove(cli.output_filename);
+  }
+  ShardedFilterType sharded_filter(cli.output_filename);
 
-  binfuse::sharded_filter8_sink sharded_filter(cli.output_filename);
+  struct shard_filter {
+    unsigned                   shard = 0;
+    std::vector<std::uint64_t> keys;
+    std::optional<FilterType>  filter;
+  };
 
-  sharded_filter.stream_prepare();
-  for (const auto& record: db) {
-    auto key = arrcmp::impl::bytearray_cast<std::uint64_t>(record.hash.data());
-    sharded_filter.stream_add(key);
-    count++;
-    if (count == cli.limit) {
-      break;
+  std::vector<PwType> records;
+  unsigned            next_shard = 0;
+
+  const auto read = [&](shard_filter& item) {
+    while (next_shard != shards && bounds[next_shard] == bounds[next_shard + 1]) {
+      ++next_shard; // empty, eg with --limit
+    }
+    if (next_shard == shards) return false;
+    item.shard = next_shard++;
+    records.resize(bounds[item.shard + 1] - bounds[item.shard]);
+    db.read(bounds[item.shard], records.size(), records.data());
+    item.keys.clear();
+    for (const auto& pw: records) {
+      item.keys.push_back(arrcmp::impl::bytearray_cast<std::uint64_t>(pw.hash.data()));
     }
+    return true;
+  };
+
+  const auto convert = [](shard_filter& item) { item.filter.emplace(item.keys); };
+
+  const auto write = [&](shard_filter& item) {
+    sharded_filter.add(*item.filter, item.shard);
+    item.filter.reset();
+    std::cerr << fmt::format("added shard {}/{}\r", item.shard + 1, shards);
+    return true;
+  };
+
+  try {
+    pipeline::ordered<shard_filter>(cli.threads, 0, read, convert, write);
+  } catch (...) {
+    std::cerr << "\n";
+    throw;
+  }
+  std::cerr << "\n";
+}
+
+template <hibp::pw_type PwType>
+void build_for(const cli_config_t& cli) {
+  if (cli.binfuse16) {
+    build<PwType, binfuse::filter16, binfuse::sharded_filter16_sink>(cli);
+  } else {
+    build<PwType, binfuse::filter8, binfuse::sharded_filter8_sink>(cli);
   }
-  sharded_filter.stream_finalize();
 }
 
 int main(int argc, char* argv[]) {
@@ -78,7 +156,21 @@ int main(int argc, char* argv[]) {
   CLI11_PARSE(app, argc, argv);
 
   try {
-    build(cli);
+    if (cli.ntlm && cli.sha1t64) {
+      throw std::runtime_error("can't use `--ntlm` and `--sha1t64` together");
+    }
+    if (!cli.force && std::filesystem::exists(cli.output_filename)) {
+      throw std::runtime_error(
+          fmt::format("File '{}' exists. Use `--force` to overwrite.", cli.output_filename));
+    }
+
+    if (cli.ntlm) {
+      build_for<hibp::pawned_pw_ntlm>(cli);
+    } else if (cli.sha1t64) {
+      build_for<hibp::pawned_pw_sha1t64>(cli);
+    } else {
+      build_for<hibp::pawned_pw_sha1>(cli);
+    }
 
   } catch (const std::exception& e) {
     std::cerr << fmt::format("Error: {}\n", e.what());
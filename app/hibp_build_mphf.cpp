@@ -0,0 +1,85 @@
+#include "hibp.hpp"
+#include "mphf.hpp"
+#include <CLI/CLI.hpp>
+#include <cstdlib>
+#include <exception>
+#include <filesystem>
+#include <fmt/format.h>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+
+struct cli_config_t {
+  std::string output_filename;
+  std::string input_filename;
+  bool        force   = false;
+  bool        ntlm    = false;
+  bool        sha1t64 = false;
+  unsigned    threads = 0; // 0 => one per core
+};
+
+void define_options(CLI::App& app, cli_config_t& cli) {
+
+  app.add_option("-i,--input", cli.input_filename,
+                 "The sorted binary database which the mphf db will be built from")
+      ->required();
+
+  app.add_option("-o,--output", cli.output_filename,
+                 "The file that the mphf db will be written to, for hibp-server --mphf-db")
+      ->required();
+
+  app.add_flag("--ntlm", cli.ntlm, "The input db has ntlm hashes, rather than sha1.");
+
+  app.add_flag("--sha1t64", cli.sha1t64, "The input db has sha1t64 hashes, rather than sha1.");
+
+  app.add_option("--threads", cli.threads,
+                 "The number of threads building shards of the mphf (default: 0 => one per core)");
+
+  app.add_flag("-f,--force", cli.force, "Overwrite any existing output file!");
+}
+
+int main(int argc, char* argv[]) {
+  cli_config_t cli;
+
+  CLI::App app("Building minimal perfect hash dbs, which need one disk read per query");
+  define_options(app, cli);
+  CLI11_PARSE(app, argc, argv);
+
+  try {
+    if (cli.ntlm && cli.sha1t64) {
+      throw std::runtime_error("can't use `--ntlm` and `--sha1t64` together");
+    }
+    if (!cli.force && std::filesystem::exists(cli.output_filename)) {
+      throw std::runtime_error(
+          fmt::format("File '{}' exists. Use `--force` to overwrite.", cli.output_filename));
+    }
+
+    const auto progress = [](unsigned shard) {
+      std::cerr << fmt::format("built shard {}/{}\r", shard + 1, hibp::details::mphf_shards);
+    };
+    if (cli.ntlm) {
+      hibp::mphf_build<hibp::pawned_pw_ntlm>(cli.input_filename, cli.output_filename, cli.threads,
+                                             progress);
+    } else if (cli.sha1t64) {
+      hibp::mphf_build<hibp::pawned_pw_sha1t64>(cli.input_filename, cli.output_filename,
+                                                cli.threads, progress);
+    } else {
+      hibp::mphf_build<hibp::pawned_pw_sha1>(cli.input_filename, cli.output_filename, cli.threads,
+                                             progress);
+    }
+    std::cerr << "\n";
+
+    const hibp::mphf_db mphf(cli.output_filename);
+    const auto          records = mphf.number_records();
+    std::cout << fmt::format("built mphf of {} records: {} ({:.2f} bits per record in memory)\n",
+                             records, cli.output_filename,
+                             records == 0 ? 0.0
+                                          : 8.0 * static_cast<double>(mphf.function_size()) /
+                                                static_cast<double>(records));
+
+  } catch (const std::exception& e) {
+    std::cerr << fmt::format("Error: {}\n", e.what());
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
@@ -1,8 +1,12 @@
 #include "flat_file.hpp"
 #include "hibp.hpp"
+#include "pipeline.hpp"
+#include "toc.hpp"
 #include <CLI/CLI.hpp>
+#include <algorithm>
 #include <cstddef>
 #include <cstdlib>
+#include <cstring>
 #include <exception>
 #include <filesystem>
 #include <fmt/format.h>
@@ -10,9 +14,12 @@
 #include <ios>
 #include <iostream>
 #include <istream>
+#include <optional>
 #include <ostream>
 #include <stdexcept>
 #include <string>
+#include <string_view>
+#include <vector>
 
 struct cli_config_t {
   std::string output_filename;
@@ -23,6 +30,10 @@ struct cli_config_t {
   bool        bin_to_txt      = false;
   bool        txt_to_bin      = false;
   bool        ntlm            = false;
+  bool        sha1t64         = false;
+  bool        toc             = false;
+  unsigned    toc_bits        = 20; // 1Mega chapters
+  unsigned    threads         = 0;  // 0 => one per core
   std::size_t limit           = -1; // ie max
 };
 
@@ -51,6 +62,23 @@ void define_options(CLI::App& app, cli_config_t& cli) {
 
   app.add_flag("--ntlm", cli.ntlm, "Use ntlm hashes rather than sha1.");
 
+  app.add_flag("--sha1t64", cli.sha1t64,
+               "Use sha1 hashes truncated to 64bits rather than full sha1. With --txt-to-bin the "
+               "text can have full sha1 hashes too, eg from the api.");
+
+  app.add_option("--threads", cli.threads,
+                 "The number of threads parsing or formatting chunks of records (default: 0 => "
+                 "one per core)");
+
+  app.add_flag("--toc", cli.toc,
+               "With --txt-to-bin, also write a table of contents for the output db. The input "
+               "must be sorted by hash.");
+
+  app.add_option("--toc-bits", cli.toc_bits,
+                 fmt::format("Specify how may bits to use for table of content mask. default {}",
+                             cli.toc_bits))
+      ->check(CLI::Range(15, 25));
+
   app.add_flag("-f,--force", cli.force, "Overwrite any existing output file!");
 }
 
@@ -79,28 +107,115 @@ std::ofstream get_output_stream(const std::string& output_filename, bool force)
   return output_stream;
 }
 
+// A chunk of the conversion, as text and as records. One of them is read, and a worker makes the
+// other from it.
 template <hibp::pw_type PwType>
-void txt_to_bin(std::istream& input_stream, std::ostream& output_stream, std::size_t limit) {
+struct chunk {
+  std::string         text;
+  std::vector<PwType> records;
+};
 
-  auto writer = flat_file::stream_writer<PwType>(output_stream);
+constexpr std::size_t chunk_bytes = 4UL << 20U; // of text, ~100k records
 
-  std::size_t count = 0;
-  for (std::string line; std::getline(input_stream, line) && count != limit; count++) {
-    writer.write(PwType{line});
+// the records of the "HASH:COUNT" lines of a chunk of text, ignoring blank lines
+template <hibp::pw_type PwType>
+void parse_lines(chunk<PwType>& chunk) {
+  chunk.records.clear();
+  std::string_view text = chunk.text;
+  while (!text.empty()) {
+    const auto       eol  = text.find('\n');
+    std::string_view line = text.substr(0, eol);
+    text.remove_prefix(eol == std::string_view::npos ? text.size() : eol + 1);
+    if (!line.empty() && line.back() == '\r') line.remove_suffix(1);
+    if (line.empty()) continue;
+    if (line.size() < PwType::hash_str_size) {
+      throw std::runtime_error(fmt::format("Invalid line in text input: '{}'", line));
+    }
+    chunk.records.emplace_back(line);
   }
 }
 
 template <hibp::pw_type PwType>
-void bin_to_txt(const std::string& input_filename, std::ostream& output_stream, std::size_t limit) {
-
-  flat_file::database<PwType> db{input_filename, 4096 / sizeof(PwType)};
+void txt_to_bin(std::istream& input_stream, std::ostream& output_stream, const cli_config_t& cli) {
+
+  output_stream.exceptions(std::ios::badbit | std::ios::failbit);
+
+  std::optional<hibp::toc_writer<PwType>> toc;
+  if (cli.toc) toc.emplace(cli.output_filename, cli.toc_bits);
+
+  // reads whole lines, with any partial last line carried over to the next chunk
+  std::string carry;
+  const auto  read = [&](chunk<PwType>& chunk) {
+    chunk.text.swap(carry);
+    carry.clear();
+    std::size_t eol = std::string::npos;
+    while (eol == std::string::npos && input_stream) {
+      const std::size_t size = chunk.text.size();
+      chunk.text.resize(size + chunk_bytes);
+      input_stream.read(chunk.text.data() + size, static_cast<std::streamsize>(chunk_bytes));
+      chunk.text.resize(size + static_cast<std::size_t>(input_stream.gcount()));
+      eol = chunk.text.rfind('\n');
+    }
+    if (input_stream && eol != std::string::npos) {
+      carry.assign(chunk.text, eol + 1);
+      chunk.text.resize(eol + 1);
+    }
+    return !chunk.text.empty();
+  };
 
   std::size_t count = 0;
-  for (const auto& record: db) {
-    output_stream << record << '\n';
-    count++;
-    if (count == limit) break;
-  }
+  const auto  write = [&](const chunk<PwType>& chunk) {
+    const std::size_t n = std::min(chunk.records.size(), cli.limit - count);
+    output_stream.write(reinterpret_cast<const char*>(chunk.records.data()), // NOLINT reincast
+                        static_cast<std::streamsize>(n * sizeof(PwType)));
+    if (toc) {
+      for (std::size_t i = 0; i != n; ++i) toc->add(chunk.records[i]);
+    }
+    count += n;
+    return count != cli.limit;
+  };
+
+  pipeline::ordered<chunk<PwType>>(cli.threads, 0, read, parse_lines<PwType>, write);
+  output_stream.flush();
+  if (toc) toc->finalize();
+}
+
+template <hibp::pw_type PwType>
+void bin_to_txt(const std::string& input_filename, std::ostream& output_stream,
+                const cli_config_t& cli) {
+
+  output_stream.exceptions(std::ios::badbit | std::ios::failbit);
+
+  flat_file::database<PwType> db{input_filename, 1}; // only whole chunks are read, unbuffered
+  const std::size_t           records = std::min(db.number_records(), cli.limit);
+  const std::size_t           chunk_records = chunk_bytes / PwType::max_str_size;
+
+  std::size_t pos  = 0;
+  const auto  read = [&](chunk<PwType>& chunk) {
+    chunk.records.resize(std::min(chunk_records, records - pos));
+    if (chunk.records.empty()) return false;
+    db.read(pos, chunk.records.size(), chunk.records.data());
+    pos += chunk.records.size();
+    return true;
+  };
+
+  const auto format = [](chunk<PwType>& chunk) {
+    chunk.text.resize(chunk.records.size() * (PwType::max_str_size + 1));
+    char* out = chunk.text.data();
+    for (const auto& record: chunk.records) {
+      out    = record.to_chars(out);
+      *out++ = '\n';
+    }
+    chunk.text.resize(static_cast<std::size_t>(out - chunk.text.data()));
+  };
+
+  const auto write = [&](const chunk<PwType>& chunk) {
+    output_stream.write(chunk.text.data(), static_cast<std::streamsize>(chunk.text.size()));
+    return true;
+  };
+
+  pipeline::ordered<chunk<PwType>>(cli.threads, 0, read, format, write);
+  output_stream.flush();
 }
 
 void check_options(const cli_config_t& cli) {
@@ -125,6 +240,14 @@ void check_options(const cli_config_t& cli) {
     throw std::runtime_error("Please use exactly one of -o|--output and --stdout, not "
                              "both, and not neither.");
   }
+
+  if (cli.ntlm && cli.sha1t64) {
+    throw std::runtime_error("Please use at most one of --ntlm and --sha1t64.");
+  }
+
+  if (cli.toc && (!cli.txt_to_bin || cli.standard_output)) {
+    throw std::runtime_error("--toc is only for --txt-to-bin with an -o|--output file.");
+  }
 }
 
 void convert(const cli_config_t& cli) {
@@ -152,9 +275,11 @@ void convert(const cli_config_t& cli) {
                              input_stream_name, output_stream_name);
 
     if (cli.ntlm) {
-      txt_to_bin<hibp::pawned_pw_ntlm>(*input_stream, *output_stream, cli.limit);
+      txt_to_bin<hibp::pawned_pw_ntlm>(*input_stream, *output_stream, cli);
+    } else if (cli.sha1t64) {
+      txt_to_bin<hibp::pawned_pw_sha1t64>(*input_stream, *output_stream, cli);
     } else {
-      txt_to_bin<hibp::pawned_pw_sha1>(*input_stream, *output_stream, cli.limit);
+      txt_to_bin<hibp::pawned_pw_sha1>(*input_stream, *output_stream, cli);
     }
     std::cerr << "Done.\n";
   } else if (cli.bin_to_txt) {
@@ -164,9 +289,11 @@ void convert(const cli_config_t& cli) {
                              input_stream_name, output_stream_name);
 
     if (cli.ntlm) {
-      bin_to_txt<hibp::pawned_pw_ntlm>(cli.input_filename, *output_stream, cli.limit);
+      bin_to_txt<hibp::pawned_pw_ntlm>(cli.input_filename, *output_stream, cli);
+    } else if (cli.sha1t64) {
+      bin_to_txt<hibp::pawned_pw_sha1t64>(cli.input_filename, *output_stream, cli);
     } else {
-      bin_to_txt<hibp::pawned_pw_sha1>(cli.input_filename, *output_stream, cli.limit);
+      bin_to_txt<hibp::pawned_pw_sha1>(cli.input_filename, *output_stream, cli);
     }
     std::cerr << "Done.\n";
   }
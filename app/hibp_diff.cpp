@@ -9,7 +9,8 @@
 struct cli_config_t {
   std::string db_file_old;
   std::string db_file_new;
-  bool        ntlm = false;
+  bool        ntlm    = false;
+  unsigned    threads = 0;
 };
 
 void define_options(CLI::App& app, cli_config_t& cli) {
@@ -23,6 +24,9 @@ void define_options(CLI::App& app, cli_config_t& cli) {
       ->required();
 
   app.add_flag("--ntlm", cli.ntlm, "Use ntlm hashes rather than sha1.");
+
+  app.add_option("--threads", cli.threads,
+                 "The number of threads to diff with (default: one per core)");
 }
 
 int main(int argc, char* argv[]) {
@@ -34,9 +38,11 @@ int main(int argc, char* argv[]) {
 
   try {
     if (cli.ntlm) {
-      hibp::diffutils::run_diff<hibp::pawned_pw_ntlm>(cli.db_file_old, cli.db_file_new, std::cout);
+      hibp::diffutils::run_diff<hibp::pawned_pw_ntlm>(cli.db_file_old, cli.db_file_new, std::cout,
+                                                      cli.threads);
     } else {
-      hibp::diffutils::run_diff<hibp::pawned_pw_sha1>(cli.db_file_old, cli.db_file_new, std::cout);
+      hibp::diffutils::run_diff<hibp::pawned_pw_sha1>(cli.db_file_old, cli.db_file_new, std::cout,
+                                                      cli.threads);
     }
   } catch (const std::exception& e) {
     std::cerr << "something went wrong: " << e.what() << "\n";
@@ -1,10 +1,14 @@
 #include "arrcmp.hpp"
 #include "binfuse/sharded_filter.hpp"
+#include "dnl/fanout.hpp"
 #include "dnl/queuemgt.hpp"
 #include "dnl/resume.hpp"
 #include "dnl/shared.hpp"
+#include "dnl/update.hpp"
 #include "flat_file.hpp"
 #include "hibp.hpp"
+#include "packed.hpp"
+#include "toc.hpp"
 #include <CLI/CLI.hpp>
 #include <cstddef>
 #include <cstdlib>
@@ -15,14 +19,32 @@
 #include <fstream>
 #include <ios>
 #include <iostream>
+#include <memory>
+#include <optional>
+#include <span>
 #include <stdexcept>
 #include <string>
+#include <utility>
+#include <vector>
 
 void define_options(CLI::App& app, hibp::dnl::cli_config_t& cli) {
 
   app.add_option("output_db_filename", cli.output_db_filename,
-                 "The file that the downloaded binary database will be written to")
-      ->required();
+                 "The file that the downloaded binary database will be written to. Required, "
+                 "unless writing --out-* instead.");
+
+  app.add_option("--out-sha1", cli.out_sha1,
+                 "Write a binary sha1 db to this file. With the other --out-* options, from the "
+                 "same download.");
+
+  app.add_option("--out-sha1t64", cli.out_sha1t64,
+                 "Write a binary sha1t64 db to this file, from the same download.");
+
+  app.add_option("--out-binfuse8", cli.out_binfuse8,
+                 "Write a binary_fuse8 filter to this file, from the same download.");
+
+  app.add_option("--out-binfuse16", cli.out_binfuse16,
+                 "Write a binary_fuse16 filter to this file, from the same download.");
 
   app.add_flag("--debug", cli.debug,
                "Send verbose thread debug output to stderr. Turns off progress.");
@@ -30,8 +52,13 @@ void define_options(CLI::App& app, hibp::dnl::cli_config_t& cli) {
                "Show a progress meter on stderr. This is the default.");
 
   app.add_flag("--resume", cli.resume,
-               "Attempt to resume an earlier download. Not with --txt-out or --binfuse(9|16)-out. "
-               "And not with --force.");
+               "Resume an earlier download, from the last checkpoint in its journal, or by "
+               "searching the db if it has none. Not with --binfuse(8|16)-out or --force.");
+
+  app.add_flag("--update", cli.update,
+               "Refresh an existing binary db. Only the files which have changed since it was "
+               "downloaded are fetched again, using the ETags saved alongside it, and the rest are "
+               "copied from the existing db. Not with --resume or --force.");
 
   app.add_flag("--ntlm", cli.ntlm, "Download the NTLM format password hashes instead of SHA1.");
 
@@ -48,38 +75,141 @@ void define_options(CLI::App& app, hibp::dnl::cli_config_t& cli) {
   app.add_flag("--binfuse16-out", cli.binfuse16_out,
                "Output a binary_fuse16 filter, for space saving probabilistic queries.");
 
+  app.add_flag("--packed", cli.packed,
+               "Output the block compressed, but still randomly accessible, packed binary format. "
+               "hibp-search and hibp-server recognise it. Not with --resume, --update or --toc.");
+
+  app.add_flag("--toc", cli.toc,
+               "Also write a table of contents for the binary db, while downloading. Saves "
+               "a full rescan of the db when first using `--toc` with hibp-server or hibp-search.");
+
+  app.add_option("--toc-bits", cli.toc_bits,
+                 fmt::format("Specify how may bits to use for table of content mask. default {}",
+                             cli.toc_bits))
+      ->check(CLI::Range(15, 25));
+
   app.add_flag("--force", cli.force, "Overwrite any existing file! Not with --resume.");
 
   app.add_option("--parallel-max", cli.parallel_max,
-                 "The maximum number of requests that will be started concurrently (default: 300)");
+                 "The maximum number of requests that each download thread will run concurrently "
+                 "(default: 300)");
+
+  app.add_option("--download-threads", cli.download_threads,
+                 "The number of threads running requests, each with its own connections "
+                 "(default: 1)");
 
   app.add_option("--limit", cli.index_limit,
                  "The maximum number (prefix) files that will be downloaded (default: 100 000 hex "
                  "or 1 048 576 dec)");
 
+  app.add_option("--parse-threads", cli.parse_threads,
+                 "The number of threads converting the downloaded text into the output format "
+                 "(default: 0 => one per core)");
+
   app.add_flag("--testing", cli.testing,
                "Download from a local test server instead of public api.");
 }
 
+// returns the ETags of all downloaded files, for a later --update
 template <hibp::pw_type PwType>
-void launch_bin_db(std::ofstream& output_db_stream, const hibp::dnl::cli_config_t& cli,
-                   std::size_t start_index) {
+std::vector<std::string> launch_bin_db(std::ofstream& output_db_stream,
+                                       const hibp::dnl::cli_config_t& cli,
+                                       std::size_t start_index) {
   // use a largegish output buffer ~240kB for efficient writes
   // keep stream instance alive here
-  auto ffsw = flat_file::stream_writer<PwType>(output_db_stream, 10'000);
-  hibp::dnl::run([&](const std::string& line) { ffsw.write(PwType{line}); }, start_index,
-                 cli.testing);
+  std::optional<flat_file::stream_writer<PwType>> ffsw;
+  std::optional<hibp::packed::writer<PwType>>     packed;
+  if (cli.packed) {
+    packed.emplace(output_db_stream);
+  } else {
+    ffsw.emplace(output_db_stream, 10'000);
+  }
+
+  // records arrive in order, so the toc can be built on the fly, unless resuming
+  std::optional<hibp::toc_writer<PwType>> toc;
+  if (cli.toc && start_index == 0) toc.emplace(cli.output_db_filename, cli.toc_bits);
+
+  // --update copies unchanged files from here, while writing to a new db
+  std::optional<hibp::dnl::prefix_source<PwType>> old_db;
+  if (cli.update) old_db.emplace(cli.output_db_filename);
+
+  // the writer only ever updates the etags of files which have already been requested, so sharing
+  // them with the requests thread is safe
+  auto etags = cli.resume || cli.update
+                   ? hibp::dnl::load_etags(cli.output_db_filename, cli.index_limit)
+                   : std::vector<std::string>(cli.index_limit);
+  const std::vector<std::string> no_etags;
+  std::size_t                    unchanged = 0;
+
+  // checkpoints for a later --resume. Not for --update, whose new db is only used once complete
+  std::optional<hibp::dnl::journal> journal;
+  if (!cli.update && !cli.packed) {
+    journal.emplace(cli.output_db_filename, std::filesystem::file_size(cli.output_db_filename),
+                    [&] {
+                      ffsw->flush();
+                      output_db_stream.flush();
+                    });
+  }
+
+  const auto write = [&](const PwType& pw) {
+    if (packed) {
+      packed->write(pw);
+      return;
+    }
+    ffsw->write(pw);
+    if (toc) toc->add(pw);
+  };
+
+  hibp::dnl::run(
+      hibp::dnl::parse_binary<PwType>,
+      [&](const hibp::dnl::download& dl) {
+        if (dl.unchanged) {
+          for (const auto& pw: old_db->records(dl.index)) write(pw);
+          ++unchanged;
+        } else {
+          for (const auto& pw: hibp::dnl::block_records<PwType>(dl.block)) write(pw);
+          if (journal) journal->add(dl.index, dl.block.size());
+        }
+        if (!dl.etag.empty()) etags[dl.index] = dl.etag;
+      },
+      start_index, cli.testing, cli.update ? etags : no_etags);
+
+  if (journal) journal->commit();
+  if (packed) packed->finalize();
+  if (toc) {
+    toc->finalize();
+  } else if (cli.toc) {
+    ffsw->flush(true);
+    hibp::toc_build<PwType>(cli.output_db_filename, cli.toc_bits); // rescan the resumed db
+  }
+  if (cli.update) {
+    std::cerr << fmt::format("Updated {}: {} changed and {} unchanged files.\n",
+                             cli.output_db_filename, cli.index_limit - unchanged, unchanged);
+  }
+  return etags;
 }
 
 template <hibp::pw_type PwType>
 std::size_t compute_start_index(const hibp::dnl::cli_config_t& cli) {
+  if (auto next = hibp::dnl::resume_from_journal(cli.output_db_filename, sizeof(PwType))) {
+    return *next;
+  }
+  // no usable journal, eg from an older version, so a new one starts from here
+  std::filesystem::remove(hibp::dnl::journal_filename(cli.output_db_filename));
   return hibp::dnl::get_last_prefix<PwType>(cli.output_db_filename, cli.testing) + 1;
 }
 
 std::size_t get_start_index(const hibp::dnl::cli_config_t& cli) {
   std::size_t start_index = 0;
   if (cli.resume) {
-    if (cli.ntlm) {
+    if (cli.txt_out) {
+      auto next = hibp::dnl::resume_from_journal(cli.output_db_filename, 1);
+      if (!next) {
+        throw std::runtime_error(fmt::format(
+            "File '{}' has no journal, so it can't be resumed.", cli.output_db_filename));
+      }
+      start_index = *next;
+    } else if (cli.ntlm) {
       start_index = compute_start_index<hibp::pawned_pw_ntlm>(cli);
     } else if (cli.sha1t64) {
       start_index = compute_start_index<hibp::pawned_pw_sha1t64>(cli);
@@ -98,32 +228,55 @@ std::size_t get_start_index(const hibp::dnl::cli_config_t& cli) {
 }
 
 void launch_stream(const hibp::dnl::cli_config_t& cli) {
+  if (!cli.resume) std::filesystem::remove(hibp::dnl::journal_filename(cli.output_db_filename));
   std::size_t             start_index = get_start_index(cli);
 
   std::ios_base::openmode mode        = cli.txt_out ? std::ios_base::out : std::ios_base::binary;
   if (cli.resume) {
     mode |= std::ios_base::app;
   }
-  
-  auto output_db_stream = std::ofstream(cli.output_db_filename, mode);
+
+  // --update writes a new db alongside, which replaces the existing one once complete
+  const std::string output_filename =
+      cli.update ? cli.output_db_filename + ".update.tmp" : cli.output_db_filename;
+
+  auto output_db_stream = std::ofstream(output_filename, mode);
   if (!output_db_stream) {
     throw std::runtime_error(fmt::format("Error opening '{}' for writing. Because: \"{}\".",
-                                         cli.output_db_filename,
+                                         output_filename,
                                          std::strerror(errno))); // NOLINT errno
   }
-  
+
   if (cli.txt_out) {
-    auto tw = hibp::dnl::text_writer(output_db_stream);
-    hibp::dnl::run([&](const std::string& line) { tw.write(line); }, start_index, cli.testing);
+    hibp::dnl::journal journal(output_filename, std::filesystem::file_size(output_filename),
+                               [&] { output_db_stream.flush(); });
+    hibp::dnl::run(
+        hibp::dnl::parse_text,
+        [&](const hibp::dnl::download& dl) {
+          output_db_stream.write(dl.block.data(), static_cast<std::streamsize>(dl.block.size()));
+          journal.add(dl.index, dl.block.size());
+        },
+        start_index, cli.testing);
+    journal.commit();
+    return;
+  }
+
+  if (!cli.resume && !cli.update) {
+    std::filesystem::remove(hibp::dnl::etags_filename(cli.output_db_filename)); // stale
+  }
+
+  std::vector<std::string> etags;
+  if (cli.ntlm) {
+    etags = launch_bin_db<hibp::pawned_pw_ntlm>(output_db_stream, cli, start_index);
+  } else if (cli.sha1t64) {
+    etags = launch_bin_db<hibp::pawned_pw_sha1t64>(output_db_stream, cli, start_index);
   } else {
-    if (cli.ntlm) {
-      launch_bin_db<hibp::pawned_pw_ntlm>(output_db_stream, cli, start_index);
-    } else if (cli.sha1t64) {
-      launch_bin_db<hibp::pawned_pw_sha1t64>(output_db_stream, cli, start_index);
-    } else {
-      launch_bin_db<hibp::pawned_pw_sha1>(output_db_stream, cli, start_index);
-    }
+    etags = launch_bin_db<hibp::pawned_pw_sha1>(output_db_stream, cli, start_index);
   }
+
+  output_db_stream.close();
+  if (cli.update) std::filesystem::rename(output_filename, cli.output_db_filename);
+  hibp::dnl::save_etags(cli.output_db_filename, etags);
 }
 
 template <typename ShardedFilterType>
@@ -135,17 +288,130 @@ void launch_filter(const hibp::dnl::cli_config_t& cli) {
   ShardedFilterType filter(cli.output_db_filename);
   filter.stream_prepare();
   hibp::dnl::run(
-      [&](const std::string& line) {
-        auto pw = hibp::pawned_pw_sha1{line};
-        filter.stream_add(arrcmp::impl::bytearray_cast<std::uint64_t>(pw.hash.data()));
+      hibp::dnl::parse_binary<hibp::pawned_pw_sha1>,
+      [&](const hibp::dnl::download& dl) {
+        for (const auto& pw: hibp::dnl::block_records<hibp::pawned_pw_sha1>(dl.block)) {
+          filter.stream_add(arrcmp::impl::bytearray_cast<std::uint64_t>(pw.hash.data()));
+        }
       },
       0, cli.testing); // always start at 0
   filter.stream_finalize();
 }
 
+// --out-*: several outputs from one download
+bool fanout(const hibp::dnl::cli_config_t& cli) {
+  return !cli.out_sha1.empty() || !cli.out_sha1t64.empty() || !cli.out_binfuse8.empty() ||
+         !cli.out_binfuse16.empty();
+}
+
+// a binary db, with a toc if required, of the sha1 records, or their first 64 bits for sha1t64
+template <hibp::pw_type PwType>
+std::unique_ptr<hibp::dnl::sink> make_db_sink(const std::string&             filename,
+                                              const hibp::dnl::cli_config_t& cli) {
+  struct output {
+    explicit output(const std::string& filename_)
+        : stream(filename_, std::ios_base::binary), writer(stream, 10'000) {}
+
+    std::ofstream                           stream;
+    flat_file::stream_writer<PwType>        writer;
+    std::optional<hibp::toc_writer<PwType>> toc;
+  };
+  auto out = std::make_shared<output>(filename);
+  if (!out->stream) {
+    throw std::runtime_error(fmt::format("Error opening '{}' for writing. Because: \"{}\".",
+                                         filename, std::strerror(errno))); // NOLINT errno
+  }
+  if (cli.toc) out->toc.emplace(filename, cli.toc_bits);
+
+  return std::make_unique<hibp::dnl::sink>(
+      filename,
+      [out](std::span<const hibp::pawned_pw_sha1> records) {
+        for (const auto& sha1: records) {
+          PwType pw{sha1.hash};
+          pw.count = sha1.count;
+          out->writer.write(pw);
+          if (out->toc) out->toc->add(pw);
+        }
+      },
+      [out, filename] {
+        out->writer.flush(true);
+        if (out->toc) out->toc->finalize();
+        out->stream.close();
+        if (!out->stream) throw std::runtime_error(fmt::format("Error writing '{}'.", filename));
+      });
+}
+
+template <typename ShardedFilterType>
+std::unique_ptr<hibp::dnl::sink> make_filter_sink(const std::string&             filename,
+                                                  const hibp::dnl::cli_config_t& cli) {
+  if (std::filesystem::exists(filename) && cli.force) std::filesystem::remove(filename);
+  auto filter = std::make_shared<ShardedFilterType>(filename);
+  filter->stream_prepare();
+
+  return std::make_unique<hibp::dnl::sink>(
+      filename,
+      [filter](std::span<const hibp::pawned_pw_sha1> records) {
+        for (const auto& pw: records) {
+          filter->stream_add(arrcmp::impl::bytearray_cast<std::uint64_t>(pw.hash.data()));
+        }
+      },
+      [filter] { filter->stream_finalize(); });
+}
+
+void launch_fanout(const hibp::dnl::cli_config_t& cli) {
+  std::vector<std::unique_ptr<hibp::dnl::sink>> sinks;
+  std::vector<std::string>                      dbs; // which get ETags, for a later --update
+  if (!cli.out_sha1.empty()) {
+    sinks.push_back(make_db_sink<hibp::pawned_pw_sha1>(cli.out_sha1, cli));
+    dbs.push_back(cli.out_sha1);
+  }
+  if (!cli.out_sha1t64.empty()) {
+    sinks.push_back(make_db_sink<hibp::pawned_pw_sha1t64>(cli.out_sha1t64, cli));
+    dbs.push_back(cli.out_sha1t64);
+  }
+  if (!cli.out_binfuse8.empty()) {
+    sinks.push_back(make_filter_sink<binfuse::sharded_filter8_sink>(cli.out_binfuse8, cli));
+  }
+  if (!cli.out_binfuse16.empty()) {
+    sinks.push_back(make_filter_sink<binfuse::sharded_filter16_sink>(cli.out_binfuse16, cli));
+  }
+
+  std::vector<std::string> etags(cli.index_limit);
+  hibp::dnl::run(
+      hibp::dnl::parse_binary<hibp::pawned_pw_sha1>,
+      [&](hibp::dnl::download& dl) {
+        // every sink shares the one block
+        const auto block = std::make_shared<const std::vector<char>>(std::move(dl.block));
+        for (const auto& sink: sinks) sink->push(block);
+        if (!dl.etag.empty()) etags[dl.index] = dl.etag;
+      },
+      0, cli.testing); // always start at 0
+  for (const auto& sink: sinks) sink->finish();
+  for (const auto& db: dbs) hibp::dnl::save_etags(db, etags);
+}
+
 void check_options(const hibp::dnl::cli_config_t& cli) {
-  if (cli.txt_out && cli.resume) {
-    throw std::runtime_error("can't use `--resume` and `--txt-out` together");
+  if (fanout(cli)) {
+    if (!cli.output_db_filename.empty()) {
+      throw std::runtime_error("use `--out-sha1`, not an output_db_filename, with `--out-*`");
+    }
+    if (cli.resume || cli.update || cli.packed || cli.txt_out || cli.ntlm || cli.sha1t64 ||
+        cli.binfuse8_out || cli.binfuse16_out) {
+      throw std::runtime_error("can't use `--out-*` with `--resume`, `--update`, `--packed`, "
+                               "`--txt-out`, `--ntlm`, `--sha1t64` or `--binfuse(8|16)-out`");
+    }
+    for (const auto& filename:
+         {cli.out_sha1, cli.out_sha1t64, cli.out_binfuse8, cli.out_binfuse16}) {
+      if (!filename.empty() && !cli.force && std::filesystem::exists(filename)) {
+        throw std::runtime_error(
+            fmt::format("File '{}' exists. Use `--force` to overwrite.", filename));
+      }
+    }
+    return;
+  }
+
+  if (cli.output_db_filename.empty()) {
+    throw std::runtime_error("an output_db_filename, or `--out-*`, is required");
   }
 
   if ((cli.binfuse8_out || cli.binfuse16_out) && cli.resume) {
@@ -156,17 +422,44 @@ void check_options(const hibp::dnl::cli_config_t& cli) {
     throw std::runtime_error("can't use `--binfuse(8|16)-out` with a hash format selector");
   }
 
+  if (cli.toc && (cli.txt_out || cli.binfuse8_out || cli.binfuse16_out)) {
+    throw std::runtime_error("`--toc` is only for binary db output");
+  }
+
+  if (cli.packed && (cli.txt_out || cli.binfuse8_out || cli.binfuse16_out)) {
+    throw std::runtime_error("`--packed` is a binary db format, not for text or filter output");
+  }
+
+  if (cli.packed && (cli.resume || cli.update || cli.toc)) {
+    throw std::runtime_error("can't use `--packed` with `--resume`, `--update` or `--toc`");
+  }
+
   if (cli.force && cli.resume) {
     throw std::runtime_error("can't use `--resume` and `--force` together");
   }
 
+  if (cli.update && (cli.resume || cli.force)) {
+    throw std::runtime_error("can't use `--update` with `--resume` or `--force`");
+  }
+
+  if (cli.update && (cli.txt_out || cli.binfuse8_out || cli.binfuse16_out)) {
+    throw std::runtime_error("`--update` is only for binary db output");
+  }
+
+  if (cli.update && !std::filesystem::exists(cli.output_db_filename)) {
+    throw std::runtime_error(
+        fmt::format("File '{}' does not exist, so cannot be updated.", cli.output_db_filename));
+  }
+
   if (cli.ntlm && cli.sha1t64) {
     throw std::runtime_error("can't use `--ntlm` and `--sha1t64` together");
   }
 
-  if (!cli.resume && !cli.force && std::filesystem::exists(cli.output_db_filename)) {
-    throw std::runtime_error(fmt::format("File '{}' exists. Use `--force` to overwrite, or "
-                                         "`--resume` to resume a previous download.",
+  if (!cli.resume && !cli.force && !cli.update &&
+      std::filesystem::exists(cli.output_db_filename)) {
+    throw std::runtime_error(fmt::format("File '{}' exists. Use `--force` to overwrite, "
+                                         "`--resume` to resume a previous download, or `--update` "
+                                         "to refresh it.",
                                          cli.output_db_filename));
   }
 }
@@ -190,7 +483,9 @@ int main(int argc, char* argv[]) {
   try {
     check_options(cli);
 
-    if (cli.binfuse8_out || cli.binfuse16_out) {
+    if (fanout(cli)) {
+      launch_fanout(cli);
+    } else if (cli.binfuse8_out || cli.binfuse16_out) {
       if (cli.binfuse8_out) {
         launch_filter<binfuse::sharded_filter8_sink>(cli);
       } else {
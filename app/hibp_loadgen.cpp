@@ -0,0 +1,545 @@
+#include "flat_file.hpp"
+#include "hibp.hpp"
+#include "srv/binary.hpp"
+#include <CLI/CLI.hpp>
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <cerrno>
+#include <charconv>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <fmt/format.h>
+#include <iostream>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+// A load generator for hibp-server: keep-alive connections, each with `--pipeline` requests in
+// flight, for a mix of formats, with needles sampled from the real dbs at a given hit ratio, and
+// skewed towards the common passwords, like real traffic. Or the same, over hibp-server's binary
+// protocol, with one digest per frame.
+
+struct cli_config_t {
+  std::string              host = "localhost";
+  std::uint16_t            port = 8082;
+  std::string              sha1_db_filename;
+  std::string              ntlm_db_filename;
+  std::string              sha1t64_db_filename;
+  std::string              binary_socket;
+  std::vector<std::string> formats;
+  double                   hit_ratio   = 0.5;
+  double                   skew        = 1.0;
+  std::size_t              pool        = 100'000; // distinct requests per format
+  unsigned                 connections = 32;
+  unsigned                 pipeline    = 1;
+  unsigned                 threads     = 0; // 0 => min(cores, connections)
+  double                   duration    = 10.0;
+  bool                     binary      = false; // or a `binary_socket`
+  bool                     json        = false;
+};
+
+void define_options(CLI::App& app, cli_config_t& cli) {
+
+  app.add_option("--host", cli.host, fmt::format("The hibp-server host (default: {})", cli.host));
+
+  app.add_option("--port", cli.port, fmt::format("The hibp-server port (default: {})", cli.port));
+
+  app.add_option("--sha1-db", cli.sha1_db_filename,
+                 "A sha1 db to sample needles from for the sha1, sha1t64 and binfuse formats");
+
+  app.add_option("--ntlm-db", cli.ntlm_db_filename,
+                 "An ntlm db to sample needles from for the ntlm format");
+
+  app.add_option("--sha1t64-db", cli.sha1t64_db_filename,
+                 "A sha1t64 db to sample needles from for the sha1t64 and binfuse formats");
+
+  app.add_option("--format", cli.formats,
+                 "The /check/:format to request, with an optional relative weight, eg "
+                 "`--format sha1:9 --format binfuse16:1`. Repeat for a mix. (default: each "
+                 "format of the given dbs, equally)");
+
+  app.add_option("--hit-ratio", cli.hit_ratio,
+                 fmt::format("The fraction of needles which are in the db (default: {})",
+                             cli.hit_ratio))
+      ->check(CLI::Range(0.0, 1.0));
+
+  app.add_option("--skew", cli.skew,
+                 fmt::format("Hits are drawn with probablity proportional to count^skew, so 1 "
+                             "follows the real popularity of each password, and 0 is uniform "
+                             "(default: {})",
+                             cli.skew))
+      ->check(CLI::Range(0.0, 4.0));
+
+  app.add_option("--pool", cli.pool,
+                 fmt::format("The number of distinct requests prepared per format (default: {})",
+                             cli.pool))
+      ->check(CLI::Range(1UL, 100'000'000UL));
+
+  app.add_option("-c,--connections", cli.connections,
+                 fmt::format("The number of keep-alive connections (default: {})",
+                             cli.connections))
+      ->check(CLI::Range(1U, 100'000U));
+
+  app.add_option("--pipeline", cli.pipeline,
+                 fmt::format("The number of requests in flight on each connection (default: {})",
+                             cli.pipeline))
+      ->check(CLI::Range(1U, 1024U));
+
+  app.add_option("--threads", cli.threads,
+                 "The number of threads which share the connections (default: all cores, but "
+                 "no more than the connections)");
+
+  app.add_option("-d,--duration", cli.duration,
+                 fmt::format("Seconds to run for (default: {})", cli.duration))
+      ->check(CLI::PositiveNumber);
+
+  app.add_flag("--binary", cli.binary,
+               "Use hibp-server's binary protocol, on --port, which is its --binary-port, rather "
+               "than http. One digest per frame, with --pipeline frames in flight.");
+
+  app.add_option("--binary-socket", cli.binary_socket,
+                 "Use hibp-server's binary protocol, on its --binary-socket at this path");
+
+  app.add_flag("--json", cli.json, "Report the results as json.");
+}
+
+using clk = std::chrono::steady_clock;
+
+struct format_t {
+  std::string name;
+  unsigned    weight = 1;
+};
+
+bool use_binary(const cli_config_t& cli) { return cli.binary || !cli.binary_socket.empty(); }
+
+// one frame of the binary protocol, for a hex encoded needle
+std::string binary_request(const std::string& name, const std::string& needle) {
+  using hibp::srv::binary::format;
+  format tag{};
+  if (name == "sha1") {
+    tag = format::sha1;
+  } else if (name == "ntlm") {
+    tag = format::ntlm;
+  } else if (name == "sha1t64") {
+    tag = format::sha1t64;
+  } else if (name == "binfuse16") {
+    tag = format::binfuse16;
+  } else {
+    tag = format::binfuse8;
+  }
+  std::string request(hibp::srv::binary::header_size, '\0');
+  request[0] = static_cast<char>(tag);
+  request[1] = static_cast<char>(needle.size() / 2);
+  request[4] = 1; // count, little endian
+  for (std::size_t i = 0; i != needle.size(); i += 2) {
+    unsigned byte = 0;
+    std::from_chars(needle.data() + i, needle.data() + i + 2, byte, 16);
+    request.push_back(static_cast<char>(byte));
+  }
+  return request;
+}
+
+std::vector<format_t> parse_formats(const cli_config_t& cli) {
+  std::vector<format_t> formats;
+  for (const auto& spec: cli.formats) {
+    format_t   fmt;
+    const auto colon = spec.find(':');
+    fmt.name         = spec.substr(0, colon);
+    if (colon != std::string::npos) {
+      const auto* last = spec.data() + spec.size();
+      if (std::from_chars(spec.data() + colon + 1, last, fmt.weight).ptr != last ||
+          fmt.weight == 0) {
+        throw std::runtime_error(fmt::format("invalid weight in --format {}", spec));
+      }
+    }
+    formats.push_back(fmt);
+  }
+  if (formats.empty()) {
+    if (!cli.sha1_db_filename.empty()) formats.push_back({"sha1"});
+    if (!cli.ntlm_db_filename.empty()) formats.push_back({"ntlm"});
+    if (!cli.sha1t64_db_filename.empty()) formats.push_back({"sha1t64"});
+  }
+  if (formats.empty()) {
+    throw std::runtime_error("Please give at least one of --sha1-db, --ntlm-db or --sha1t64-db");
+  }
+  return formats;
+}
+
+// the hex encoded needles of a `pool` of requests for one format
+template <hibp::pw_type PwType>
+std::vector<std::string> sample_needles(const std::string& db_filename, const cli_config_t& cli,
+                                        std::size_t hex_chars, std::mt19937_64& gen) {
+  flat_file::database<PwType> db(db_filename);
+  if (db.number_records() == 0) throw std::runtime_error(fmt::format("{} is empty", db_filename));
+
+  // candidate hits, uniform over the db, then weighted by their popularity
+  const std::size_t                          candidates = std::min(cli.pool, db.number_records());
+  std::uniform_int_distribution<std::size_t> position(0, db.number_records() - 1);
+  std::vector<PwType>                        hits;
+  std::vector<double>                        weights;
+  hits.reserve(candidates);
+  weights.reserve(candidates);
+  for (std::size_t i = 0; i != candidates; ++i) {
+    hits.push_back(db.get_record(position(gen)));
+    weights.push_back(std::pow(static_cast<double>(std::max(hits.back().count, 1)), cli.skew));
+  }
+  std::discrete_distribution<std::size_t> popular(weights.begin(), weights.end());
+  std::bernoulli_distribution             is_hit(cli.hit_ratio);
+
+  std::vector<std::string> needles;
+  needles.reserve(cli.pool);
+  for (std::size_t i = 0; i != cli.pool; ++i) {
+    PwType needle;
+    if (is_hit(gen)) {
+      needle = hits[popular(gen)];
+    } else {
+      for (auto& b: needle.hash) b = static_cast<std::byte>(gen()); // almost certainly a miss
+    }
+    needles.push_back(needle.to_string().substr(0, hex_chars));
+  }
+  return needles;
+}
+
+// the pool of complete http requests for one format
+std::vector<std::string> make_requests(const format_t& format, const cli_config_t& cli,
+                                       std::mt19937_64& gen) {
+  std::vector<std::string> needles;
+  if (format.name == "sha1" && !cli.sha1_db_filename.empty()) {
+    needles = sample_needles<hibp::pawned_pw_sha1>(cli.sha1_db_filename, cli, 40, gen);
+  } else if (format.name == "ntlm" && !cli.ntlm_db_filename.empty()) {
+    needles = sample_needles<hibp::pawned_pw_ntlm>(cli.ntlm_db_filename, cli, 32, gen);
+  } else if (format.name == "sha1t64" || format.name == "binfuse8" ||
+             format.name == "binfuse16") {
+    // the leading 16 hex chars of either db
+    if (!cli.sha1t64_db_filename.empty()) {
+      needles = sample_needles<hibp::pawned_pw_sha1t64>(cli.sha1t64_db_filename, cli, 16, gen);
+    } else if (!cli.sha1_db_filename.empty()) {
+      needles = sample_needles<hibp::pawned_pw_sha1>(cli.sha1_db_filename, cli, 16, gen);
+    }
+  } else if (format.name != "sha1" && format.name != "ntlm") {
+    throw std::runtime_error(fmt::format("unknown --format: {}", format.name));
+  }
+  if (needles.empty()) {
+    throw std::runtime_error(fmt::format("--format {} needs a db to sample from", format.name));
+  }
+  std::vector<std::string> requests;
+  requests.reserve(needles.size());
+  for (const auto& needle: needles) {
+    if (use_binary(cli)) {
+      requests.push_back(binary_request(format.name, needle));
+      continue;
+    }
+    requests.push_back(fmt::format("GET /check/{}/{} HTTP/1.1\r\nHost: {}\r\n\r\n", format.name,
+                                   needle, cli.host));
+  }
+  return requests;
+}
+
+struct results_t {
+  std::uint64_t              responses = 0;
+  std::uint64_t              found     = 0;
+  std::uint64_t              errors    = 0; // non 200 responses and dropped connections
+  std::vector<std::uint64_t> latencies_ns;
+};
+
+int connect_to(const cli_config_t& cli) {
+  if (!cli.binary_socket.empty()) {
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    if (cli.binary_socket.size() >= sizeof(addr.sun_path)) {
+      throw std::runtime_error(fmt::format("--binary-socket {} is too long", cli.binary_socket));
+    }
+    std::memcpy(addr.sun_path, cli.binary_socket.c_str(), cli.binary_socket.size() + 1);
+    const int fd   = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    auto*     sock = reinterpret_cast<sockaddr*>(&addr); // NOLINT reinterpret_cast
+    if (fd == -1 || ::connect(fd, sock, sizeof(addr)) != 0) {
+      throw std::runtime_error(fmt::format("cannot connect to {}, because '{}'", cli.binary_socket,
+                                           std::strerror(errno))); // NOLINT errno
+    }
+    return fd;
+  }
+  addrinfo hints{};
+  hints.ai_family   = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  addrinfo*   addrs = nullptr;
+  const auto  port  = std::to_string(cli.port);
+  if (const int err = ::getaddrinfo(cli.host.c_str(), port.c_str(), &hints, &addrs); err != 0) {
+    throw std::runtime_error(
+        fmt::format("cannot resolve {}, because '{}'", cli.host, ::gai_strerror(err)));
+  }
+  int fd = -1;
+  for (const addrinfo* addr = addrs; addr != nullptr; addr = addr->ai_next) {
+    fd = ::socket(addr->ai_family, addr->ai_socktype, addr->ai_protocol);
+    if (fd == -1) continue;
+    if (::connect(fd, addr->ai_addr, addr->ai_addrlen) == 0) break;
+    ::close(fd);
+    fd = -1;
+  }
+  ::freeaddrinfo(addrs);
+  if (fd == -1) {
+    throw std::runtime_error(fmt::format("cannot connect to {}:{}, because '{}'", cli.host,
+                                         cli.port, std::strerror(errno))); // NOLINT errno
+  }
+  const int one = 1;
+  ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  return fd;
+}
+
+// one keep-alive connection, with its requests in flight
+struct connection {
+  int                           fd = -1;
+  std::string                   out;
+  std::size_t                   out_pos = 0;
+  std::string                   in;
+  std::deque<clk::time_point>   sent; // of each request in flight, in order
+  std::mt19937_64               gen;
+};
+
+// Consumes one complete response from the front of `in`, if there is one. Returns false if more
+// data is needed.
+bool parse_response(std::string& in, bool& ok, bool& found) {
+  const auto header_end = in.find("\r\n\r\n");
+  if (header_end == std::string::npos) return false;
+  const std::string_view header(in.data(), header_end);
+
+  std::size_t content_length = 0;
+  for (std::size_t pos = header.find("\r\n"); pos != std::string_view::npos;
+       pos             = header.find("\r\n", pos + 2)) {
+    const auto line = header.substr(pos + 2, header.find("\r\n", pos + 2) - pos - 2);
+    const auto same = [](char a, char b) {
+      return a == std::tolower(static_cast<unsigned char>(b));
+    };
+    constexpr std::string_view name = "content-length:";
+    if (line.size() > name.size() && std::equal(name.begin(), name.end(), line.begin(), same)) {
+      auto value = line.substr(name.size());
+      while (!value.empty() && value.front() == ' ') value.remove_prefix(1);
+      std::from_chars(value.data(), value.data() + value.size(), content_length);
+    }
+  }
+  const std::size_t total = header_end + 4 + content_length;
+  if (in.size() < total) return false;
+
+  ok = header.starts_with("HTTP/1.1 200");
+  // "COUNT\n" or {"count":COUNT}
+  std::string_view body(in.data() + header_end + 4, content_length);
+  if (const auto colon = body.find(':'); colon != std::string_view::npos) {
+    body.remove_prefix(colon + 1);
+  }
+  int count = -1;
+  std::from_chars(body.data(), body.data() + body.size(), count);
+  found = ok && count != -1;
+  in.erase(0, total);
+  return true;
+}
+
+// the same for the binary protocol: one little endian int32 count per single digest frame
+bool parse_binary_response(std::string& in, bool& ok, bool& found) {
+  if (in.size() < 4) return false;
+  std::uint32_t count = 0;
+  for (unsigned i = 0; i != 4; ++i) {
+    count |= static_cast<std::uint32_t>(static_cast<unsigned char>(in[i])) << (8 * i);
+  }
+  ok    = true; // errors close the connection
+  found = static_cast<std::int32_t>(count) != -1;
+  in.erase(0, 4);
+  return true;
+}
+
+// runs `conns` connections until `deadline`
+results_t run_connections(const cli_config_t& cli, unsigned conns,
+                          const std::vector<const std::string*>& requests, std::uint64_t seed,
+                          clk::time_point deadline) {
+  results_t               results;
+  std::vector<connection> connections(conns);
+  for (auto& conn: connections) {
+    conn.fd  = connect_to(cli);
+    conn.gen = std::mt19937_64{seed++};
+  }
+  std::uniform_int_distribution<std::size_t> pick(0, requests.size() - 1);
+
+  const auto parse = use_binary(cli) ? parse_binary_response : parse_response;
+
+  std::vector<pollfd>          fds(conns);
+  std::array<char, 64 * 1024>  buf{};
+  while (clk::now() < deadline) {
+    for (std::size_t i = 0; i != conns; ++i) {
+      auto& conn = connections[i];
+      while (conn.sent.size() < cli.pipeline) {
+        conn.out += *requests[pick(conn.gen)];
+        conn.sent.push_back(clk::now());
+      }
+      const bool pending = conn.out_pos < conn.out.size();
+      fds[i]             = {conn.fd, static_cast<short>(POLLIN | (pending ? POLLOUT : 0)), 0};
+    }
+    if (::poll(fds.data(), fds.size(), 100) < 0) {
+      if (errno == EINTR) continue; // NOLINT errno
+      throw std::runtime_error(
+          fmt::format("poll failed, because '{}'", std::strerror(errno))); // NOLINT errno
+    }
+    for (std::size_t i = 0; i != conns; ++i) {
+      auto& conn = connections[i];
+      bool  dropped = (fds[i].revents & (POLLERR | POLLHUP)) != 0 && (fds[i].revents & POLLIN) == 0;
+      if (!dropped && (fds[i].revents & POLLOUT) != 0) {
+        const auto sent = ::send(conn.fd, conn.out.data() + conn.out_pos,
+                                 conn.out.size() - conn.out_pos, MSG_NOSIGNAL);
+        if (sent > 0) {
+          conn.out_pos += static_cast<std::size_t>(sent);
+          if (conn.out_pos == conn.out.size()) {
+            conn.out.clear();
+            conn.out_pos = 0;
+          }
+        } else if (errno != EAGAIN) { // NOLINT errno
+          dropped = true;
+        }
+      }
+      if (!dropped && (fds[i].revents & POLLIN) != 0) {
+        const auto got = ::recv(conn.fd, buf.data(), buf.size(), 0);
+        if (got <= 0) {
+          dropped = true;
+        } else {
+          conn.in.append(buf.data(), static_cast<std::size_t>(got));
+          bool ok    = false;
+          bool found = false;
+          while (!conn.sent.empty() && parse(conn.in, ok, found)) {
+            const auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                clk::now() - conn.sent.front());
+            conn.sent.pop_front();
+            ++results.responses;
+            results.found += found ? 1 : 0;
+            results.errors += ok ? 0 : 1;
+            results.latencies_ns.push_back(static_cast<std::uint64_t>(ns.count()));
+          }
+        }
+      }
+      if (dropped) { // eg the server closed the connection after an error, so start again
+        results.errors += conn.sent.size();
+        ::close(conn.fd);
+        conn.fd = connect_to(cli);
+        conn.out.clear();
+        conn.out_pos = 0;
+        conn.in.clear();
+        conn.sent.clear();
+      }
+    }
+  }
+  for (auto& conn: connections) ::close(conn.fd);
+  return results;
+}
+
+double percentile_us(std::vector<std::uint64_t>& sorted, double p) {
+  if (sorted.empty()) return 0.0;
+  const auto idx = std::min(static_cast<std::size_t>(p * static_cast<double>(sorted.size())),
+                            sorted.size() - 1);
+  return static_cast<double>(sorted[idx]) / 1e3;
+}
+
+void run(const cli_config_t& cli) {
+  const auto formats = parse_formats(cli);
+
+  // all the prepared requests, repeated by weight, so a uniform pick gives the mix
+  std::mt19937_64                       gen{std::random_device{}()};
+  std::vector<std::vector<std::string>> pools;
+  std::vector<const std::string*>       requests;
+  for (const auto& format: formats) pools.push_back(make_requests(format, cli, gen));
+  for (std::size_t f = 0; f != formats.size(); ++f) {
+    for (unsigned w = 0; w != formats[f].weight; ++w) {
+      for (const auto& request: pools[f]) requests.push_back(&request);
+    }
+  }
+
+  const unsigned threads =
+      std::clamp(cli.threads == 0 ? std::thread::hardware_concurrency() : cli.threads, 1U,
+                 cli.connections);
+  std::cerr << fmt::format("{} connections, {} in flight on each, on {} threads, for {}s\n",
+                           cli.connections, cli.pipeline, threads, cli.duration);
+
+  const auto start    = clk::now();
+  const auto deadline = start + std::chrono::duration_cast<clk::duration>(
+                                    std::chrono::duration<double>(cli.duration));
+
+  std::vector<results_t> results(threads);
+  {
+    std::vector<std::jthread> workers;
+    for (unsigned t = 0; t != threads; ++t) {
+      // share the connections out as evenly as possible
+      const unsigned conns = cli.connections / threads + (t < cli.connections % threads ? 1 : 0);
+      workers.emplace_back([&, t, conns, seed = gen()] {
+        try {
+          results[t] = run_connections(cli, conns, requests, seed, deadline);
+        } catch (const std::exception& e) {
+          std::cerr << fmt::format("Error: {}\n", e.what());
+          std::exit(EXIT_FAILURE); // NOLINT concurrency
+        }
+      });
+    }
+  }
+  const double elapsed = std::chrono::duration<double>(clk::now() - start).count();
+
+  results_t total;
+  for (auto& r: results) {
+    total.responses += r.responses;
+    total.found += r.found;
+    total.errors += r.errors;
+    total.latencies_ns.insert(total.latencies_ns.end(), r.latencies_ns.begin(),
+                              r.latencies_ns.end());
+  }
+  std::sort(total.latencies_ns.begin(), total.latencies_ns.end());
+
+  const double rate  = static_cast<double>(total.responses) / elapsed;
+  const double found = total.responses == 0 ? 0.0
+                                            : static_cast<double>(total.found) * 100 /
+                                                  static_cast<double>(total.responses);
+  const double p50   = percentile_us(total.latencies_ns, 0.50);
+  const double p99   = percentile_us(total.latencies_ns, 0.99);
+  const double p999  = percentile_us(total.latencies_ns, 0.999);
+  const double max   = percentile_us(total.latencies_ns, 1.0);
+
+  if (cli.json) {
+    std::cout << fmt::format(
+        R"({{"responses":{},"errors":{},"seconds":{:.3f},"requests_per_second":{:.1f},)"
+        R"("found_percent":{:.2f},"latency_us":{{"p50":{:.1f},"p99":{:.1f},"p999":{:.1f},)"
+        R"("max":{:.1f}}}}})"
+        "\n",
+        total.responses, total.errors, elapsed, rate, found, p50, p99, p999, max);
+  } else {
+    std::cout << fmt::format("{} responses in {:.2f}s => {:.0f} requests/s, {:.1f}% found, {} "
+                             "errors\n"
+                             "latency: p50={:.1f}us p99={:.1f}us p999={:.1f}us max={:.1f}us\n",
+                             total.responses, elapsed, rate, found, total.errors, p50, p99, p999,
+                             max);
+  }
+}
+
+int main(int argc, char* argv[]) {
+  cli_config_t cli;
+
+  CLI::App app("Generating realistic load for hibp-server");
+  define_options(app, cli);
+  CLI11_PARSE(app, argc, argv);
+
+  try {
+    run(cli);
+  } catch (const std::exception& e) {
+    std::cerr << fmt::format("Error: {}\n", e.what());
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,100 @@
+#include "diffutils.hpp"
+#include "hibp.hpp"
+#include <CLI/CLI.hpp>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <filesystem>
+#include <fmt/format.h>
+#include <fstream>
+#include <ios>
+#include <iostream>
+#include <istream>
+#include <stdexcept>
+#include <string>
+
+struct cli_config_t {
+  std::string db_file_old;
+  std::string diff_file;
+  std::string db_file_new;
+  bool        ntlm  = false;
+  bool        force = false;
+};
+
+void define_options(CLI::App& app, cli_config_t& cli) {
+
+  app.add_option("db_file_old", cli.db_file_old, "The binary database which the diff was made from")
+      ->required();
+
+  app.add_option("diff_file", cli.diff_file,
+                 "The output of hibp-diff, to apply to db_file_old. Use '-' for standard input.")
+      ->required();
+
+  app.add_option("db_file_new", cli.db_file_new, "The patched binary database will be written here")
+      ->required();
+
+  app.add_flag("--ntlm", cli.ntlm, "Use ntlm hashes rather than sha1.");
+
+  app.add_flag("-f,--force", cli.force, "Overwrite any existing output file!");
+}
+
+template <hibp::pw_type PwType>
+std::size_t patch(const cli_config_t& cli) {
+  if (!cli.force && std::filesystem::exists(cli.db_file_new)) {
+    throw std::runtime_error(
+        fmt::format("File '{}' exists. Use `--force` to overwrite.", cli.db_file_new));
+  }
+
+  std::ifstream diff_file;
+  std::istream* diff = &std::cin;
+  if (cli.diff_file != "-") {
+    diff_file.open(cli.diff_file);
+    if (!diff_file) {
+      throw std::runtime_error(fmt::format("Error opening '{}' for reading. Because: \"{}\".",
+                                           cli.diff_file,
+                                           std::strerror(errno))); // NOLINT errno
+    }
+    diff = &diff_file;
+  }
+
+  // write to a temporary file, so a failed patch never leaves a plausible looking db behind
+  const auto    tmp = std::filesystem::path(cli.db_file_new + ".tmp");
+  std::ofstream new_db(tmp, std::ios_base::binary);
+  if (!new_db) {
+    throw std::runtime_error(fmt::format("Error opening '{}' for writing. Because: \"{}\".",
+                                         tmp.string(),
+                                         std::strerror(errno))); // NOLINT errno
+  }
+  std::size_t hunks = 0;
+  try {
+    hunks = hibp::diffutils::run_patch<PwType>(cli.db_file_old, *diff, new_db);
+    new_db.close();
+  } catch (...) {
+    new_db.close();
+    std::filesystem::remove(tmp);
+    throw;
+  }
+  std::filesystem::rename(tmp, cli.db_file_new);
+  return hunks;
+}
+
+int main(int argc, char* argv[]) {
+  cli_config_t cli;
+
+  CLI::App app;
+  define_options(app, cli);
+  CLI11_PARSE(app, argc, argv);
+
+  try {
+    const auto hunks =
+        cli.ntlm ? patch<hibp::pawned_pw_ntlm>(cli) : patch<hibp::pawned_pw_sha1>(cli);
+    std::cerr << fmt::format("Applied {} hunks to '{}', giving '{}'.\n", hunks, cli.db_file_old,
+                             cli.db_file_new);
+  } catch (const std::exception& e) {
+    std::cerr << "something went wrong: " << e.what() << "\n";
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -1,7 +1,7 @@
 #include "arrcmp.hpp"
 #include "binfuse/sharded_filter.hpp"
+#include "digest.hpp"
 #include "hibp.hpp"
-#include "sha1.h"
 #include <CLI/CLI.hpp>
 #include <cstdint>
 #include <cstdio>
@@ -68,7 +68,7 @@ void query(const cli_config_t& cli) {
     hibp::pawned_pw_sha1t64 pw{cli.plain_text_password};
     needle = arrcmp::impl::bytearray_cast<std::uint64_t>(pw.hash.data());
   } else {
-    hibp::pawned_pw_sha1t64 pw{SHA1{}(cli.plain_text_password)};
+    hibp::pawned_pw_sha1t64 pw{hibp::digest::sha1(cli.plain_text_password)};
     needle = arrcmp::impl::bytearray_cast<std::uint64_t>(pw.hash.data());
   }
   std::cout << fmt::format("needle = {:016X}\n", needle);
@@ -1,10 +1,14 @@
+#include "digest.hpp"
 #include "flat_file.hpp"
 #include "hibp.hpp"
-#include "ntlm.hpp"
+#include "packed.hpp"
+#include "paged.hpp"
+#include "split.hpp"
 #include "toc.hpp"
 #include <CLI/CLI.hpp>
 #include <algorithm>
 #include <chrono>
+#include <cstddef>
 #include <cstdlib>
 #include <exception>
 #include <fmt/chrono.h> // IWYU pragma: keep
@@ -12,25 +16,32 @@
 #include <iostream>
 #include <optional>
 #include <ratio>
-#include <sha1.h>
 #include <stdexcept>
 #include <string>
 #include <type_traits>
+#include <utility>
 
 struct cli_config_t {
   std::string db_filename;
   std::string plain_text_password;
-  bool        toc      = false;
-  bool        hash     = false;
-  bool        ntlm     = false;
-  bool        sha1t64  = false;
-  unsigned    toc_bits = 20; // 1Mega chapters
+  bool        toc          = false;
+  bool        hash         = false;
+  bool        ntlm         = false;
+  bool        sha1t64      = false;
+  unsigned    toc_bits     = 20; // 1Mega chapters
+  bool        pla          = false;
+  unsigned    pla_epsilon  = 64; // search window of ~1 disk page
+  std::size_t hot_index_mb = 0;  // 0 => no hot index
+  bool        split        = false;
+  bool        paged        = false;
+  std::size_t page_size    = 4096;
 };
 
 void define_options(CLI::App& app, cli_config_t& cli) {
 
   app.add_option("db_filename", cli.db_filename,
-                 "The file that contains the binary database you downloaded")
+                 "The file that contains the binary database you downloaded, in the flat or the "
+                 "packed format")
       ->required();
 
   app.add_option("plain-text-password", cli.plain_text_password,
@@ -53,16 +64,37 @@ void define_options(CLI::App& app, cli_config_t& cli) {
                  fmt::format("Specify how may bits to use for table of content mask. default {}",
                              cli.toc_bits))
       ->check(CLI::Range(15, 25));
-}
 
-template <hibp::pw_type PwType>
-void run_search(const cli_config_t& cli) {
-  flat_file::database<PwType> db(cli.db_filename, 4096 / sizeof(PwType));
+  app.add_flag("--pla", cli.pla,
+               "Use a learned, piecewise linear index of record positions for extra performance.");
 
-  if (cli.toc) {
-    hibp::toc_build<PwType>(cli.db_filename, cli.toc_bits);
-  }
+  app.add_option("--pla-epsilon", cli.pla_epsilon,
+                 fmt::format("Maximum error of the pla index, in records. default {}",
+                             cli.pla_epsilon))
+      ->check(CLI::Range(1, 1 << 16));
+
+  app.add_option("--hot-index-mb", cli.hot_index_mb,
+                 "Size in MB of a resident index of evenly spaced db records, searched before "
+                 "the db itself. Combines with --toc and --pla. (default: 0 => off)");
 
+  app.add_flag("--split", cli.split,
+               "Search a copy of the db, split into a dense column of hash keys and columns of "
+               "the rest, which are only read on a hit. Built alongside the db on first use. "
+               "Combines with --toc, --pla and --hot-index-mb.");
+
+  app.add_flag("--paged", cli.paged,
+               "Search a copy of the db, bucketed into pages, with one aligned read of one page. "
+               "Built alongside the db on first use. Not used with --split, --toc, --pla or "
+               "--hot-index-mb.");
+
+  app.add_option("--page-size", cli.page_size,
+                 fmt::format("The page size of the --paged copy, a power of 2 (default: {})",
+                             cli.page_size))
+      ->check(CLI::Range(std::size_t{512}, std::size_t{1} << 20U));
+}
+
+template <hibp::pw_type PwType>
+PwType make_needle(const cli_config_t& cli) {
   PwType needle;
   if constexpr (std::is_same_v<PwType, hibp::pawned_pw_ntlm>) {
     if (cli.hash) {
@@ -71,7 +103,7 @@ void run_search(const cli_config_t& cli) {
       }
       needle = PwType{cli.plain_text_password};
     } else {
-      needle.hash = hibp::ntlm(cli.plain_text_password);
+      needle = PwType{hibp::digest::ntlm(cli.plain_text_password)};
     }
   } else { // sha1
     if (cli.hash) {
@@ -80,29 +112,123 @@ void run_search(const cli_config_t& cli) {
       }
       needle = PwType{cli.plain_text_password};
     } else {
-      // note that sha1t64 can also be constructed from sha1 text hash
-      needle = PwType{SHA1{}(cli.plain_text_password)};
+      // note that sha1t64 can also be constructed from a sha1 digest
+      needle = PwType{hibp::digest::sha1(cli.plain_text_password)};
     }
   }
+  return needle;
+}
 
-  std::optional<PwType> maybe_ppw;
+template <hibp::pw_type PwType>
+void report(const PwType& needle, const std::optional<PwType>& maybe_ppw) {
+  std::cout << "needle = " << needle << "\n";
+  if (maybe_ppw)
+    std::cout << "found  = " << *maybe_ppw << "\n";
+  else
+    std::cout << "not found\n";
+}
+
+// [first, last) positions of the db, or of its split columns, which could contain `needle`: the toc
+// chapter or pla window, narrowed by the hot index, as in hibp-server. Empty if the needle cannot
+// be in the db.
+template <hibp::pw_type PwType>
+std::pair<std::size_t, std::size_t> narrow(const cli_config_t& cli, const PwType& needle,
+                                           std::size_t db_size,
+                                           const flat_file::hot_index<PwType>* hot) {
+  std::pair<std::size_t, std::size_t> range{0, db_size};
+  if (cli.toc) {
+    // empty beyond the end of a partial toc, and therefore "not found"
+    range = hibp::toc_chapter(needle, cli.toc_bits, db_size).value_or(decltype(range){});
+  } else if (cli.pla) {
+    range = hibp::pla_window(needle, db_size);
+  }
+  if (hot != nullptr) {
+    const auto [first, last] = hot->range(needle);
+    range = {std::max(range.first, first), std::min(range.second, last)};
+  }
+  range.first = std::min(range.first, range.second);
+  return range;
+}
+
+// packed dbs carry their own block index, so there is nothing to build
+template <hibp::pw_type PwType>
+void run_packed_search(const cli_config_t& cli) {
+  if (cli.toc || cli.pla || cli.hot_index_mb != 0 || cli.split || cli.paged) {
+    throw std::runtime_error(
+        "--toc, --pla, --hot-index-mb, --split and --paged are not used with packed dbs");
+  }
+  hibp::packed::database<PwType> db(cli.db_filename);
+  const PwType                   needle = make_needle<PwType>(cli);
 
   using clk       = std::chrono::high_resolution_clock;
   using fmilli    = std::chrono::duration<double, std::milli>;
   auto start_time = clk::now();
+  auto maybe_ppw  = db.find(needle);
+  std::cout << fmt::format("search took {:.2}\n", duration_cast<fmilli>(clk::now() - start_time));
+  report(needle, maybe_ppw);
+}
+
+template <hibp::pw_type PwType>
+void run_search(const cli_config_t& cli) {
+  if (hibp::packed::is_packed(cli.db_filename)) {
+    run_packed_search<PwType>(cli);
+    return;
+  }
+  flat_file::database<PwType> db(cli.db_filename, 4096 / sizeof(PwType));
+
   if (cli.toc) {
-    maybe_ppw = hibp::toc_search<PwType>(db, needle, cli.toc_bits);
-  } else if (auto iter = std::lower_bound(db.begin(), db.end(), needle);
-             iter != db.end() && *iter == needle) {
-    maybe_ppw = *iter;
+    hibp::toc_build<PwType>(cli.db_filename, cli.toc_bits);
+  } else if (cli.pla) {
+    hibp::pla_build<PwType>(cli.db_filename, cli.pla_epsilon);
+  }
+
+  std::optional<hibp::split_db<PwType>> split;
+  if (cli.split) {
+    hibp::split_build<PwType>(cli.db_filename);
+    split.emplace(cli.db_filename);
+  }
+
+  std::optional<hibp::paged_db<PwType>> paged;
+  if (cli.paged) {
+    hibp::paged_build<PwType>(cli.db_filename, cli.page_size);
+    paged.emplace(cli.db_filename);
+  }
+
+  const PwType needle = make_needle<PwType>(cli);
+
+  std::optional<flat_file::hot_index<PwType>> hot;
+  if (cli.hot_index_mb != 0) {
+    hot.emplace(db, cli.hot_index_mb * (1UL << 20U));
+    std::cout << fmt::format("hot index: {} samples, every {} records\n", hot->size(),
+                             hot->stride());
+  }
+
+  std::optional<PwType> maybe_ppw;
+
+  using clk       = std::chrono::high_resolution_clock;
+  using fmilli    = std::chrono::duration<double, std::milli>;
+  auto        start_time = clk::now();
+  std::size_t pages      = 0;
+  if (paged) {
+    maybe_ppw = paged->find(needle, pages);
+  } else if (split) {
+    // the columns have the same positions as the db, so any of its indexes narrow the search
+    const auto [first, last] = narrow(cli, needle, split->number_records(), hot ? &*hot : nullptr);
+    maybe_ppw                = split->find(needle, first, last);
+  } else {
+    const auto [first, last] = narrow(cli, needle, db.number_records(), hot ? &*hot : nullptr);
+    auto end                 = db.begin() + last;
+    if (auto iter = std::lower_bound(db.begin() + first, end, needle);
+        iter != end && *iter == needle) {
+      maybe_ppw = *iter;
+    }
   }
   std::cout << fmt::format("search took {:.2}\n", duration_cast<fmilli>(clk::now() - start_time));
+  if (paged) {
+    std::cout << fmt::format("read {} page(s){}\n", pages, paged->direct() ? ", direct io" : "");
+  }
 
-  std::cout << "needle = " << needle << "\n";
-  if (maybe_ppw)
-    std::cout << "found  = " << *maybe_ppw << "\n";
-  else
-    std::cout << "not found\n";
+  report(needle, maybe_ppw);
 }
 
 int main(int argc, char* argv[]) {
@@ -113,6 +239,10 @@ int main(int argc, char* argv[]) {
   CLI11_PARSE(app, argc, argv);
 
   try {
+    if (cli.paged && (cli.split || cli.toc || cli.pla || cli.hot_index_mb != 0)) {
+      throw std::runtime_error("--paged searches its own copy of the db, and is not used with "
+                               "--split, --toc, --pla or --hot-index-mb");
+    }
     if (cli.ntlm) {
       run_search<hibp::pawned_pw_ntlm>(cli);
     } else if (cli.sha1t64) {
@@ -2,8 +2,10 @@
 #include "binfuse/sharded_filter.hpp"
 #include "flat_file.hpp"
 #include "hibp.hpp"
+#include "mphf.hpp"
+#include "packed.hpp"
 #include "srv/server.hpp"
-#include "toc.hpp"
+#include "uring.hpp"
 #include <CLI/CLI.hpp>
 #include <cstdlib>
 #include <exception>
@@ -26,6 +28,10 @@ void define_options(CLI::App& app, hibp::srv::cli_config_t& cli) {
                  "The file that contains the binary database of sha1t64 hashes you downloaded. "
                  "Used for /check/sha1t64/... requests.");
 
+  app.add_option("--mphf-db", cli.mphf_db_filename,
+                 "The file that contains the minimal perfect hash db (from hibp-build-mphf), which "
+                 "needs one disk read per query. Used for /check/mphf/... requests.");
+
   app.add_option("--binfuse16-filter", cli.binfuse16_filter_filename,
                  "The file that contains the binary fuse16 filter you downloaded. "
                  "Used for /check/binfuse16/... requests.");
@@ -34,6 +40,24 @@ void define_options(CLI::App& app, hibp::srv::cli_config_t& cli) {
                  "The file that contains the binary fuse8 filter you downloaded. "
                  "Used for /check/binfuse8/... requests.");
 
+  app.add_option("--hot-sha1-db", cli.hot_sha1_db_filename,
+                 "A small binary database of the most common sha1 hashes (eg from hibp-topn), "
+                 "which is held in memory and checked before --sha1-db.");
+
+  app.add_option("--hot-ntlm-db", cli.hot_ntlm_db_filename,
+                 "A small binary database of the most common ntlm hashes, which is held in "
+                 "memory and checked before --ntlm-db.");
+
+  app.add_option("--hot-sha1t64-db", cli.hot_sha1t64_db_filename,
+                 "A small binary database of the most common sha1t64 hashes, which is held in "
+                 "memory and checked before --sha1t64-db.");
+
+  app.add_option("--prefilter", cli.prefilter_filename,
+                 "A binfuse16 filter (from hibp-download --binfuse16-out), checked before "
+                 "--sha1-db and --sha1t64-db. Passwords which the filter rules out are reported "
+                 "as not found without any disk access, all others get an exact count from the "
+                 "db.");
+
   app.add_option(
       "--bind-address", cli.bind_address,
       fmt::format("The IP4 address the server will bind to. (default: {})", cli.bind_address));
@@ -45,6 +69,20 @@ void define_options(CLI::App& app, hibp::srv::cli_config_t& cli) {
                  fmt::format("The number of threads to use (default: {})", cli.threads))
       ->check(CLI::Range(1U, cli.threads));
 
+  app.add_flag("--reuse-port", cli.reuse_port,
+               "Run --threads independent, single threaded servers, each pinned to a core and "
+               "with its own SO_REUSEPORT listening socket, so the kernel spreads the connections "
+               "over them, rather than sharing one acceptor. Not on Windows.");
+
+  app.add_option("--binary-socket", cli.binary_socket,
+                 "Also serve the compact binary protocol (see srv/binary.hpp) on a unix domain "
+                 "socket at this path, for clients on the same host. Not on Windows.");
+
+  app.add_option("--binary-port", cli.binary_port,
+                 "Also serve the compact binary protocol on this tcp port, of --bind-address. "
+                 "Not on Windows.")
+      ->check(CLI::Range(1, 65535));
+
   app.add_flag("--json", cli.json, "Output a json response.");
 
   app.add_flag(
@@ -52,12 +90,90 @@ void define_options(CLI::App& app, hibp::srv::cli_config_t& cli) {
       "Use this to uniquefy the password provided for each query, "
       "thereby defeating the cache. The results will be wrong, but good for performance tests");
 
+#ifdef FLAT_FILE_HAS_MMAP
+  app.add_flag("--mmap", cli.mmap,
+               "Memory map the dbs. One read-only mapping is shared by all threads and records are "
+               "read straight from the OS page cache, without per query syscalls or copying.");
+
+  app.add_flag("--warmup", cli.warmup,
+               "Before serving, read the filters, the tocs and the top levels of the searches of "
+               "each db into the OS page cache, in parallel, so the first queries are not slow.");
+
+  app.add_option("--warmup-depth", cli.warmup_depth,
+                 fmt::format("The number of levels of each db search read by --warmup. Each "
+                             "level doubles the pages read. (default: {})",
+                             cli.warmup_depth))
+      ->check(CLI::Range(1U, 24U));
+
+  app.add_flag("--lock-memory", cli.lock_memory,
+               "Implies --warmup, and then locks all of those pages in RAM (mlock), so they are "
+               "never evicted. Needs a large enough `ulimit -l`.");
+#endif
+
+  app.add_option("--cache-mb", cli.cache_mb,
+                 "Size in MB of a block cache shared by all threads and dbs. Disk reads use "
+                 "positional i/o and the top levels of every search will be memory hits. An "
+                 "alternative to --mmap with a strict memory budget. (default: 0 => off)");
+
+  app.add_option("--hot-index-mb", cli.hot_index_mb,
+                 "Size in MB of a resident index of evenly spaced db records, which is searched "
+                 "in cache friendly (Eytzinger) order before the db itself. Complements --toc, "
+                 "--mmap and --cache-mb. (default: 0 => off)");
+
+  app.add_option("--max-batch", cli.max_batch,
+                 fmt::format("Maximum number of entries in one POST /check/:format batch request "
+                             "(default: {})",
+                             cli.max_batch))
+      ->check(CLI::Range(1UL, 10'000'000UL));
+
+  app.add_option("--range-cache", cli.range_cache,
+                 "Number of rendered /range/:prefix responses to keep in an LRU cache, for hot "
+                 "prefixes. Each is about 40kB. (default: 0 => off)");
+
+  app.add_flag("--admin-reload", cli.admin_reload,
+               "Enable POST /admin/reload, which reloads all dbs and filters, like SIGHUP, and "
+               "responds once they are served. Anyone who can reach the server can use it.");
+
   app.add_flag("--toc", cli.toc, "Use a table of contents for extra performance.");
 
   app.add_option("--toc-bits", cli.toc_bits,
                  fmt::format("Specify how may bits to use for table of content mask. default {}",
                              cli.toc_bits))
       ->check(CLI::Range(15, 25));
+
+  app.add_flag("--pla", cli.pla,
+               "Use a learned, piecewise linear index of record positions. Smaller than a table of "
+               "contents, and each search reads a window of about 2 * epsilon records.");
+
+  app.add_option("--pla-epsilon", cli.pla_epsilon,
+                 fmt::format("Maximum error of the pla index, in records. default {}",
+                             cli.pla_epsilon))
+      ->check(CLI::Range(1, 1 << 16));
+
+  app.add_flag("--split", cli.split,
+               "Search split columns of each db: a dense column of hash keys and columns of the "
+               "rest, which are only read on a hit. Built alongside the db on first use. Combines "
+               "with --toc, --pla and --hot-index-mb.");
+
+  app.add_flag("--paged", cli.paged,
+               "Search a copy of each db, bucketed into pages, so each search is one aligned read "
+               "of one page, bypassing the page cache where possible. Built alongside the db on "
+               "first use.");
+
+  app.add_option("--page-size", cli.page_size,
+                 fmt::format("The page size of --paged dbs, a power of 2 (default: {})",
+                             cli.page_size))
+      ->check(CLI::Range(std::size_t{512}, std::size_t{1} << 20U));
+
+  app.add_flag("--uring", cli.uring,
+               "Search the dbs with asynchronous reads, using Linux io_uring. The reads of all "
+               "concurrent searches are submitted together, so a few threads can keep a fast disk "
+               "busy with cold lookups. Combines with --toc, --pla and --hot-index-mb.");
+
+  app.add_option("--uring-depth", cli.uring_depth,
+                 fmt::format("Maximum number of --uring reads in flight, per db (default: {})",
+                             cli.uring_depth))
+      ->check(CLI::Range(1U, 4096U));
 }
 
 namespace hibp::srv {
@@ -65,11 +181,15 @@ cli_config_t cli;
 } // namespace hibp::srv
 
 template <hibp::pw_type PwType>
-void prep_db(const std::string& db_filename, bool toc, unsigned toc_bits) {
-  auto test_db = flat_file::database<PwType>{db_filename};
-  if (toc) {
-    hibp::toc_build<PwType>(db_filename, toc_bits);
+void prep_db(const std::string& db_filename, const hibp::srv::cli_config_t& cli) {
+  if (hibp::packed::is_packed(db_filename)) {
+    if (cli.split) throw std::runtime_error("--split is not used with packed dbs");
+    if (cli.uring) throw std::runtime_error("--uring is not used with packed dbs");
+    if (cli.paged) throw std::runtime_error("--paged is not used with packed dbs");
+    auto test_db = hibp::packed::database<PwType>{db_filename}; // has its own index
+    return;
   }
+  auto test_db = flat_file::database<PwType>{db_filename}; // the server builds its toc etc
 }
 
 // test filter files open OK, before starting server
@@ -78,16 +198,19 @@ void prep_filter(const std::string& db_filename) {
   auto filter = FilterType(db_filename);
 }
 
-// test db files open OK, before starting server, and build their tocs
+// test db files open OK, before starting server
 void prep_sources(const hibp::srv::cli_config_t& cli) {
   if (!cli.sha1_db_filename.empty()) {
-    prep_db<hibp::pawned_pw_sha1>(cli.sha1_db_filename, cli.toc, cli.toc_bits);
+    prep_db<hibp::pawned_pw_sha1>(cli.sha1_db_filename, cli);
   }
   if (!cli.ntlm_db_filename.empty()) {
-    prep_db<hibp::pawned_pw_ntlm>(cli.ntlm_db_filename, cli.toc, cli.toc_bits);
+    prep_db<hibp::pawned_pw_ntlm>(cli.ntlm_db_filename, cli);
   }
   if (!cli.sha1t64_db_filename.empty()) {
-    prep_db<hibp::pawned_pw_sha1t64>(cli.sha1t64_db_filename, cli.toc, cli.toc_bits);
+    prep_db<hibp::pawned_pw_sha1t64>(cli.sha1t64_db_filename, cli);
+  }
+  if (!cli.mphf_db_filename.empty()) {
+    auto test_db = hibp::mphf_db{cli.mphf_db_filename};
   }
   if (!cli.binfuse8_filter_filename.empty()) {
     prep_filter<binfuse::sharded_filter8_source>(cli.binfuse8_filter_filename);
@@ -106,10 +229,42 @@ int main(int argc, char* argv[]) {
 
   try {
     if (cli.sha1_db_filename.empty() && cli.ntlm_db_filename.empty() &&
-        cli.sha1t64_db_filename.empty() && cli.binfuse16_filter_filename.empty() &&
-        cli.binfuse8_filter_filename.empty()) {
+        cli.sha1t64_db_filename.empty() && cli.mphf_db_filename.empty() &&
+        cli.binfuse16_filter_filename.empty() && cli.binfuse8_filter_filename.empty()) {
       throw std::runtime_error("You must one of --sha1-db, --ntlm-db or --sha1t64-db");
     }
+    if (cli.mmap && cli.cache_mb != 0) {
+      throw std::runtime_error("--mmap and --cache-mb are alternatives, please choose one");
+    }
+    if ((!cli.hot_sha1_db_filename.empty() && cli.sha1_db_filename.empty()) ||
+        (!cli.hot_ntlm_db_filename.empty() && cli.ntlm_db_filename.empty()) ||
+        (!cli.hot_sha1t64_db_filename.empty() && cli.sha1t64_db_filename.empty())) {
+      throw std::runtime_error("A --hot-*-db needs the full db of the same format too");
+    }
+    if (!cli.prefilter_filename.empty() && cli.sha1_db_filename.empty() &&
+        cli.sha1t64_db_filename.empty()) {
+      throw std::runtime_error("--prefilter needs --sha1-db or --sha1t64-db");
+    }
+    if (cli.toc && cli.pla) {
+      throw std::runtime_error("--toc and --pla are alternatives, please choose one");
+    }
+    if (cli.paged && (cli.split || cli.uring)) {
+      throw std::runtime_error("--paged searches its own copy of the db, and is not used with "
+                               "--split or --uring");
+    }
+    if (cli.binary_port == cli.port) {
+      throw std::runtime_error("--binary-port needs a port of its own, not the http --port");
+    }
+    if (cli.uring) {
+      if (cli.mmap || cli.cache_mb != 0 || cli.split) {
+        throw std::runtime_error("--uring reads the db itself, and is not used with --mmap, "
+                                 "--cache-mb or --split");
+      }
+      if (!hibp::uring_available()) {
+        throw std::runtime_error("--uring needs io_uring, which needs Linux 5.7 or later, and "
+                                 "which has not been disabled");
+      }
+    }
     prep_sources(cli);
 
     hibp::srv::run_server();
@@ -1,17 +1,25 @@
 #include "flat_file.hpp"
 #include "hibp.hpp"
+#include "toc.hpp"
 #include <CLI/CLI.hpp>
 #include <cstdlib>
 #include <exception>
 #include <fmt/format.h>
+#include <functional>
 #include <iostream>
+#include <optional>
+#include <stdexcept>
 #include <string>
 
 struct cli_config_t {
   std::string input_filename;
   bool        sort_by_count = false;
   bool        ntlm          = false;
+  bool        toc           = false;
+  unsigned    toc_bits      = 20; // 1Mega chapters
   std::size_t max_memory    = 1000;
+  std::string strategy      = "radix";
+  unsigned    threads       = 0; // 0 => one per core
 };
 
 void define_options(CLI::App& app, cli_config_t& cli) {
@@ -32,6 +40,26 @@ void define_options(CLI::App& app, cli_config_t& cli) {
                   "will, result in more chunks being written to disk, which is slower."
                   "(default = {}MB)",
                   cli.max_memory));
+
+  app.add_option("--strategy", cli.strategy,
+                 "How to sort by hash. `radix` partitions the records by their leading bits, then "
+                 "sorts each partition in parallel, with no merge phase and 2x rather than 3x the "
+                 "disk space. `merge` sorts chunks and merges them. --sort-by-count always merges. "
+                 "(default: radix)")
+      ->check(CLI::IsMember({"radix", "merge"}));
+
+  app.add_option("--threads", cli.threads,
+                 "The number of partitions sorted concurrently by the radix strategy, within "
+                 "--max-memory (default: 0 => one per core)");
+
+  app.add_flag("--toc", cli.toc,
+               "Also write a table of contents for the sorted db, while merging. Only when sorting "
+               "by hash.");
+
+  app.add_option("--toc-bits", cli.toc_bits,
+                 fmt::format("Specify how may bits to use for table of content mask. default {}",
+                             cli.toc_bits))
+      ->check(CLI::Range(15, 25));
 }
 
 template <hibp::pw_type PwType>
@@ -50,7 +78,20 @@ std::string sort_db(const cli_config_t& cli) {
         },
         {}, max_mem_bytes);
   } else {
-    sorted_filename = db.disksort({}, {}, max_mem_bytes);
+    // the toc is built while writing the sorted output, rather than by rescanning it
+    std::optional<hibp::toc_writer<PwType>> toc;
+    std::function<void(const PwType&)>      on_write;
+    if (cli.toc) {
+      toc.emplace(fmt::format("{}.sorted", cli.input_filename), cli.toc_bits);
+      on_write = [&](const PwType& pw) { toc->add(pw); };
+    }
+    if (cli.strategy == "radix") {
+      auto radix      = [](const PwType& pw) { return hibp::details::pw_to_key(pw); };
+      sorted_filename = db.radix_disksort(radix, {}, max_mem_bytes, on_write, cli.threads);
+    } else {
+      sorted_filename = db.disksort({}, {}, max_mem_bytes, on_write);
+    }
+    if (toc) toc->finalize();
   }
   return sorted_filename;
 }
@@ -63,6 +104,10 @@ int main(int argc, char* argv[]) {
   CLI11_PARSE(app, argc, argv);
 
   try {
+    if (cli.toc && cli.sort_by_count) {
+      throw std::runtime_error("--toc requires the output to be sorted by hash, so not with "
+                               "--sort-by-count.");
+    }
     std::string sorted_filename;
     if (cli.ntlm) {
       sorted_filename = sort_db<hibp::pawned_pw_ntlm>(cli);
@@ -2,11 +2,13 @@
 #include "hibp.hpp"
 #include <CLI/CLI.hpp>
 #include <algorithm>
+#include <atomic>
 #if __has_include(<bits/chrono.h>)
 #include <bits/chrono.h>
 #endif
 #include <chrono>
 #include <cstddef>
+#include <cstdint>
 #include <cstdlib>
 #include <fmt/chrono.h> // IWYU pragma: keep
 #include <fmt/format.h>
@@ -18,9 +20,13 @@
 #include <fstream>
 #include <ios>
 #include <iostream>
+#include <limits>
+#include <mutex>
 #include <ostream>
 #include <stdexcept>
 #include <string>
+#include <thread>
+#include <utility>
 #include <vector>
 
 struct cli_config_t {
@@ -31,6 +37,7 @@ struct cli_config_t {
   bool        ntlm            = false;
   bool        sha1t64         = false;
   std::size_t topn            = 50'000'000; // ~1GB in memory, about 5% of the DB
+  unsigned    threads         = 0;          // 0 => all cores
 };
 
 void define_options(CLI::App& app, cli_config_t& cli) {
@@ -48,6 +55,10 @@ void define_options(CLI::App& app, cli_config_t& cli) {
   app.add_option("-N,--topn", cli.topn,
                  fmt::format("Return the N most common password records (default: {})", cli.topn));
 
+  app.add_option("--threads", cli.threads,
+                 "Number of threads which each scan a range of the db. Up to about 2 x N "
+                 "records are held in memory, however many. (default: all cores)");
+
   app.add_flag("--ntlm", cli.ntlm, "Use ntlm hashes rather than sha1.");
 
   app.add_flag("--sha1t64", cli.sha1t64,
@@ -71,6 +82,91 @@ std::ofstream get_output_stream(const std::string& output_filename, bool force)
   return output_stream;
 }
 
+// TopN order: by count descending, falling back to hash ascending for stability
+template <hibp::pw_type PwType>
+bool by_count_desc(const PwType& a, const PwType& b) {
+  if (a.count == b.count) return a < b;
+  return a.count > b.count;
+}
+
+// reduces `best` to its top `topn` records, in no particular order
+template <hibp::pw_type PwType>
+void select_topn(std::vector<PwType>& best, std::size_t topn) {
+  if (best.size() <= topn) return;
+  if (topn == 0) {
+    best.clear();
+    return;
+  }
+  std::nth_element(best.begin(), best.begin() + static_cast<std::ptrdiff_t>(topn - 1), best.end(),
+                   by_count_desc<PwType>);
+  best.resize(topn); // and best.back() is now the worst record kept
+}
+
+// Each thread buffers the records of its own range of the db, and whenever its buffer is full,
+// merges it into the shared top N, with an nth_element() under a lock. Once that holds N records,
+// their lowest count is a floor below which no record can be in the overall top N, and all threads
+// skip those records without buffering them. The buffers are about N / threads records each, so
+// no more than about 2 x N records are held in memory, however many threads there are.
+template <hibp::pw_type PwType, typename Db>
+std::vector<PwType> parallel_topn(Db& input_db, std::size_t topn, unsigned threads) {
+  const std::size_t records = input_db.number_records();
+  if (threads == 0) threads = std::max(std::thread::hardware_concurrency(), 1U);
+  threads = static_cast<unsigned>(std::min<std::size_t>(threads, records));
+
+  const std::size_t capacity = std::max<std::size_t>(topn / threads, 4096); // of each buffer
+
+  std::atomic<std::int32_t>       floor{std::numeric_limits<std::int32_t>::min()};
+  std::mutex                      mutex; // of best
+  std::vector<PwType>             best;
+  std::vector<std::exception_ptr> errors(threads);
+  best.reserve(topn + capacity);
+
+  auto merge = [&](std::vector<PwType>& buffer) {
+    const std::lock_guard lock(mutex);
+    best.insert(best.end(), buffer.begin(), buffer.end());
+    buffer.clear();
+    if (topn == 0 || best.size() <= topn) return;
+    select_topn(best, topn);
+    // best.back() is now the worst record kept, and never gets worse, so the floor only rises
+    floor.store(best.back().count, std::memory_order_relaxed);
+  };
+
+  {
+    std::vector<std::jthread> workers;
+    for (unsigned t = 0; t != threads; ++t) {
+      workers.emplace_back([&, t] {
+        try {
+          std::vector<PwType> buffer;
+          buffer.reserve(std::min(capacity, records / threads + 1));
+
+          auto consider = [&](const PwType& pw) {
+            if (pw.count < floor.load(std::memory_order_relaxed)) return;
+            buffer.push_back(pw);
+            if (buffer.size() == capacity) merge(buffer);
+          };
+
+          const std::size_t first = records * t / threads;
+          const std::size_t last  = records * (t + 1) / threads;
+#ifdef FLAT_FILE_HAS_MMAP
+          std::for_each(input_db.begin() + first, input_db.begin() + last, consider);
+#else
+          // each thread needs its own buffered reader
+          flat_file::database<PwType> db(input_db.filename(), (1U << 16U) / sizeof(PwType));
+          std::for_each(db.begin() + first, db.begin() + last, consider);
+#endif
+          merge(buffer);
+        } catch (...) {
+          errors[t] = std::current_exception();
+        }
+      });
+    }
+  }
+  for (const auto& error: errors) {
+    if (error) std::rethrow_exception(error);
+  }
+  return best;
+}
+
 template <hibp::pw_type PwType>
 void build_topn(const cli_config_t& cli) {
   std::ostream* output_stream      = &std::cout;
@@ -82,14 +178,18 @@ void build_topn(const cli_config_t& cli) {
     output_stream_name = cli.output_filename;
   }
 
+#ifdef FLAT_FILE_HAS_MMAP
+  const flat_file::mmap_database<PwType> input_db(cli.input_filename,
+                                                  flat_file::access_hint::sequential);
+#else
   flat_file::database<PwType> input_db(cli.input_filename, (1U << 16U) / sizeof(PwType));
+#endif
 
   if (input_db.number_records() <= cli.topn) {
     throw std::runtime_error(
         fmt::format("size of input db ({}) <= topn ({}). Output would be identical. Aborting.",
                     input_db.number_records(), cli.topn));
   }
-  std::vector<PwType> memdb(cli.topn);
 
   std::cout << fmt::format("{:50}", "Read db from disk and topN sort by count desc ...");
 
@@ -97,14 +197,7 @@ void build_topn(const cli_config_t& cli) {
   using fsecs = std::chrono::duration<double>;
   auto start  = clk::now();
 
-  // TopN sort descending by count (par_unseq makes no sense, as disk bound and flat_file not
-  // thread safe)
-  std::partial_sort_copy(input_db.begin(), input_db.end(), memdb.begin(), memdb.end(),
-                         [](auto& a, auto& b) {
-                           if (a.count == b.count)
-                             return a < b; // fall back to hash asc for stability
-                           return a.count > b.count;
-                         });
+  std::vector<PwType> memdb = parallel_topn<PwType>(input_db, cli.topn, cli.threads);
 
   std::cout << fmt::format("{:>8.3}\n", duration_cast<fsecs>(clk::now() - start));
 
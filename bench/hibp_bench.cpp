@@ -0,0 +1,432 @@
+#include "arrcmp.hpp"
+#include "binfuse/sharded_filter.hpp"
+#include "digest.hpp"
+#include "flat_file.hpp"
+#include "hibp.hpp"
+#include "toc.hpp"
+#include <algorithm>
+#include <array>
+#include <benchmark/benchmark.h>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fmt/format.h>
+#include <fstream>
+#include <random>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+#if __has_include(<fcntl.h>)
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+// Microbenchmarks of the hot kernels, over a synthetic, sorted db of random hashes. Use the google
+// benchmark options for machine readable results, eg:
+//
+//   hibp-bench --benchmark_format=json --benchmark_out=results.json
+//
+// `--records=N` sets the size of the synthetic dbs (default 4M), which are written to
+// `--dir=DIR` (default: the system temp directory). Searches are run with the page cache both warm
+// and, where the OS allows it to be dropped, cold.
+
+namespace {
+
+std::size_t           records = 1UL << 22U; // NOLINT non-const global
+std::filesystem::path bench_dir;            // NOLINT non-const global
+
+constexpr unsigned toc_bits    = 16;
+constexpr unsigned pla_epsilon = 64;
+
+template <hibp::pw_type PwType>
+std::filesystem::path db_path() {
+  return bench_dir / fmt::format("hibp_bench.{}.{}.bin", PwType::hash_size, records);
+}
+
+// random records, sorted, with counts which are skewed towards 1
+template <hibp::pw_type PwType>
+std::vector<PwType> make_records(std::size_t count, std::uint64_t seed) {
+  std::mt19937_64                           gen{seed};
+  std::geometric_distribution<std::int32_t> counts(0.3);
+
+  std::vector<PwType> recs(count);
+  for (auto& rec: recs) {
+    for (std::size_t i = 0; i < PwType::hash_size; i += sizeof(std::uint64_t)) {
+      const std::uint64_t random = gen();
+      std::memcpy(rec.hash.data() + i, &random, std::min(sizeof(random), PwType::hash_size - i));
+    }
+    rec.count = counts(gen) + 1;
+  }
+  std::sort(recs.begin(), recs.end());
+  return recs;
+}
+
+// the synthetic db, written on first use, and the toc and pla for it
+template <hibp::pw_type PwType>
+const std::filesystem::path& synthetic_db() {
+  static const std::filesystem::path path = [] {
+    auto file = db_path<PwType>();
+    if (!std::filesystem::exists(file) ||
+        std::filesystem::file_size(file) != records * sizeof(PwType)) {
+      std::ofstream                    os(file, std::ios::binary);
+      flat_file::stream_writer<PwType> writer(os);
+      for (const auto& rec: make_records<PwType>(records, 42)) writer.write(rec);
+    }
+    hibp::toc_build<PwType>(file, toc_bits);
+    hibp::pla_build<PwType>(file, pla_epsilon);
+    return file;
+  }();
+  return path;
+}
+
+// needles from the db, and random ones which are (almost certainly) not, alternately
+template <hibp::pw_type PwType>
+const std::vector<PwType>& needles() {
+  static const std::vector<PwType> all = [] {
+    constexpr std::size_t count = 1UL << 14U;
+
+    flat_file::database<PwType> db(synthetic_db<PwType>());
+    std::mt19937_64             gen{7};
+    std::vector<PwType>         result;
+    const auto                  misses = make_records<PwType>(count / 2, 99);
+    for (std::size_t i = 0; i != count / 2; ++i) {
+      result.push_back(db.get_record(gen() % db.number_records()));
+      result.push_back(misses[i]);
+    }
+    return result;
+  }();
+  return all;
+}
+
+// drops the db from the page cache, if the OS supports it
+bool drop_cache(const std::filesystem::path& path) {
+#if defined(POSIX_FADV_DONTNEED)
+  const int fd = ::open(path.c_str(), O_RDONLY); // NOLINT vararg
+  if (fd == -1) return false;
+  const bool ok = ::posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED) == 0;
+  ::close(fd);
+  return ok;
+#else
+  static_cast<void>(path);
+  return false;
+#endif
+}
+
+// ---- pawned_pw ----
+
+template <hibp::pw_type PwType>
+void BM_pawned_pw_from_text(benchmark::State& state) {
+  std::vector<std::string> lines;
+  for (const auto& rec: make_records<PwType>(1024, 1)) lines.push_back(rec.to_string());
+  std::size_t i = 0;
+  for (auto _: state) {
+    benchmark::DoNotOptimize(PwType{lines[i++ % lines.size()]});
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+template <hibp::pw_type PwType>
+void BM_pawned_pw_to_string(benchmark::State& state) {
+  const auto  recs = make_records<PwType>(1024, 1);
+  std::size_t i    = 0;
+  for (auto _: state) {
+    benchmark::DoNotOptimize(recs[i++ % recs.size()].to_string());
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+// ---- arrcmp ----
+
+// the vector width of array_compare is chosen at compile time, see the "arrcmp_maxvec" context
+template <std::size_t N, typename Comp>
+void BM_array_compare(benchmark::State& state) {
+  // equal leading bytes, so the whole width is compared
+  std::vector<std::array<std::byte, N>> arrs(1024);
+  std::mt19937_64                       gen{3};
+  for (auto& arr: arrs) arr[N - 1] = static_cast<std::byte>(gen());
+  std::size_t i = 0;
+  for (auto _: state) {
+    const auto& a = arrs[i % arrs.size()];
+    const auto& b = arrs[(i + 1) % arrs.size()];
+    benchmark::DoNotOptimize(arrcmp::array_compare(a, b, Comp{}));
+    ++i;
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+// the block search kernels are chosen at runtime, so each available one is measured
+template <arrcmp::isa Kernel>
+void BM_block_lower_bound(benchmark::State& state) {
+  using PwType = hibp::pawned_pw_sha1;
+  if (Kernel > arrcmp::best_isa()) {
+    state.SkipWithError("not supported by this cpu");
+    return;
+  }
+  const auto  recs = make_records<PwType>(static_cast<std::size_t>(state.range(0)), 5);
+  const auto& ndls = needles<PwType>();
+  const auto* data = reinterpret_cast<const std::byte*>(recs.data()); // NOLINT reincast
+  std::size_t i    = 0;
+  for (auto _: state) {
+    benchmark::DoNotOptimize(arrcmp::block_lower_bound<PwType::hash_size, sizeof(PwType)>(
+        data, recs.size(), ndls[i++ % ndls.size()].hash.data(), Kernel));
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+// ---- db searches ----
+
+enum class lookup_index { none, toc, pla, hot };
+enum class cache_state { warm, cold };
+
+template <lookup_index Index, hibp::pw_type PwType>
+bool find(flat_file::database<PwType>& db, const flat_file::hot_index<PwType>& hot,
+          const PwType& needle) {
+  if constexpr (Index == lookup_index::toc) {
+    return hibp::toc_search(db, needle, toc_bits).has_value();
+  } else if constexpr (Index == lookup_index::pla) {
+    return hibp::pla_search(db, needle).has_value();
+  } else {
+    auto first = db.begin();
+    auto last  = db.end();
+    if constexpr (Index == lookup_index::hot) {
+      const auto [lo, hi] = hot.range(needle);
+      last                = first + hi;
+      first += lo;
+    }
+    auto iter = std::lower_bound(first, last, needle);
+    return iter != last && *iter == needle;
+  }
+}
+
+// a single lookup through a buffered db, as by hibp-search and hibp-server without `--mmap`
+template <lookup_index Index, cache_state Cache>
+void BM_db_search(benchmark::State& state) {
+  using PwType     = hibp::pawned_pw_sha1;
+  const auto& path = synthetic_db<PwType>();
+  const auto& ndls = needles<PwType>();
+
+  flat_file::database<PwType>  db(path, 4096 / sizeof(PwType));
+  flat_file::hot_index<PwType> hot;
+  if constexpr (Index == lookup_index::hot) hot = flat_file::hot_index<PwType>(db, 1UL << 20U);
+
+  std::size_t i = 0;
+  for (auto _: state) {
+    if constexpr (Cache == cache_state::cold) {
+      state.PauseTiming();
+      if (!drop_cache(path)) {
+        state.SkipWithError("cannot drop the page cache on this OS");
+        break;
+      }
+      db = flat_file::database<PwType>(path, 4096 / sizeof(PwType)); // no stale buffer either
+      state.ResumeTiming();
+    }
+    benchmark::DoNotOptimize(find<Index>(db, hot, ndls[i++ % ndls.size()]));
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+#ifdef FLAT_FILE_HAS_MMAP
+// a single lookup through a warm memory mapping, as by hibp-server --mmap
+void BM_mmap_search(benchmark::State& state) {
+  using PwType = hibp::pawned_pw_sha1;
+  const flat_file::mmap_database<PwType> db(synthetic_db<PwType>(), flat_file::access_hint::random);
+  const auto&                            ndls = needles<PwType>();
+  db.prefault();
+
+  std::size_t i = 0;
+  for (auto _: state) {
+    const auto& needle = ndls[i++ % ndls.size()];
+    auto        iter   = hibp::lower_bound(db.begin(), db.end(), needle);
+    benchmark::DoNotOptimize(iter != db.end() && *iter == needle);
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+#endif
+
+// ---- filters ----
+
+// `Bits` per key, ie binfuse8 or binfuse16
+template <unsigned Bits>
+void BM_filter_contains(benchmark::State& state) {
+  using PwType = hibp::pawned_pw_sha1;
+  using Sink   = std::conditional_t<Bits == 8, binfuse::sharded_filter8_sink,
+                                    binfuse::sharded_filter16_sink>;
+  using Source = std::conditional_t<Bits == 8, binfuse::sharded_filter8_source,
+                                    binfuse::sharded_filter16_source>;
+
+  const auto& path        = synthetic_db<PwType>();
+  const auto  filter_path = bench_dir / fmt::format("hibp_bench.{}.binfuse{}", records, Bits);
+  if (!std::filesystem::exists(filter_path)) {
+    flat_file::database<PwType> db(path, (1U << 16U) / sizeof(PwType));
+    Sink                        sink(filter_path);
+    sink.stream_prepare();
+    for (const auto& rec: db) {
+      sink.stream_add(arrcmp::impl::bytearray_cast<std::uint64_t>(rec.hash.data()));
+    }
+    sink.stream_finalize();
+  }
+  const Source filter(filter_path);
+  const auto&  ndls = needles<PwType>();
+
+  std::size_t i = 0;
+  for (auto _: state) {
+    const auto& needle = ndls[i++ % ndls.size()];
+    benchmark::DoNotOptimize(
+        filter.contains(arrcmp::impl::bytearray_cast<std::uint64_t>(needle.hash.data())));
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+// ---- hashing ----
+
+std::vector<std::string> passwords() {
+  std::vector<std::string> pws;
+  for (std::size_t i = 0; i != 1024; ++i) pws.push_back(fmt::format("password{}", i * 7919));
+  return pws;
+}
+
+void BM_sha1(benchmark::State& state) {
+  const auto  pws = passwords();
+  std::size_t i   = 0;
+  for (auto _: state) {
+    benchmark::DoNotOptimize(hibp::digest::sha1(pws[i++ % pws.size()]));
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+void BM_sha1_scalar(benchmark::State& state) {
+  const auto  pws = passwords();
+  std::size_t i   = 0;
+  for (auto _: state) {
+    benchmark::DoNotOptimize(hibp::digest::sha1_scalar(pws[i++ % pws.size()]));
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+void BM_ntlm(benchmark::State& state) {
+  const auto  pws = passwords();
+  std::size_t i   = 0;
+  for (auto _: state) {
+    benchmark::DoNotOptimize(hibp::digest::ntlm(pws[i++ % pws.size()]));
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+// all the passwords per iteration, `lanes(Isa)` at a time
+template <typename Digest, hibp::digest::isa Isa>
+void BM_multi_buffer(benchmark::State& state) {
+  const auto                          pws = passwords();
+  const std::vector<std::string_view> texts(pws.begin(), pws.end());
+  std::vector<Digest>                 digests(texts.size());
+  if (Isa > hibp::digest::best_isa()) {
+    state.SkipWithError("not supported by this cpu");
+    return;
+  }
+  for (auto _: state) {
+    if constexpr (std::is_same_v<Digest, hibp::digest::ntlm_t>) {
+      hibp::digest::ntlm(texts, digests, Isa);
+    } else {
+      hibp::digest::sha1(texts, digests, Isa);
+    }
+    benchmark::DoNotOptimize(digests.data());
+  }
+  state.SetItemsProcessed(state.iterations() * static_cast<std::int64_t>(texts.size()));
+}
+
+// ---- writing ----
+
+template <hibp::pw_type PwType>
+void BM_stream_writer(benchmark::State& state) {
+  const auto recs = make_records<PwType>(1UL << 18U, 11);
+  const auto path = bench_dir / "hibp_bench.stream_writer.bin";
+  for (auto _: state) {
+    std::ofstream                    os(path, std::ios::binary);
+    flat_file::stream_writer<PwType> writer(os);
+    for (const auto& rec: recs) writer.write(rec);
+    writer.flush();
+  }
+  std::filesystem::remove(path);
+  const auto items = static_cast<std::int64_t>(recs.size());
+  state.SetBytesProcessed(state.iterations() * items * static_cast<std::int64_t>(sizeof(PwType)));
+  state.SetItemsProcessed(state.iterations() * items);
+}
+
+} // namespace
+
+BENCHMARK(BM_pawned_pw_from_text<hibp::pawned_pw_sha1>);
+BENCHMARK(BM_pawned_pw_from_text<hibp::pawned_pw_ntlm>);
+BENCHMARK(BM_pawned_pw_from_text<hibp::pawned_pw_sha1t64>);
+BENCHMARK(BM_pawned_pw_to_string<hibp::pawned_pw_sha1>);
+BENCHMARK(BM_pawned_pw_to_string<hibp::pawned_pw_ntlm>);
+BENCHMARK(BM_pawned_pw_to_string<hibp::pawned_pw_sha1t64>);
+
+BENCHMARK(BM_array_compare<8, arrcmp::three_way>);
+BENCHMARK(BM_array_compare<16, arrcmp::three_way>);
+BENCHMARK(BM_array_compare<20, arrcmp::three_way>);
+BENCHMARK(BM_array_compare<8, arrcmp::equal>);
+BENCHMARK(BM_array_compare<16, arrcmp::equal>);
+BENCHMARK(BM_array_compare<20, arrcmp::equal>);
+
+BENCHMARK(BM_block_lower_bound<arrcmp::isa::scalar>)->Arg(32)->Arg(1024)->Arg(1UL << 20U);
+BENCHMARK(BM_block_lower_bound<arrcmp::isa::avx2>)->Arg(32)->Arg(1024)->Arg(1UL << 20U);
+BENCHMARK(BM_block_lower_bound<arrcmp::isa::avx512>)->Arg(32)->Arg(1024)->Arg(1UL << 20U);
+
+BENCHMARK(BM_db_search<lookup_index::none, cache_state::warm>);
+BENCHMARK(BM_db_search<lookup_index::toc, cache_state::warm>);
+BENCHMARK(BM_db_search<lookup_index::pla, cache_state::warm>);
+BENCHMARK(BM_db_search<lookup_index::hot, cache_state::warm>);
+BENCHMARK(BM_db_search<lookup_index::none, cache_state::cold>)->Iterations(200);
+BENCHMARK(BM_db_search<lookup_index::toc, cache_state::cold>)->Iterations(200);
+BENCHMARK(BM_db_search<lookup_index::pla, cache_state::cold>)->Iterations(200);
+BENCHMARK(BM_db_search<lookup_index::hot, cache_state::cold>)->Iterations(200);
+#ifdef FLAT_FILE_HAS_MMAP
+BENCHMARK(BM_mmap_search);
+#endif
+
+BENCHMARK(BM_filter_contains<8>);
+BENCHMARK(BM_filter_contains<16>);
+
+BENCHMARK(BM_sha1);
+BENCHMARK(BM_sha1_scalar);
+BENCHMARK(BM_ntlm);
+BENCHMARK(BM_multi_buffer<hibp::digest::sha1_t, hibp::digest::isa::avx2>);
+BENCHMARK(BM_multi_buffer<hibp::digest::sha1_t, hibp::digest::isa::avx512>);
+BENCHMARK(BM_multi_buffer<hibp::digest::ntlm_t, hibp::digest::isa::avx2>);
+BENCHMARK(BM_multi_buffer<hibp::digest::ntlm_t, hibp::digest::isa::avx512>);
+
+BENCHMARK(BM_stream_writer<hibp::pawned_pw_sha1>);
+BENCHMARK(BM_stream_writer<hibp::pawned_pw_sha1t64>);
+
+int main(int argc, char** argv) {
+  // our own options, which google benchmark would reject
+  bench_dir = std::filesystem::temp_directory_path();
+  int kept  = 1;
+  for (int i = 1; i != argc; ++i) {
+    const std::string_view arg = argv[i]; // NOLINT pointer arithmetic
+    if (arg.starts_with("--records=")) {
+      records = std::stoul(std::string(arg.substr(10)));
+    } else if (arg.starts_with("--dir=")) {
+      bench_dir = arg.substr(6);
+    } else {
+      argv[kept++] = argv[i]; // NOLINT pointer arithmetic
+    }
+  }
+  argc = kept;
+
+  benchmark::Initialize(&argc, argv);
+  if (benchmark::ReportUnrecognizedArguments(argc, argv)) return EXIT_FAILURE;
+
+  benchmark::AddCustomContext("records", std::to_string(records));
+  benchmark::AddCustomContext("arrcmp_maxvec", std::to_string(arrcmp::impl::maxvec));
+  benchmark::AddCustomContext("best_isa", arrcmp::best_isa() == arrcmp::isa::avx512 ? "avx512"
+                                          : arrcmp::best_isa() == arrcmp::isa::avx2 ? "avx2"
+                                                                                    : "scalar");
+  benchmark::AddCustomContext("sha_ni", hibp::digest::has_sha_ni() ? "yes" : "no");
+  benchmark::RunSpecifiedBenchmarks();
+  benchmark::Shutdown();
+  return EXIT_SUCCESS;
+}
@@ -6,8 +6,10 @@
 #include <concepts>
 #include <cstddef>
 #include <cstdint>
+#include <cstring>
 #include <emmintrin.h>
 #include <immintrin.h>
+#include <limits>
 #include <type_traits>
 
 namespace arrcmp {
@@ -260,4 +262,138 @@ constexpr typename Comp::return_t array_compare(const std::array<std::byte, N>&
   return array_compare<N>(a.data(), b.data(), comp);
 }
 
+// Block search: lower_bound over `count` sorted, fixed width records, `Stride` bytes apart, which
+// each start with a big-endian key of `KeyBytes` bytes (eg a hash). Bisects on the leading 8 key
+// bytes down to a small block, which is then scanned with the widest vector compare the running
+// cpu supports (AVX-512, AVX2 or scalar), all chosen at runtime so one binary runs everywhere.
+// Full key compares are only needed to resolve ties of the leading 8 bytes.
+
+enum class isa { scalar, avx2, avx512 };
+
+inline isa best_isa() noexcept {
+  static const isa best = [] {
+#if defined(__GNUC__) || defined(__clang__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw")) return isa::avx512;
+    if (__builtin_cpu_supports("avx2")) return isa::avx2;
+#endif
+    return isa::scalar;
+  }();
+  return best;
+}
+
+namespace impl {
+
+// records per vector scanned block, beyond which we bisect
+static constexpr std::size_t block_records = 32;
+
+inline std::uint64_t key_prefix(const std::byte* record) noexcept {
+  std::uint64_t prefix = 0;
+  std::memcpy(&prefix, record, sizeof(prefix)); // records are not necessarily 8 byte aligned
+  if constexpr (std::endian::native == std::endian::little) prefix = byteswap(prefix);
+  return prefix;
+}
+
+// number of leading records in the block whose 8 byte key prefix is < `prefix`
+template <std::size_t Stride>
+std::size_t count_less_scalar(const std::byte* first, std::size_t count,
+                              std::uint64_t prefix) noexcept {
+  std::size_t idx = 0;
+  while (idx != count && key_prefix(first + idx * Stride) < prefix) ++idx;
+  return idx;
+}
+
+#if defined(__GNUC__) || defined(__clang__)
+
+template <std::size_t Stride>
+__attribute__((target("avx2"))) std::size_t
+count_less_avx2(const std::byte* first, std::size_t count, std::uint64_t prefix) noexcept {
+  constexpr auto stride = static_cast<long long>(Stride);
+  const auto     offsets = _mm256_setr_epi64x(0, stride, 2 * stride, 3 * stride);
+  // reverses the bytes of each 64bit lane, ie big-endian => native
+  const auto bswap = _mm256_setr_epi8(7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5,
+                                      4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8);
+  // AVX2 only has signed 64bit compares, so flip the sign bits
+  const auto sign    = _mm256_set1_epi64x(std::numeric_limits<long long>::min());
+  const auto needles = _mm256_xor_si256(_mm256_set1_epi64x(static_cast<long long>(prefix)), sign);
+
+  std::size_t idx = 0;
+  for (; idx + 4 <= count; idx += 4) {
+    const auto* base = reinterpret_cast<const long long*>(first + idx * Stride); // NOLINT reincast
+    auto        keys = _mm256_i64gather_epi64(base, offsets, 1);
+    keys             = _mm256_xor_si256(_mm256_shuffle_epi8(keys, bswap), sign);
+    const auto less  = static_cast<unsigned>(
+        _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(needles, keys))));
+    if (less != 0xFU) return idx + static_cast<std::size_t>(std::countr_one(less));
+  }
+  return idx + count_less_scalar<Stride>(first + idx * Stride, count - idx, prefix);
+}
+
+template <std::size_t Stride>
+__attribute__((target("avx512f,avx512bw"))) std::size_t
+count_less_avx512(const std::byte* first, std::size_t count, std::uint64_t prefix) noexcept {
+  constexpr auto stride  = static_cast<long long>(Stride);
+  const auto     offsets = _mm512_setr_epi64(0, stride, 2 * stride, 3 * stride, 4 * stride,
+                                             5 * stride, 6 * stride, 7 * stride);
+  // reverses the bytes of each 64bit lane, ie big-endian => native
+  const auto bswap =
+      _mm512_set4_epi32(0x08090a0b, 0x0c0d0e0f, 0x00010203, 0x04050607); // per 128bit lane
+  const auto needles = _mm512_set1_epi64(static_cast<long long>(prefix));
+
+  std::size_t idx = 0;
+  for (; idx + 8 <= count; idx += 8) {
+    const auto* base = first + idx * Stride;
+    // masked, with a zeroed source, as the unmasked gather's source is "maybe uninitialized"
+    const auto gathered =
+        _mm512_mask_i64gather_epi64(_mm512_setzero_si512(), 0xFF, offsets, base, 1);
+    const auto keys = _mm512_shuffle_epi8(gathered, bswap);
+    const auto less = static_cast<unsigned>(_mm512_cmplt_epu64_mask(keys, needles));
+    if (less != 0xFFU) return idx + static_cast<std::size_t>(std::countr_one(less));
+  }
+  return idx + count_less_scalar<Stride>(first + idx * Stride, count - idx, prefix);
+}
+
+#endif
+
+template <std::size_t Stride>
+std::size_t count_less(isa kernel, const std::byte* first, std::size_t count,
+                       std::uint64_t prefix) noexcept {
+#if defined(__GNUC__) || defined(__clang__)
+  if (kernel == isa::avx512) return count_less_avx512<Stride>(first, count, prefix);
+  if (kernel == isa::avx2) return count_less_avx2<Stride>(first, count, prefix);
+#endif
+  return count_less_scalar<Stride>(first, count, prefix);
+}
+
+} // namespace impl
+
+// returns the index of the first record whose key is not less than `needle`'s key
+template <std::size_t KeyBytes, std::size_t Stride>
+std::size_t block_lower_bound(const std::byte* first, std::size_t count, const std::byte* needle,
+                              isa kernel = best_isa()) noexcept {
+  static_assert(KeyBytes >= sizeof(std::uint64_t) && KeyBytes <= Stride);
+
+  const std::uint64_t prefix = impl::key_prefix(needle);
+  const auto          less   = [&](std::size_t idx) {
+    const std::byte*    record = first + idx * Stride;
+    const std::uint64_t key    = impl::key_prefix(record);
+    if (key != prefix) return key < prefix;
+    return array_compare<KeyBytes>(record, needle, three_way{}) < 0; // rare tie
+  };
+
+  std::size_t lo = 0;
+  while (count > impl::block_records) {
+    const std::size_t half = count / 2;
+    if (less(lo + half)) {
+      lo += half + 1;
+      count -= half + 1;
+    } else {
+      count = half;
+    }
+  }
+  std::size_t idx = lo + impl::count_less<Stride>(kernel, first + lo * Stride, count, prefix);
+  while (idx != lo + count && less(idx)) ++idx; // resolve ties of the leading 8 bytes
+  return idx;
+}
+
 } // namespace arrcmp
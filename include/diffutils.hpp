@@ -1,12 +1,24 @@
 #include "hibp.hpp"
+#include <cstddef>
 #include <cstdlib>
 #include <filesystem>
+#include <istream>
 #include <ostream>
 
 namespace hibp::diffutils {
 
+// Writes the changes from OLD to NEW as "U:POS:HASH:COUNT" (updated count) and "I:POS:HASH:COUNT"
+// (inserted before the record at POS) hunks, where POS is the position in OLD, as 8 hex digits.
+// The dbs are split into chapters by hash prefix, which are diffed on `threads` threads (0 => one
+// per core) and output in order.
 template <hibp::pw_type PwType>
 void run_diff(const std::filesystem::path& old_path, const std::filesystem::path& new_path,
-              std::ostream& diff);
+              std::ostream& diff, unsigned threads = 0);
+
+// Applies the hunks from `diff` to OLD, writing NEW to `new_db` in one sequential merge pass.
+// Returns the number of hunks applied.
+template <hibp::pw_type PwType>
+std::size_t run_patch(const std::filesystem::path& old_path, std::istream& diff,
+                      std::ostream& new_db);
 
 } // namespace hibp::diffutils
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <span>
+#include <string_view>
+
+// SHA1 and NTLM digests of plain text passwords, returned in binary, ready for a `pawned_pw`.
+//
+// One password at a time uses SHA-NI for SHA1, when the cpu has it. Many passwords at a time are
+// hashed 8 (AVX2) or 16 (AVX-512) in parallel, one per vector lane, which is where most of the
+// speed is: passwords are short, so each is a single 64 byte block. Longer ones drop out of the
+// lanes and are hashed one at a time. All chosen at runtime, so one binary runs everywhere.
+//
+// NTLM is MD4 of the UTF-16LE encoding of the password. The UTF-8 input is converted on the fly,
+// without allocating, and invalid UTF-8 throws std::range_error.
+
+namespace hibp::digest {
+
+using sha1_t = std::array<std::byte, 20>;
+using ntlm_t = std::array<std::byte, 16>;
+
+enum class isa { scalar, avx2, avx512 };
+
+inline isa best_isa() noexcept {
+  static const isa best = [] {
+#if defined(__GNUC__) || defined(__clang__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) return isa::avx512;
+    if (__builtin_cpu_supports("avx2")) return isa::avx2;
+#endif
+    return isa::scalar;
+  }();
+  return best;
+}
+
+// the number of passwords hashed in parallel
+constexpr std::size_t lanes(isa kernel) noexcept {
+  return kernel == isa::avx512 ? 16 : kernel == isa::avx2 ? 8 : 1;
+}
+
+bool has_sha_ni() noexcept;
+
+sha1_t sha1(std::string_view text);
+ntlm_t ntlm(std::string_view password);
+
+// without SHA-NI, eg for testing
+sha1_t sha1_scalar(std::string_view text);
+
+// multi-buffer: digests[i] = sha1(texts[i]). The spans must be the same size.
+void sha1(std::span<const std::string_view> texts, std::span<sha1_t> digests,
+          isa kernel = best_isa());
+
+// multi-buffer: digests[i] = ntlm(passwords[i]). The spans must be the same size.
+void ntlm(std::span<const std::string_view> passwords, std::span<ntlm_t> digests,
+          isa kernel = best_isa());
+
+} // namespace hibp::digest
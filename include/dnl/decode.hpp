@@ -0,0 +1,20 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace hibp::dnl {
+
+// compressed transfers: the server's encoding is undone by the parser threads, not by curl in the
+// requests threads
+
+// the "Accept-Encoding" we can undo, best first
+std::string accept_encoding();
+
+// replaces the `buffer`, as received with the `encoding` of the "Content-Encoding" header, with the
+// decoded body. "deflate" may be zlib wrapped, or raw. Throws for an unsupported encoding, or a
+// corrupt or truncated body.
+void decode(std::string_view encoding, std::vector<char>& buffer);
+
+} // namespace hibp::dnl
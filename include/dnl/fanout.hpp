@@ -0,0 +1,60 @@
+#pragma once
+
+#include "hibp.hpp"
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace hibp::dnl {
+
+// --out-*: one download of the sha1 records, written to several outputs
+
+// a parsed block of sha1 records, shared by all the sinks
+using shared_block = std::shared_ptr<const std::vector<char>>;
+
+// One output, eg a binary db or a filter, written on its own thread from a bounded queue of
+// blocks, so a slower output only holds up the others once its queue is full.
+class sink {
+public:
+  using write_fn_t    = std::function<void(std::span<const pawned_pw_sha1> records)>;
+  using finalize_fn_t = std::function<void()>;
+
+  static constexpr std::size_t queue_capacity = 256; // blocks, ie prefix files
+
+  sink(std::string name, write_fn_t write_fn, finalize_fn_t finalize_fn);
+
+  sink(const sink& other)            = delete;
+  sink& operator=(const sink& other) = delete;
+  sink(sink&& other)                 = delete;
+  sink& operator=(sink&& other)      = delete;
+  ~sink()                            = default; // without finalizing, after an error
+
+  // blocks while the queue is full. Rethrows any exception from the sink's thread.
+  void push(shared_block block);
+
+  // writes the rest of the queue, finalizes the output and rethrows any exception
+  void finish();
+
+private:
+  void run(const std::stop_token& stoken);
+
+  std::string                 name_;
+  write_fn_t                  write_fn_;
+  finalize_fn_t               finalize_fn_;
+  std::mutex                  mutex_;
+  std::condition_variable_any cv_; // _any for stop_token
+  std::deque<shared_block>    queue_;
+  bool                        closed_ = false;
+  std::exception_ptr          exception_;
+  std::jthread                thread_; // last, so started after, and stopped before, the rest
+};
+
+} // namespace hibp::dnl
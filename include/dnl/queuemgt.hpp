@@ -1,28 +1,102 @@
 #pragma once
 
+#include "hibp.hpp"
+#include <algorithm>
+#include <array>
+#include <charconv>
 #include <cstddef>
+#include <cstring>
+#include <fmt/format.h>
 #include <functional>
-#include <iostream>
+#include <span>
+#include <stdexcept>
 #include <string>
+#include <string_view>
+#include <vector>
 
 namespace hibp::dnl {
 
-// alternative simple text writer
+// Each downloaded file is converted into a "block" of output bytes by a pool of parser threads, in
+// any order. A single writer thread then receives the blocks in index order.
 
-struct text_writer {
-  explicit text_writer(std::ostream& os) : os_(os) {}
-  void write(const std::string& line) {
-    os_.write(line.c_str(), static_cast<std::streamsize>(line.length()));
-    os_.write("\n", 1);
+// prefer use of std::function (ie stdlib type erasure) rather than templates to keep .hpp interface
+// clean
+
+// Appends the converted records of the file for `prefix` to `block` and returns how many there
+// were. Called concurrently from all parser threads.
+using parse_fn_t = std::function<std::size_t(std::string_view prefix, std::string_view body,
+                                             std::vector<char>& block)>;
+
+struct download;
+
+// Called with each parsed download, in index order, on a single thread. It may take the `block`.
+using write_fn_t = std::function<void(download& dl)>;
+
+// `known_etags` (by index), from an earlier download, make conditional requests for --update.
+// Unchanged downloads are then passed to `write_fn` with `unchanged` set and nothing to parse.
+void run(parse_fn_t parse_fn, write_fn_t write_fn, std::size_t start_index_, bool testing,
+         const std::vector<std::string>& known_etags = {});
+
+// calls `fn` with each non-empty line of the body, without any trailing '\r'
+template <typename Fn>
+std::size_t for_each_line(std::string_view body, Fn fn) {
+  std::size_t count = 0;
+  while (!body.empty()) {
+    auto eol  = body.find('\n');
+    auto line = body.substr(0, eol);
+    body.remove_prefix(eol == std::string_view::npos ? body.size() : eol + 1);
+    while (!line.empty() && line.back() == '\r') line.remove_suffix(1);
+    if (!line.empty()) {
+      fn(line);
+      ++count;
+    }
   }
+  return count;
+}
 
-private:
-  std::ostream& os_; // NOLINT reference
-};
+// "PREFIXSUFFIX:COUNT\n" lines, for --txt-out
+inline std::size_t parse_text(std::string_view prefix, std::string_view body,
+                              std::vector<char>& block) {
+  block.reserve(block.size() + body.size() + body.size() / 8); // room for the prefixes
+  return for_each_line(body, [&](std::string_view line) {
+    block.insert(block.end(), prefix.begin(), prefix.end());
+    block.insert(block.end(), line.begin(), line.end());
+    block.push_back('\n');
+  });
+}
 
-// prefer use of std::function (ie stdlib type erasure) rather than templates to keep .hpp interface
-// clean
-using write_fn_t = std::function<void(const std::string&)>;
-void run(write_fn_t write_fn, std::size_t start_index_, bool testing);
+// Binary records, built directly from the "SUFFIX:COUNT" lines, without any intermediate strings.
+// For sha1t64 the sha1 suffixes are truncated.
+template <pw_type PwType>
+std::size_t parse_binary(std::string_view prefix, std::string_view body, std::vector<char>& block) {
+  constexpr std::size_t suffix_chars = PwType::suffix_str_size;
+
+  const auto max_lines = static_cast<std::size_t>(std::count(body.begin(), body.end(), '\n')) + 1;
+  block.reserve(block.size() + max_lines * sizeof(PwType));
+  return for_each_line(body, [&](std::string_view line) {
+    const auto colon = line.find(':');
+    if (prefix.size() != PwType::prefix_str_size || colon == std::string_view::npos ||
+        colon < suffix_chars) {
+      throw std::runtime_error(
+          fmt::format("Malformed line in download of prefix {}: '{}'", prefix, line));
+    }
+    std::array<char, PwType::hash_str_size> hex; // NOLINT initialisation
+    std::memcpy(hex.data(), prefix.data(), PwType::prefix_str_size);
+    std::memcpy(hex.data() + PwType::prefix_str_size, line.data(), suffix_chars);
+
+    PwType pw{hex.data(), -1};
+    std::from_chars(line.data() + colon + 1, line.data() + line.size(), pw.count);
+
+    const auto* bytes = reinterpret_cast<const char*>(&pw); // NOLINT reinterpret_cast
+    block.insert(block.end(), bytes, bytes + sizeof(PwType));
+  });
+}
+
+// the records of a block made by parse_binary
+template <pw_type PwType>
+std::span<const PwType> block_records(const std::vector<char>& block) {
+  return {reinterpret_cast<const PwType*>(block.data()), // NOLINT reinterpret_cast
+          block.size() / sizeof(PwType)};
+}
 
 } // namespace hibp::dnl
@@ -3,11 +3,14 @@
 #include <cstddef>
 #include <stop_token>
 #include <string>
+#include <vector>
 
 namespace hibp::dnl {
 
 void init_curl_and_events();
-void run_event_loop(std::size_t start_index, bool testing_, std::stop_token stoken);
+// `known_etags` (by index) make conditional requests, for --update
+void run_event_loop(std::size_t start_index, bool testing_,
+                    const std::vector<std::string>& known_etags, std::stop_token stoken);
 void shutdown_curl_and_events();
 void curl_and_event_cleanup();
 
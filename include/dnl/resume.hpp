@@ -2,11 +2,75 @@
 
 #include "hibp.hpp"
 #include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <optional>
 #include <string>
 
 namespace hibp::dnl {
 
+// utilities for --resume
+
+// The slow fallback, for dbs without a journal: re-downloads the last prefix file and searches the
+// db for where it started
 template <pw_type PwType>
 std::size_t get_last_prefix(const std::string& filename, bool testing);
 
+// "<db_filename>.journal": checkpoints of how much of the output was complete, and durably so, as
+// the download progressed, so --resume can continue from the last one immediately
+std::filesystem::path journal_filename(const std::filesystem::path& db_filename);
+
+struct checkpoint {
+  std::uint64_t next_index = 0; // all prefix files before this one are in the output
+  std::uint64_t offset     = 0; // the size of the output up to there
+  std::uint64_t check      = 0; // detects a torn write of the last checkpoint
+
+  [[nodiscard]] bool valid() const;
+};
+
+// The last intact checkpoint of the db's journal, if it has one
+std::optional<checkpoint> last_checkpoint(const std::filesystem::path& db_filename);
+
+// Trims the db back to its last checkpoint, and returns the index to continue from, or nullopt if
+// there is no usable journal. `record_size` is 1 for text outputs.
+std::optional<std::size_t> resume_from_journal(const std::filesystem::path& db_filename,
+                                               std::size_t                  record_size);
+
+// Appends a checkpoint to the db's journal after every `batch` files, each only once `flush_fn` has
+// passed the output written so far to the OS, and the db has been fsync'd. The journal is then
+// fsync'd too, so a crash loses at most one batch.
+class journal {
+public:
+  using flush_fn_t = std::function<void()>;
+
+  // `offset` is the size of the db so far, ie non-zero when resuming
+  journal(std::filesystem::path db_filename, std::uint64_t offset, flush_fn_t flush_fn,
+          std::size_t batch = 256);
+
+  journal(const journal& other)            = delete;
+  journal& operator=(const journal& other) = delete;
+  journal(journal&& other)                 = delete;
+  journal& operator=(journal&& other)      = delete;
+  ~journal();
+
+  // the file with `index` has been written, adding `bytes` to the db
+  void add(std::size_t index, std::size_t bytes);
+
+  // writes a checkpoint now, if any files were added since the last, eg at the end
+  void commit();
+
+private:
+  std::filesystem::path db_filename_;
+  std::uint64_t         next_index_ = 0;
+  std::uint64_t         offset_;
+  flush_fn_t            flush_fn_;
+  std::size_t           batch_;
+  std::size_t           pending_ = 0; // files added since the last checkpoint
+  std::ofstream         stream_;
+  int                   db_fd_      = -1;
+  int                   journal_fd_ = -1;
+};
+
 } // namespace hibp::dnl
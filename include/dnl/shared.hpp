@@ -21,18 +21,28 @@ namespace hibp::dnl {
 
 struct cli_config_t {
   std::string output_db_filename;
-  bool        debug         = false;
-  bool        progress      = true;
-  bool        resume        = false;
-  bool        ntlm          = false;
-  bool        sha1t64       = false;
-  bool        txt_out       = false;
-  bool        binfuse8_out  = false;
-  bool        binfuse16_out = false;
-  bool        force         = false;
-  bool        testing       = false;
-  std::size_t index_limit   = 0x100000;
-  std::size_t parallel_max  = 300;
+  std::string out_sha1; // --out-*, instead of output_db_filename, from one download
+  std::string out_sha1t64;
+  std::string out_binfuse8;
+  std::string out_binfuse16;
+  bool        debug            = false;
+  bool        progress         = true;
+  bool        resume           = false;
+  bool        ntlm             = false;
+  bool        sha1t64          = false;
+  bool        txt_out          = false;
+  bool        binfuse8_out     = false;
+  bool        binfuse16_out    = false;
+  bool        force            = false;
+  bool        update           = false;
+  bool        testing          = false;
+  bool        toc              = false;
+  bool        packed           = false;
+  unsigned    toc_bits         = 20; // 1Mega chapters
+  std::size_t index_limit      = 0x100000;
+  std::size_t parallel_max     = 300; // per download thread
+  unsigned    download_threads = 1;
+  unsigned    parse_threads    = 0; // 0 => one per core
 };
 
 struct download {
@@ -41,6 +51,12 @@ struct download {
     buffer.reserve(1U << 16U); // 64kB should be enough for any file for a while
   }
 
+  download(const download& other)            = delete;
+  download& operator=(const download& other) = delete;
+  download(download&& other)                 = delete;
+  download& operator=(download&& other)      = delete;
+  ~download() { curl_slist_free_all(headers); }
+
   // used in priority_queue to keep items in order
   std::strong_ordering operator<=>(const download& rhs) const { return index <=> rhs.index; }
 
@@ -50,7 +66,15 @@ struct download {
   std::size_t       index;
   std::string       prefix;
   std::vector<char> buffer;
-  int               retries_left = max_retries;
+  std::vector<char> block; // buffer, after conversion by a parser thread
+  std::size_t       record_count = 0;
+  std::string       etag;                        // as returned by the server
+  std::string       content_encoding;            // of the buffer, until decoded by a parser
+  std::size_t       transfer_size = 0;           // of the buffer, as received
+  curl_slist*       headers       = nullptr;     // Accept-Encoding, and If-None-Match
+  bool              conditional   = false;       // If-None-Match was sent, for --update
+  bool              unchanged     = false;       // since the last download, for --update
+  int               retries_left  = max_retries;
 };
 
 // thread messaging API
@@ -0,0 +1,56 @@
+#pragma once
+
+#include "flat_file.hpp"
+#include "hibp.hpp"
+#include "toc.hpp"
+#include <cstddef>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+namespace hibp::dnl {
+
+// utilities for --update
+
+// "<db_filename>.etags": the ETag which the server returned for each prefix file, one
+// "PREFIX ETAG" line per file, so a later --update can make conditional requests
+std::filesystem::path etags_filename(const std::filesystem::path& db_filename);
+
+// empty strings for prefixes without a known ETag, or all, if there is no sidecar
+std::vector<std::string> load_etags(const std::filesystem::path& db_filename, std::size_t prefixes);
+
+void save_etags(const std::filesystem::path& db_filename, const std::vector<std::string>& etags);
+
+// The records of an existing db by prefix file, located with a 20 bit (ie one chapter per prefix
+// file) toc, so unchanged files can be copied from it with one large read each.
+template <pw_type PwType>
+class prefix_source {
+public:
+  static constexpr unsigned prefix_bits = 20;
+
+  explicit prefix_source(const std::filesystem::path& db_filename)
+      : db_(db_filename, (1U << 16U) / sizeof(PwType)) {
+    toc_build<PwType>(db_filename, prefix_bits);
+  }
+
+  // the records of the file with this prefix, valid until the next call
+  const std::vector<PwType>& records(std::size_t prefix) {
+    PwType needle;
+    needle.hash[0] = static_cast<std::byte>(prefix >> 12U);
+    needle.hash[1] = static_cast<std::byte>(prefix >> 4U);
+    needle.hash[2] = static_cast<std::byte>(prefix << 4U);
+
+    buf_.clear();
+    if (auto chapter = toc_chapter(needle, prefix_bits, db_.number_records())) {
+      buf_.resize(chapter->second - chapter->first);
+      db_.read(chapter->first, buf_.size(), buf_.data());
+    }
+    return buf_;
+  }
+
+private:
+  flat_file::database<PwType> db_;
+  std::vector<PwType>         buf_;
+};
+
+} // namespace hibp::dnl
@@ -1,6 +1,10 @@
 #pragma once
 
+#include "pipeline.hpp"
 #include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cerrno>
 #include <cstddef>
 #include <cstdint>
 #include <cstdlib>
@@ -13,15 +17,28 @@
 #include <fmt/std.h> // IWYU pragma: keep
 #include <fstream>
 #include <functional>
+#include <future>
 #include <ios>
 #include <iostream>
 #include <iterator>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <optional>
 #include <queue>
 #include <stdexcept>
 #include <string>
+#include <thread>
 #include <type_traits>
 #include <utility>
 #include <vector>
+#if __has_include(<sys/mman.h>)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#define FLAT_FILE_HAS_MMAP 1
+#endif
 
 namespace flat_file {
 
@@ -88,6 +105,68 @@ public:
   }
 };
 
+namespace impl {
+
+// random access iterator over any of the buffered database types, which are expected to provide
+// `get_record(pos)`
+template <typename DbType>
+struct record_iterator {
+  using iterator_category = std::random_access_iterator_tag;
+  using difference_type   = std::ptrdiff_t;
+  using value_type        = typename DbType::value_type;
+  using pointer           = const value_type*;
+  using reference         = const value_type&;
+
+  record_iterator(DbType& ffdb, std::size_t pos) : ffdb_(&ffdb), pos_(pos) {}
+
+  // clang-format off
+  reference operator*() const { return current(); }
+  pointer   operator->() const { current(); return cur_; }
+
+  bool operator==(const record_iterator& other) const { return ffdb_ == other.ffdb_ && pos_ == other.pos_; }
+  
+  record_iterator& operator++() { return *this += 1; }
+  record_iterator operator++(int) { record_iterator tmp = *this; ++(*this); return tmp; } // NOLINT why const?
+  record_iterator& operator--() { return *this -= 1; }
+  record_iterator operator--(int) { record_iterator tmp = *this; --(*this); return tmp; } // NOLINT why const?
+
+  record_iterator& operator+=(std::size_t offset) { set_pos(pos_ + offset); return *this; }
+  record_iterator& operator-=(std::size_t offset) { set_pos(pos_ - offset); return *this; }
+
+  friend record_iterator operator+(record_iterator iter, std::size_t offset) { return iter += offset; }
+  friend record_iterator operator+(std::size_t offset, record_iterator iter) { return iter += offset; }
+  friend record_iterator operator-(record_iterator iter, std::size_t offset) { return iter -= offset; }
+  friend difference_type operator-(const record_iterator& a, const record_iterator& b) {
+      return static_cast<difference_type>(a.pos_ - b.pos_);
+  }
+  // clang-format on
+
+  std::size_t           pos() { return pos_; }
+  std::filesystem::path filename() { return ffdb_->filename(); }
+
+private:
+  DbType*     ffdb_ = nullptr;
+  std::size_t pos_{};
+  // cur_ and cur_valid_ are mutable so that operator* can be const
+  mutable const value_type* cur_;
+  mutable bool              cur_valid_ = false;
+
+  void set_pos(std::size_t pos) {
+    pos_       = pos;
+    cur_valid_ = false;
+  }
+
+  reference current() const {
+    if (!cur_valid_) {
+      cur_       = &ffdb_->get_record(pos_);
+      cur_valid_ = true;
+    }
+    return *cur_;
+  }
+};
+
+} // namespace impl
+
 // CAUTION: flat_file::database ALWAYS INVALIDATES its iterators during move assignment.
 // This can be surprising as this is UNLIKE the STL containers.
 template <typename ValueType>
@@ -115,8 +194,8 @@ public:
     db_.exceptions(std::ios::badbit | std::ios::failbit); // throw on any future errors
   }
 
-  using value_type = ValueType;
-  struct const_iterator;
+  using value_type     = ValueType;
+  using const_iterator = impl::record_iterator<database>;
 
   const ValueType& get_record(std::size_t pos) {
     if (!(pos >= buf_start_ && pos < buf_end_)) { // NOLINT can be simplified
@@ -129,6 +208,7 @@ public:
 
       db_.read(reinterpret_cast<char*>(buf_.data()), // NOLINT reinterpret_cast
                static_cast<std::streamsize>(sizeof(ValueType) * nrecs));
+      ++reads_;
 
       buf_start_ = pos;
       buf_end_   = pos + nrecs;
@@ -136,6 +216,17 @@ public:
     return buf_[pos - buf_start_];
   }
 
+  // copies the `count` records from `pos` into `dest` with a single read, bypassing the buffer
+  void read(std::size_t pos, std::size_t count, ValueType* dest) {
+    if (pos + count > dbsize_) {
+      throw std::runtime_error("flat_file:read cannot return data beyond the end of the db");
+    }
+    db_.seekg(static_cast<std::streamoff>(pos * sizeof(ValueType)));
+    db_.read(reinterpret_cast<char*>(dest), // NOLINT reinterpret_cast
+             static_cast<std::streamsize>(sizeof(ValueType) * count));
+    ++reads_;
+  }
+
   const_iterator begin() { return {*this, 0}; }
   const_iterator end() { return {*this, dbsize_}; }
 
@@ -144,10 +235,19 @@ public:
   std::filesystem::path filename() const { return filename_; }
   std::size_t           filesize() const { return dbfsize_; }
   std::size_t           number_records() const { return dbsize_; }
+  std::size_t           reads() const { return reads_; } // from the file, ie buffer refills
 
   template <typename Comp = std::less<>, typename Proj = std::identity>
   std::string disksort(Comp comp = {}, Proj proj = {},
-                       std::size_t max_memory_usage = 1'000'000'000);
+                       std::size_t max_memory_usage = 1'000'000'000,
+                       const std::function<void(const ValueType&)>& on_write = {});
+
+  // see radix_disksort_range()
+  template <typename Radix, typename Comp = std::less<>>
+  std::string radix_disksort(Radix radix, Comp comp = {},
+                             std::size_t max_memory_usage = 1'000'000'000,
+                             const std::function<void(const ValueType&)>& on_write = {},
+                             unsigned threads = 0);
 
 private:
   std::filesystem::path  filename_;
@@ -156,70 +256,572 @@ private:
   std::ifstream          db_;
   std::size_t            buf_start_ = 0;
   std::size_t            buf_end_   = 0; // one past the end
+  std::size_t            reads_     = 0;
   std::vector<ValueType> buf_;
 };
 
+// hints passed on to the OS about the expected access pattern of a mapping
+enum class access_hint { normal, random, sequential, willneed };
+
+#ifdef FLAT_FILE_HAS_MMAP
+
+// A read-only, memory mapped alternative to flat_file::database.
+//
+// Records are returned by reference straight from the mapping, so there are no buffers, no
+// syscalls per read and no copying. It has no mutable state, so a single instance can be shared by
+// any number of threads. The const_iterator is a plain pointer.
 template <typename ValueType>
-struct database<ValueType>::const_iterator {
-  using iterator_category = std::random_access_iterator_tag;
-  using difference_type   = std::ptrdiff_t;
-  using value_type        = ValueType;
-  using pointer           = const ValueType*;
-  using reference         = const ValueType&;
+class mmap_database {
 
-  const_iterator(database<ValueType>& ffdb, std::size_t pos) : ffdb_(&ffdb), pos_(pos) {}
+  static_assert(std::is_trivially_copyable_v<ValueType>);
+  static_assert(std::is_standard_layout_v<ValueType>);
 
-  // clang-format off
-  reference operator*() const { return current(); }
-  pointer   operator->() const { current(); return cur_; }
+public:
+  using value_type     = ValueType;
+  using const_iterator = const ValueType*;
 
-  bool operator==(const const_iterator& other) const { return ffdb_ == other.ffdb_ && pos_ == other.pos_; }
-  
-  const_iterator& operator++() { return *this += 1; }
-  const_iterator operator++(int) { const_iterator tmp = *this; ++(*this); return tmp; } // NOLINT why const?
-  const_iterator& operator--() { return *this -= 1; }
-  const_iterator operator--(int) { const_iterator tmp = *this; --(*this); return tmp; } // NOLINT why const?
-
-  const_iterator& operator+=(std::size_t offset) { set_pos(pos_ + offset); return *this; }
-  const_iterator& operator-=(std::size_t offset) { set_pos(pos_ - offset); return *this; }
-
-  friend const_iterator operator+(const_iterator iter, std::size_t offset) { return iter += offset; }
-  friend const_iterator operator+(std::size_t offset, const_iterator iter) { return iter += offset; }
-  friend const_iterator operator-(const_iterator iter, std::size_t offset) { return iter -= offset; }
-  friend difference_type operator-(const const_iterator& a, const const_iterator& b) {
-      return static_cast<difference_type>(a.pos_ - b.pos_);
+  explicit mmap_database(std::filesystem::path filename, access_hint hint = access_hint::normal)
+      : filename_(std::move(filename)), dbfsize_(std::filesystem::file_size(filename_)) {
+
+    if (dbfsize_ % sizeof(ValueType) != 0)
+      throw std::ios::failure("db file size is not a multiple of the record size");
+
+    dbsize_ = static_cast<std::size_t>(dbfsize_ / sizeof(ValueType));
+    if (dbsize_ == 0) return; // can't map an empty file, but it's a valid (empty) db
+
+    const int fd = ::open(filename_.c_str(), O_RDONLY); // NOLINT vararg
+    if (fd == -1)
+      throw std::ios::failure(fmt::format("cannot open db: {}, because '{}'", filename_,
+                                          std::strerror(errno))); // NOLINT errno
+
+    void* addr = ::mmap(nullptr, dbfsize_, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd); // the mapping keeps its own reference to the file
+    if (addr == MAP_FAILED) // NOLINT cstyle cast in macro
+      throw std::ios::failure(fmt::format("cannot mmap db: {}, because '{}'", filename_,
+                                          std::strerror(errno))); // NOLINT errno
+
+    data_ = static_cast<const ValueType*>(addr);
+    advise(hint);
   }
-  // clang-format on
 
-  std::size_t           pos() { return pos_; }
-  std::filesystem::path filename() { return ffdb_->filename(); }
+  // a "unique manager" .. no copies, move-only
+  mmap_database(const mmap_database& other)            = delete;
+  mmap_database& operator=(const mmap_database& other) = delete;
+
+  mmap_database(mmap_database&& other) noexcept
+      : filename_(std::move(other.filename_)), dbfsize_(other.dbfsize_), dbsize_(other.dbsize_),
+        data_(std::exchange(other.data_, nullptr)) {}
+
+  mmap_database& operator=(mmap_database&& other) noexcept {
+    if (this != &other) {
+      unmap();
+      filename_ = std::move(other.filename_);
+      dbfsize_  = other.dbfsize_;
+      dbsize_   = other.dbsize_;
+      data_     = std::exchange(other.data_, nullptr);
+    }
+    return *this;
+  }
+
+  ~mmap_database() { unmap(); }
+
+  const ValueType& get_record(std::size_t pos) const {
+    if (pos >= dbsize_) {
+      throw std::runtime_error(
+          "flat_file:get_record cannot return data, are you dereferencing db.end()?");
+    }
+    return data_[pos];
+  }
+
+  const_iterator begin() const { return data_; }
+  const_iterator end() const { return data_ + dbsize_; }
+
+  const ValueType& back() const { return *std::prev(end()); }
+
+  std::filesystem::path filename() const { return filename_; }
+  std::size_t           filesize() const { return dbfsize_; }
+  std::size_t           number_records() const { return dbsize_; }
+
+  // advise the OS about how records [first, last) will be accessed. Defaults to the whole db.
+  void advise(access_hint hint, std::size_t first = 0,
+              std::size_t last = std::numeric_limits<std::size_t>::max()) const {
+    const auto [start, stop] = page_range(first, last);
+    if (start == stop) return;
+
+    int advice = MADV_NORMAL;
+    switch (hint) {
+    case access_hint::normal:
+      advice = MADV_NORMAL;
+      break;
+    case access_hint::random:
+      advice = MADV_RANDOM;
+      break;
+    case access_hint::sequential:
+      advice = MADV_SEQUENTIAL;
+      break;
+    case access_hint::willneed:
+      advice = MADV_WILLNEED;
+      break;
+    }
+    // only advisory, failure is not a problem
+    ::madvise(reinterpret_cast<void*>(start), stop - start, advice); // NOLINT reincast
+  }
+
+  // reads the pages of records [first, last) into memory now, so later accesses don't page fault.
+  // Defaults to the whole db.
+  void prefault(std::size_t first = 0,
+                std::size_t last = std::numeric_limits<std::size_t>::max()) const {
+    const auto [start, stop] = page_range(first, last);
+    advise(access_hint::willneed, first, last); // start the reads, in parallel
+    for (auto addr = start; addr < stop; addr += page_size()) {
+      static_cast<void>(*reinterpret_cast<const volatile std::byte*>(addr)); // NOLINT reincast
+    }
+  }
+
+  // locks the pages of records [first, last) in RAM, see mlock(2), until they are unmapped.
+  // Defaults to the whole db.
+  void lock(std::size_t first = 0,
+            std::size_t last = std::numeric_limits<std::size_t>::max()) const {
+    const auto [start, stop] = page_range(first, last);
+    if (start == stop) return;
+    if (::mlock(reinterpret_cast<const void*>(start), stop - start) != 0) { // NOLINT reincast
+      throw std::ios::failure(fmt::format("cannot lock {} in memory, because '{}'. Check `ulimit "
+                                          "-l` (RLIMIT_MEMLOCK).",
+                                          filename_, std::strerror(errno))); // NOLINT errno
+    }
+  }
 
 private:
-  database*   ffdb_ = nullptr;
-  std::size_t pos_{};
-  // cur_ and cur_valid_ are mutable so that operator* can be const
-  mutable const value_type* cur_;
-  mutable bool              cur_valid_ = false;
+  std::filesystem::path filename_;
+  std::uintmax_t        dbfsize_;
+  std::size_t           dbsize_ = 0;
+  const ValueType*      data_   = nullptr;
+
+  static std::uintptr_t page_size() {
+    static const auto size = static_cast<std::uintptr_t>(::sysconf(_SC_PAGESIZE));
+    return size;
+  }
 
-  void set_pos(std::size_t pos) {
-    pos_       = pos;
-    cur_valid_ = false;
+  // the addresses of the records [first, last), extended to page boundaries, or an empty range
+  [[nodiscard]] std::pair<std::uintptr_t, std::uintptr_t> page_range(std::size_t first,
+                                                                     std::size_t last) const {
+    last = std::min(last, dbsize_);
+    if (first >= last) return {0, 0};
+
+    auto start = reinterpret_cast<std::uintptr_t>(data_ + first); // NOLINT reincast
+    auto stop  = reinterpret_cast<std::uintptr_t>(data_ + last);  // NOLINT reincast
+    start &= ~(page_size() - 1); // madvise and mlock require a page aligned start address
+    return {start, stop};
   }
 
-  reference current() const {
-    if (!cur_valid_) {
-      cur_       = &ffdb_->get_record(pos_);
-      cur_valid_ = true;
+  void unmap() {
+    if (data_ != nullptr) {
+      ::munmap(const_cast<ValueType*>(data_), dbfsize_); // NOLINT const_cast
+      data_ = nullptr;
     }
-    return *cur_;
   }
 };
 
+#endif // FLAT_FILE_HAS_MMAP
+
+namespace impl {
+
+// Reads at explicit offsets, so there is no shared stream position. On POSIX this is `pread` and
+// the reader can be used from any number of threads. Elsewhere it falls back to a private stream,
+// so each thread needs its own reader.
+class positional_reader {
+public:
+  explicit positional_reader(const std::filesystem::path& filename) {
+#ifdef FLAT_FILE_HAS_MMAP // ie POSIX
+    fd_           = ::open(filename.c_str(), O_RDONLY); // NOLINT vararg
+    const bool ok = fd_ != -1;
+#else
+    ifs_.open(filename, std::ios::binary);
+    const bool ok = ifs_.is_open();
+#endif
+    if (!ok)
+      throw std::ios::failure(fmt::format("cannot open db: {}, because '{}'", filename,
+                                          std::strerror(errno))); // NOLINT errno
+#ifndef FLAT_FILE_HAS_MMAP
+    ifs_.exceptions(std::ios::badbit | std::ios::failbit);
+#endif
+  }
+
+  positional_reader(const positional_reader& other)            = delete;
+  positional_reader& operator=(const positional_reader& other) = delete;
+
+#ifdef FLAT_FILE_HAS_MMAP
+  positional_reader(positional_reader&& other) noexcept : fd_(std::exchange(other.fd_, -1)) {}
+  positional_reader& operator=(positional_reader&& other) noexcept {
+    std::swap(fd_, other.fd_);
+    return *this;
+  }
+  ~positional_reader() {
+    if (fd_ != -1) ::close(fd_);
+  }
+#else
+  positional_reader(positional_reader&& other) noexcept            = default;
+  positional_reader& operator=(positional_reader&& other) noexcept = default;
+  ~positional_reader()                                             = default;
+#endif
+
+  void read(std::byte* dest, std::size_t size, std::uint64_t offset) {
+#ifdef FLAT_FILE_HAS_MMAP
+    while (size != 0) {
+      const auto res = ::pread(fd_, dest, size, static_cast<off_t>(offset));
+      if (res <= 0) {
+        if (res == -1 && errno == EINTR) continue; // NOLINT errno
+        throw std::ios::failure(fmt::format("flat_file: pread failed at offset {}, because '{}'",
+                                            offset,
+                                            res == 0 ? "unexpected eof"
+                                                     : std::strerror(errno))); // NOLINT errno
+      }
+      dest += res;
+      size -= static_cast<std::size_t>(res);
+      offset += static_cast<std::uint64_t>(res);
+    }
+#else
+    ifs_.seekg(static_cast<std::streamoff>(offset));
+    ifs_.read(reinterpret_cast<char*>(dest), // NOLINT reinterpret_cast
+              static_cast<std::streamsize>(size));
+#endif
+  }
+
+private:
+#ifdef FLAT_FILE_HAS_MMAP
+  int fd_ = -1;
+#else
+  std::ifstream ifs_;
+#endif
+};
+
+} // namespace impl
+
+// A fixed size, thread safe cache of file blocks, designed to be shared by all the
+// flat_file::cached_database instances of a process.
+//
+// Blocks live in a set associative table, with a CLOCK replacement policy inside each set. Hits
+// are lock free: every slot is guarded by a sequence lock and a reader, which raced with the
+// replacement of the block it was copying, just treats that as a miss. Misses are read by the
+// caller without holding any lock, and then one of the sharded mutexes is only held to insert.
+class page_cache {
+public:
+  static constexpr std::size_t block_size = 4096;
+  static constexpr std::size_t ways       = 8;
+
+  explicit page_cache(std::size_t capacity_bytes)
+      : sets_(std::max(capacity_bytes / (block_size * ways), std::size_t{1})), slots_(sets_ * ways),
+        data_(sets_ * ways * block_size), hands_(sets_), locks_(std::min(sets_, max_locks)) {}
+
+  // stable id for a file, used to build the cache keys of its blocks. A file which has been
+  // replaced, or modified, since gets a new id, so its stale blocks are never hit, and age out.
+  std::uint64_t file_id(const std::filesystem::path& filename) {
+    const std::lock_guard lk(files_mutex_);
+    file_version version{std::filesystem::weakly_canonical(filename),
+                         std::filesystem::last_write_time(filename)};
+    auto         found = std::find(files_.begin(), files_.end(), version);
+    if (found != files_.end()) return static_cast<std::uint64_t>(found - files_.begin());
+    files_.push_back(std::move(version));
+    return files_.size() - 1;
+  }
+
+  static constexpr std::uint64_t make_key(std::uint64_t file_id, std::uint64_t block) {
+    return file_id << 48U | block;
+  }
+
+  // copies `size` bytes of the cached block into `dest`. Returns false if the block is not cached.
+  bool try_get(std::uint64_t key, std::byte* dest, std::size_t size) {
+    const std::size_t set = set_of(key);
+    for (std::size_t way = 0; way != ways; ++way) {
+      slot&      s   = slots_[set * ways + way];
+      const auto seq = s.seq.load(std::memory_order_acquire);
+      if ((seq & 1U) != 0 || s.key.load(std::memory_order_relaxed) != key) continue;
+
+      std::memcpy(dest, block_data(set * ways + way), size);
+
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (s.seq.load(std::memory_order_relaxed) != seq) return false; // replaced during the copy
+
+      if (!s.referenced.load(std::memory_order_relaxed)) {
+        s.referenced.store(true, std::memory_order_relaxed); // avoid needless cacheline writes
+      }
+      return true;
+    }
+    return false;
+  }
+
+  // inserts a block, which the caller has just read after a miss
+  void put(std::uint64_t key, const std::byte* src, std::size_t size) {
+    const std::size_t set = set_of(key);
+    const std::lock_guard lk(locks_[set % locks_.size()]);
+
+    for (std::size_t way = 0; way != ways; ++way) {
+      if (slots_[set * ways + way].key.load(std::memory_order_relaxed) == key) {
+        return; // another thread missed on the same block and beat us to it
+      }
+    }
+
+    // CLOCK: sweep past, and clear, referenced slots until we find an unreferenced victim
+    auto& hand = hands_[set];
+    while (slots_[set * ways + hand].referenced.exchange(false, std::memory_order_relaxed)) {
+      hand = static_cast<std::uint8_t>((hand + 1) % ways);
+    }
+    const std::size_t idx = set * ways + hand;
+    hand                  = static_cast<std::uint8_t>((hand + 1) % ways);
+
+    slot& victim = slots_[idx];
+    victim.seq.fetch_add(1, std::memory_order_relaxed); // odd => readers will back off
+    std::atomic_thread_fence(std::memory_order_release);
+    victim.key.store(key, std::memory_order_relaxed);
+    std::memcpy(block_data(idx), src, size);
+    victim.seq.fetch_add(1, std::memory_order_release); // even => stable again
+  }
+
+  std::size_t capacity() const { return data_.size(); }
+
+private:
+  static constexpr std::size_t   max_locks = 1024;
+  static constexpr std::uint64_t empty_key = std::numeric_limits<std::uint64_t>::max();
+
+  struct slot {
+    std::atomic<std::uint64_t> seq{0};
+    std::atomic<std::uint64_t> key{empty_key};
+    std::atomic<bool>          referenced{false};
+  };
+
+  std::size_t               sets_;
+  std::vector<slot>         slots_;
+  std::vector<std::byte>    data_;
+  std::vector<std::uint8_t> hands_; // CLOCK hand for each set, guarded by locks_
+  std::vector<std::mutex>   locks_;
+
+  using file_version = std::pair<std::filesystem::path, std::filesystem::file_time_type>;
+
+  std::mutex                files_mutex_;
+  std::vector<file_version> files_;
+
+  std::byte* block_data(std::size_t idx) { return &data_[idx * block_size]; }
+
+  std::size_t set_of(std::uint64_t key) const {
+    // fibonacci hashing, as consecutive blocks would otherwise map to consecutive sets
+    return static_cast<std::size_t>((key * 0x9E3779B97F4A7C15ULL) >> 32U) % sets_;
+  }
+};
+
+// The same interface as flat_file::database, but reading through a shared page_cache with
+// positional reads. Instances are cheap and not thread safe, so each thread should have its own,
+// but they all share the cached blocks.
+template <typename ValueType>
+class cached_database {
+
+  static_assert(std::is_trivially_copyable_v<ValueType>);
+  static_assert(std::is_standard_layout_v<ValueType>);
+  static_assert(sizeof(ValueType) <= page_cache::block_size);
+
+public:
+  using value_type     = ValueType;
+  using const_iterator = impl::record_iterator<cached_database>;
+
+  // blocks are a whole number of records, so a record never straddles two blocks
+  static constexpr std::size_t records_per_block = page_cache::block_size / sizeof(ValueType);
+
+  cached_database(std::filesystem::path filename, page_cache& cache)
+      : filename_(std::move(filename)), dbfsize_(std::filesystem::file_size(filename_)),
+        reader_(filename_), cache_(&cache), file_id_(cache.file_id(filename_)),
+        buf_(records_per_block) {
+
+    if (dbfsize_ % sizeof(ValueType) != 0)
+      throw std::ios::failure("db file size is not a multiple of the record size");
+
+    dbsize_ = static_cast<std::size_t>(dbfsize_ / sizeof(ValueType));
+  }
+
+  const ValueType& get_record(std::size_t pos) {
+    if (!(pos >= buf_start_ && pos < buf_end_)) { // NOLINT can be simplified
+      if (pos >= dbsize_) {
+        throw std::runtime_error(
+            "flat_file:get_record cannot return data, are you dereferencing db.end()?");
+      }
+      const std::size_t block = pos / records_per_block;
+      const std::size_t first = block * records_per_block;
+      const std::size_t nrecs = std::min(records_per_block, dbsize_ - first);
+      const std::size_t bytes = nrecs * sizeof(ValueType);
+
+      auto*      dest = reinterpret_cast<std::byte*>(buf_.data()); // NOLINT reinterpret_cast
+      const auto key  = page_cache::make_key(file_id_, block);
+      if (!cache_->try_get(key, dest, bytes)) {
+        reader_.read(dest, bytes, first * sizeof(ValueType));
+        cache_->put(key, dest, bytes);
+        ++reads_;
+      }
+      buf_start_ = first;
+      buf_end_   = first + nrecs;
+    }
+    return buf_[pos - buf_start_];
+  }
+
+  // copies the `count` records from `pos` into `dest`, through the cache
+  void read(std::size_t pos, std::size_t count, ValueType* dest) {
+    if (pos + count > dbsize_) {
+      throw std::runtime_error("flat_file:read cannot return data beyond the end of the db");
+    }
+    std::copy(begin() + pos, begin() + pos + count, dest);
+  }
+
+  const_iterator begin() { return {*this, 0}; }
+  const_iterator end() { return {*this, dbsize_}; }
+
+  const ValueType& back() { return *std::prev(end()); }
+
+  std::filesystem::path filename() const { return filename_; }
+  std::size_t           filesize() const { return dbfsize_; }
+  std::size_t           number_records() const { return dbsize_; }
+  std::size_t           reads() const { return reads_; } // from the file, ie cache misses
+
+private:
+  std::filesystem::path   filename_;
+  std::uintmax_t          dbfsize_;
+  std::size_t             dbsize_ = 0;
+  impl::positional_reader reader_;
+  page_cache*             cache_;
+  std::uint64_t           file_id_;
+  std::size_t             buf_start_ = 0;
+  std::size_t             buf_end_   = 0; // one past the end
+  std::size_t             reads_     = 0;
+  std::vector<ValueType>  buf_;
+};
+
+// Exponential ("galloping") search: same result as std::lower_bound, but probes first + 1, 3, 7,
+// 15, ... before bisecting. When successive needles are sorted and close together, this touches
+// O(log(distance)) records near `first`, rather than O(log(last - first)) records spread over
+// the whole range.
+template <typename Iter, typename T>
+Iter gallop_lower_bound(Iter first, Iter last, const T& value) {
+  const auto  len = static_cast<std::size_t>(last - first);
+  std::size_t lo  = 0;
+  std::size_t hi  = 1;
+  while (hi < len && *(first + hi) < value) {
+    lo = hi + 1;
+    hi = 2 * hi + 1;
+  }
+  return std::lower_bound(first + lo, first + std::min(hi, len), value);
+}
+
+namespace impl {
+
+template <typename T>
+struct cacheline_allocator {
+  using value_type = T;
+
+  static constexpr std::align_val_t alignment{64};
+
+  cacheline_allocator() = default;
+  template <typename U>
+  explicit cacheline_allocator(const cacheline_allocator<U>& /*other*/) {}
+
+  T* allocate(std::size_t n) { return static_cast<T*>(::operator new(n * sizeof(T), alignment)); }
+  void deallocate(T* ptr, std::size_t n) { ::operator delete(ptr, n * sizeof(T), alignment); }
+
+  bool operator==(const cacheline_allocator& /*other*/) const = default;
+};
+
+inline void prefetch([[maybe_unused]] const void* addr) {
+#if defined(__GNUC__) || defined(__clang__)
+  __builtin_prefetch(addr);
+#endif
+}
+
+} // namespace impl
+
+// A resident index over every `stride`th record of a sorted db, with the stride chosen to fit a
+// memory budget. The samples are stored in Eytzinger (breadth first) order in a cache line
+// aligned array, so the top levels of every search are a branch free descent through memory,
+// which prefetches a few levels ahead, rather than a scattered series of disk reads or page
+// faults. `range()` then narrows the search in the db itself to one stride.
+template <typename ValueType>
+class hot_index {
+public:
+  hot_index() = default;
+
+  // samples `db`, which can be any of the flat_file database types
+  template <typename DbType>
+  hot_index(DbType& db, std::size_t max_bytes) : db_size_(db.number_records()) {
+    if (db_size_ == 0) return;
+
+    const std::size_t max_samples = // node 0 is unused
+        std::max(max_bytes / (sizeof(ValueType) + sizeof(std::uint32_t)), std::size_t{2}) - 1;
+    stride_            = (db_size_ + max_samples - 1) / max_samples;
+    const auto samples = (db_size_ + stride_ - 1) / stride_;
+    if (samples > std::numeric_limits<std::uint32_t>::max()) {
+      throw std::runtime_error("flat_file::hot_index: too many samples, reduce the budget");
+    }
+
+    std::vector<ValueType> sorted;
+    sorted.reserve(samples);
+    for (std::size_t i = 0; i != samples; ++i) sorted.push_back(db.get_record(i * stride_));
+
+    tree_.resize(samples + 1); // 1 based, for the simple child arithmetic
+    ranks_.resize(samples + 1);
+    fill(sorted, 0, 1);
+  }
+
+  // [first, last) positions in the db which would contain `value`
+  [[nodiscard]] std::pair<std::size_t, std::size_t> range(const ValueType& value) const {
+    const std::size_t samples = size();
+    if (samples == 0) return {0, db_size_};
+
+    std::size_t node = 1;
+    while (node <= samples) {
+      const std::size_t descendants = node << prefetch_levels;
+      impl::prefetch(&tree_[std::min(descendants, samples)]);
+      impl::prefetch(&tree_[std::min(descendants + (1U << prefetch_levels) - 1, samples)]);
+      node = 2 * node + static_cast<std::size_t>(tree_[node] < value);
+    }
+    // undo the final right turns, and one left turn, to find the first sample >= value
+    node >>= std::countr_one(node) + 1;
+
+    // samples[rank - 1] < value <= samples[rank], so it is within this stride, or at its end
+    const std::size_t rank  = node == 0 ? samples : ranks_[node];
+    const std::size_t first = rank == 0 ? 0 : (rank - 1) * stride_ + 1;
+    const std::size_t last  = std::min(rank * stride_ + 1, db_size_);
+    return {first, last};
+  }
+
+  [[nodiscard]] std::size_t size() const { return tree_.empty() ? 0 : tree_.size() - 1; }
+  [[nodiscard]] std::size_t stride() const { return stride_; }
+  [[nodiscard]] std::size_t memory() const {
+    return tree_.size() * sizeof(ValueType) + ranks_.size() * sizeof(std::uint32_t);
+  }
+
+private:
+  // levels below the current node, which fit in 2 cache lines
+  static constexpr unsigned prefetch_levels =
+      std::bit_width(std::max(128 / sizeof(ValueType), std::size_t{1})) - 1;
+
+  std::vector<ValueType, impl::cacheline_allocator<ValueType>> tree_;
+  std::vector<std::uint32_t>                                   ranks_; // of each node's sample
+  std::size_t                                                  db_size_ = 0;
+  std::size_t                                                  stride_  = 1;
+
+  // in order traversal of the implicit tree, consuming the sorted samples
+  std::size_t fill(const std::vector<ValueType>& sorted, std::size_t idx, std::size_t node) {
+    if (node < tree_.size()) {
+      idx          = fill(sorted, idx, 2 * node);
+      tree_[node]  = sorted[idx];
+      ranks_[node] = static_cast<std::uint32_t>(idx);
+      idx          = fill(sorted, idx + 1, 2 * node + 1);
+    }
+    return idx;
+  }
+};
+
+// `on_write` is called for each record of the final sorted output, in order, eg to build an index
 template <typename ValueType, typename Comp = std::less<>, typename Proj = std::identity>
-std::vector<std::string> sort_into_chunks(typename database<ValueType>::const_iterator first,
-                                          typename database<ValueType>::const_iterator last,
-                                          Comp comp = {}, Proj proj = {},
-                                          std::size_t max_memory_usage = 1'000'000'000) {
+std::vector<std::string>
+sort_into_chunks(typename database<ValueType>::const_iterator first,
+                 typename database<ValueType>::const_iterator last, Comp comp = {}, Proj proj = {},
+                 std::size_t                                  max_memory_usage = 1'000'000'000,
+                 const std::function<void(const ValueType&)>& on_write         = {}) {
 
   auto        records_to_sort = static_cast<std::size_t>(last - first);
   std::size_t chunk_size      = std::min(records_to_sort, max_memory_usage / sizeof(ValueType));
@@ -234,7 +836,8 @@ std::vector<std::string> sort_into_chunks(typename database<ValueType>::const_it
   std::vector<std::string> chunk_filenames;
   chunk_filenames.reserve(number_of_chunks);
   for (std::size_t chunk = 0; chunk != number_of_chunks; ++chunk) {
-    std::string chunk_filename = fmt::format("{}.partial.{:04d}", first.filename(), chunk);
+    std::string chunk_filename =
+        fmt::format("{}.partial.{:04d}", first.filename().string(), chunk);
     chunk_filenames.push_back(chunk_filename);
 
     std::size_t start = chunk * chunk_size;
@@ -253,14 +856,18 @@ std::vector<std::string> sort_into_chunks(typename database<ValueType>::const_it
           return comp(std::invoke(proj, a), std::invoke(proj, b));
         });
     auto part = file_writer<ValueType>(chunk_filename);
-    for (const auto& obj: objs) part.write(obj);
+    for (const auto& obj: objs) {
+      part.write(obj);
+      if (number_of_chunks == 1 && on_write) on_write(obj); // the only chunk is the output
+    }
   }
   return chunk_filenames;
 }
 
 template <typename ValueType, typename Comp = std::less<>, typename Proj = std::identity>
 void merge_sorted_chunks(const std::vector<std::string>& chunk_filenames,
-                         const std::string& sorted_filename, Comp comp = {}, Proj proj = {}) {
+                         const std::string& sorted_filename, Comp comp = {}, Proj proj = {},
+                         const std::function<void(const ValueType&)>& on_write = {}) {
 
   static_assert(std::is_invocable_v<Proj, ValueType>);
 
@@ -300,6 +907,7 @@ void merge_sorted_chunks(const std::vector<std::string>& chunk_filenames,
   while (!heads.empty()) {
     const head& t = heads.top();
     sorted.write(t.value);
+    if (on_write) on_write(t.value);
     const std::size_t chunk_idx = t.idx;
     heads.pop();
     if (auto& chunk = chunks[chunk_idx]; chunk.current != chunk.end) {
@@ -314,12 +922,13 @@ void merge_sorted_chunks(const std::vector<std::string>& chunk_filenames,
 template <typename ValueType, typename Comp = std::less<>, typename Proj = std::identity>
 std::string disksort_range(typename database<ValueType>::const_iterator first,
                            typename database<ValueType>::const_iterator last, Comp comp = {},
-                           Proj proj = {}, std::size_t max_memory_usage = 1'000'000'000) {
+                           Proj proj = {}, std::size_t max_memory_usage = 1'000'000'000,
+                           const std::function<void(const ValueType&)>& on_write = {}) {
 
   std::vector<std::string> chunk_filenames =
-      sort_into_chunks<ValueType>(first, last, comp, proj, max_memory_usage);
+      sort_into_chunks<ValueType>(first, last, comp, proj, max_memory_usage, on_write);
 
-  std::string sorted_filename = fmt::format("{}.sorted", first.filename());
+  std::string sorted_filename = fmt::format("{}.sorted", first.filename().string());
 
   if (chunk_filenames.size() == 1) {
     std::filesystem::rename(chunk_filenames[0], sorted_filename);
@@ -327,15 +936,181 @@ std::string disksort_range(typename database<ValueType>::const_iterator first,
   } else {
     std::cerr << fmt::format("\nmerging [{:12d},{:12d}) => {:s}\n", first.pos(), last.pos(),
                              sorted_filename);
-    merge_sorted_chunks<ValueType>(chunk_filenames, sorted_filename, comp, proj);
+    merge_sorted_chunks<ValueType>(chunk_filenames, sorted_filename, comp, proj, on_write);
+  }
+  return sorted_filename;
+}
+
+namespace impl {
+
+// all partition files are open at once while scattering, so stay well inside the usual fd limits
+inline constexpr unsigned max_radix_bits = 9;
+
+// Calls `fn` with consecutive blocks of the records [pos, pos + count) of a db file, while the next
+// block is read on another thread, ie double buffered.
+template <typename ValueType, typename Fn>
+void for_each_block(const std::filesystem::path& filename, std::size_t pos, std::size_t count,
+                    std::size_t block_records, Fn fn) {
+  database<ValueType>    db(filename);
+  std::vector<ValueType> current;
+  std::vector<ValueType> next;
+
+  const std::size_t end  = pos + count;
+  auto              read = [&](std::vector<ValueType>& buf, std::size_t from) {
+    buf.resize(std::min(block_records, end - from));
+    db.read(from, buf.size(), buf.data());
+  };
+  if (count != 0) read(current, pos);
+  while (pos != end) {
+    const std::size_t next_pos = pos + current.size();
+    std::future<void> pending;
+    if (next_pos != end) pending = std::async(std::launch::async, read, std::ref(next), next_pos);
+    fn(current);
+    if (pending.valid()) pending.get();
+    std::swap(current, next);
+    pos = next_pos;
+  }
+}
+
+} // namespace impl
+
+// An external sort without a merge phase, for records whose order starts with a well distributed
+// 64bit key, eg the leading bits of a hash, which `radix(record)` returns.
+//
+// One sequential, double buffered pass scatters the records into 2^bits partition files by the top
+// bits of their keys. Then the partitions are read in order, sorted in memory on a pool of threads,
+// and appended to the output in order, see pipeline::ordered(), removing each partition file once
+// it is written, so the peak disk usage is about 2x the db, rather than 3x. Partitions which do not
+// fit into memory, because the keys were not well distributed after all, fall back to
+// disksort_range().
+template <typename ValueType, typename Radix, typename Comp = std::less<>>
+std::string radix_disksort_range(typename database<ValueType>::const_iterator first,
+                                 typename database<ValueType>::const_iterator last, Radix radix,
+                                 Comp comp = {}, std::size_t max_memory_usage = 1'000'000'000,
+                                 const std::function<void(const ValueType&)>& on_write = {},
+                                 unsigned threads = 0) {
+
+  static_assert(std::is_invocable_r_v<std::uint64_t, Radix, ValueType>);
+
+  if (threads == 0) threads = std::max(1U, std::thread::hardware_concurrency());
+  const std::filesystem::path input_filename  = first.filename();
+  const std::string           sorted_filename = fmt::format("{}.sorted", input_filename.string());
+  const auto                  records         = static_cast<std::size_t>(last - first);
+
+  // enough partitions that `threads` of them are expected to fit into memory together
+  const std::size_t part_memory = std::max(max_memory_usage / threads, sizeof(ValueType));
+  unsigned          bits        = 0;
+  while (bits < impl::max_radix_bits && (records * sizeof(ValueType) >> bits) > part_memory) ++bits;
+  const std::size_t partitions = std::size_t{1} << bits;
+
+  std::cerr << fmt::format("{:20s} = {:12d}\n", "max memory usage", max_memory_usage);
+  std::cerr << fmt::format("{:20s} = {:12d}\n", "records to sort", records);
+  std::cerr << fmt::format("{:20s} = {:12d}\n", "partitions", partitions);
+  std::cerr << fmt::format("{:20s} = {:12d}\n", "threads", threads) << "\n";
+
+  constexpr std::size_t block_records = (1U << 22U) / sizeof(ValueType); // 4MB i/o
+
+  // scatter
+  std::vector<std::string> part_filenames;
+  std::vector<std::size_t> part_sizes(partitions);
+  {
+    // unique_ptr, because a file_writer refers to its own stream, so cannot move
+    std::vector<std::unique_ptr<file_writer<ValueType>>> parts;
+    for (std::size_t part = 0; part != partitions; ++part) {
+      part_filenames.push_back(fmt::format("{}.partition.{:04d}", input_filename.string(), part));
+      parts.push_back(std::make_unique<file_writer<ValueType>>(part_filenames.back()));
+    }
+    impl::for_each_block<ValueType>(
+        input_filename, first.pos(), records, block_records,
+        [&](const std::vector<ValueType>& block) {
+          for (const auto& value: block) {
+            const std::size_t part = bits == 0 ? 0 : std::invoke(radix, value) >> (64 - bits);
+            parts[part]->write(value);
+            ++part_sizes[part];
+          }
+        });
+  }
+
+  // sort the partitions, and append them to the output in order
+  const std::size_t largest = *std::max_element(part_sizes.begin(), part_sizes.end());
+  const auto        workers = static_cast<unsigned>(std::clamp<std::size_t>(
+      max_memory_usage / std::max<std::size_t>(largest * sizeof(ValueType), 1), 1, threads));
+
+  struct partition {
+    std::size_t            part      = 0;
+    bool                   in_memory = false;
+    std::vector<ValueType> values;      // if in_memory
+    std::string            sorted_part; // otherwise
+  };
+
+  std::size_t next_part = 0;
+
+  auto read = [&](partition& item) {
+    if (next_part == partitions) return false;
+    item.part      = next_part++;
+    item.in_memory = part_sizes[item.part] * sizeof(ValueType) <= max_memory_usage / workers;
+    if (item.in_memory) {
+      item.values.resize(part_sizes[item.part]);
+      database<ValueType> part_db(part_filenames[item.part]);
+      part_db.read(0, item.values.size(), item.values.data());
+    }
+    return true;
+  };
+
+  auto sort = [&](partition& item) {
+    if (item.in_memory) {
+      std::sort(item.values.begin(), item.values.end(), comp);
+    } else { // the keys were not well distributed after all
+      database<ValueType> part_db(part_filenames[item.part]);
+      item.sorted_part = disksort_range<ValueType>(part_db.begin(), part_db.end(), comp,
+                                                   std::identity{}, max_memory_usage / workers);
+    }
+  };
+
+  std::ofstream out(sorted_filename, std::ios::binary);
+  out.exceptions(std::ios::badbit | std::ios::failbit);
+  auto append = [&](const std::vector<ValueType>& values) {
+    out.write(reinterpret_cast<const char*>(values.data()), // NOLINT reincast
+              static_cast<std::streamsize>(values.size() * sizeof(ValueType)));
+    if (on_write) std::for_each(values.begin(), values.end(), on_write);
+  };
+
+  auto write = [&](partition& item) {
+    if (item.in_memory) {
+      append(item.values);
+    } else {
+      impl::for_each_block<ValueType>(item.sorted_part, 0, part_sizes[item.part], block_records,
+                                      append);
+      std::filesystem::remove(item.sorted_part);
+    }
+    std::filesystem::remove(part_filenames[item.part]);
+    return true;
+  };
+
+  try {
+    pipeline::ordered<partition>(workers, workers, read, sort, write);
+  } catch (...) {
+    for (const auto& filename: part_filenames) std::filesystem::remove(filename);
+    throw;
   }
   return sorted_filename;
 }
 
+template <typename ValueType>
+template <typename Radix, typename Comp>
+std::string
+database<ValueType>::radix_disksort(Radix radix, Comp comp, std::size_t max_memory_usage,
+                                    const std::function<void(const ValueType&)>& on_write,
+                                    unsigned threads) {
+  return radix_disksort_range<ValueType>(begin(), end(), radix, comp, max_memory_usage, on_write,
+                                         threads);
+}
+
 template <typename ValueType>
 template <typename Comp, typename Proj>
-std::string database<ValueType>::disksort(Comp comp, Proj proj, std::size_t max_memory_usage) {
-  return disksort_range<ValueType>(begin(), end(), comp, proj, max_memory_usage);
+std::string database<ValueType>::disksort(Comp comp, Proj proj, std::size_t max_memory_usage,
+                                          const std::function<void(const ValueType&)>& on_write) {
+  return disksort_range<ValueType>(begin(), end(), comp, proj, max_memory_usage, on_write);
 }
 
 } // namespace flat_file
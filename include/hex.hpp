@@ -0,0 +1,172 @@
+#pragma once
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <emmintrin.h>
+#include <immintrin.h>
+
+// Hex <=> binary conversion of fixed size hashes, with SSSE3 and AVX2 kernels and a scalar
+// fallback, chosen at runtime so one binary runs everywhere.
+//
+// The vector kernels convert 8 bytes (16 chars) or 16 bytes (32 chars) at a time. Other sizes are
+// covered by overlapping the last block with its predecessor, so any size >= 8 bytes is fully
+// vectorised, and nothing outside [src, src + N) or [dst, dst + N) is ever touched.
+//
+// Decoding accepts upper and lower case, and, like the rest of hibp, assumes valid hex digits.
+// Encoding produces upper case, like the `have i been pawned` api.
+
+namespace hibp::hex {
+
+enum class isa { scalar, ssse3, avx2 };
+
+inline isa best_isa() noexcept {
+  static const isa best = [] {
+#if defined(__GNUC__) || defined(__clang__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) return isa::avx2;
+    if (__builtin_cpu_supports("ssse3")) return isa::ssse3;
+#endif
+    return isa::scalar;
+  }();
+  return best;
+}
+
+// the value of one hex digit
+constexpr std::byte nibble(char c) {
+  assert((c >= '0' && c <= '9') || (c >= 'A' && c <= 'F') || (c >= 'a' && c <= 'f'));
+  auto n = c - '0';
+  if (n > 9) n = (n & ~('a' - 'A')) - ('A' - '0') + 10; // NOLINT signed
+  return static_cast<std::byte>(n);
+}
+
+// the upper case hex digit of a nibble
+constexpr char digit(std::byte nibble) {
+  auto n = std::to_integer<std::uint8_t>(nibble);
+  assert(n <= 15);
+  return static_cast<char>(n + (n < 10 ? '0' : 'A' - 10));
+}
+
+namespace impl {
+
+inline void decode_scalar(const char* src, std::byte* dst, std::size_t bytes) noexcept {
+  for (std::size_t i = 0; i != bytes; ++i) {
+    dst[i] = nibble(src[2 * i]) << 4U | nibble(src[2 * i + 1]);
+  }
+}
+
+inline void encode_scalar(const std::byte* src, char* dst, std::size_t bytes) noexcept {
+  for (std::size_t i = 0; i != bytes; ++i) {
+    dst[2 * i]     = digit(src[i] >> 4U);
+    dst[2 * i + 1] = digit(src[i] & std::byte{0x0FU});
+  }
+}
+
+#if defined(__GNUC__) || defined(__clang__)
+
+// ascii hex digits => nibble values, in each byte
+__attribute__((target("ssse3"))) inline __m128i nibbles(__m128i chars) noexcept {
+  // '0'-'9' already have bit 0x20 set, this lowercases 'A'-'F'
+  const auto lower = _mm_or_si128(chars, _mm_set1_epi8(0x20));
+  const auto alpha = _mm_cmpgt_epi8(lower, _mm_set1_epi8('9'));
+  const auto base  = _mm_add_epi8(_mm_set1_epi8('0'), _mm_and_si128(alpha, _mm_set1_epi8(0x27)));
+  return _mm_sub_epi8(lower, base); // 'a' - 10 == '0' + 0x27
+}
+
+// 16 chars => 8 bytes
+__attribute__((target("ssse3"))) inline void decode8_ssse3(const char* src,
+                                                           std::byte* dst) noexcept {
+  const auto nibs  = nibbles(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src))); // NOLINT
+  const auto pairs = _mm_maddubs_epi16(nibs, _mm_set1_epi16(0x0110)); // hi * 16 + lo
+  _mm_storel_epi64(reinterpret_cast<__m128i*>(dst), _mm_packus_epi16(pairs, pairs)); // NOLINT
+}
+
+// 32 chars => 16 bytes
+__attribute__((target("avx2"))) inline void decode16_avx2(const char* src,
+                                                          std::byte* dst) noexcept {
+  const auto chars = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src)); // NOLINT
+  const auto lower = _mm256_or_si256(chars, _mm256_set1_epi8(0x20));
+  const auto alpha = _mm256_cmpgt_epi8(lower, _mm256_set1_epi8('9'));
+  const auto base =
+      _mm256_add_epi8(_mm256_set1_epi8('0'), _mm256_and_si256(alpha, _mm256_set1_epi8(0x27)));
+  const auto pairs = _mm256_maddubs_epi16(_mm256_sub_epi8(lower, base), _mm256_set1_epi16(0x0110));
+  // packus works within 128bit lanes, so gather the low 8 bytes of each
+  const auto packed = _mm256_permute4x64_epi64(_mm256_packus_epi16(pairs, pairs), 0b1000);
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(dst), _mm256_castsi256_si128(packed)); // NOLINT
+}
+
+// 8 bytes => 16 chars
+__attribute__((target("ssse3"))) inline void encode8_ssse3(const std::byte* src,
+                                                           char*            dst) noexcept {
+  const auto digits = _mm_setr_epi8('0', '1', '2', '3', '4', '5', '6', '7', '8', '9', 'A', 'B', 'C',
+                                    'D', 'E', 'F');
+  const auto bytes  = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(src)); // NOLINT
+  const auto mask   = _mm_set1_epi8(0x0F);
+  const auto hi     = _mm_and_si128(_mm_srli_epi16(bytes, 4), mask);
+  const auto lo     = _mm_and_si128(bytes, mask);
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(dst), // NOLINT
+                   _mm_shuffle_epi8(digits, _mm_unpacklo_epi8(hi, lo)));
+}
+
+// 16 bytes => 32 chars
+__attribute__((target("avx2"))) inline void encode16_avx2(const std::byte* src,
+                                                          char*            dst) noexcept {
+  const auto digits = _mm256_setr_epi8('0', '1', '2', '3', '4', '5', '6', '7', '8', '9', 'A', 'B',
+                                       'C', 'D', 'E', 'F', '0', '1', '2', '3', '4', '5', '6', '7',
+                                       '8', '9', 'A', 'B', 'C', 'D', 'E', 'F');
+  // each 16bit lane holds one byte, so the nibbles can be split apart in place
+  const auto* in    = reinterpret_cast<const __m128i*>(src); // NOLINT reincast
+  const auto  bytes = _mm256_cvtepu8_epi16(_mm_loadu_si128(in));
+  const auto  hi    = _mm256_srli_epi16(bytes, 4);
+  const auto  lo    = _mm256_slli_epi16(_mm256_and_si256(bytes, _mm256_set1_epi16(0x0F)), 8);
+  _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst), // NOLINT
+                      _mm256_shuffle_epi8(digits, _mm256_or_si256(hi, lo)));
+}
+
+#endif
+
+} // namespace impl
+
+// `Bytes` bytes from 2 * `Bytes` hex chars at `src`
+template <std::size_t Bytes>
+void decode(const char* src, std::byte* dst, isa kernel = best_isa()) noexcept {
+#if defined(__GNUC__) || defined(__clang__)
+  if constexpr (Bytes >= 8) {
+    std::size_t i = 0;
+    if (kernel == isa::avx2 && Bytes >= 16) {
+      for (; i + 16 <= Bytes; i += 16) impl::decode16_avx2(src + 2 * i, dst + i);
+      if (i != Bytes) impl::decode16_avx2(src + 2 * (Bytes - 16), dst + Bytes - 16); // overlap
+      return;
+    }
+    if (kernel != isa::scalar) {
+      for (; i + 8 <= Bytes; i += 8) impl::decode8_ssse3(src + 2 * i, dst + i);
+      if (i != Bytes) impl::decode8_ssse3(src + 2 * (Bytes - 8), dst + Bytes - 8); // overlap
+      return;
+    }
+  }
+#endif
+  impl::decode_scalar(src, dst, Bytes);
+}
+
+// 2 * `Bytes` upper case hex chars from `Bytes` bytes at `src`. Not null terminated.
+template <std::size_t Bytes>
+void encode(const std::byte* src, char* dst, isa kernel = best_isa()) noexcept {
+#if defined(__GNUC__) || defined(__clang__)
+  if constexpr (Bytes >= 8) {
+    std::size_t i = 0;
+    if (kernel == isa::avx2 && Bytes >= 16) {
+      for (; i + 16 <= Bytes; i += 16) impl::encode16_avx2(src + i, dst + 2 * i);
+      if (i != Bytes) impl::encode16_avx2(src + Bytes - 16, dst + 2 * (Bytes - 16)); // overlap
+      return;
+    }
+    if (kernel != isa::scalar) {
+      for (; i + 8 <= Bytes; i += 8) impl::encode8_ssse3(src + i, dst + 2 * i);
+      if (i != Bytes) impl::encode8_ssse3(src + Bytes - 8, dst + 2 * (Bytes - 8)); // overlap
+      return;
+    }
+  }
+#endif
+  impl::encode_scalar(src, dst, Bytes);
+}
+
+} // namespace hibp::hex
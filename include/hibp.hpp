@@ -1,6 +1,8 @@
 #pragma once
 
 #include "arrcmp.hpp"
+#include "hex.hpp"
+#include <algorithm>
 #include <array>
 #include <cassert>
 #include <charconv>
@@ -11,37 +13,13 @@
 #include <ostream>
 #include <string>
 #include <string_view>
+#include <type_traits>
 
 namespace hibp {
 
 template <unsigned HashSize>
 struct pawned_pw;
 
-namespace detail {
-
-constexpr std::byte make_nibble(char c) {
-  assert((c >= '0' && c <= '9') || (c >= 'A' && c <= 'F') || (c >= 'a' && c <= 'f'));
-  auto nibble = c - '0';
-  if (nibble > 9) nibble = (nibble & ~('a' - 'A')) - ('A' - '0') + 10; // NOLINT signed
-  assert(nibble >= 0 && nibble <= 15);
-  return static_cast<std::byte>(nibble);
-}
-
-constexpr std::byte make_byte(char mschr, char lschr) {
-  return make_nibble(mschr) << 4U | make_nibble(lschr);
-}
-
-constexpr std::byte make_byte(const char* two_chrs) {
-  return make_byte(*two_chrs, *(two_chrs + 1));
-}
-
-constexpr char nibble_to_char(std::byte nibble) {
-  auto n = std::to_integer<uint8_t>(nibble);
-  assert(n <= 15);
-  return static_cast<char>(n + (n < 10 ? '0' : 'A' - 10));
-}
-} // namespace detail
-
 template <unsigned HashSize>
 struct pawned_pw {
   constexpr static unsigned hash_size       = HashSize;
@@ -49,15 +27,15 @@ struct pawned_pw {
   constexpr static unsigned prefix_str_size = 5;
   constexpr static unsigned suffix_str_size = hash_str_size - prefix_str_size;
 
+  // hash, ':', and up to 11 chars of count
+  constexpr static unsigned max_str_size = hash_str_size + 1 + 11;
+
   pawned_pw() = default;
 
-  explicit pawned_pw(const std::string& text) {
+  // "HASH[:COUNT]" text, from eg the `have i been pawned` api, never allocates
+  explicit pawned_pw(std::string_view text) {
     assert(text.length() >= hash_str_size);
-    std::size_t i = 0;
-    for (auto& b: hash) {
-      b = detail::make_byte(&text[2 * i]);
-      ++i;
-    }
+    hex::decode<hash_size>(text.data(), hash.data());
 
     count          = -1;
     auto count_idx = hash_str_size + 1;
@@ -68,10 +46,22 @@ struct pawned_pw {
       }
     }
     if (text.size() > count_idx) {
-      std::from_chars(text.c_str() + count_idx, text.c_str() + text.size(), count);
+      std::from_chars(text.data() + count_idx, text.data() + text.size(), count);
     }
   }
 
+  // the leading `hash_size` bytes of a binary digest, eg of a sha1 for sha1t64
+  template <std::size_t N>
+    requires(N >= HashSize)
+  explicit pawned_pw(const std::array<std::byte, N>& digest) {
+    std::copy_n(digest.begin(), hash_size, hash.begin());
+  }
+
+  // exactly `hash_str_size` hex chars at `hash_hex`
+  pawned_pw(const char* hash_hex, std::int32_t count_) : count(count_) {
+    hex::decode<hash_size>(hash_hex, hash.data());
+  }
+
   std::strong_ordering operator<=>(const pawned_pw& rhs) const {
     if constexpr (HashSize == 8) { // alignment problems => fallback
       return hash <=> rhs.hash;
@@ -88,21 +78,23 @@ struct pawned_pw {
     }
   }
 
+  // writes "HASH:COUNT" to [first, first + max_str_size), like std::to_chars, returns the end
+  char* to_chars(char* first) const noexcept {
+    hex::encode<hash_size>(hash.data(), first);
+    first += hash_str_size;
+    *first++ = ':';
+    return std::to_chars(first, first + 11, count).ptr;
+  }
+
   [[nodiscard]] std::string to_string() const {
-    std::string buffer(60, '\0');
-    char*       strptr = buffer.data();
-    for (auto h: hash) {
-      *strptr++ = detail::nibble_to_char(h >> 4U);
-      *strptr++ = detail::nibble_to_char(h & std::byte(0x0FU));
-    }
-    *strptr++      = ':';
-    auto [ptr, ec] = std::to_chars(strptr, buffer.data() + buffer.size(), count);
-    buffer.resize(static_cast<std::size_t>(ptr - buffer.data()));
+    std::string buffer(max_str_size, '\0');
+    buffer.resize(static_cast<std::size_t>(to_chars(buffer.data()) - buffer.data()));
     return buffer;
   }
 
   friend std::ostream& operator<<(std::ostream& os, const pawned_pw& rhs) {
-    return os << rhs.to_string();
+    std::array<char, max_str_size> buffer; // NOLINT initialisation
+    return os.write(buffer.data(), rhs.to_chars(buffer.data()) - buffer.data());
   }
 
   std::array<std::byte, HashSize> hash{};
@@ -117,6 +109,20 @@ template <typename T>
 concept pw_type = std::is_same_v<T, pawned_pw_sha1> || std::is_same_v<T, pawned_pw_ntlm> ||
                   std::is_same_v<T, pawned_pw_sha1t64>;
 
+// std::lower_bound, except that contiguous records (eg from a memory mapped db) are searched with
+// the vectorised arrcmp::block_lower_bound
+template <typename Iter, pw_type PwType>
+Iter lower_bound(Iter first, Iter last, const PwType& needle) {
+  if constexpr (std::is_same_v<Iter, const PwType*>) {
+    static_assert(offsetof(PwType, hash) == 0);
+    return first + arrcmp::block_lower_bound<PwType::hash_size, sizeof(PwType)>(
+                       reinterpret_cast<const std::byte*>(first), // NOLINT reincast
+                       static_cast<std::size_t>(last - first), needle.hash.data());
+  } else {
+    return std::lower_bound(first, last, needle);
+  }
+}
+
 template <pw_type PwType>
 inline bool is_valid_hash(const std::string& hash) {
   return hash.size() == PwType::hash_size * 2 &&
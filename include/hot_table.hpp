@@ -0,0 +1,81 @@
+#pragma once
+
+#include "flat_file.hpp"
+#include "hibp.hpp"
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <optional>
+#include <vector>
+
+namespace hibp {
+
+// An in-memory open addressing hash table of a small db of the most commonly queried records, eg
+// the output of hibp-topn. It is consulted before the full db, so hits never touch the disk.
+//
+// Hashes are uniformly random already, so the leading 8 bytes are used as the hash value, without
+// any further mixing. Linear probing, at most 50% load. Thread safe for lookups, with relaxed hit
+// and miss counters.
+template <pw_type PwType>
+class hot_table {
+public:
+  explicit hot_table(const std::filesystem::path& db_filename) {
+    flat_file::database<PwType> db(db_filename, (1U << 16U) / sizeof(PwType));
+
+    slots_.resize(std::bit_ceil(std::max(2 * db.number_records(), std::size_t{1})));
+    mask_ = slots_.size() - 1;
+    for (const auto& pw: db) insert(pw);
+  }
+
+  // Empty if the needle is not hot, which does *not* mean it is not in the full db.
+  [[nodiscard]] std::optional<PwType> find(const PwType& needle) const {
+    for (std::size_t idx = slot_of(needle);; idx = (idx + 1) & mask_) {
+      const PwType& slot = slots_[idx];
+      if (slot.count < 0) break; // empty
+      if (slot == needle) {
+        hits_.fetch_add(1, std::memory_order_relaxed);
+        return slot;
+      }
+    }
+    misses_.fetch_add(1, std::memory_order_relaxed);
+    return {};
+  }
+
+  [[nodiscard]] std::size_t   size() const { return size_; }
+  [[nodiscard]] std::size_t   memory() const { return slots_.size() * sizeof(PwType); }
+  [[nodiscard]] std::uint64_t hits() const { return hits_.load(std::memory_order_relaxed); }
+  [[nodiscard]] std::uint64_t misses() const { return misses_.load(std::memory_order_relaxed); }
+
+private:
+  std::vector<PwType> slots_; // count < 0 => empty
+  std::size_t         mask_ = 0;
+  std::size_t         size_ = 0;
+
+  mutable std::atomic<std::uint64_t> hits_{0};
+  mutable std::atomic<std::uint64_t> misses_{0};
+
+  std::size_t slot_of(const PwType& pw) const {
+    std::uint64_t key = 0;
+    std::memcpy(&key, pw.hash.data(), sizeof(key));
+    return static_cast<std::size_t>(key) & mask_;
+  }
+
+  void insert(const PwType& pw) {
+    if (pw.count < 0) return; // cannot be stored, and not pawned anyway
+    for (std::size_t idx = slot_of(pw);; idx = (idx + 1) & mask_) {
+      PwType& slot = slots_[idx];
+      if (slot.count < 0) {
+        slot = pw;
+        ++size_;
+        return;
+      }
+      if (slot == pw) return; // duplicate
+    }
+  }
+};
+
+} // namespace hibp
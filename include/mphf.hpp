@@ -0,0 +1,120 @@
+#pragma once
+
+#include "flat_file.hpp"
+#include "hibp.hpp"
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <vector>
+
+// MPHF: an immutable, exact lookup format with one disk read per query
+//
+// A minimal perfect hash function maps the n hashes of a sorted db onto the positions [0, n) of a
+// slot array, without collisions. It only takes a few bits per hash and is held in memory. Each
+// slot holds a 32 bit fingerprint of its hash and the count, so a lookup is: compute the position,
+// read that one slot, and compare the fingerprint. Hashes which are not in the db are reported as
+// found with probability 1 / 2^32, which is between sha1t64 and binfuse16.
+//
+// The function is PTHash style: the hashes are split into 256 shards, by their first byte, which
+// are built in parallel. Within a shard each hash goes into one of a number of small buckets, and
+// each bucket has a "pilot", found while building, which places all of its hashes in free
+// positions of a table slightly larger than n. The few positions past n are remapped into the
+// gaps which that leaves below n.
+//
+// The file is the slot array, followed by the function and a trailer, so the slots start at
+// offset 0 and are written as the shards are built:
+//
+//   mphf_slot[records]   in shard order
+//   mphf_shard[256]
+//   uint16_t[pilots]     one per bucket
+//   uint32_t[remaps]     the positions below n for the positions past n, per shard
+//   padding              to a multiple of sizeof(mphf_slot)
+//   mphf_trailer
+
+namespace hibp {
+
+struct mphf_slot {
+  std::uint32_t fingerprint;
+  std::int32_t  count;
+};
+static_assert(sizeof(mphf_slot) == 8);
+
+namespace details {
+
+struct mphf_shard {
+  std::uint64_t first_slot  = 0; // in the slot array
+  std::uint64_t first_pilot = 0; // in the pilots
+  std::uint64_t first_remap = 0; // in the remaps
+  std::uint32_t records     = 0; // ie the slots of this shard
+  std::uint32_t table_size  = 0; // the positions which the pilots map into, >= records
+  std::uint32_t buckets     = 0;
+  std::uint32_t seed        = 0;
+};
+static_assert(sizeof(mphf_shard) == 40);
+
+struct mphf_trailer {
+  std::array<char, 8> magic{'h', 'i', 'b', 'p', 'm', 'p', 'h', 'f'};
+  std::uint32_t       version   = 1;
+  std::uint32_t       hash_size = 0; // of the db it was built from: 20 sha1, 16 ntlm, 8 sha1t64
+  std::uint64_t       records   = 0;
+  std::uint64_t       pilots    = 0;
+  std::uint64_t       remaps    = 0;
+  std::uint64_t       reserved  = 0;
+};
+static_assert(sizeof(mphf_trailer) == 48);
+
+constexpr unsigned mphf_shards = 256;
+
+} // namespace details
+
+// Builds the mphf file for the sorted db, using `threads` threads (0 => one per core). Throws if
+// the db has duplicate or unsorted hashes. `on_written` is called as each shard is written, in
+// order, eg for progress.
+template <pw_type PwType>
+void mphf_build(const std::filesystem::path& db_filename,
+                const std::filesystem::path& mphf_filename, unsigned threads = 0,
+                const std::function<void(unsigned shard)>& on_written = {});
+
+// An mphf file, with its function loaded into memory. The slots are memory mapped where possible,
+// when one instance can be shared by all threads. Elsewhere reads are serialised.
+class mphf_db {
+public:
+  explicit mphf_db(const std::filesystem::path& filename);
+
+  // of the db it was built from, so the type of hashes it can look up
+  [[nodiscard]] std::size_t hash_size() const { return trailer_.hash_size; }
+  [[nodiscard]] std::size_t number_records() const { return trailer_.records; }
+  [[nodiscard]] std::size_t function_size() const; // in bytes, ie its memory use
+
+  // the count of the `hash_size()` byte `hash`, if it is in the db
+  std::optional<int> find(std::span<const std::byte> hash);
+
+  template <pw_type PwType>
+  std::optional<int> find(const PwType& needle) {
+    return find(std::span<const std::byte>(needle.hash));
+  }
+
+private:
+#ifdef FLAT_FILE_HAS_MMAP
+  using slots_t = flat_file::mmap_database<mphf_slot>;
+#else
+  using slots_t = flat_file::database<mphf_slot>;
+#endif
+
+  details::mphf_trailer                                 trailer_;
+  std::array<details::mphf_shard, details::mphf_shards> shards_{};
+  std::vector<std::uint16_t>                            pilots_;
+  std::vector<std::uint32_t>                            remaps_;
+  std::unique_ptr<slots_t>                              slots_;
+#ifndef FLAT_FILE_HAS_MMAP
+  std::mutex mutex_; // the slots are a buffered stream
+#endif
+};
+
+} // namespace hibp
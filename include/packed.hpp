@@ -0,0 +1,120 @@
+#pragma once
+
+#include "flat_file.hpp"
+#include "hibp.hpp"
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <mutex>
+#include <optional>
+#include <ostream>
+#include <vector>
+
+// "packed": a block compressed db format, which stays randomly accessible.
+//
+// Records are stored in blocks of `block_records`, in hash order. Within a block the leading 64bits
+// of each hash (the "key") are delta coded against the previous record and bit packed, at the
+// width of the largest delta in that block. The rest of each hash is stored verbatim, because it
+// is random, and the counts, which are mostly tiny, are varints:
+//
+//   first hash | delta width (1 byte) | deltas, bit packed | hash tails | counts, as LEB128
+//
+// The blocks are followed by an index of the first key and file offset of each block, and a fixed
+// size footer. The index is held in memory, so a lookup reads and decodes exactly one block
+// (~4kB for sha1, ~1.5kB for sha1t64).
+
+namespace hibp::packed {
+
+namespace details {
+
+struct footer {
+  static constexpr std::array<char, 8> expected_magic  = {'H', 'I', 'B', 'P', 'P', 'A', 'K', '\0'};
+  static constexpr std::uint32_t       current_version = 1;
+
+  std::array<char, 8> magic         = expected_magic;
+  std::uint32_t       version       = current_version;
+  std::uint32_t       hash_size     = 0;
+  std::uint32_t       block_records = 0;
+  std::uint32_t       reserved      = 0;
+  std::uint64_t       records       = 0;
+  std::uint64_t       blocks        = 0;
+  std::uint64_t       index_offset  = 0; // the blocks occupy [0, index_offset)
+};
+static_assert(sizeof(footer) == 48);
+
+struct index_entry {
+  std::uint64_t key;    // of the first record in the block
+  std::uint64_t offset; // of the block in the file
+};
+static_assert(sizeof(index_entry) == 16);
+
+} // namespace details
+
+// true if the file is a packed db, of any record type
+bool is_packed(const std::filesystem::path& filename);
+
+// Writes a packed db to a stream, from records in hash order. Only ever appends, so the stream need
+// not be seekable.
+template <pw_type PwType>
+class writer {
+public:
+  static constexpr std::size_t default_block_records = 256;
+
+  explicit writer(std::ostream& os, std::size_t block_records = default_block_records);
+
+  void write(const PwType& pw);
+
+  // writes the last block, the index and the footer
+  void finalize();
+
+  [[nodiscard]] std::uint64_t bytes_written() const { return offset_; }
+
+private:
+  void write_block();
+
+  std::ostream&                     os_; // NOLINT ref
+  std::size_t                       block_records_;
+  std::vector<PwType>               block_;
+  std::vector<std::byte>            buf_;
+  std::vector<details::index_entry> index_;
+  std::uint64_t                     offset_  = 0;
+  std::uint64_t                     records_ = 0;
+  PwType                            last_;
+};
+
+// Reads a packed db. Only the index is held in memory. Thread safe on POSIX, like
+// positional_reader, and elsewhere reads are serialised.
+template <pw_type PwType>
+class database {
+public:
+  explicit database(std::filesystem::path filename);
+
+  std::optional<PwType> find(const PwType& needle);
+
+  // all records with `first` <= record < `last`, or up to the end of the db
+  void read_range(const PwType& first, const std::optional<PwType>& last,
+                  std::vector<PwType>& records);
+
+  // replaces `records` with those of one block
+  void read_block(std::size_t block, std::vector<PwType>& records);
+
+  [[nodiscard]] std::size_t number_records() const { return footer_.records; }
+  [[nodiscard]] std::size_t number_blocks() const { return footer_.blocks; }
+  [[nodiscard]] std::size_t memory() const { return index_.size() * sizeof(details::index_entry); }
+  [[nodiscard]] std::filesystem::path filename() const { return filename_; }
+
+private:
+  // the first block which could contain records with this key
+  [[nodiscard]] std::size_t first_block(std::uint64_t key) const;
+
+  std::filesystem::path              filename_;
+  details::footer                    footer_;
+  std::vector<details::index_entry>  index_;
+  flat_file::impl::positional_reader reader_;
+#ifndef FLAT_FILE_HAS_MMAP
+  std::mutex mutex_; // the reader is a private stream
+#endif
+};
+
+} // namespace hibp::packed
@@ -0,0 +1,113 @@
+#pragma once
+
+#include "hibp.hpp"
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <optional>
+#include <string>
+
+#if __has_include(<unistd.h>) && !defined(_WIN32)
+#define HIBP_PAGED_PREAD
+#endif
+
+// PAGED: a copy of a db, bucketed into disk pages, so a lookup is one aligned read of one page
+//
+// A binary search of the flat db, even narrowed by a toc, touches several pages, some of which a
+// record straddles. The paged layout puts the records into buckets, by the leading 64bits of their
+// hashes, scaled over the keys of the db, so the buckets are in hash order and about equally full.
+// Each bucket is one page of `page_size` bytes (4096 by default): a small header and the sorted
+// records, which are searched in memory with the vectorised hibp::lower_bound. The buckets are ~3/4
+// full on average, so only ~0.1% of them overflow into a chain of further pages.
+//
+//   "<db_filename>.paged"
+//   page 0                 paged_header
+//   pages 1 .. buckets     one per bucket: page_header, PwType[records], unused
+//   the rest               overflow pages, chained from the bucket's page by page_header.next
+//
+// Pages are read with `pread`, at offsets which are multiples of the page size, into a page
+// aligned buffer, so, where the filesystem supports it, the file is opened with O_DIRECT and a
+// lookup is a single device read, which does not depend on the page cache.
+
+namespace hibp {
+
+namespace details {
+
+struct paged_header {
+  std::array<char, 8>       magic{'h', 'i', 'b', 'p', 'p', 'a', 'g', 'e'};
+  std::uint32_t             version   = 1;
+  std::uint32_t             hash_size = 0;
+  std::uint32_t             page_size = 0;
+  std::uint32_t             shift     = 0; // bucket = ((key - first_key) >> shift) * scale >> 32
+  std::uint64_t             scale     = 0;
+  std::uint64_t             first_key = 0; // the leading 64 bits of the first hash
+  std::uint64_t             last_key  = 0;
+  std::uint64_t             buckets   = 0;
+  std::uint64_t             overflows = 0; // pages
+  std::uint64_t             records   = 0;
+  std::array<std::byte, 24> first{}; // the first and last records of the db, to detect when it
+  std::array<std::byte, 24> last{};  // has changed, like the toc
+};
+static_assert(sizeof(paged_header) == 120);
+
+struct page_header {
+  std::uint32_t records = 0;
+  std::uint32_t next    = 0; // the next page of the bucket, or 0 => none
+};
+static_assert(sizeof(page_header) == 8);
+
+} // namespace details
+
+std::filesystem::path paged_filename(const std::filesystem::path& db_filename);
+
+// Checks that the paged copy of a db is valid for it, with pages of `page_size` bytes, a power
+// of 2 from 512, or (re)builds it.
+template <pw_type PwType>
+void paged_build(const std::filesystem::path& db_filename, std::size_t page_size = 4096);
+
+// The paged copy of a db. Thread safe, where `pread` exists. Elsewhere reads are serialised.
+template <pw_type PwType>
+class paged_db {
+public:
+  // `direct` => bypass the page cache, where the file system allows that
+  explicit paged_db(const std::filesystem::path& db_filename, bool direct = true);
+
+  paged_db(const paged_db& other)            = delete;
+  paged_db& operator=(const paged_db& other) = delete;
+  paged_db(paged_db&& other)                 = delete;
+  paged_db& operator=(paged_db&& other)      = delete;
+  ~paged_db();
+
+  [[nodiscard]] std::size_t number_records() const { return header_.records; }
+  [[nodiscard]] std::size_t page_size() const { return header_.page_size; }
+  [[nodiscard]] std::size_t buckets() const { return header_.buckets; }
+  [[nodiscard]] std::size_t overflow_pages() const { return header_.overflows; }
+  [[nodiscard]] bool        direct() const { return direct_; } // ie O_DIRECT, or F_NOCACHE
+
+  // `reads` is incremented by the number of pages read, almost always 1, or 0 for a needle outside
+  // the range of the db
+  std::optional<PwType> find(const PwType& needle, std::size_t& reads);
+
+  std::optional<PwType> find(const PwType& needle) {
+    std::size_t reads = 0;
+    return find(needle, reads);
+  }
+
+private:
+  // reads page `page` into the calling thread's buffer
+  const std::byte* read_page(std::uint64_t page);
+
+  details::paged_header header_;
+  std::string           filename_;
+  bool                  direct_ = false;
+  int                   fd_     = -1;
+#ifndef HIBP_PAGED_PREAD
+  std::ifstream stream_;
+  std::mutex    mutex_; // the stream is shared
+#endif
+};
+
+} // namespace hibp
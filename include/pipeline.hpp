@@ -0,0 +1,124 @@
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstddef>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace pipeline {
+
+// Runs items through 3 stages: `read(item)` fills the next item, in order, on the calling thread,
+// `convert(item)` processes it, on `threads` workers (0 => one per core), and `write(item)`
+// consumes it, in order, on a writer thread.
+//
+// At most `window` items (0 => 2 * threads) are in flight, from being read until they are written,
+// and the Item objects are reused, so the memory is bounded, and there are no allocations once
+// their buffers have grown. `read` returns false at the end of the input, and `write` returns
+// false to stop early. The first exception from any stage stops the pipeline, and is rethrown here.
+template <typename Item>
+void ordered(unsigned threads, std::size_t window, auto&& read, auto&& convert, auto&& write) {
+  if (threads == 0) threads = std::max(std::thread::hardware_concurrency(), 1U);
+  if (window == 0) window = 2UL * threads;
+
+  enum class state { free, loaded, converted };
+
+  std::vector<Item>       items(window);
+  std::vector<state>      states(window, state::free);
+  std::size_t             items_read      = 0; // all guarded by mutex
+  std::size_t             next_to_convert = 0;
+  bool                    end_of_input    = false;
+  bool                    stop            = false;
+  std::exception_ptr      exception;
+  std::mutex              mutex;
+  std::condition_variable cv;
+
+  const auto fail = [&] {
+    const std::lock_guard lk(mutex);
+    if (!exception) exception = std::current_exception();
+    stop = true;
+    cv.notify_all();
+  };
+
+  const auto worker = [&] {
+    while (true) {
+      std::size_t idx = 0;
+      {
+        std::unique_lock lk(mutex);
+        cv.wait(lk, [&] { return next_to_convert < items_read || end_of_input || stop; });
+        if (stop || next_to_convert == items_read) return; // ie done
+        idx = next_to_convert++;
+      }
+      try {
+        convert(items[idx % window]);
+      } catch (...) {
+        fail();
+        return;
+      }
+      const std::lock_guard lk(mutex);
+      states[idx % window] = state::converted;
+      cv.notify_all();
+    }
+  };
+
+  const auto writer = [&] {
+    for (std::size_t idx = 0;; ++idx) {
+      {
+        std::unique_lock lk(mutex);
+        cv.wait(lk, [&] {
+          return states[idx % window] == state::converted || (end_of_input && idx == items_read) ||
+                 stop;
+        });
+        if (stop || states[idx % window] != state::converted) return;
+      }
+      bool more = false;
+      try {
+        more = write(items[idx % window]);
+      } catch (...) {
+        fail();
+        return;
+      }
+      const std::lock_guard lk(mutex);
+      states[idx % window] = state::free;
+      if (!more) stop = true;
+      cv.notify_all();
+      if (!more) return;
+    }
+  };
+
+  {
+    std::vector<std::jthread> workers;
+    for (unsigned i = 0; i != threads; ++i) workers.emplace_back(worker);
+    std::jthread writing(writer);
+
+    for (std::size_t idx = 0;; ++idx) {
+      {
+        std::unique_lock lk(mutex);
+        cv.wait(lk, [&] { return states[idx % window] == state::free || stop; });
+        if (stop) break;
+      }
+      bool more = false;
+      try {
+        more = read(items[idx % window]);
+      } catch (...) {
+        fail();
+        break;
+      }
+      const std::lock_guard lk(mutex);
+      if (more) {
+        states[idx % window] = state::loaded;
+        items_read           = idx + 1;
+      } else {
+        end_of_input = true;
+      }
+      cv.notify_all();
+      if (!more) break;
+    }
+  } // wait here until the workers and the writer are done
+
+  if (exception) std::rethrow_exception(exception);
+}
+
+} // namespace pipeline
@@ -0,0 +1,118 @@
+#pragma once
+
+#include "flat_file.hpp"
+#include "hibp.hpp"
+#include <compare>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <type_traits>
+
+// SPLIT: a "structure of arrays" copy of a db, for searching
+//
+// `pawned_pw` records interleave the hash with the count, so every probe of a binary search drags
+// counts (and, for sha1t64, misaligned hashes) through the cache. The split layout keeps the
+// leading 64 or 128 bits of each hash as a dense column of native, naturally aligned integer keys,
+// and the rest of each record in parallel columns, which are only read on a hit:
+//
+//   "<db_filename>.keys"    a uint64_t (sha1t64) or key128 (ntlm, sha1) per record
+//   "<db_filename>.tails"   a uint32_t per record, the last 4 bytes of the hash (sha1 only)
+//   "<db_filename>.counts"  an int32_t per record
+//
+// Each column is a plain flat_file of its type, with the records in the same positions as in the
+// db, so a toc, pla or hot index of the db narrows searches of the key column just the same.
+
+namespace hibp {
+
+namespace details {
+
+// the leading 128bits of a hash, ordered like the records
+struct alignas(16) key128 {
+  std::uint64_t hi;
+  std::uint64_t lo;
+
+  std::strong_ordering operator<=>(const key128& rhs) const = default;
+};
+static_assert(sizeof(key128) == 16);
+
+template <pw_type PwType>
+using split_key_t = std::conditional_t<PwType::hash_size == 8, std::uint64_t, key128>;
+
+template <pw_type PwType>
+constexpr bool split_has_tail = PwType::hash_size > sizeof(split_key_t<PwType>);
+
+} // namespace details
+
+// Builds the split columns of a db, while its records are written or scanned in order, with the
+// same interface as toc_writer.
+template <pw_type PwType>
+class split_writer {
+public:
+  explicit split_writer(std::filesystem::path db_filename);
+
+  void add(const PwType& pw);
+
+  // closes the columns and renames them into place
+  void finalize();
+
+private:
+  // optional, so finalize() can close them, before they are renamed
+  template <typename T>
+  using column_writer = std::optional<flat_file::file_writer<T>>;
+
+  std::filesystem::path                       db_filename_;
+  column_writer<details::split_key_t<PwType>> keys_;
+  column_writer<std::uint32_t>                tails_;
+  column_writer<std::int32_t>                 counts_;
+  std::uint64_t                               records_ = 0;
+  PwType                                      last_;
+};
+
+// Checks that the split columns of a db are valid for it, or (re)builds them.
+template <pw_type PwType>
+void split_build(const std::filesystem::path& db_filename);
+
+// The split columns of a db. Memory mapped where possible, when one instance can be shared by all
+// threads. Elsewhere reads are serialised.
+template <pw_type PwType>
+class split_db {
+public:
+  using key_type = details::split_key_t<PwType>;
+
+  explicit split_db(const std::filesystem::path& db_filename);
+
+  [[nodiscard]] std::size_t number_records() const { return records_; }
+
+  // searches the records at positions [first, last), eg a toc chapter, only reads the tails and
+  // counts on a hit
+  std::optional<PwType> find(const PwType& needle, std::size_t first, std::size_t last);
+
+  std::optional<PwType> find(const PwType& needle) { return find(needle, 0, records_); }
+
+  PwType get_record(std::size_t pos);
+
+private:
+#ifdef FLAT_FILE_HAS_MMAP
+  template <typename T>
+  using column = flat_file::mmap_database<T>;
+#else
+  template <typename T>
+  using column = flat_file::database<T>;
+#endif
+
+  [[nodiscard]] std::size_t lower_bound(const key_type& key, std::size_t first, std::size_t last);
+
+  std::size_t                            records_ = 0;
+  column<key_type>                       keys_;
+  std::unique_ptr<column<std::uint32_t>> tails_; // sha1 only
+  column<std::int32_t>                   counts_;
+#ifndef FLAT_FILE_HAS_MMAP
+  std::mutex mutex_; // the columns are buffered streams
+#endif
+};
+
+} // namespace hibp
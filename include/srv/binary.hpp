@@ -0,0 +1,88 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <mutex>
+#include <span>
+#include <stop_token>
+#include <string>
+#include <thread>
+
+// BINARY: a compact request protocol, for clients on the same host, eg sidecars, without HTTP
+//
+// A client sends frames on a unix domain socket, or a tcp connection, and may send more frames
+// before the responses to earlier ones have arrived. Each frame is an 8 byte header, followed by
+// `count` raw digests of `digest_size` bytes each, back to back:
+//
+//   uint8_t  format       1 sha1, 2 ntlm, 3 sha1t64, 4 mphf, 5 binfuse16, 6 binfuse8
+//   uint8_t  digest_size  20 sha1, 16 ntlm, 8 sha1t64 and the filters, that of its db for mphf
+//   uint16_t reserved     0
+//   uint32_t count        little endian, up to --max-batch
+//
+// The response to each frame, in the order they were sent, is `count` little endian int32_t
+// counts, with -1 for not found, like the body of a POST /check/:format, and nothing else. A frame
+// which cannot be served, eg for a format with no db, closes the connection.
+
+namespace hibp::srv::binary {
+
+enum class format : std::uint8_t { sha1 = 1, ntlm, sha1t64, mphf, binfuse16, binfuse8 };
+
+struct frame_header {
+  std::uint8_t  format      = 0;
+  std::uint8_t  digest_size = 0;
+  std::uint16_t reserved    = 0;
+  std::uint32_t count       = 0;
+};
+
+constexpr std::size_t header_size = 8; // on the wire
+
+// Fills `counts`, one per digest in `digests`. Throws if the frame cannot be served.
+using handler = std::function<void(const frame_header& header, std::span<const std::byte> digests,
+                                   std::span<std::int32_t> counts)>;
+
+// Accepts connections on a thread of its own, and serves each connection on a thread of its own,
+// as the frames are small, and may arrive one at a time. Pipelined frames which arrive together
+// are all served before their responses are written, together.
+class listener {
+public:
+  // on a unix domain socket at `path`, which replaces any stale socket there
+  listener(const std::string& path, std::size_t max_batch, handler handle);
+
+  // on a tcp port
+  listener(const std::string& address, std::uint16_t port, std::size_t max_batch, handler handle);
+
+  listener(const listener& other)            = delete;
+  listener& operator=(const listener& other) = delete;
+  listener(listener&& other)                 = delete;
+  listener& operator=(listener&& other)      = delete;
+
+  // stops accepting, and closes all connections
+  ~listener();
+
+  [[nodiscard]] const std::string& endpoint() const { return endpoint_; } // for messages
+
+private:
+  struct connection {
+    int               fd = -1;
+    std::atomic<bool> done{false}; // its thread has finished, so it can be joined and closed
+    std::jthread      thread;
+  };
+
+  void start();
+  void accept(const std::stop_token& stop);
+  void serve(connection& conn) const;
+
+  handler               handle_;
+  std::size_t           max_batch_;
+  std::string           path_; // of the unix domain socket, or empty for tcp
+  std::string           endpoint_;
+  int                   fd_ = -1;
+  std::mutex            mutex_; // of the connections
+  std::list<connection> connections_;
+  std::jthread          acceptor_; // last, so it is stopped before the rest is destroyed
+};
+
+} // namespace hibp::srv::binary
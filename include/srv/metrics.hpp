@@ -0,0 +1,77 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// METRICS: counters and latency histograms for `/metrics`, in the Prometheus text format.
+//
+// Each thread has its own set, which only it writes, so counting is a relaxed load and store, with
+// no locks and no contended cache lines. A scrape sums the sets of all threads, which have ever
+// counted anything.
+
+namespace hibp::srv::metrics {
+
+enum class format : std::uint8_t { plain, sha1, ntlm, sha1t64, mphf, binfuse16, binfuse8, range };
+inline constexpr std::size_t formats = 8;
+
+enum class phase : std::uint8_t { hash, search, response };
+inline constexpr std::size_t phases = 3;
+
+// Latency buckets are powers of 2 in ns: bucket i holds durations < 2^(first_bucket_log2 + i)ns,
+// ie from 1us to ~2s, and the last bucket is the rest.
+inline constexpr unsigned    first_bucket_log2 = 10;
+inline constexpr std::size_t buckets           = 22;
+
+using clock = std::chrono::steady_clock;
+
+// the counters of one thread
+struct alignas(64) thread_counters {
+  using counter = std::atomic<std::uint64_t>;
+
+  std::array<counter, formats>                          requests{};
+  std::array<std::array<counter, 2>, formats>           lookups{}; // [not found, found]
+  std::array<counter, formats>                          db_reads{};
+  std::array<counter, formats>                          prefilter_rejects{};
+  std::array<counter, phases>                           phase_ns{};
+  std::array<std::array<counter, buckets + 1>, formats> latency{};
+  std::array<counter, formats>                          latency_ns{};
+};
+
+// this thread's counters
+thread_counters& local();
+
+// the timings of one request, from when it was received. Copyable, so it can be finished on
+// another thread, eg in a `--uring` callback.
+class request {
+public:
+  explicit request(format fmt);
+
+  // adds the time since the previous mark, or the start, to `phase`
+  void mark(phase p);
+
+  // counts the result of looking up one needle
+  void lookup(bool found) const;
+
+  // counts `reads` of the db file which were needed for this request
+  void reads(std::size_t reads) const;
+
+  // counts a needle which the `--prefilter` proved is not in the db, so was not looked up
+  void rejected() const;
+
+  // records the latency of the whole request. Call once, after responding.
+  void done() const;
+
+private:
+  format            fmt_;
+  clock::time_point start_;
+  clock::time_point mark_;
+};
+
+// all the counters of all threads, in the Prometheus text exposition format
+std::string render();
+
+} // namespace hibp::srv::metrics
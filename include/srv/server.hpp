@@ -1,5 +1,6 @@
 #pragma once
 
+#include <cstddef>
 #include <cstdint>
 #include <string>
 #include <thread>
@@ -12,13 +13,37 @@ struct cli_config_t {
   std::string   sha1t64_db_filename;
   std::string   binfuse8_filter_filename;
   std::string   binfuse16_filter_filename;
+  std::string   hot_sha1_db_filename;
+  std::string   hot_ntlm_db_filename;
+  std::string   hot_sha1t64_db_filename;
+  std::string   prefilter_filename;
+  std::string   mphf_db_filename;
+  std::string   binary_socket; // a unix domain socket for the binary protocol, empty => none
   std::string   bind_address = "localhost";
   std::uint16_t port         = 8082;
+  std::uint16_t binary_port  = 0; // a tcp port for the binary protocol, 0 => none
   unsigned int  threads      = std::thread::hardware_concurrency();
+  bool          reuse_port   = false; // a pinned, single threaded server per thread
   bool          json         = false;
   bool          perf_test    = false;
+  bool          mmap         = false;
+  bool          warmup       = false;
+  unsigned      warmup_depth = 16; // levels of each search read into memory by --warmup
+  bool          lock_memory  = false;
   bool          toc          = false;
   unsigned      toc_bits     = 20; // 1Mega chapters
+  bool          pla          = false;
+  unsigned      pla_epsilon  = 64; // search window of ~1 disk page
+  bool          split        = false;
+  bool          paged        = false;
+  std::size_t   page_size    = 4096; // of --paged dbs
+  bool          uring        = false;
+  unsigned      uring_depth  = 256; // reads in flight per db
+  std::size_t   cache_mb     = 0;  // 0 => no shared page cache
+  std::size_t   hot_index_mb = 0;  // 0 => no hot index
+  std::size_t   max_batch    = 10'000;
+  std::size_t   range_cache  = 0; // number of /range bodies cached, 0 => off
+  bool          admin_reload = false;
 };
 
 extern cli_config_t cli;
@@ -1,18 +1,247 @@
 #pragma once
 
+#include "arrcmp.hpp"
 #include "flat_file.hpp"
 #include "hibp.hpp"
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
 #include <cstdlib>
 #include <filesystem>
+#include <fmt/format.h>
+#include <limits>
+#include <memory>
 #include <optional>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
 
 namespace hibp {
 
+namespace details {
+
+template <pw_type PwType>
+std::uint32_t pw_to_prefix(const PwType& pw, unsigned bits) {
+  return arrcmp::impl::bytearray_cast<std::uint32_t>(pw.hash.data()) >>
+         (sizeof(std::uint32_t) * 8 - bits);
+}
+
+// the leading 64bits of the hash, big-endian, so keys are ordered like the records
+template <pw_type PwType>
+std::uint64_t pw_to_key(const PwType& pw) {
+  return arrcmp::impl::bytearray_cast<std::uint64_t>(pw.hash.data());
+}
+
+struct pla_segment {
+  std::uint64_t key;   // of the first record in this segment
+  std::uint64_t pos;   // of the first record in this segment
+  double        slope; // records per unit of key
+};
+static_assert(sizeof(pla_segment) == 24);
+
+class toc_table;
+class pla_model;
+
+} // namespace details
+
+// "<db_filename>.<bits>.toc"
+std::string toc_filename(const std::filesystem::path& db_filename, unsigned bits);
+
+// Loads "<db_filename>.<bits>.toc", if it is valid for the db, or (re)builds and saves it.
 template <pw_type PwType>
 void toc_build(const std::filesystem::path& db_filename, unsigned bits);
 
+// [begin, end) record positions of the chapter which would contain `needle`. Empty if the needle is
+// beyond the end of a partial toc, and therefore "not found".
+template <pw_type PwType>
+std::optional<std::pair<std::size_t, std::size_t>> toc_chapter(const PwType& needle, unsigned bits,
+                                                               std::size_t db_size);
+
+// The toc of one db, for when more than one db of a type is searched at a time, eg by hibp-server
+// while it reloads its dbs. toc_build() and toc_chapter() use a single one for each type of pw.
+template <pw_type PwType>
+class toc_index {
+public:
+  // loads the toc, if it is valid for the db, or (re)builds and saves it, like toc_build()
+  toc_index(const std::filesystem::path& db_filename, unsigned bits);
+
+  // as toc_chapter()
+  [[nodiscard]] std::optional<std::pair<std::size_t, std::size_t>>
+  chapter(const PwType& needle, std::size_t db_size) const;
+
+private:
+  std::shared_ptr<const details::toc_table> table_;
+  unsigned                                  bits_;
+};
+
+// works with any of the flat_file database types
+template <pw_type PwType, typename DbType>
+std::optional<PwType> toc_search(DbType& db, const PwType& needle, unsigned bits) {
+  const auto chapter = toc_chapter(needle, bits, db.number_records());
+  if (!chapter) {
+    return {}; // must be partial db & toc, and therefore "not found"
+  }
+  auto last = db.begin() + chapter->second;
+  if (auto iter = hibp::lower_bound(db.begin() + chapter->first, last, needle);
+      iter != last && *iter == needle) {
+    return *iter; // found!
+  }
+  return {}; // not found;
+}
+
+// Builds the toc of a db as a side output, while the db's records are being written in order (eg
+// by hibp-download, hibp-sort or hibp-convert), which saves rescanning the db afterwards. Call
+// `add()` for every record and then `finalize()`, which saves "<db_filename>.<bits>.toc".
+template <pw_type PwType>
+class toc_writer {
+public:
+  toc_writer(std::filesystem::path db_filename, unsigned bits)
+      : db_filename_(std::move(db_filename)), bits_(bits) {
+    entries_.reserve(1UL << bits_);
+  }
+
+  void add(const PwType& pw) {
+    const std::uint32_t prefix = details::pw_to_prefix(pw, bits_);
+    if (!entries_.empty() && prefix < entries_.size() - 1) {
+      throw std::runtime_error(fmt::format("Cannot build table of contents for {}: records are "
+                                           "not sorted by hash at record {}.",
+                                           db_filename_.string(), records_));
+    }
+    // prefixes without any records get an empty chapter
+    while (entries_.size() <= prefix) entries_.push_back(records_);
+    if (records_ == 0) first_ = pw;
+    last_ = pw;
+    ++records_;
+  }
+
+  void finalize();
+
+private:
+  std::filesystem::path      db_filename_;
+  unsigned                   bits_;
+  std::vector<std::uint64_t> entries_;
+  std::uint64_t              records_ = 0;
+  PwType                     first_;
+  PwType                     last_;
+};
+
+// PLA: "Piecewise linear approximation", a learned alternative to the toc
+//
+// Models the position of a record as a piecewise linear function of the leading 64bits of its
+// hash. The fit guarantees that every record is within `epsilon` positions of its prediction, so a
+// search only visits a window of about 2 * epsilon records, typically a single disk read. Hashes
+// are close to uniformly distributed, so few segments are needed.
+
+// Loads "<db_filename>.<epsilon>.pla", if it is valid for the db, or (re)builds and saves it.
+template <pw_type PwType>
+void pla_build(const std::filesystem::path& db_filename, unsigned epsilon);
+
+// [begin, end) record positions of the window which would contain `needle`. Empty if the needle
+// sorts before the first record.
+template <pw_type PwType>
+std::pair<std::size_t, std::size_t> pla_window(const PwType& needle, std::size_t db_size);
+
+// The pla of one db, as toc_index is for the toc
+template <pw_type PwType>
+class pla_index {
+public:
+  // loads the pla, if it is valid for the db, or (re)builds and saves it, like pla_build()
+  pla_index(const std::filesystem::path& db_filename, unsigned epsilon);
+
+  // as pla_window()
+  [[nodiscard]] std::pair<std::size_t, std::size_t> window(const PwType& needle,
+                                                           std::size_t   db_size) const;
+
+private:
+  std::shared_ptr<const details::pla_model> model_;
+};
+
+// works with any of the flat_file database types
+template <pw_type PwType, typename DbType>
+std::optional<PwType> pla_search(DbType& db, const PwType& needle) {
+  const auto [first, last] = pla_window(needle, db.number_records());
+  if (first == last) return {}; // not found
+  auto begin = db.begin() + first;
+  auto end   = db.begin() + last;
+  // touch the start of the window first, so buffered dbs read the whole window in one go
+  if (*begin == needle) return *begin; // found!
+  if (auto iter = hibp::lower_bound(begin, end, needle); iter != end && *iter == needle) {
+    return *iter; // found!
+  }
+  return {}; // not found
+}
+
+// Fits the pla of a db while its records are written or scanned in order, with the same interface
+// as toc_writer. Uses a "shrinking cone": each segment keeps the range of slopes which predict all
+// its records so far to within epsilon, and a new segment starts when that range becomes empty.
+// Records which share a key are predicted by the first of them, and the longest such run widens
+// the search window.
 template <pw_type PwType>
-std::optional<PwType> toc_search(flat_file::database<PwType>& db, const PwType& needle,
-                                 unsigned bits);
+class pla_writer {
+public:
+  pla_writer(std::filesystem::path db_filename, unsigned epsilon)
+      : db_filename_(std::move(db_filename)), epsilon_(epsilon) {}
+
+  void add(const PwType& pw) {
+    const std::uint64_t key = details::pw_to_key(pw);
+    if (records_ == 0) {
+      start_segment(key);
+      first_ = pw;
+    } else if (key < prev_key_) {
+      throw std::runtime_error(fmt::format("Cannot build pla index for {}: records are not sorted "
+                                           "by hash at record {}.",
+                                           db_filename_.string(), records_));
+    } else if (key == prev_key_) {
+      max_run_ = std::max(max_run_, ++run_);
+    } else {
+      run_          = 1;
+      const auto dx = static_cast<double>(key - segment_.key);
+      const auto dy = static_cast<double>(records_ - segment_.pos);
+      const auto lo = (dy - epsilon_) / dx;
+      const auto hi = (dy + epsilon_) / dx;
+      if (lo > slope_hi_ || hi < slope_lo_) {
+        close_segment();
+        start_segment(key);
+      } else {
+        slope_lo_ = std::max(slope_lo_, lo);
+        slope_hi_ = std::min(slope_hi_, hi);
+      }
+    }
+    prev_key_ = key;
+    last_     = pw;
+    ++records_;
+  }
+
+  void finalize();
+
+private:
+  void start_segment(std::uint64_t key) {
+    segment_  = {.key = key, .pos = records_, .slope = 0.0};
+    slope_lo_ = 0.0;
+    slope_hi_ = std::numeric_limits<double>::infinity();
+  }
+
+  void close_segment() {
+    // single record segments have an infinite cone, any slope >= 0 will do
+    segment_.slope = slope_hi_ == std::numeric_limits<double>::infinity()
+                         ? 0.0
+                         : (slope_lo_ + slope_hi_) / 2;
+    segments_.push_back(segment_);
+  }
+
+  std::filesystem::path             db_filename_;
+  unsigned                          epsilon_;
+  std::vector<details::pla_segment> segments_;
+  details::pla_segment              segment_{};
+  double                            slope_lo_ = 0.0;
+  double                            slope_hi_ = 0.0;
+  std::uint64_t                     prev_key_ = 0;
+  std::uint64_t                     run_      = 1;
+  std::uint64_t                     max_run_  = 1;
+  std::uint64_t                     records_  = 0;
+  PwType                            first_;
+  PwType                            last_;
+};
 
 } // namespace hibp
@@ -0,0 +1,52 @@
+#pragma once
+
+#include "hibp.hpp"
+#include <cstddef>
+#include <exception>
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <optional>
+
+// URING: asynchronous searches of a flat_file db with Linux io_uring (no liburing needed)
+//
+// Each search is a small state machine: it reads a disk page worth of records around the middle of
+// its current range, narrows the range using all of them, and then submits the next read, until
+// the records which remain fit in a single read. One thread runs the ring for all searches, so the
+// reads of many concurrent searches are submitted to the kernel in one batch, and there can be a
+// deep queue of them in flight, without a blocked thread for each.
+
+namespace hibp {
+
+// true if the kernel supports io_uring (Linux 5.7+), and it has not been disabled
+bool uring_available();
+
+template <pw_type PwType>
+class uring_search {
+public:
+  // `found` is empty if the needle is not in the db. Called on the thread which runs the ring, so
+  // it should be short and must not throw.
+  using callback = std::function<void(std::optional<PwType> found, std::exception_ptr error)>;
+
+  // at most `queue_depth` reads are in flight, more searches wait for a free slot
+  explicit uring_search(const std::filesystem::path& db_filename, unsigned queue_depth = 256);
+
+  uring_search(const uring_search& other)            = delete;
+  uring_search& operator=(const uring_search& other) = delete;
+  uring_search(uring_search&& other)                 = delete;
+  uring_search& operator=(uring_search&& other)      = delete;
+
+  // searches in progress are abandoned, without calling their callbacks
+  ~uring_search();
+
+  [[nodiscard]] std::size_t number_records() const;
+
+  // starts a search of the records at positions [first, last), eg a toc chapter. Thread safe.
+  void find(const PwType& needle, std::size_t first, std::size_t last, callback done);
+
+private:
+  struct impl;
+  std::unique_ptr<impl> impl_;
+};
+
+} // namespace hibp
@@ -1,14 +1,22 @@
 #include "diffutils.hpp"
 #include "flat_file.hpp"
 #include "hibp.hpp"
+#include "pipeline.hpp"
 #include <algorithm>
+#include <cctype>
+#include <charconv>
+#include <cstddef>
 #include <cstdlib>
 #include <filesystem>
 #include <fmt/chrono.h> // IWYU pragma: keep
 #include <fmt/format.h>
 #include <iostream>
+#include <sstream>
 #include <stdexcept>
+#include <string>
+#include <string_view>
 #include <type_traits>
+#include <vector>
 
 namespace hibp::diffutils {
 
@@ -26,66 +34,192 @@ struct hunk {
   }
 };
 
+namespace {
+
+// 4096 chapters by leading 12 hash bits: plenty to balance the work across any number of cores,
+// and small enough (~5MB for the full sha1 db) to be read into memory whole
+constexpr unsigned    chapter_bits     = 12;
+constexpr std::size_t chapters         = 1U << chapter_bits;
+constexpr std::size_t hunk_pos_digits  = 8;
+constexpr std::size_t hunk_hash_offset = 2 + hunk_pos_digits + 1; // "T:PPPPPPPP:"
+constexpr std::size_t patch_buf_bytes  = 1U << 22U;
+
+// the position of the first record of each chapter in the db, followed by the end
 template <hibp::pw_type PwType>
-void run_diff(const std::filesystem::path& old_path, const std::filesystem::path& new_path,
-              std::ostream& diff) {
-  flat_file::database<PwType> db_old(old_path, (1U << 16U) / sizeof(PwType));
-  flat_file::database<PwType> db_new(new_path, (1U << 16U) / sizeof(PwType));
-
-  auto old_begin   = db_old.begin();
-  auto new_begin   = db_new.begin();
-  auto deep_equals = [](const PwType& a, const PwType& b) { return a == b && a.count == b.count; };
-  while (true) {
-    auto [diff_iter_old, diff_iter_new] =
-        std::mismatch(old_begin, db_old.end(), new_begin, db_new.end(), deep_equals);
-
-    if (diff_iter_old == db_old.end()) {
-      // OLD was shorter..
-      // copy rest of new into diff as inserts
-      while (diff_iter_new != db_new.end()) {
-        const hunk h{hunk_type::insert, static_cast<unsigned>(diff_iter_old - db_old.begin()),
-                     *diff_iter_new};
-        diff << h << '\n';
-
-        ++diff_iter_new;
-      }
-      break;
+std::vector<std::size_t> chapter_starts(const std::filesystem::path& path) {
+  flat_file::database<PwType> db(path); // unbuffered, the searches only read single records
+
+  std::vector<std::size_t> starts{0};
+  starts.reserve(chapters + 1);
+  for (std::size_t chapter = 1; chapter != chapters; ++chapter) {
+    PwType needle;
+    needle.hash[0] = static_cast<std::byte>(chapter >> (chapter_bits - 8));
+    needle.hash[1] = static_cast<std::byte>(chapter << (16 - chapter_bits));
+    auto first     = db.begin() + starts.back();
+    starts.push_back(static_cast<std::size_t>(hibp::lower_bound(first, db.end(), needle) -
+                                              db.begin()));
+  }
+  starts.push_back(db.number_records());
+  return starts;
+}
+
+// the records [first, last) of the db, in one read
+template <hibp::pw_type PwType>
+void read_chapter(flat_file::database<PwType>& db, std::size_t first, std::size_t last,
+                  std::vector<PwType>& records) {
+  records.resize(last - first);
+  db.read(first, records.size(), records.data());
+}
+
+// Diffs one chapter, in memory, with hunk positions offset by the chapter's start in OLD. Both are
+// sorted by hash, so this is a merge, in which any record of OLD that is missing from NEW is an
+// error.
+template <hibp::pw_type PwType>
+void diff_chapter(const std::vector<PwType>& old_recs, const std::vector<PwType>& new_recs,
+                  std::size_t old_offset, std::ostream& diff) {
+  auto old_iter = old_recs.begin();
+  auto new_iter = new_recs.begin();
+  while (new_iter != new_recs.end()) {
+    const auto pos = static_cast<unsigned>(old_offset + static_cast<std::size_t>(
+                                                            old_iter - old_recs.begin()));
+    if (old_iter == old_recs.end() || *new_iter < *old_iter) {
+      diff << hunk{hunk_type::insert, pos, *new_iter} << '\n';
+      ++new_iter;
+      continue;
     }
-    if (diff_iter_new == db_new.end()) { // protect against deref of end()
-      throw std::runtime_error("NEW was shorter");
+    if (*old_iter < *new_iter) {
+      throw std::runtime_error(fmt::format("Deletion from OLD at {:08X}", pos));
     }
-    // fine to dereference both
-
-    if (std::next(diff_iter_old) != db_old.end() &&
-        deep_equals(*std::next(diff_iter_old), *diff_iter_new)) {
-      throw std::runtime_error("Deletion from OLD");
+    if (old_iter->count != new_iter->count) {
+      diff << hunk{hunk_type::update, pos, *new_iter} << '\n';
     }
-    // fine to dereference std::next(new)
-    if (std::next(diff_iter_new) != db_new.end() &&
-        deep_equals(*diff_iter_old, *std::next(diff_iter_new))) {
-      const hunk h{hunk_type::insert, static_cast<unsigned>(diff_iter_old - db_old.begin()),
-                   *diff_iter_new};
-      diff << h << '\n';
-      old_begin = diff_iter_old;
-      new_begin = diff_iter_new + 1;
-      continue;
+    ++old_iter;
+    ++new_iter;
+  }
+  if (old_iter != old_recs.end()) {
+    throw std::runtime_error("NEW was shorter");
+  }
+}
+
+// "T:PPPPPPPP:HASH:COUNT", as written by run_diff
+template <hibp::pw_type PwType>
+hunk<PwType> parse_hunk(std::string_view line, std::size_t line_no) {
+  auto malformed = [&] {
+    return std::runtime_error(fmt::format("Malformed hunk at line {}: '{}'", line_no, line));
+  };
+  if (line.size() <= hunk_hash_offset + PwType::hash_str_size || line[1] != ':' ||
+      line[hunk_hash_offset - 1] != ':' || line[hunk_hash_offset + PwType::hash_str_size] != ':' ||
+      (line[0] != static_cast<char>(hunk_type::update) &&
+       line[0] != static_cast<char>(hunk_type::insert))) {
+    throw malformed();
+  }
+  const auto hash = line.substr(hunk_hash_offset, PwType::hash_str_size);
+  if (!std::all_of(hash.begin(), hash.end(), [](char c) { return std::isxdigit(c) != 0; })) {
+    throw malformed();
+  }
+
+  hunk<PwType> h{static_cast<hunk_type>(line[0]), 0, PwType{line.substr(hunk_hash_offset)}};
+  const auto* pos_end = line.data() + hunk_hash_offset - 1;
+  if (auto [ptr, ec] = std::from_chars(line.data() + 2, pos_end, h.pos, 16);
+      ec != std::errc{} || ptr != pos_end) {
+    throw malformed();
+  }
+  return h;
+}
+
+} // namespace
+
+template <hibp::pw_type PwType>
+void run_diff(const std::filesystem::path& old_path, const std::filesystem::path& new_path,
+              std::ostream& diff, unsigned threads) {
+  const auto old_starts = chapter_starts<PwType>(old_path);
+  const auto new_starts = chapter_starts<PwType>(new_path);
+
+  // chapters are read in order, diffed in parallel, and their hunks are written out in order
+  struct chapter_diff {
+    std::size_t         chapter = 0;
+    std::vector<PwType> old_recs;
+    std::vector<PwType> new_recs;
+    std::ostringstream  hunks;
+  };
+
+  flat_file::database<PwType> db_old(old_path);
+  flat_file::database<PwType> db_new(new_path);
+  std::size_t                 next_chapter = 0;
+
+  const auto read = [&](chapter_diff& item) {
+    if (next_chapter == chapters) return false;
+    item.chapter = next_chapter++;
+    read_chapter(db_old, old_starts[item.chapter], old_starts[item.chapter + 1], item.old_recs);
+    read_chapter(db_new, new_starts[item.chapter], new_starts[item.chapter + 1], item.new_recs);
+    return true;
+  };
+
+  const auto convert = [&](chapter_diff& item) {
+    diff_chapter(item.old_recs, item.new_recs, old_starts[item.chapter], item.hunks);
+  };
+
+  const auto write = [&](chapter_diff& item) {
+    diff << item.hunks.view();
+    item.hunks.str({});
+    return true;
+  };
+
+  pipeline::ordered<chapter_diff>(threads, 0, read, convert, write);
+}
+
+template <hibp::pw_type PwType>
+std::size_t run_patch(const std::filesystem::path& old_path, std::istream& diff,
+                      std::ostream& new_db) {
+  flat_file::database<PwType>      db_old(old_path, patch_buf_bytes / sizeof(PwType));
+  flat_file::stream_writer<PwType> writer(new_db, patch_buf_bytes / sizeof(PwType));
+
+  auto        old_iter = db_old.begin();
+  std::size_t pos      = 0;
+  std::size_t hunks    = 0;
+  std::size_t line_no  = 0;
+  for (std::string line; std::getline(diff, line);) {
+    ++line_no;
+    if (line.empty()) continue;
+    const auto h = parse_hunk<PwType>(line, line_no);
+    if (h.pos < pos || h.pos > db_old.number_records()) {
+      throw std::runtime_error(fmt::format(
+          "Hunk at line {} is out of order or beyond the end of OLD: '{}'", line_no, line));
     }
-    if (*diff_iter_old != *diff_iter_new) { // comparing hash only
-      throw std::runtime_error("Replacement implies deletion");
+    for (; pos != h.pos; ++pos, ++old_iter) writer.write(*old_iter);
+
+    const bool at_end = pos == db_old.number_records();
+    if (h.type == hunk_type::update) {
+      if (at_end || *old_iter != h.pw) {
+        throw std::runtime_error(
+            fmt::format("Update at line {} does not match OLD: '{}'", line_no, line));
+      }
+      ++pos;
+      ++old_iter;
+    } else if (!at_end && !(h.pw < *old_iter)) {
+      throw std::runtime_error(
+          fmt::format("Insert at line {} does not sort before OLD: '{}'", line_no, line));
     }
-    const hunk h{hunk_type::update, static_cast<unsigned>(diff_iter_old - db_old.begin()),
-                 *diff_iter_new};
-    diff << h << '\n';
-    old_begin = diff_iter_old + 1;
-    new_begin = diff_iter_new + 1;
+    writer.write(h.pw);
+    ++hunks;
   }
+  for (; old_iter != db_old.end(); ++old_iter) writer.write(*old_iter);
+  writer.flush(true);
+  return hunks;
 }
 
 template void run_diff<hibp::pawned_pw_sha1>(const std::filesystem::path& old_path,
                                              const std::filesystem::path& new_path,
-                                             std::ostream&                diff);
+                                             std::ostream&                diff,
+                                             unsigned                     threads);
 template void run_diff<hibp::pawned_pw_ntlm>(const std::filesystem::path& old_path,
                                              const std::filesystem::path& new_path,
-                                             std::ostream&                diff);
+                                             std::ostream&                diff,
+                                             unsigned                     threads);
+
+template std::size_t run_patch<hibp::pawned_pw_sha1>(const std::filesystem::path& old_path,
+                                                     std::istream& diff, std::ostream& new_db);
+template std::size_t run_patch<hibp::pawned_pw_ntlm>(const std::filesystem::path& old_path,
+                                                     std::istream& diff, std::ostream& new_db);
 
 } // namespace hibp::diffutils
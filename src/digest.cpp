@@ -0,0 +1,505 @@
+#include "digest.hpp"
+#include <array>
+#include <bit>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <span>
+#include <stdexcept>
+#include <string_view>
+
+#if defined(__GNUC__) || defined(__clang__)
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+namespace hibp::digest {
+
+namespace {
+
+constexpr std::size_t block_size = 64;
+constexpr std::size_t max_single = block_size - 9; // leaves room for the 0x80 and the length
+
+using block_t = std::array<std::uint8_t, block_size>;
+
+constexpr std::array<std::uint32_t, 5> sha1_init = {0x67452301, 0xEFCDAB89, 0x98BADCFE,
+                                                    0x10325476, 0xC3D2E1F0};
+constexpr std::array<std::uint32_t, 4> md4_init  = {0x67452301, 0xEFCDAB89, 0x98BADCFE,
+                                                    0x10325476};
+
+std::uint32_t load_be32(const std::uint8_t* p) noexcept {
+  return std::uint32_t{p[0]} << 24U | std::uint32_t{p[1]} << 16U | std::uint32_t{p[2]} << 8U |
+         std::uint32_t{p[3]};
+}
+
+std::uint32_t load_le32(const std::uint8_t* p) noexcept {
+  return std::uint32_t{p[3]} << 24U | std::uint32_t{p[2]} << 16U | std::uint32_t{p[1]} << 8U |
+         std::uint32_t{p[0]};
+}
+
+template <bool BigEndian>
+std::uint32_t load32(const std::uint8_t* p) noexcept {
+  return BigEndian ? load_be32(p) : load_le32(p);
+}
+
+template <std::size_t Words, bool BigEndian>
+std::array<std::byte, Words * 4> to_digest(std::array<std::uint32_t, Words> state) noexcept {
+  if constexpr (BigEndian == (std::endian::native == std::endian::little)) {
+    for (auto& word: state) word = __builtin_bswap32(word);
+  }
+  std::array<std::byte, Words * 4> digest{};
+  std::memcpy(digest.data(), state.data(), digest.size());
+  return digest;
+}
+
+// The compression functions are written once, for `V` = a uint32_t, or a gcc/clang vector of them
+// with one password per lane: the vector extensions have the same operators as scalars. They must
+// be inlined into the callers, which enable the instruction set.
+
+// in place, because passing vectors by value warns about the abi
+template <typename V>
+[[gnu::always_inline]] inline void rotate_left(V& x, unsigned n) noexcept {
+  x = (x << n) | (x >> (32U - n));
+}
+
+// `w` is the block as 16 big-endian words, and is used for the message schedule
+template <typename V>
+[[gnu::always_inline]] inline void sha1_compress(V* state, V* w) noexcept {
+  V a = state[0];
+  V b = state[1];
+  V c = state[2];
+  V d = state[3];
+  V e = state[4];
+  for (unsigned t = 0; t != 80; ++t) {
+    if (t >= 16) {
+      w[t % 16] = w[(t + 13) % 16] ^ w[(t + 8) % 16] ^ w[(t + 2) % 16] ^ w[t % 16];
+      rotate_left(w[t % 16], 1);
+    }
+    V             f = b ^ c ^ d;
+    std::uint32_t k = t < 40 ? 0x6ED9EBA1 : 0xCA62C1D6;
+    if (t < 20) {
+      f = d ^ (b & (c ^ d));
+      k = 0x5A827999;
+    } else if (t >= 40 && t < 60) {
+      f = (b & c) | (d & (b | c));
+      k = 0x8F1BBCDC;
+    }
+    V temp = a;
+    rotate_left(temp, 5);
+    temp += f + e + k + w[t % 16];
+    e = d;
+    d = c;
+    c = b;
+    rotate_left(c, 30);
+    b = a;
+    a = temp;
+  }
+  state[0] += a;
+  state[1] += b;
+  state[2] += c;
+  state[3] += d;
+  state[4] += e;
+}
+
+// `x` is the block as 16 little-endian words
+template <typename V>
+[[gnu::always_inline]] inline void md4_compress(V* state, const V* x) noexcept {
+  constexpr std::array<unsigned, 4>  shift1 = {3, 7, 11, 19};
+  constexpr std::array<unsigned, 4>  shift2 = {3, 5, 9, 13};
+  constexpr std::array<unsigned, 4>  shift3 = {3, 9, 11, 15};
+  constexpr std::array<unsigned, 16> order3 = {0, 8,  4, 12, 2, 10, 6, 14,
+                                               1, 9,  5, 13, 3, 11, 7, 15};
+
+  std::array<V, 4> v = {state[0], state[1], state[2], state[3]};
+  for (unsigned i = 0; i != 48; ++i) {
+    // each step updates a, d, c, b in turn, from the other three in order
+    const unsigned p = (4 - i % 4) % 4;
+    const V&       b = v[(p + 1) % 4];
+    const V&       c = v[(p + 2) % 4];
+    const V&       d = v[(p + 3) % 4];
+    const unsigned j = i % 16;
+    if (i < 16) {
+      v[p] += ((b & c) | (~b & d)) + x[j];
+      rotate_left(v[p], shift1[j % 4]);
+    } else if (i < 32) {
+      v[p] += ((b & c) | (b & d) | (c & d)) + x[(j % 4) * 4 + j / 4] + 0x5A827999U;
+      rotate_left(v[p], shift2[j % 4]);
+    } else {
+      v[p] += (b ^ c ^ d) + x[order3[j]] + 0x6ED9EBA1U;
+      rotate_left(v[p], shift3[j % 4]);
+    }
+  }
+  for (unsigned i = 0; i != 4; ++i) state[i] += v[i];
+}
+
+void sha1_block_scalar(std::uint32_t* state, const std::uint8_t* block) noexcept {
+  std::array<std::uint32_t, 16> w{};
+  for (std::size_t j = 0; j != w.size(); ++j) w[j] = load_be32(block + 4 * j);
+  sha1_compress(state, w.data());
+}
+
+void md4_block_scalar(std::uint32_t* state, const std::uint8_t* block) noexcept {
+  std::array<std::uint32_t, 16> x{};
+  for (std::size_t j = 0; j != x.size(); ++j) x[j] = load_le32(block + 4 * j);
+  md4_compress(state, x.data());
+}
+
+#if defined(__GNUC__) || defined(__clang__)
+
+// 4 rounds of SHA-NI, from the 3rd group onwards, ie the steady state of the message schedule,
+// where msg[K % 4] holds the words of this group
+template <unsigned K>
+__attribute__((target("sha,sse4.1"), always_inline)) inline void
+sha_ni_rounds(__m128i& abcd, __m128i& e0, __m128i& e1, std::array<__m128i, 4>& msg) noexcept {
+  __m128i& e    = K % 2 == 0 ? e0 : e1;
+  __m128i& next = K % 2 == 0 ? e1 : e0;
+  e             = _mm_sha1nexte_epu32(e, msg[K % 4]);
+  next          = abcd;
+  if constexpr (K + 1 < 20) msg[(K + 1) % 4] = _mm_sha1msg2_epu32(msg[(K + 1) % 4], msg[K % 4]);
+  abcd = _mm_sha1rnds4_epu32(abcd, e, K / 5);
+  if constexpr (K + 3 < 20) msg[(K + 3) % 4] = _mm_sha1msg1_epu32(msg[(K + 3) % 4], msg[K % 4]);
+  if constexpr (K + 2 < 20) msg[(K + 2) % 4] = _mm_xor_si128(msg[(K + 2) % 4], msg[K % 4]);
+}
+
+template <unsigned... K>
+__attribute__((target("sha,sse4.1"), always_inline)) inline void
+sha_ni_all_rounds(__m128i& abcd, __m128i& e0, __m128i& e1, std::array<__m128i, 4>& msg,
+                  std::integer_sequence<unsigned, K...> /*groups*/) noexcept {
+  (sha_ni_rounds<K + 3>(abcd, e0, e1, msg), ...);
+}
+
+__attribute__((target("sha,sse4.1"))) void sha1_block_sha_ni(std::uint32_t*      state,
+                                                             const std::uint8_t* block) noexcept {
+  const auto bswap = _mm_set_epi64x(0x0001020304050607LL, 0x08090a0b0c0d0e0fLL);
+
+  __m128i abcd = _mm_shuffle_epi32(
+      _mm_loadu_si128(reinterpret_cast<const __m128i*>(state)), 0x1B); // NOLINT reincast
+  __m128i e0 = _mm_set_epi32(static_cast<int>(state[4]), 0, 0, 0);
+  __m128i e1{};
+
+  const __m128i abcd_save = abcd;
+  const __m128i e0_save   = e0;
+
+  std::array<__m128i, 4> msg{};
+  for (std::size_t i = 0; i != msg.size(); ++i) {
+    msg[i] = _mm_shuffle_epi8(
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(block + 16 * i)), // NOLINT reincast
+        bswap);
+  }
+
+  // rounds 0-11, while the message schedule fills up
+  e0     = _mm_add_epi32(e0, msg[0]);
+  e1     = abcd;
+  abcd   = _mm_sha1rnds4_epu32(abcd, e0, 0);
+  e1     = _mm_sha1nexte_epu32(e1, msg[1]);
+  e0     = abcd;
+  abcd   = _mm_sha1rnds4_epu32(abcd, e1, 0);
+  msg[0] = _mm_sha1msg1_epu32(msg[0], msg[1]);
+  e0     = _mm_sha1nexte_epu32(e0, msg[2]);
+  e1     = abcd;
+  abcd   = _mm_sha1rnds4_epu32(abcd, e0, 0);
+  msg[1] = _mm_sha1msg1_epu32(msg[1], msg[2]);
+  msg[0] = _mm_xor_si128(msg[0], msg[2]);
+
+  // rounds 12-79
+  sha_ni_all_rounds(abcd, e0, e1, msg, std::make_integer_sequence<unsigned, 17>{});
+
+  e0   = _mm_sha1nexte_epu32(e0, e0_save);
+  abcd = _mm_add_epi32(abcd, abcd_save);
+
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(state), // NOLINT reincast
+                   _mm_shuffle_epi32(abcd, 0x1B));
+  state[4] = static_cast<std::uint32_t>(_mm_extract_epi32(e0, 3));
+}
+
+using u32x8  = std::uint32_t __attribute__((vector_size(32)));
+using u32x16 = std::uint32_t __attribute__((vector_size(64)));
+
+// one padded block per lane, and the resulting state per lane: SHA1 for 5 words, MD4 for 4
+template <typename V, std::size_t Lanes, std::size_t Words>
+[[gnu::always_inline]] inline void compress_lanes(const block_t*                    blocks,
+                                                  std::array<std::uint32_t, Words>* out) noexcept {
+  constexpr bool is_sha1 = Words == sha1_init.size();
+
+  std::array<V, 16> w{};
+  for (std::size_t j = 0; j != w.size(); ++j) {
+    for (std::size_t lane = 0; lane != Lanes; ++lane) {
+      w[j][lane] = load32<is_sha1>(blocks[lane].data() + 4 * j);
+    }
+  }
+  std::array<V, Words> state{};
+  for (std::size_t i = 0; i != Words; ++i) state[i] = V{} + (is_sha1 ? sha1_init[i] : md4_init[i]);
+  if constexpr (is_sha1) {
+    sha1_compress(state.data(), w.data());
+  } else {
+    md4_compress(state.data(), w.data());
+  }
+  for (std::size_t lane = 0; lane != Lanes; ++lane) {
+    for (std::size_t i = 0; i != Words; ++i) out[lane][i] = state[i][lane];
+  }
+}
+
+__attribute__((target("avx2"))) void
+sha1_lanes_avx2(const block_t* blocks, std::array<std::uint32_t, 5>* out) noexcept {
+  compress_lanes<u32x8, 8>(blocks, out);
+}
+
+__attribute__((target("avx512f"))) void
+sha1_lanes_avx512(const block_t* blocks, std::array<std::uint32_t, 5>* out) noexcept {
+  compress_lanes<u32x16, 16>(blocks, out);
+}
+
+__attribute__((target("avx2"))) void
+md4_lanes_avx2(const block_t* blocks, std::array<std::uint32_t, 4>* out) noexcept {
+  compress_lanes<u32x8, 8>(blocks, out);
+}
+
+__attribute__((target("avx512f"))) void
+md4_lanes_avx512(const block_t* blocks, std::array<std::uint32_t, 4>* out) noexcept {
+  compress_lanes<u32x16, 16>(blocks, out);
+}
+
+#endif
+
+// SHA1 and MD4 are both Merkle-Damgard over 64 byte blocks, and only differ in the byte order of
+// the words and the length, and in the compression function.
+template <std::size_t Words, bool BigEndian>
+class hasher {
+public:
+  using compress_fn = void (*)(std::uint32_t*, const std::uint8_t*) noexcept;
+
+  hasher(const std::array<std::uint32_t, Words>& init, compress_fn compress) noexcept
+      : state_(init), compress_(compress) {}
+
+  void update(std::uint8_t byte) noexcept {
+    block_[used_++] = byte;
+    if (used_ == block_size) {
+      compress_(state_.data(), block_.data());
+      used_ = 0;
+    }
+    ++bytes_;
+  }
+
+  void update(std::string_view text) noexcept {
+    for (const char c: text) update(static_cast<std::uint8_t>(c));
+  }
+
+  std::array<std::byte, Words * 4> finish() noexcept {
+    const std::uint64_t bits = bytes_ * 8;
+    update(0x80);
+    while (used_ != block_size - 8) update(0);
+    for (unsigned i = 0; i != 8; ++i) {
+      update(static_cast<std::uint8_t>(bits >> (BigEndian ? 56U - 8U * i : 8U * i)));
+    }
+    return to_digest<Words, BigEndian>(state_);
+  }
+
+private:
+  std::array<std::uint32_t, Words> state_;
+  compress_fn                      compress_;
+  block_t                          block_{};
+  std::size_t                      used_  = 0;
+  std::uint64_t                    bytes_ = 0;
+};
+
+// pads a message of `len` bytes, already at the start of `block`, into one complete block
+template <bool BigEndian>
+void pad(block_t& block, std::size_t len) noexcept {
+  assert(len <= max_single);
+  block[len] = 0x80;
+  std::memset(block.data() + len + 1, 0, block_size - 8 - len - 1);
+  std::uint64_t bits = len * 8;
+  if constexpr (BigEndian == (std::endian::native == std::endian::little)) {
+    bits = __builtin_bswap64(bits);
+  }
+  std::memcpy(block.data() + block_size - 8, &bits, sizeof(bits));
+}
+
+// calls `emit` with each UTF-16 code unit of `utf8`
+template <typename Emit>
+void utf8_to_utf16(std::string_view utf8, Emit emit) {
+  const auto invalid = [] { throw std::range_error("Invalid UTF-8 in password"); };
+
+  const auto* p   = reinterpret_cast<const std::uint8_t*>(utf8.data()); // NOLINT reincast
+  const auto* end = p + utf8.size();
+  while (p != end) {
+    std::uint32_t cp = *p++;
+    if (cp >= 0x80) {
+      std::size_t   extra     = 0;
+      std::uint32_t min_value = 0;
+      if ((cp & 0xE0U) == 0xC0U) {
+        extra     = 1;
+        cp       &= 0x1FU;
+        min_value = 0x80;
+      } else if ((cp & 0xF0U) == 0xE0U) {
+        extra     = 2;
+        cp       &= 0x0FU;
+        min_value = 0x800;
+      } else if ((cp & 0xF8U) == 0xF0U) {
+        extra     = 3;
+        cp       &= 0x07U;
+        min_value = 0x10000;
+      } else {
+        invalid();
+      }
+      if (static_cast<std::size_t>(end - p) < extra) invalid();
+      for (std::size_t i = 0; i != extra; ++i, ++p) {
+        if ((*p & 0xC0U) != 0x80U) invalid();
+        cp = cp << 6U | (*p & 0x3FU);
+      }
+      // overlong, beyond unicode, or a surrogate
+      if (cp < min_value || cp > 0x10FFFF || (cp >= 0xD800 && cp <= 0xDFFF)) invalid();
+    }
+    if (cp >= 0x10000) {
+      cp -= 0x10000;
+      emit(static_cast<std::uint16_t>(0xD800U + (cp >> 10U)));
+      emit(static_cast<std::uint16_t>(0xDC00U + (cp & 0x3FFU)));
+    } else {
+      emit(static_cast<std::uint16_t>(cp));
+    }
+  }
+}
+
+// the UTF-16LE password as one padded block, if it fits
+bool ntlm_block(std::string_view password, block_t& block) {
+  std::size_t len = 0;
+  utf8_to_utf16(password, [&](std::uint16_t unit) {
+    if (len + 2 <= max_single) {
+      block[len]     = static_cast<std::uint8_t>(unit);
+      block[len + 1] = static_cast<std::uint8_t>(unit >> 8U);
+    }
+    len += 2;
+  });
+  if (len > max_single) return false;
+  pad<false>(block, len);
+  return true;
+}
+
+bool sha1_block(std::string_view text, block_t& block) noexcept {
+  if (text.size() > max_single) return false;
+  std::memcpy(block.data(), text.data(), text.size());
+  pad<true>(block, text.size());
+  return true;
+}
+
+template <std::size_t Words>
+using lanes_fn = void (*)(const block_t*, std::array<std::uint32_t, Words>*) noexcept;
+
+// Hashes the inputs which fit in one block `lanes` at a time, and the others one at a time.
+template <std::size_t Words, bool BigEndian, typename Digest, typename Fill, typename Single>
+void hash_lanes(std::size_t count, std::span<Digest> digests, std::size_t lanes,
+                lanes_fn<Words> kernel, Fill fill, Single single) {
+  std::array<block_t, 16>                          blocks{};
+  std::array<std::size_t, 16>                      idxs{};
+  std::array<std::array<std::uint32_t, Words>, 16> out{};
+  std::size_t                                      used = 0;
+
+  const auto flush = [&] {
+    kernel(blocks.data(), out.data()); // stale lanes, beyond `used`, are harmless
+    for (std::size_t lane = 0; lane != used; ++lane) {
+      digests[idxs[lane]] = to_digest<Words, BigEndian>(out[lane]);
+    }
+    used = 0;
+  };
+
+  for (std::size_t i = 0; i != count; ++i) {
+    if (fill(i, blocks[used])) {
+      idxs[used++] = i;
+      if (used == lanes) flush();
+    } else {
+      digests[i] = single(i);
+    }
+  }
+  if (used != 0) flush();
+}
+
+} // namespace
+
+bool has_sha_ni() noexcept {
+  static const bool sha_ni = [] {
+#if defined(__GNUC__) || defined(__clang__)
+    unsigned eax = 0;
+    unsigned ebx = 0;
+    unsigned ecx = 0;
+    unsigned edx = 0;
+    return __get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx) != 0 && (ebx & (1U << 29U)) != 0;
+#else
+    return false;
+#endif
+  }();
+  return sha_ni;
+}
+
+sha1_t sha1_scalar(std::string_view text) {
+  if (block_t block; sha1_block(text, block)) {
+    auto state = sha1_init;
+    sha1_block_scalar(state.data(), block.data());
+    return to_digest<5, true>(state);
+  }
+  hasher<5, true> h(sha1_init, sha1_block_scalar);
+  h.update(text);
+  return h.finish();
+}
+
+sha1_t sha1(std::string_view text) {
+#if defined(__GNUC__) || defined(__clang__)
+  if (has_sha_ni()) {
+    if (block_t block; sha1_block(text, block)) {
+      auto state = sha1_init;
+      sha1_block_sha_ni(state.data(), block.data());
+      return to_digest<5, true>(state);
+    }
+    hasher<5, true> h(sha1_init, sha1_block_sha_ni);
+    h.update(text);
+    return h.finish();
+  }
+#endif
+  return sha1_scalar(text);
+}
+
+ntlm_t ntlm(std::string_view password) {
+  if (block_t block; ntlm_block(password, block)) {
+    auto state = md4_init;
+    md4_block_scalar(state.data(), block.data());
+    return to_digest<4, false>(state);
+  }
+  hasher<4, false> h(md4_init, md4_block_scalar);
+  utf8_to_utf16(password, [&](std::uint16_t unit) {
+    h.update(static_cast<std::uint8_t>(unit));
+    h.update(static_cast<std::uint8_t>(unit >> 8U));
+  });
+  return h.finish();
+}
+
+void sha1(std::span<const std::string_view> texts, std::span<sha1_t> digests, isa kernel) {
+  assert(texts.size() == digests.size());
+#if defined(__GNUC__) || defined(__clang__)
+  if (kernel != isa::scalar) {
+    hash_lanes<5, true>(
+        texts.size(), digests, lanes(kernel),
+        kernel == isa::avx512 ? sha1_lanes_avx512 : sha1_lanes_avx2,
+        [&](std::size_t i, block_t& block) { return sha1_block(texts[i], block); },
+        [&](std::size_t i) { return sha1(texts[i]); });
+    return;
+  }
+#endif
+  for (std::size_t i = 0; i != texts.size(); ++i) digests[i] = sha1(texts[i]);
+}
+
+void ntlm(std::span<const std::string_view> passwords, std::span<ntlm_t> digests, isa kernel) {
+  assert(passwords.size() == digests.size());
+#if defined(__GNUC__) || defined(__clang__)
+  if (kernel != isa::scalar) {
+    hash_lanes<4, false>(
+        passwords.size(), digests, lanes(kernel),
+        kernel == isa::avx512 ? md4_lanes_avx512 : md4_lanes_avx2,
+        [&](std::size_t i, block_t& block) { return ntlm_block(passwords[i], block); },
+        [&](std::size_t i) { return ntlm(passwords[i]); });
+    return;
+  }
+#endif
+  for (std::size_t i = 0; i != passwords.size(); ++i) digests[i] = ntlm(passwords[i]);
+}
+
+} // namespace hibp::digest
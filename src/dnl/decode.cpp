@@ -0,0 +1,123 @@
+#include "dnl/decode.hpp"
+#include <algorithm>
+#include <cctype>
+#include <cstddef>
+#include <cstdint>
+#include <fmt/format.h>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <zlib.h>
+#ifdef HIBP_USE_BROTLI
+#include <brotli/decode.h>
+#endif
+
+namespace hibp::dnl {
+
+namespace {
+
+// the hex text compresses about 2:1, so this rarely needs to grow
+std::vector<char> output_for(const std::vector<char>& buffer) {
+  return std::vector<char>(std::max(buffer.size() * 3, std::size_t{1U << 16U}));
+}
+
+// max window, with gzip / zlib header detection
+constexpr int gzip_or_zlib = 15 + 32;
+// max window, and no header
+constexpr int raw_deflate = -15;
+
+// "deflate" should be zlib wrapped (RFC 9110), but some servers send raw deflate data. A zlib
+// header is a deflate method byte, and a check that the first 2 bytes are a multiple of 31.
+bool has_zlib_header(const std::vector<char>& buffer) {
+  if (buffer.size() < 2) return false;
+  const auto cmf = static_cast<unsigned char>(buffer[0]);
+  const auto flg = static_cast<unsigned char>(buffer[1]);
+  return (cmf & 0x0FU) == Z_DEFLATED && ((cmf << 8U) | flg) % 31 == 0;
+}
+
+void inflate_buffer(std::vector<char>& buffer, int window_bits) {
+  z_stream zs{};
+  if (inflateInit2(&zs, window_bits) != Z_OK) {
+    throw std::runtime_error("decode: inflateInit2 failed");
+  }
+  auto decoded = output_for(buffer);
+
+  zs.next_in  = reinterpret_cast<Bytef*>(buffer.data()); // NOLINT reinterpret_cast
+  zs.avail_in = static_cast<uInt>(buffer.size());
+  int ret     = Z_OK;
+  while (ret == Z_OK) {
+    if (zs.total_out == decoded.size()) decoded.resize(decoded.size() * 2);
+    zs.next_out  = reinterpret_cast<Bytef*>(decoded.data() + zs.total_out); // NOLINT
+    zs.avail_out = static_cast<uInt>(decoded.size() - zs.total_out);
+    ret          = inflate(&zs, Z_NO_FLUSH);
+  }
+  const auto decoded_size = zs.total_out;
+  inflateEnd(&zs);
+  if (ret != Z_STREAM_END) {
+    throw std::runtime_error(fmt::format("decode: corrupt or truncated gzip or deflate body: {}",
+                                         zs.msg != nullptr ? zs.msg : zError(ret)));
+  }
+  decoded.resize(decoded_size);
+  buffer.swap(decoded);
+}
+
+#ifdef HIBP_USE_BROTLI
+void unbrotli_buffer(std::vector<char>& buffer) {
+  BrotliDecoderState* state = BrotliDecoderCreateInstance(nullptr, nullptr, nullptr);
+  if (state == nullptr) throw std::runtime_error("decode: BrotliDecoderCreateInstance failed");
+
+  auto decoded = output_for(buffer);
+
+  std::size_t         avail_in  = buffer.size();
+  const auto*         next_in   = reinterpret_cast<const std::uint8_t*>(buffer.data()); // NOLINT
+  std::size_t         total_out = 0;
+  BrotliDecoderResult ret       = BROTLI_DECODER_RESULT_NEEDS_MORE_OUTPUT;
+  while (ret == BROTLI_DECODER_RESULT_NEEDS_MORE_OUTPUT) {
+    if (total_out == decoded.size()) decoded.resize(decoded.size() * 2);
+    std::size_t avail_out = decoded.size() - total_out;
+    auto*       next_out  = reinterpret_cast<std::uint8_t*>(decoded.data() + total_out); // NOLINT
+    ret = BrotliDecoderDecompressStream(state, &avail_in, &next_in, &avail_out, &next_out,
+                                        &total_out);
+  }
+  BrotliDecoderDestroyInstance(state);
+  if (ret != BROTLI_DECODER_RESULT_SUCCESS) {
+    throw std::runtime_error("decode: corrupt or truncated brotli body");
+  }
+  decoded.resize(total_out);
+  buffer.swap(decoded);
+}
+#endif
+
+} // namespace
+
+std::string accept_encoding() {
+#ifdef HIBP_USE_BROTLI
+  return "br, gzip";
+#else
+  return "gzip";
+#endif
+}
+
+void decode(std::string_view encoding, std::vector<char>& buffer) {
+  // content codings are case-insensitive (RFC 9110)
+  const auto is = [encoding](std::string_view name) {
+    return std::ranges::equal(encoding, name, [](unsigned char a, unsigned char b) {
+      return std::tolower(a) == std::tolower(b);
+    });
+  };
+  if (encoding.empty() || is("identity")) return;
+  if (is("gzip") || is("x-gzip")) {
+    inflate_buffer(buffer, gzip_or_zlib);
+  } else if (is("deflate")) {
+    inflate_buffer(buffer, has_zlib_header(buffer) ? gzip_or_zlib : raw_deflate);
+#ifdef HIBP_USE_BROTLI
+  } else if (is("br")) {
+    unbrotli_buffer(buffer);
+#endif
+  } else {
+    throw std::runtime_error(fmt::format("decode: unsupported Content-Encoding: '{}'", encoding));
+  }
+}
+
+} // namespace hibp::dnl
@@ -0,0 +1,70 @@
+#include "dnl/fanout.hpp"
+#include "dnl/queuemgt.hpp"
+#include "dnl/shared.hpp"
+#include "hibp.hpp"
+#include <exception>
+#include <fmt/format.h>
+#include <mutex>
+#include <stdexcept>
+#include <stop_token>
+#include <string>
+#include <thread>
+#include <utility>
+
+namespace hibp::dnl {
+
+sink::sink(std::string name, write_fn_t write_fn, finalize_fn_t finalize_fn)
+    : name_(std::move(name)), write_fn_(std::move(write_fn)),
+      finalize_fn_(std::move(finalize_fn)),
+      thread_([this](const std::stop_token& stoken) { run(stoken); }) {
+  const std::lock_guard lk(cerr_mutex);
+  thrnames[thread_.get_id()] = "sink";
+}
+
+void sink::push(shared_block block) {
+  {
+    std::unique_lock lk(mutex_);
+    cv_.wait(lk, [this] { return queue_.size() < queue_capacity || exception_; });
+    if (exception_) std::rethrow_exception(exception_);
+    queue_.push_back(std::move(block));
+  }
+  cv_.notify_all();
+}
+
+void sink::finish() {
+  {
+    const std::lock_guard lk(mutex_);
+    closed_ = true;
+  }
+  cv_.notify_all();
+  thread_.join();
+  if (exception_) std::rethrow_exception(exception_);
+}
+
+void sink::run(const std::stop_token& stoken) {
+  try {
+    while (true) {
+      shared_block block;
+      {
+        std::unique_lock lk(mutex_);
+        if (!cv_.wait(lk, stoken, [this] { return !queue_.empty() || closed_; })) return; // stopped
+        if (queue_.empty()) break; // closed
+        block = std::move(queue_.front());
+        queue_.pop_front();
+      }
+      cv_.notify_all(); // there is room now
+      write_fn_(block_records<pawned_pw_sha1>(*block));
+    }
+    finalize_fn_();
+    logger.log(fmt::format("finalized {}", name_));
+  } catch (const std::exception& e) {
+    {
+      const std::lock_guard lk(mutex_);
+      exception_ = std::make_exception_ptr(
+          std::runtime_error(fmt::format("writing '{}': {}", name_, e.what())));
+    }
+    cv_.notify_all();
+  }
+}
+
+} // namespace hibp::dnl
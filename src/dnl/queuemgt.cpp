@@ -1,10 +1,12 @@
 #include "dnl/queuemgt.hpp"
+#include "dnl/decode.hpp"
 #include "dnl/requests.hpp"
 #include "dnl/shared.hpp"
 #include <stop_token>
 #if __has_include(<bits/chrono.h>)
 #include <bits/chrono.h>
 #endif
+#include <algorithm>
 #include <chrono>
 #include <condition_variable>
 #include <cstddef>
@@ -15,26 +17,32 @@
 #include <memory>
 #include <mutex>
 #include <queue>
-#include <sstream>
 #include <stdexcept>
 #include <string>
+#include <string_view>
 #include <thread>
 #include <utility>
 #include <vector>
 
 // queue management
 
-// We have 2 threads:
+// We have 2 kinds of threads plus a pool of parsers:
 //
-// 1. the `requests` thread, which handles the curl/libevent event
-// loop to affect the downloads. It also manages the `download_queue`
+// 1. the `requests` threads (`--download-threads`, default 1), which
+// each handle a curl/libevent event loop to affect the downloads, with
+// their own connections. They also manage the `download_slots`
 //
 // 2. the `queuemgt`(main) thread, which manages the `process_queue` and
 // the `message_queue` writes the downloads to disk.
+//
+// 3. the `parser` threads, started by queuemgt, which decode any
+// compressed download and convert the text into blocks of output
+// records, in parallel and in any order, so the single queuemgt thread
+// only has to write them.
 
-// We have 3 queues:
+// We have 5 queues:
 //
-// 1. `download_slots` managed by `requests.cpp` (the `requests`
+// 1. `download_slots` managed by `requests.cpp` (one per `requests`
 // thread), contains the current set of parallel downloads. it is an
 // unordered_map, so not really a 'queue' as such, just a collection
 // of parallel 'slots'. As each set of downloads completes the
@@ -45,17 +53,23 @@
 //
 // 2. `message_queue` managed by queuemgr.cpp. When receiving messages
 // from the requests thread, the main thread is notified and it
-// shuffles the contents of the messages into the process_queue. The
+// shuffles the contents of the messages into the parse_queue. The
 // `message_queue` is the minimal communication interface between the
 // two threads.
 //
-// 3. The `process_queue` is a std::priority_queue which reorders the
-// dowloads into index order and items are only removed when the
+// 3. The `parse_queue`, from which the parser threads take downloads.
+//
+// 4. The `parsed_queue`, into which the parser threads return the
+// converted downloads, and notify the main thread, just like for the
+// `message_queue`.
+//
+// 5. The `process_queue` is a std::priority_queue which reorders the
+// parsed dowloads into index order and items are only removed when the
 // `next_process_index` is at top().
 
 // we use std::unique_ptr<download> as the queue and message elements
 // throughout to keep the address of the downloads stable as they move
-// through the 3 queues. This ensures the curl C-APi has stable pointers.
+// through the queues. This ensures the curl C-APi has stable pointers.
 
 namespace hibp::dnl {
 
@@ -73,13 +87,21 @@ std::priority_queue<std::unique_ptr<download>, std::vector<std::unique_ptr<downl
                     decltype(process_queue_compare)>
     process_queue(process_queue_compare);
 
-std::mutex                  msgmutex;
-std::queue<enq_msg_t>       msg_queue;
-std::condition_variable_any msg_cv; // _any for stop_token
-bool                        finished_dls = false;
+std::mutex                             msgmutex;
+std::queue<enq_msg_t>                  msg_queue;
+std::vector<std::unique_ptr<download>> parsed_queue;
+std::exception_ptr                     parse_exception; // first one thrown by a parser
+std::condition_variable_any            msg_cv;          // _any for stop_token
+bool                                   finished_dls = false;
+
+std::mutex                            parse_mutex;
+std::queue<std::unique_ptr<download>> parse_queue;
+std::condition_variable_any           parse_cv;
+std::size_t                           parsing = 0; // in parse_queue or a parser. queuemgt only
 
-std::size_t files_processed = 0UL;
-std::size_t bytes_processed = 0UL;
+std::size_t files_processed   = 0UL;
+std::size_t bytes_processed   = 0UL; // decoded
+std::size_t bytes_transferred = 0UL; // as received, maybe compressed
 
 void print_progress() {
   if (cli.progress) {
@@ -89,9 +111,10 @@ void print_progress() {
 
     const std::lock_guard lk(cerr_mutex);
     auto                  files_todo = cli.index_limit - start_index;
-    std::cerr << fmt::format("Elapsed: {:%H:%M:%S}  Progress: {} / {} files  {:.1f}MB/s  {:5.1f}%  "
-                             "  Write queue size: {:4d}\r",
+    std::cerr << fmt::format("Elapsed: {:%H:%M:%S}  Progress: {} / {} files  {:.1f}MB/s "
+                             "({:.1f}MB/s decoded)  {:5.1f}%    Write queue size: {:4d}\r",
                              elapsed_trunc, files_processed, files_todo,
+                             static_cast<double>(bytes_transferred) / (1U << 20U) / elapsed_sec,
                              static_cast<double>(bytes_processed) / (1U << 20U) / elapsed_sec,
                              100.0 * static_cast<double>(files_processed) /
                                  static_cast<double>(files_todo),
@@ -99,27 +122,42 @@ void print_progress() {
   }
 }
 
-std::size_t write_lines(write_fn_t& write_fn, download& dl) {
-  // "embarrassing" copy onto std:string until C++26 P2495R3 Interfacing stringstreams with
-  // string_view
-  std::stringstream ss(std::string(dl.buffer.data(), dl.buffer.size()));
-
-  auto recordcount = 0UL;
-
-  for (std::string line, prefixed_line; std::getline(ss, line);) {
-    if (!line.empty()) {
-      prefixed_line = dl.prefix + line;
-      prefixed_line.erase(prefixed_line.find_last_not_of('\r') + 1);
-
-      // calls text_writer or hibp_ff_sw, the latter via implicit conversion
-      write_fn(prefixed_line);
-
-      recordcount++;
+// the body of each parser thread
+void parse_downloads(const parse_fn_t& parse_fn, std::stop_token stoken) { // NOLINT stoken
+  while (true) {
+    std::unique_ptr<download> dl;
+    {
+      std::unique_lock lk(parse_mutex);
+      if (!parse_cv.wait(lk, stoken, [] { return !parse_queue.empty(); })) return; // stopped
+      dl = std::move(parse_queue.front());
+      parse_queue.pop();
+    }
+    std::exception_ptr exception_ptr;
+    try {
+      if (!dl->unchanged) { // nothing was downloaded
+        dl->transfer_size = dl->buffer.size();
+        decode(dl->content_encoding, dl->buffer);
+        dl->content_encoding.clear();
+        dl->record_count =
+            parse_fn(dl->prefix, std::string_view(dl->buffer.data(), dl->buffer.size()), dl->block);
+      }
+    } catch (...) {
+      exception_ptr = std::current_exception();
+    }
+    {
+      const std::lock_guard lk(msgmutex);
+      parsed_queue.emplace_back(std::move(dl));
+      if (exception_ptr && !parse_exception) parse_exception = exception_ptr;
     }
+    msg_cv.notify_one();
   }
-  logger.log(fmt::format("wrote {} binary records with prefix {}", recordcount, dl.prefix));
+}
+
+void write_block(write_fn_t& write_fn, download& dl) {
+  write_fn(dl);
+  logger.log(fmt::format("wrote {} records with prefix {}", dl.record_count, dl.prefix));
   bytes_processed += dl.buffer.size();
-  return recordcount;
+  bytes_transferred += dl.transfer_size;
 }
 
 bool handle_exception(const std::exception_ptr& exception_ptr, std::thread::id thr_id) {
@@ -162,35 +200,65 @@ void finished_downloads() {
   qmgt::msg_cv.notify_one();
 }
 
-void service_queue(write_fn_t& write_fn, std::size_t next_index,
+void service_queue(const parse_fn_t& parse_fn, write_fn_t& write_fn, std::size_t next_index,
                    std::stop_token stoken) { // NOLINT stoken
 
+  std::vector<std::jthread> parsers; // stopped and joined on any exit
+  const unsigned            parse_threads = cli.parse_threads != 0
+                                                ? cli.parse_threads
+                                                : std::max(std::thread::hardware_concurrency(), 1U);
+  for (unsigned i = 0; i != parse_threads; ++i) {
+    parsers.emplace_back(
+        [&](std::stop_token parser_stoken) { qmgt::parse_downloads(parse_fn, parser_stoken); });
+    const std::lock_guard lk(cerr_mutex);
+    thrnames[parsers.back().get_id()] = "parser";
+  }
+
   while (true) {
     std::unique_lock lk(qmgt::msgmutex);
-    qmgt::msg_cv.wait(lk, stoken, [&] { return !qmgt::msg_queue.empty() || qmgt::finished_dls; });
+    qmgt::msg_cv.wait(lk, stoken, [&] {
+      return !qmgt::msg_queue.empty() || !qmgt::parsed_queue.empty() || qmgt::parse_exception ||
+             (qmgt::finished_dls && qmgt::parsing == 0);
+    });
 
     if (stoken.stop_requested()) {
       logger.log("stop request received: bailing out");
       break;
     }
-
-    // bring messages over into process_queue
-    while (!qmgt::msg_queue.empty()) {
-      auto& msg = qmgt::msg_queue.front();
-      logger.log(fmt::format("processing message: msg.size() = {}", msg.size()));
-      for (auto& dl: msg) {
-        qmgt::process_queue.emplace(std::move(dl));
+    if (qmgt::parse_exception) std::rethrow_exception(qmgt::parse_exception);
+
+    // bring messages over into parse_queue
+    if (!qmgt::msg_queue.empty()) {
+      {
+        const std::lock_guard parse_lk(qmgt::parse_mutex);
+        while (!qmgt::msg_queue.empty()) {
+          auto& msg = qmgt::msg_queue.front();
+          logger.log(fmt::format("processing message: msg.size() = {}", msg.size()));
+          for (auto& dl: msg) {
+            qmgt::parse_queue.emplace(std::move(dl));
+            ++qmgt::parsing;
+          }
+          qmgt::msg_queue.pop();
+        }
       }
-      qmgt::msg_queue.pop();
+      qmgt::parse_cv.notify_all();
+    }
+
+    // and parsed downloads into the process_queue
+    for (auto& dl: qmgt::parsed_queue) {
+      qmgt::process_queue.emplace(std::move(dl));
+      --qmgt::parsing;
     }
-    if (qmgt::finished_dls && qmgt::msg_queue.empty() && qmgt::process_queue.empty()) {
+    qmgt::parsed_queue.clear();
+
+    if (qmgt::finished_dls && qmgt::parsing == 0 && qmgt::process_queue.empty()) {
       break; // normal finish
     }
 
-    lk.unlock(); // free up other thread to pass us more messages
+    lk.unlock(); // free up other threads to pass us more messages
 
     // now do the work in the process queue
-    // there is no contention on this queue, and this is slow processing
+    // there is no contention on this queue, and this is the only serial work
     logger.log(fmt::format("process_queue.size() = {}", qmgt::process_queue.size()));
     while (!qmgt::process_queue.empty()) {
       const auto& top = qmgt::process_queue.top();
@@ -198,7 +266,7 @@ void service_queue(write_fn_t& write_fn, std::size_t next_index,
         break; // must wait for an earlier batch to preserve the correct order
       }
       logger.log(fmt::format("service_queue: writing prefix = {}", top->prefix));
-      qmgt::write_lines(write_fn, *top);
+      qmgt::write_block(write_fn, *top);
       qmgt::process_queue.pop();
       next_index++;
       qmgt::files_processed++;
@@ -211,7 +279,8 @@ void service_queue(write_fn_t& write_fn, std::size_t next_index,
 }
 
 // main entry point for the download process
-void run(write_fn_t write_fn, std::size_t start_index_, bool testing_) {
+void run(parse_fn_t parse_fn, write_fn_t write_fn, std::size_t start_index_, bool testing_,
+         const std::vector<std::string>& known_etags) {
   std::exception_ptr requests_exception;
   std::exception_ptr queuemgt_exception;
 
@@ -227,7 +296,7 @@ void run(write_fn_t write_fn, std::size_t start_index_, bool testing_) {
 
     const std::jthread requests_thread([&]() {
       try {
-        run_event_loop(start_index_, testing_, req_stop_source.get_token());
+        run_event_loop(start_index_, testing_, known_etags, req_stop_source.get_token());
       } catch (...) {
         requests_exception = std::current_exception();
         logger.log("exception caught: requesting stop of queuemgt thread via stop_token");
@@ -235,20 +304,27 @@ void run(write_fn_t write_fn, std::size_t start_index_, bool testing_) {
       }
     });
 
-    req_thr_id           = requests_thread.get_id();
-    thrnames[req_thr_id] = "requests";
+    req_thr_id = requests_thread.get_id();
+    {
+      // the requests thread's event loop threads register their names too
+      const std::lock_guard lk(cerr_mutex);
+      thrnames[req_thr_id] = "requests";
+    }
 
     const std::jthread queuemgt_thread([&]() {
       try {
-        service_queue(write_fn, start_index_, que_stop_source.get_token());
+        service_queue(parse_fn, write_fn, start_index_, que_stop_source.get_token());
       } catch (...) {
         queuemgt_exception = std::current_exception();
         logger.log("exception caught: requesting stop of requests thread via stop_token");
         req_stop_source.request_stop();
       }
     });
-    que_thr_id           = queuemgt_thread.get_id();
-    thrnames[que_thr_id] = "queuemgt";
+    que_thr_id = queuemgt_thread.get_id();
+    {
+      const std::lock_guard lk(cerr_mutex);
+      thrnames[que_thr_id] = "queuemgt";
+    }
 
   } // wait here until threads join
 
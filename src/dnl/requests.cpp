@@ -1,9 +1,15 @@
 #include "dnl/requests.hpp"
+#include "dnl/decode.hpp"
 #include "dnl/shared.hpp"
 #include "hibp.hpp"
 #include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <exception>
 #include <fmt/format.h>
+#include <mutex>
 #include <stop_token>
+#include <thread>
 #if __has_include(<bits/types/struct_timeval.h>)
 #include <bits/types/struct_timeval.h>
 #elif __has_include(<sys/_timeval.h>)
@@ -19,8 +25,10 @@
 #include <iostream>
 #include <iterator>
 #include <memory>
+#include <optional>
 #include <stdexcept>
 #include <string>
+#include <string_view>
 #include <unordered_map>
 #include <utility>
 #include <vector>
@@ -32,34 +40,46 @@ namespace hibp::dnl {
 // with a 2x C-APIs, libcurl and libevent
 namespace req {
 
-// double indirection via unique_ptr. Strictly unecessary for address stability, but consistent with
-// other queues and non critical
-std::unordered_map<std::size_t, std::unique_ptr<download>> download_slots;
+// One per requests thread, each with its own connections. They share the work by taking the next
+// index from `next_index`, so the writer receives the downloads in roughly index order.
+struct event_loop {
+  // double indirection via unique_ptr. Strictly unecessary for address stability, but consistent
+  // with other queues and non critical
+  std::unordered_map<std::size_t, std::unique_ptr<download>> download_slots;
 
-CURLM* curl_multi_handle;
-event* timeout;
+  CURLM*      curl_multi_handle = nullptr;
+  event*      timeout           = nullptr;
+  event_base* ebase             = nullptr;
+};
+
+std::vector<std::unique_ptr<event_loop>> loops;
 
-event_base*     ebase;
 std::stop_token stoken;
 
-std::size_t next_index = 0x0UL;
+std::atomic<std::size_t> next_index = 0x0UL;
 
 bool testing = false;
 
+const std::vector<std::string>* known_etags = nullptr; // by index, for --update
+
+const std::string accept_encoding_header = fmt::format("Accept-Encoding: {}", accept_encoding());
+
 // connects an event with a socketfd
 struct curl_context_t {
   struct event* event;
   curl_socket_t sockfd;
+  event_loop*   loop;
 };
 
 void curl_perform_event_cb(evutil_socket_t fd, short event, void* arg);
 
-curl_context_t* create_curl_context(curl_socket_t sockfd) {
+curl_context_t* create_curl_context(event_loop& loop, curl_socket_t sockfd) {
   auto* context = new curl_context_t; // NOLINT manual new and delete
 
   context->sockfd = sockfd;
-  context->event =
-      event_new(ebase, static_cast<evutil_socket_t>(sockfd), 0, curl_perform_event_cb, context);
+  context->loop   = &loop;
+  context->event  = event_new(loop.ebase, static_cast<evutil_socket_t>(sockfd), 0,
+                              curl_perform_event_cb, context);
 
   return context;
 }
@@ -71,10 +91,11 @@ void destroy_curl_context(curl_context_t* context) {
 }
 
 std::size_t write_data_curl_cb(char* ptr, std::size_t size, std::size_t nmemb, void* userdata);
+std::size_t header_curl_cb(char* buffer, std::size_t size, std::size_t nitems, void* userdata);
 
-void add_download(std::size_t index) {
+void add_download(event_loop& loop, std::size_t index) {
   auto [dl_iter, inserted] =
-      download_slots.insert(std::make_pair(index, std::make_unique<download>(index)));
+      loop.download_slots.insert(std::make_pair(index, std::make_unique<download>(index)));
 
   if (!inserted) {
     throw std::runtime_error(fmt::format("unexpected condition: index {} already existed", index));
@@ -86,36 +107,51 @@ void add_download(std::size_t index) {
   curl_easy_setopt(easy, CURLOPT_PIPEWAIT, 1L); // wait for multiplexing! key for perf
   curl_easy_setopt(easy, CURLOPT_WRITEFUNCTION, write_data_curl_cb);
   curl_easy_setopt(easy, CURLOPT_WRITEDATA, dl.get());
+  curl_easy_setopt(easy, CURLOPT_HEADERFUNCTION, header_curl_cb);
+  curl_easy_setopt(easy, CURLOPT_HEADERDATA, dl.get());
+  // not CURLOPT_ACCEPT_ENCODING, so the body is decoded by a parser thread, rather than this one
+  dl->headers = curl_slist_append(nullptr, accept_encoding_header.c_str());
+  if (known_etags != nullptr && index < known_etags->size() && !(*known_etags)[index].empty()) {
+    // conditional request, the server responds with "304 Not Modified" if unchanged
+    dl->headers = curl_slist_append(
+        dl->headers, fmt::format("If-None-Match: {}", (*known_etags)[index]).c_str());
+    dl->conditional = true;
+  }
+  curl_easy_setopt(easy, CURLOPT_HTTPHEADER, dl->headers);
   curl_easy_setopt(easy, CURLOPT_PRIVATE, dl.get());
   curl_easy_setopt(easy, CURLOPT_URL, chunk_url.c_str());
   // abort if slower than 1000 bytes/sec for 5 seconds
   curl_easy_setopt(easy, CURLOPT_LOW_SPEED_TIME, 5L);
   curl_easy_setopt(easy, CURLOPT_LOW_SPEED_LIMIT, 1000L);
-  curl_multi_add_handle(curl_multi_handle, easy);
+  curl_multi_add_handle(loop.curl_multi_handle, easy);
   dl->easy = easy;
 }
 
-void fill_download_queue() {
-  while (download_slots.size() != cli.parallel_max && next_index != cli.index_limit) {
-    add_download(next_index++);
+void fill_download_queue(event_loop& loop) {
+  while (loop.download_slots.size() != cli.parallel_max) {
+    const std::size_t index = next_index++;
+    if (index >= cli.index_limit) break;
+    add_download(loop, index);
   }
 }
 
-void process_curl_done_msg(CURLMsg* message, enq_msg_t& msg) {
+void process_curl_done_msg(event_loop& loop, CURLMsg* message, enq_msg_t& msg) {
   CURL* easy_handle = message->easy_handle;
 
   const auto curl_code = message->data.result;
 
   download* dl = nullptr;
   curl_easy_getinfo(easy_handle, CURLINFO_PRIVATE, &dl);
-  curl_multi_remove_handle(curl_multi_handle, easy_handle);
+  curl_multi_remove_handle(loop.curl_multi_handle, easy_handle);
 
   long response_code = 0;
   curl_easy_getinfo(easy_handle, CURLINFO_RESPONSE_CODE, &response_code);
-  if (curl_code == CURLE_OK && response_code == 200) {
+  const bool not_modified = response_code == 304 && dl->conditional;
+  if (curl_code == CURLE_OK && (response_code == 200 || not_modified)) {
+    dl->unchanged = not_modified;
     curl_easy_cleanup(easy_handle);
     dl->easy = nullptr; // prevent further attempts at cleanup
-    auto nh  = download_slots.extract(dl->index);
+    auto nh  = loop.download_slots.extract(dl->index);
     logger.log(fmt::format("download {} complete. http resp code {}. batching up into message",
                            dl->prefix, response_code));
     msg.emplace_back(std::move(nh.mapped())); // batch up to avoid mutex too many times
@@ -131,14 +167,16 @@ void process_curl_done_msg(CURLMsg* message, enq_msg_t& msg) {
 
   dl->retries_left--;
   dl->buffer.clear(); // throw away anything that was returned
+  dl->etag.clear();
+  dl->content_encoding.clear();
   logger.log(fmt::format("prefix: {}, curl result: '{}', http resp code: {}, after {} retries",
                          dl->prefix, curl_easy_strerror(curl_code), response_code,
                          dl->retries_left));
 
-  curl_multi_add_handle(curl_multi_handle, easy_handle); // try again with same handle
+  curl_multi_add_handle(loop.curl_multi_handle, easy_handle); // try again with same handle
 }
 
-void process_curl_messages() {
+void process_curl_messages(event_loop& loop) {
   CURLMsg* message = nullptr;
   int      pending = 0;
 
@@ -148,10 +186,10 @@ void process_curl_messages() {
   }
 
   enq_msg_t msg;
-  while ((message = curl_multi_info_read(curl_multi_handle, &pending)) != nullptr) {
+  while ((message = curl_multi_info_read(loop.curl_multi_handle, &pending)) != nullptr) {
     switch (message->msg) {
     case CURLMSG_DONE:
-      process_curl_done_msg(message, msg);
+      process_curl_done_msg(loop, message, msg);
       break;
 
     default:
@@ -162,7 +200,7 @@ void process_curl_messages() {
   if (!msg.empty()) {
     enqueue_downloads_for_writing(std::move(msg));
   }
-  fill_download_queue();
+  fill_download_queue(loop);
 }
 
 // event callbacks
@@ -176,15 +214,18 @@ void curl_perform_event_cb(evutil_socket_t /*fd*/, short event, void* arg) {
 
   auto* context = static_cast<curl_context_t*>(arg);
 
-  curl_multi_socket_action(curl_multi_handle, context->sockfd, flags, &running_handles);
+  auto& loop = *context->loop;
+
+  curl_multi_socket_action(loop.curl_multi_handle, context->sockfd, flags, &running_handles);
 
-  process_curl_messages();
+  process_curl_messages(loop);
 }
 
-void timeout_event_cb(evutil_socket_t /*fd*/, short /*events*/, void* /*arg*/) {
-  int running_handles = 0;
-  curl_multi_socket_action(curl_multi_handle, CURL_SOCKET_TIMEOUT, 0, &running_handles);
-  process_curl_messages();
+void timeout_event_cb(evutil_socket_t /*fd*/, short /*events*/, void* arg) {
+  auto& loop            = *static_cast<event_loop*>(arg);
+  int   running_handles = 0;
+  curl_multi_socket_action(loop.curl_multi_handle, CURL_SOCKET_TIMEOUT, 0, &running_handles);
+  process_curl_messages(loop);
 }
 
 // CURL callbacks
@@ -197,7 +238,37 @@ std::size_t write_data_curl_cb(char* ptr, std::size_t size, std::size_t nmemb, v
   return realsize;
 }
 
-int start_timeout_curl_cb(CURLM* /*multi*/, long timeout_ms, void* /*userp*/) {
+// the value of the `header` line, if it has this lower case `name`
+std::optional<std::string_view> header_value(std::string_view header, std::string_view name) {
+  if (header.size() <= name.size() + 1 || header[name.size()] != ':' ||
+      !std::equal(name.begin(), name.end(), header.begin(), [](char a, char b) {
+        return a == std::tolower(static_cast<unsigned char>(b));
+      })) {
+    return std::nullopt;
+  }
+  header.remove_prefix(name.size() + 1);
+  const auto first = header.find_first_not_of(" \t");
+  const auto last  = header.find_last_not_of(" \t\r\n");
+  if (first == std::string_view::npos) return std::string_view{};
+  return header.substr(first, last - first + 1);
+}
+
+// the only response headers we need are the ETag, for a later --update, and the Content-Encoding
+std::size_t header_curl_cb(char* buffer, std::size_t size, std::size_t nitems, void* userdata) {
+  auto*                  dl       = static_cast<download*>(userdata);
+  const auto             realsize = size * nitems;
+  const std::string_view header{buffer, realsize};
+
+  if (auto etag = header_value(header, "etag")) {
+    dl->etag = *etag;
+  } else if (auto encoding = header_value(header, "content-encoding")) {
+    dl->content_encoding = *encoding;
+  }
+  return realsize;
+}
+
+int start_timeout_curl_cb(CURLM* /*multi*/, long timeout_ms, void* userp) {
+  auto* timeout = static_cast<event_loop*>(userp)->timeout;
   if (timeout_ms < 0) {
     evtimer_del(timeout);
   } else {
@@ -212,8 +283,9 @@ int start_timeout_curl_cb(CURLM* /*multi*/, long timeout_ms, void* /*userp*/) {
   return 0;
 }
 
-int handle_socket_curl_cb(CURL* /*easy*/, curl_socket_t s, int action, void* /*userp*/,
+int handle_socket_curl_cb(CURL* /*easy*/, curl_socket_t s, int action, void* userp,
                           void* socketp) {
+  auto&           loop         = *static_cast<event_loop*>(userp);
   curl_context_t* curl_context = nullptr;
   short           events       = 0;
 
@@ -222,9 +294,9 @@ int handle_socket_curl_cb(CURL* /*easy*/, curl_socket_t s, int action, void* /*u
   case CURL_POLL_OUT:
   case CURL_POLL_INOUT:
     curl_context =
-        (socketp != nullptr) ? static_cast<curl_context_t*>(socketp) : create_curl_context(s);
+        (socketp != nullptr) ? static_cast<curl_context_t*>(socketp) : create_curl_context(loop, s);
 
-    curl_multi_assign(curl_multi_handle, s, curl_context);
+    curl_multi_assign(loop.curl_multi_handle, s, curl_context);
 
     if (action != CURL_POLL_IN) events |= EV_WRITE; // NOLINT signed-bool-ops
     if (action != CURL_POLL_OUT) events |= EV_READ; // NOLINT signed-bool-ops
@@ -232,8 +304,9 @@ int handle_socket_curl_cb(CURL* /*easy*/, curl_socket_t s, int action, void* /*u
     events |= EV_PERSIST; // NOLINT signed bitwise
 
     event_del(curl_context->event);
-    event_assign(curl_context->event, ebase, static_cast<evutil_socket_t>(curl_context->sockfd),
-                 events, curl_perform_event_cb, curl_context);
+    event_assign(curl_context->event, loop.ebase,
+                 static_cast<evutil_socket_t>(curl_context->sockfd), events, curl_perform_event_cb,
+                 curl_context);
     event_add(curl_context->event, nullptr);
 
     break;
@@ -242,7 +315,7 @@ int handle_socket_curl_cb(CURL* /*easy*/, curl_socket_t s, int action, void* /*u
       curl_context = static_cast<curl_context_t*>(socketp);
       event_del(curl_context->event);
       destroy_curl_context(curl_context);
-      curl_multi_assign(curl_multi_handle, s, nullptr);
+      curl_multi_assign(loop.curl_multi_handle, s, nullptr);
     }
     break;
   default:
@@ -281,51 +354,88 @@ void init_curl_and_events() {
     throw std::runtime_error("Error: Could not init curl\n");
   }
 
-  req::ebase   = event_base_new();
-  req::timeout = evtimer_new(req::ebase, req::timeout_event_cb, nullptr);
+  for (unsigned i = 0; i != std::max(cli.download_threads, 1U); ++i) {
+    auto& loop = *req::loops.emplace_back(std::make_unique<req::event_loop>());
+
+    loop.ebase   = event_base_new();
+    loop.timeout = evtimer_new(loop.ebase, req::timeout_event_cb, &loop);
 
-  req::curl_multi_handle = curl_multi_init();
-  curl_multi_setopt(req::curl_multi_handle, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
-  curl_multi_setopt(req::curl_multi_handle, CURLMOPT_SOCKETFUNCTION, req::handle_socket_curl_cb);
-  curl_multi_setopt(req::curl_multi_handle, CURLMOPT_TIMERFUNCTION, req::start_timeout_curl_cb);
+    loop.curl_multi_handle = curl_multi_init();
+    curl_multi_setopt(loop.curl_multi_handle, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+    curl_multi_setopt(loop.curl_multi_handle, CURLMOPT_SOCKETFUNCTION, req::handle_socket_curl_cb);
+    curl_multi_setopt(loop.curl_multi_handle, CURLMOPT_SOCKETDATA, &loop);
+    curl_multi_setopt(loop.curl_multi_handle, CURLMOPT_TIMERFUNCTION, req::start_timeout_curl_cb);
+    curl_multi_setopt(loop.curl_multi_handle, CURLMOPT_TIMERDATA, &loop);
+  }
 }
 
-void run_event_loop(std::size_t start_index, bool testing_, std::stop_token stoken) {
-  req::next_index = start_index;
-  req::testing    = testing_;
-  req::fill_download_queue();
-  req::stoken = std::move(stoken);
-  event_base_dispatch(req::ebase);
-  logger.log("event_base_dispatch() completed");
+// Runs each event loop on its own thread. The first exception stops the others, on their next
+// event, and is rethrown once they have all returned.
+void run_event_loop(std::size_t start_index, bool testing_,
+                    const std::vector<std::string>& known_etags, std::stop_token stoken) {
+  req::next_index  = start_index;
+  req::testing     = testing_;
+  req::known_etags = &known_etags;
+
+  std::stop_source         loops_stop_source;
+  const std::stop_callback forward_stop(stoken, [&] { loops_stop_source.request_stop(); });
+  std::mutex               exception_mutex;
+  std::exception_ptr       loops_exception;
+  req::stoken = loops_stop_source.get_token();
+  {
+    std::vector<std::jthread> threads;
+    for (auto& loop: req::loops) {
+      threads.emplace_back([&, &loop = *loop] {
+        try {
+          req::fill_download_queue(loop);
+          event_base_dispatch(loop.ebase);
+          logger.log("event_base_dispatch() completed");
+        } catch (...) {
+          const std::lock_guard lk(exception_mutex);
+          if (!loops_exception) loops_exception = std::current_exception();
+          loops_stop_source.request_stop();
+        }
+      });
+      const std::lock_guard lk(cerr_mutex);
+      thrnames[threads.back().get_id()] = fmt::format("requests{}", threads.size());
+    }
+  } // wait here until threads join
+  if (loops_exception) std::rethrow_exception(loops_exception);
   finished_downloads();
 }
 
 void shutdown_curl_and_events() {
-  if (auto res = curl_multi_cleanup(req::curl_multi_handle); res != CURLM_OK) {
-    std::cerr << fmt::format("error: curl_multi_cleanup: '{}'\n", curl_multi_strerror(res));
-  }
+  for (auto& loop: req::loops) {
+    if (auto res = curl_multi_cleanup(loop->curl_multi_handle); res != CURLM_OK) {
+      std::cerr << fmt::format("error: curl_multi_cleanup: '{}'\n", curl_multi_strerror(res));
+    }
 
-  event_free(req::timeout);
-  event_base_free(req::ebase);
+    event_free(loop->timeout);
+    event_base_free(loop->ebase);
+  }
+  req::loops.clear();
 
   libevent_global_shutdown();
   curl_global_cleanup();
 }
 
 void curl_and_event_cleanup() {
-  event_base_loopbreak(req::ebase);
-
-  for (auto& dl_item: req::download_slots) {
-    auto& dl = dl_item.second;
-    if (dl->easy != nullptr) {
-      if (auto res = curl_multi_remove_handle(req::curl_multi_handle, dl->easy); res != CURLM_OK) {
-        std::cerr << fmt::format("error in curl_multi_remove_handle(): '{}'\n",
-                                 curl_multi_strerror(res));
+  for (auto& loop: req::loops) {
+    event_base_loopbreak(loop->ebase);
+
+    for (auto& dl_item: loop->download_slots) {
+      auto& dl = dl_item.second;
+      if (dl->easy != nullptr) {
+        if (auto res = curl_multi_remove_handle(loop->curl_multi_handle, dl->easy);
+            res != CURLM_OK) {
+          std::cerr << fmt::format("error in curl_multi_remove_handle(): '{}'\n",
+                                   curl_multi_strerror(res));
+        }
+        curl_easy_cleanup(dl->easy);
       }
-      curl_easy_cleanup(dl->easy);
     }
+    loop->download_slots.clear(); // more efficient to clear all at once
   }
-  req::download_slots.clear(); // more efficient to clear all at once
   shutdown_curl_and_events();
 }
 } // namespace hibp::dnl
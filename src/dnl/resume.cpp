@@ -1,17 +1,29 @@
+#include "dnl/resume.hpp"
 #include "dnl/requests.hpp"
 #include "flat_file.hpp"
 #include "hibp.hpp"
 #include <algorithm>
+#include <cerrno>
 #include <charconv>
 #include <cstddef>
+#include <cstdint>
 #include <cstdlib>
+#include <cstring>
 #include <filesystem>
 #include <fmt/format.h>
+#include <fstream>
 #include <iostream>
 #include <iterator>
+#include <optional>
 #include <sstream>
 #include <stdexcept>
 #include <string>
+#include <utility>
+#if __has_include(<unistd.h>) && !defined(_WIN32)
+#include <fcntl.h>
+#include <unistd.h>
+#define HIBP_HAS_FSYNC
+#endif
 
 namespace hibp::dnl {
 
@@ -81,6 +93,136 @@ std::size_t get_last_prefix(const std::string& filename, bool testing) {
   return last_prefix - 1;
 }
 
+namespace {
+
+constexpr std::uint64_t checkpoint_magic = 0x6869627020636b70ULL; // "hibp ckp"
+
+checkpoint make_checkpoint(std::uint64_t next_index, std::uint64_t offset) {
+  return {next_index, offset, next_index ^ offset ^ checkpoint_magic};
+}
+
+#ifdef HIBP_HAS_FSYNC
+int open_for_sync(const std::filesystem::path& filename) {
+  const int fd = ::open(filename.c_str(), O_RDONLY); // NOLINT vararg
+  if (fd < 0) {
+    throw std::runtime_error(fmt::format("Error opening '{}' for fsync. Because: \"{}\".",
+                                         filename.string(),
+                                         std::strerror(errno))); // NOLINT errno
+  }
+  return fd;
+}
+
+void sync(int fd, const std::filesystem::path& filename) {
+  if (::fsync(fd) != 0) {
+    throw std::runtime_error(fmt::format("Error in fsync of '{}'. Because: \"{}\".",
+                                         filename.string(),
+                                         std::strerror(errno))); // NOLINT errno
+  }
+}
+#endif
+
+} // namespace
+
+std::filesystem::path journal_filename(const std::filesystem::path& db_filename) {
+  return db_filename.string() + ".journal";
+}
+
+bool checkpoint::valid() const { return check == (next_index ^ offset ^ checkpoint_magic); }
+
+std::optional<checkpoint> last_checkpoint(const std::filesystem::path& db_filename) {
+  std::ifstream stream(journal_filename(db_filename), std::ios::binary | std::ios::ate);
+  if (!stream) return std::nullopt;
+
+  // any partial checkpoint at the end was being written when we stopped
+  auto end = static_cast<std::size_t>(stream.tellg()) / sizeof(checkpoint) * sizeof(checkpoint);
+  while (end != 0) {
+    end -= sizeof(checkpoint);
+    checkpoint cp;
+    stream.seekg(static_cast<std::streamoff>(end));
+    stream.read(reinterpret_cast<char*>(&cp), sizeof(cp)); // NOLINT reinterpret_cast
+    if (stream && cp.valid()) return cp;
+    stream.clear();
+  }
+  return std::nullopt;
+}
+
+std::optional<std::size_t> resume_from_journal(const std::filesystem::path& db_filename,
+                                               std::size_t                  record_size) {
+  auto cp = last_checkpoint(db_filename);
+  if (!cp) return std::nullopt;
+
+  const auto filesize = std::filesystem::file_size(db_filename);
+  if (cp->offset > filesize || cp->offset % record_size != 0) {
+    std::cerr << fmt::format("Journal '{}' does not match its db, ignoring it.\n",
+                             journal_filename(db_filename).string());
+    return std::nullopt;
+  }
+  if (filesize != cp->offset) {
+    std::cerr << fmt::format("Trimmed off {} bytes written after the last checkpoint.\n",
+                             filesize - cp->offset);
+    std::filesystem::resize_file(db_filename, cp->offset);
+  }
+
+  // restart the journal from there, without any torn tail, for the appends to follow it
+  const auto    filename = journal_filename(db_filename);
+  const auto    tmp      = std::filesystem::path(filename.string() + ".tmp");
+  std::ofstream stream(tmp, std::ios::binary);
+  stream.write(reinterpret_cast<const char*>(&*cp), sizeof(*cp)); // NOLINT reinterpret_cast
+  stream.close();
+  if (!stream) {
+    throw std::runtime_error(fmt::format("Error writing '{}'. Because: \"{}\".", tmp.string(),
+                                         std::strerror(errno))); // NOLINT errno
+  }
+  std::filesystem::rename(tmp, filename);
+  return cp->next_index;
+}
+
+journal::journal(std::filesystem::path db_filename, std::uint64_t offset, flush_fn_t flush_fn,
+                 std::size_t batch)
+    : db_filename_(std::move(db_filename)), offset_(offset), flush_fn_(std::move(flush_fn)),
+      batch_(batch), stream_(journal_filename(db_filename_), std::ios::binary | std::ios::app) {
+  if (!stream_) {
+    throw std::runtime_error(fmt::format("Error opening '{}' for writing. Because: \"{}\".",
+                                         journal_filename(db_filename_).string(),
+                                         std::strerror(errno))); // NOLINT errno
+  }
+  stream_.exceptions(std::ios::badbit | std::ios::failbit);
+#ifdef HIBP_HAS_FSYNC
+  db_fd_      = open_for_sync(db_filename_);
+  journal_fd_ = open_for_sync(journal_filename(db_filename_));
+#endif
+}
+
+journal::~journal() {
+#ifdef HIBP_HAS_FSYNC
+  if (db_fd_ >= 0) ::close(db_fd_);
+  if (journal_fd_ >= 0) ::close(journal_fd_);
+#endif
+}
+
+void journal::add(std::size_t index, std::size_t bytes) {
+  next_index_ = index + 1;
+  offset_ += bytes;
+  if (++pending_ == batch_) commit();
+}
+
+void journal::commit() {
+  if (pending_ == 0) return;
+
+  // the data must be on disk before any checkpoint which refers to it
+  flush_fn_();
+#ifdef HIBP_HAS_FSYNC
+  sync(db_fd_, db_filename_);
+#endif
+  const checkpoint cp = make_checkpoint(next_index_, offset_);
+  stream_.write(reinterpret_cast<const char*>(&cp), sizeof(cp)); // NOLINT reinterpret_cast
+  stream_.flush();
+#ifdef HIBP_HAS_FSYNC
+  sync(journal_fd_, journal_filename(db_filename_));
+#endif
+  pending_ = 0;
+}
+
 // explicit instantiations
 
 template std::size_t get_last_prefix<pawned_pw_sha1>(const std::string& filename, bool testing);
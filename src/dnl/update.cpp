@@ -0,0 +1,55 @@
+#include "dnl/update.hpp"
+#include <charconv>
+#include <cstddef>
+#include <cstring>
+#include <filesystem>
+#include <fmt/format.h>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace hibp::dnl {
+
+std::filesystem::path etags_filename(const std::filesystem::path& db_filename) {
+  return db_filename.string() + ".etags";
+}
+
+std::vector<std::string> load_etags(const std::filesystem::path& db_filename,
+                                    std::size_t                  prefixes) {
+  std::vector<std::string> etags(prefixes);
+
+  std::ifstream sidecar(etags_filename(db_filename));
+  if (!sidecar) return etags; // none known, so all will be downloaded
+
+  for (std::string line; std::getline(sidecar, line);) {
+    std::size_t prefix{};
+    const auto [ptr, ec] = std::from_chars(line.data(), line.data() + line.size(), prefix, 16);
+    if (ec != std::errc{} || *ptr != ' ') {
+      throw std::runtime_error(fmt::format("Corrupt line in {}: '{}'",
+                                           etags_filename(db_filename).string(), line));
+    }
+    if (prefix < prefixes) {
+      etags[prefix] = line.substr(static_cast<std::size_t>(ptr - line.data()) + 1);
+    }
+  }
+  return etags;
+}
+
+void save_etags(const std::filesystem::path& db_filename, const std::vector<std::string>& etags) {
+  const auto    filename = etags_filename(db_filename);
+  const auto    tmp      = std::filesystem::path(filename.string() + ".tmp");
+  std::ofstream sidecar(tmp);
+  if (!sidecar) {
+    throw std::runtime_error(fmt::format("Error opening '{}' for writing. Because: \"{}\".",
+                                         tmp.string(),
+                                         std::strerror(errno))); // NOLINT errno
+  }
+  for (std::size_t prefix = 0; prefix != etags.size(); ++prefix) {
+    if (!etags[prefix].empty()) sidecar << fmt::format("{:05X} {}\n", prefix, etags[prefix]);
+  }
+  sidecar.close();
+  std::filesystem::rename(tmp, filename);
+}
+
+} // namespace hibp::dnl
@@ -0,0 +1,445 @@
+#include "mphf.hpp"
+#include "arrcmp.hpp"
+#include "flat_file.hpp"
+#include "hibp.hpp"
+#include "pipeline.hpp"
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <compare>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fmt/format.h>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <numeric>
+#include <optional>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace hibp {
+
+namespace {
+
+using details::mphf_shard;
+using details::mphf_shards;
+using details::mphf_trailer;
+
+constexpr double        bucket_ratio   = 4.0;        // buckets = ratio * n / log2(n)
+constexpr std::uint64_t dense_share    = 2576980377; // 60% of 2^32, see bucket_of()
+constexpr std::uint32_t max_pilot      = 1U << 16U;  // so they fit a uint16_t
+constexpr unsigned      seed_attempts  = 16;
+constexpr std::uint64_t fingerprint_iv = 0x6d70686620667021ULL;
+
+// the hash bits which the function and the fingerprint are computed from
+struct key {
+  std::uint64_t hi   = 0;
+  std::uint64_t lo   = 0; // ntlm and sha1 only
+  std::uint32_t tail = 0; // sha1 only
+
+  auto operator<=>(const key& rhs) const = default; // the order of the hashes, as loaded big endian
+};
+
+key to_key(std::span<const std::byte> hash) {
+  key k;
+  k.hi = arrcmp::impl::bytearray_cast<std::uint64_t>(hash.data());
+  if (hash.size() >= 16) k.lo = arrcmp::impl::bytearray_cast<std::uint64_t>(hash.data() + 8);
+  if (hash.size() >= 20) k.tail = arrcmp::impl::bytearray_cast<std::uint32_t>(hash.data() + 16);
+  return k;
+}
+
+unsigned shard_of(const key& k) { return static_cast<unsigned>(k.hi >> 56U); } // the first byte
+
+// the splitmix64 finalizer
+std::uint64_t mix(std::uint64_t x) {
+  x ^= x >> 30U;
+  x *= 0xbf58476d1ce4e5b9ULL;
+  x ^= x >> 27U;
+  x *= 0x94d049bb133111ebULL;
+  x ^= x >> 31U;
+  return x;
+}
+
+// maps `x` onto [0, range) without a division
+std::uint32_t fastrange(std::uint32_t x, std::uint32_t range) {
+  return static_cast<std::uint32_t>((std::uint64_t{x} * range) >> 32U);
+}
+
+struct key_hashes {
+  std::uint64_t bucket;
+  std::uint64_t position;
+};
+
+key_hashes hash_key(const key& k, std::uint32_t seed) {
+  const std::uint64_t s = mix(std::uint64_t{seed} + 1);
+  return {.bucket = mix(k.hi ^ s), .position = mix(k.lo ^ std::rotl(k.hi, 32) ^ ~s)};
+}
+
+std::uint32_t fingerprint(const key& k) {
+  return static_cast<std::uint32_t>(mix(k.hi ^ mix(k.lo ^ k.tail ^ fingerprint_iv)) >> 32U);
+}
+
+std::uint32_t dense_buckets(const mphf_shard& shard) {
+  return std::clamp(static_cast<std::uint32_t>(std::uint64_t{shard.buckets} * 3 / 10), 1U,
+                    shard.buckets - 1);
+}
+
+// 60% of the hashes go into the first 30% of the buckets, which are placed first, while the table
+// is emptiest. This makes the pilots smaller, and quicker to find.
+std::uint32_t bucket_of(std::uint64_t bucket_hash, const mphf_shard& shard) {
+  const auto dense = dense_buckets(shard);
+  const auto low   = static_cast<std::uint32_t>(bucket_hash);
+  if ((bucket_hash >> 32U) < dense_share) return fastrange(low, dense);
+  return dense + fastrange(low, shard.buckets - dense);
+}
+
+std::uint32_t position(std::uint64_t position_hash, std::uint32_t pilot,
+                       std::uint32_t table_size) {
+  const std::uint64_t h = mix(position_hash ^ ((pilot + 1ULL) * 0x9e3779b97f4a7c15ULL));
+  return fastrange(static_cast<std::uint32_t>(h >> 32U), table_size);
+}
+
+// the slot of a hash within its shard
+std::uint32_t slot_of(const key_hashes& hashes, const mphf_shard& shard,
+                      const std::uint16_t* pilots, const std::uint32_t* remaps) {
+  const auto pos =
+      position(hashes.position, pilots[bucket_of(hashes.bucket, shard)], shard.table_size);
+  return pos < shard.records ? pos : remaps[pos - shard.records];
+}
+
+struct built_shard {
+  mphf_shard                 shard;
+  std::vector<std::uint16_t> pilots;
+  std::vector<std::uint32_t> remaps;
+  std::vector<mphf_slot>     slots;
+};
+
+// false if, with this seed, some bucket has no pilot which fits
+bool try_build_shard(const std::vector<key>& keys, const std::vector<std::int32_t>& counts,
+                     std::uint32_t seed, built_shard& out) {
+  const auto n = static_cast<std::uint32_t>(keys.size());
+
+  mphf_shard& shard = out.shard;
+  shard.records     = n;
+  shard.table_size  = n + n / 100 + 1; // a load factor of ~0.99
+  shard.buckets     = std::max(2U, static_cast<std::uint32_t>(
+                                   bucket_ratio * n / std::log2(std::max(n, 2U))));
+  shard.seed        = seed;
+
+  struct entry {
+    std::uint64_t position_hash;
+    std::uint32_t bucket;
+    std::uint32_t index; // in keys
+  };
+  std::vector<entry> entries(n);
+  for (std::uint32_t i = 0; i != n; ++i) {
+    const auto hashes = hash_key(keys[i], seed);
+    entries[i]        = {hashes.position, bucket_of(hashes.bucket, shard), i};
+  }
+  std::sort(entries.begin(), entries.end(), [](const entry& a, const entry& b) {
+    return a.bucket != b.bucket ? a.bucket < b.bucket : a.position_hash < b.position_hash;
+  });
+
+  std::vector<std::uint32_t> starts(shard.buckets + 1, 0); // of each bucket in entries
+  for (const auto& e: entries) ++starts[e.bucket + 1];
+  std::partial_sum(starts.begin(), starts.end(), starts.begin());
+
+  // the largest buckets first
+  std::vector<std::uint32_t> order(shard.buckets);
+  std::iota(order.begin(), order.end(), 0);
+  std::stable_sort(order.begin(), order.end(), [&](std::uint32_t a, std::uint32_t b) {
+    return starts[a + 1] - starts[a] > starts[b + 1] - starts[b];
+  });
+
+  out.pilots.assign(shard.buckets, 0);
+  std::vector<bool>          taken(shard.table_size);
+  std::vector<std::uint32_t> placed;
+  for (const auto bucket: order) {
+    const auto first = entries.begin() + starts[bucket];
+    const auto last  = entries.begin() + starts[bucket + 1];
+    if (first == last) break; // and so are all the rest
+
+    std::uint32_t pilot = 0;
+    for (; pilot != max_pilot; ++pilot) {
+      placed.clear();
+      for (auto e = first; e != last; ++e) {
+        const auto pos = position(e->position_hash, pilot, shard.table_size);
+        if (taken[pos]) break; // includes a clash within the bucket
+        taken[pos] = true;
+        placed.push_back(pos);
+      }
+      if (placed.size() == static_cast<std::size_t>(last - first)) break; // all placed
+      for (const auto pos: placed) taken[pos] = false;
+    }
+    if (pilot == max_pilot) return false;
+    out.pilots[bucket] = static_cast<std::uint16_t>(pilot);
+  }
+
+  // the positions past n are moved into the gaps below n, of which there are just as many
+  out.remaps.assign(shard.table_size - n, 0);
+  std::uint32_t gap = 0;
+  for (std::uint32_t pos = n; pos != shard.table_size; ++pos) {
+    if (!taken[pos]) continue;
+    while (taken[gap]) ++gap;
+    out.remaps[pos - n] = gap++;
+  }
+
+  out.slots.assign(n, {});
+  for (const auto& e: entries) {
+    const auto pos  = position(e.position_hash, out.pilots[e.bucket], shard.table_size);
+    const auto slot = pos < n ? pos : out.remaps[pos - n];
+    out.slots[slot] = {fingerprint(keys[e.index]), counts[e.index]};
+  }
+  return true;
+}
+
+// `first_seed` is the shard, so every shard has different seeds
+built_shard build_shard(const std::vector<key>& keys, const std::vector<std::int32_t>& counts,
+                        unsigned first_seed) {
+  built_shard out;
+  for (unsigned attempt = 0; attempt != seed_attempts; ++attempt) {
+    if (try_build_shard(keys, counts, first_seed + attempt * mphf_shards, out)) return out;
+  }
+  throw std::runtime_error(fmt::format("Cannot build the mphf of shard {}, after {} attempts.",
+                                       first_seed, seed_attempts));
+}
+
+// the [first, last) records of each shard, found by bisecting the sorted db
+template <pw_type PwType>
+std::vector<std::size_t> shard_bounds(flat_file::database<PwType>& db) {
+  std::vector<std::size_t> bounds{0};
+  for (unsigned shard = 1; shard != mphf_shards; ++shard) {
+    std::size_t lo = bounds.back();
+    std::size_t hi = db.number_records();
+    while (lo < hi) {
+      const std::size_t mid = lo + (hi - lo) / 2;
+      if (std::to_integer<unsigned>(db.get_record(mid).hash[0]) < shard) {
+        lo = mid + 1;
+      } else {
+        hi = mid;
+      }
+    }
+    bounds.push_back(lo);
+  }
+  bounds.push_back(db.number_records());
+  return bounds;
+}
+
+std::size_t padded_function_size(const mphf_trailer& trailer) {
+  const std::size_t size = sizeof(mphf_shard) * mphf_shards +
+                           sizeof(std::uint16_t) * trailer.pilots +
+                           sizeof(std::uint32_t) * trailer.remaps;
+  return (size + sizeof(mphf_slot) - 1) / sizeof(mphf_slot) * sizeof(mphf_slot);
+}
+
+template <typename T>
+void write_array(std::ofstream& file, const T* data, std::size_t count) {
+  file.write(reinterpret_cast<const char*>(data), // NOLINT reinterpret_cast
+             static_cast<std::streamsize>(sizeof(T) * count));
+}
+
+template <typename T>
+void read_array(std::ifstream& file, T* data, std::size_t count) {
+  file.read(reinterpret_cast<char*>(data), // NOLINT reinterpret_cast
+            static_cast<std::streamsize>(sizeof(T) * count));
+}
+
+} // namespace
+
+// Like hibp-build-filter: the shards are read in order, built on the workers, and written in
+// order, with at most a few per thread held in memory, waiting their turn.
+template <pw_type PwType>
+void mphf_build(const std::filesystem::path& db_filename,
+                const std::filesystem::path& mphf_filename, unsigned threads,
+                const std::function<void(unsigned shard)>& on_written) {
+  flat_file::database<PwType> db{db_filename, (1U << 16U) / sizeof(PwType)};
+  const auto                  bounds = shard_bounds(db);
+
+  const auto    tmp_filename = std::filesystem::path(mphf_filename.string() + ".tmp");
+  std::ofstream file(tmp_filename, std::ios::binary);
+  if (!file) {
+    throw std::runtime_error(fmt::format("Error opening '{}' for writing. Because: \"{}\".",
+                                         tmp_filename.string(),
+                                         std::strerror(errno))); // NOLINT errno
+  }
+  file.exceptions(std::ios::badbit | std::ios::failbit);
+
+  struct shard_build {
+    unsigned                  shard = 0;
+    std::vector<key>          keys;
+    std::vector<std::int32_t> counts;
+    built_shard               result;
+  };
+
+  std::vector<PwType> records;
+  unsigned            next_shard = 0;
+
+  const auto read = [&](shard_build& item) {
+    if (next_shard == mphf_shards) return false;
+    item.shard = next_shard++;
+    records.resize(bounds[item.shard + 1] - bounds[item.shard]);
+    if (!records.empty()) db.read(bounds[item.shard], records.size(), records.data());
+    item.keys.clear();
+    item.counts.clear();
+    for (const auto& pw: records) {
+      item.keys.push_back(to_key(pw.hash));
+      if (item.keys.size() > 1 && item.keys.back() <= item.keys[item.keys.size() - 2]) {
+        throw std::runtime_error(fmt::format(
+            "Cannot build an mphf: {} hash {} in {}.",
+            item.keys.back() == item.keys[item.keys.size() - 2] ? "duplicate" : "out of order",
+            pw.to_string(), db_filename.string()));
+      }
+      item.counts.push_back(pw.count);
+    }
+    return true;
+  };
+
+  const auto convert = [](shard_build& item) {
+    item.result =
+        item.keys.empty() ? built_shard{} : build_shard(item.keys, item.counts, item.shard);
+  };
+
+  mphf_trailer                        trailer{};
+  std::array<mphf_shard, mphf_shards> shards{};
+  std::vector<std::uint16_t>          pilots;
+  std::vector<std::uint32_t>          remaps;
+
+  const auto write = [&](shard_build& item) {
+    const auto& result             = item.result;
+    shards[item.shard]             = result.shard;
+    shards[item.shard].first_slot  = trailer.records;
+    shards[item.shard].first_pilot = pilots.size();
+    shards[item.shard].first_remap = remaps.size();
+    write_array(file, result.slots.data(), result.slots.size());
+    trailer.records += result.slots.size();
+    pilots.insert(pilots.end(), result.pilots.begin(), result.pilots.end());
+    remaps.insert(remaps.end(), result.remaps.begin(), result.remaps.end());
+    if (on_written) on_written(item.shard);
+    return true;
+  };
+
+  try {
+    pipeline::ordered<shard_build>(threads, 0, read, convert, write);
+  } catch (...) {
+    file.close();
+    std::filesystem::remove(tmp_filename);
+    throw;
+  }
+
+  trailer.hash_size = PwType::hash_size;
+  trailer.pilots    = pilots.size();
+  trailer.remaps    = remaps.size();
+  write_array(file, shards.data(), shards.size());
+  write_array(file, pilots.data(), pilots.size());
+  write_array(file, remaps.data(), remaps.size());
+  const std::size_t       unpadded = sizeof(shards) + sizeof(std::uint16_t) * pilots.size() +
+                               sizeof(std::uint32_t) * remaps.size();
+  const std::vector<char> padding(padded_function_size(trailer) - unpadded);
+  write_array(file, padding.data(), padding.size());
+  write_array(file, &trailer, 1);
+  file.close();
+  std::filesystem::rename(tmp_filename, mphf_filename);
+}
+
+mphf_db::mphf_db(const std::filesystem::path& filename) {
+  std::ifstream file(filename, std::ios::binary);
+  if (!file) {
+    throw std::runtime_error(fmt::format("Cannot open mphf db '{}'. Because: \"{}\".",
+                                         filename.string(),
+                                         std::strerror(errno))); // NOLINT errno
+  }
+  const auto filesize = std::filesystem::file_size(filename);
+  if (filesize < sizeof(trailer_)) {
+    throw std::runtime_error(fmt::format("'{}' is not an mphf db.", filename.string()));
+  }
+  file.seekg(static_cast<std::streamoff>(filesize - sizeof(trailer_)));
+  read_array(file, &trailer_, 1);
+  if (!file || trailer_.magic != mphf_trailer{}.magic) {
+    throw std::runtime_error(fmt::format("'{}' is not an mphf db.", filename.string()));
+  }
+  if (trailer_.version != mphf_trailer{}.version ||
+      (trailer_.hash_size != 20 && trailer_.hash_size != 16 && trailer_.hash_size != 8)) {
+    throw std::runtime_error(fmt::format("mphf db '{}' has an unknown version or hash size.",
+                                         filename.string()));
+  }
+  const std::uint64_t function_offset = trailer_.records * sizeof(mphf_slot);
+  if (function_offset + padded_function_size(trailer_) + sizeof(trailer_) != filesize) {
+    throw std::runtime_error(fmt::format("mphf db '{}' is corrupt: its size does not match.",
+                                         filename.string()));
+  }
+
+  file.seekg(static_cast<std::streamoff>(function_offset));
+  read_array(file, shards_.data(), shards_.size());
+  pilots_.resize(trailer_.pilots);
+  read_array(file, pilots_.data(), pilots_.size());
+  remaps_.resize(trailer_.remaps);
+  read_array(file, remaps_.data(), remaps_.size());
+  if (!file) {
+    throw std::runtime_error(fmt::format("Error reading mphf db '{}'.", filename.string()));
+  }
+  for (const auto& shard: shards_) {
+    if (shard.records == 0) continue; // never read
+    if (shard.first_slot + shard.records > trailer_.records || shard.table_size < shard.records ||
+        shard.buckets < 2 || shard.first_pilot + shard.buckets > trailer_.pilots ||
+        shard.first_remap + (shard.table_size - shard.records) > trailer_.remaps) {
+      throw std::runtime_error(fmt::format("mphf db '{}' is corrupt.", filename.string()));
+    }
+  }
+
+  // the file is a multiple of the slot size, so they can be read as a flat_file, ignoring the rest
+  slots_ = std::make_unique<slots_t>(filename);
+#ifdef FLAT_FILE_HAS_MMAP
+  slots_->advise(flat_file::access_hint::random);
+#endif
+}
+
+std::size_t mphf_db::function_size() const {
+  return sizeof(shards_) + sizeof(std::uint16_t) * pilots_.size() +
+         sizeof(std::uint32_t) * remaps_.size();
+}
+
+std::optional<int> mphf_db::find(std::span<const std::byte> hash) {
+  if (hash.size() != trailer_.hash_size) {
+    throw std::runtime_error(fmt::format("Cannot look up a {} byte hash in an mphf db of {} byte "
+                                         "hashes.",
+                                         hash.size(), trailer_.hash_size));
+  }
+  const key   k     = to_key(hash);
+  const auto& shard = shards_[shard_of(k)];
+  if (shard.records == 0) return std::nullopt;
+
+  const std::uint64_t pos =
+      shard.first_slot + slot_of(hash_key(k, shard.seed), shard,
+                                 pilots_.data() + shard.first_pilot,
+                                 remaps_.data() + shard.first_remap);
+  mphf_slot slot; // NOLINT initialisation
+  {
+#ifndef FLAT_FILE_HAS_MMAP
+    const std::lock_guard lock(mutex_);
+#endif
+    slot = slots_->get_record(pos); // the only read
+  }
+  if (slot.fingerprint != fingerprint(k)) return std::nullopt;
+  return slot.count;
+}
+
+template void
+mphf_build<pawned_pw_sha1>(const std::filesystem::path& db_filename,
+                           const std::filesystem::path& mphf_filename, unsigned threads,
+                           const std::function<void(unsigned shard)>& on_written);
+template void
+mphf_build<pawned_pw_ntlm>(const std::filesystem::path& db_filename,
+                           const std::filesystem::path& mphf_filename, unsigned threads,
+                           const std::function<void(unsigned shard)>& on_written);
+template void
+mphf_build<pawned_pw_sha1t64>(const std::filesystem::path& db_filename,
+                              const std::filesystem::path& mphf_filename, unsigned threads,
+                              const std::function<void(unsigned shard)>& on_written);
+
+} // namespace hibp
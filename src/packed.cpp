@@ -0,0 +1,314 @@
+#include "packed.hpp"
+#include "arrcmp.hpp"
+#include "flat_file.hpp"
+#include "hibp.hpp"
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fmt/format.h>
+#include <fmt/std.h> // IWYU pragma: keep
+#include <fstream>
+#include <ios>
+#include <mutex>
+#include <optional>
+#include <ostream>
+#include <stdexcept>
+#include <vector>
+
+namespace hibp::packed {
+
+namespace {
+
+using details::footer;
+using details::index_entry;
+
+template <pw_type PwType>
+constexpr std::size_t tail_size = PwType::hash_size - sizeof(std::uint64_t);
+
+// the leading 64bits of the hash, big-endian, so keys are ordered like the records
+template <pw_type PwType>
+std::uint64_t get_key(const PwType& pw) {
+  return arrcmp::impl::bytearray_cast<std::uint64_t>(pw.hash.data());
+}
+
+template <pw_type PwType>
+void set_key(PwType& pw, std::uint64_t key) {
+  if constexpr (std::endian::native == std::endian::little) key = arrcmp::impl::byteswap(key);
+  std::memcpy(pw.hash.data(), &key, sizeof(key));
+}
+
+void put_varint(std::vector<std::byte>& out, std::uint32_t value) {
+  while (value >= 0x80U) {
+    out.push_back(static_cast<std::byte>(value | 0x80U));
+    value >>= 7U;
+  }
+  out.push_back(static_cast<std::byte>(value));
+}
+
+// appends the low `width` bits of `value` to a little endian bit stream, which ends at `bitpos`
+void put_bits(std::vector<std::byte>& out, std::size_t& bitpos, std::uint64_t value,
+              unsigned width) {
+  for (unsigned done = 0; done != width;) {
+    const auto used = static_cast<unsigned>(bitpos % 8);
+    if (used == 0) out.push_back(std::byte{0});
+    const unsigned take = std::min(8 - used, width - done);
+    out.back() |= static_cast<std::byte>(((value >> done) & ((1U << take) - 1)) << used);
+    done += take;
+    bitpos += take;
+  }
+}
+
+std::uint64_t get_bits(const std::byte* in, std::size_t bitpos, unsigned width) {
+  std::uint64_t value = 0;
+  for (unsigned done = 0; done != width;) {
+    const auto     used = static_cast<unsigned>(bitpos % 8);
+    const unsigned take = std::min(8 - used, width - done);
+    const auto     bits = std::to_integer<std::uint64_t>(in[bitpos / 8]) >> used;
+    value |= (bits & ((1U << take) - 1)) << done;
+    done += take;
+    bitpos += take;
+  }
+  return value;
+}
+
+std::runtime_error corrupt(const std::filesystem::path& filename, std::size_t block) {
+  return std::runtime_error(fmt::format("packed db {} is corrupt in block {}", filename, block));
+}
+
+template <pw_type PwType>
+void encode_block(const std::vector<PwType>& block, std::vector<std::byte>& out) {
+  out.clear();
+  const auto* first = reinterpret_cast<const std::byte*>(block.front().hash.data()); // NOLINT
+  out.insert(out.end(), first, first + PwType::hash_size);
+
+  std::uint64_t max_delta = 0;
+  for (std::size_t i = 1; i != block.size(); ++i) {
+    max_delta = std::max(max_delta, get_key(block[i]) - get_key(block[i - 1]));
+  }
+  const auto width = static_cast<unsigned>(std::bit_width(max_delta));
+  out.push_back(static_cast<std::byte>(width));
+
+  std::size_t bitpos = 0;
+  for (std::size_t i = 1; i != block.size(); ++i) {
+    put_bits(out, bitpos, get_key(block[i]) - get_key(block[i - 1]), width);
+  }
+  for (std::size_t i = 1; i != block.size(); ++i) {
+    const auto* tail = block[i].hash.data() + sizeof(std::uint64_t);
+    out.insert(out.end(), tail, tail + tail_size<PwType>);
+  }
+  for (const auto& pw: block) put_varint(out, static_cast<std::uint32_t>(pw.count));
+}
+
+// false if the block is truncated or corrupt
+template <pw_type PwType>
+bool decode_block(const std::byte* in, std::size_t size, std::size_t count,
+                  std::vector<PwType>& records) {
+  const std::byte* end = in + size;
+  if (count == 0 || size < PwType::hash_size + 1) return false;
+
+  records.resize(count);
+  std::memcpy(records[0].hash.data(), in, PwType::hash_size);
+  in += PwType::hash_size;
+
+  const auto width = std::to_integer<unsigned>(*in++);
+  if (width > 64) return false;
+  const std::byte*  deltas     = in;
+  const std::size_t delta_size = ((count - 1) * width + 7) / 8;
+  const std::size_t tails_size = (count - 1) * tail_size<PwType>;
+  if (static_cast<std::size_t>(end - in) < delta_size + tails_size) return false;
+  in += delta_size;
+
+  std::uint64_t key = get_key(records[0]);
+  for (std::size_t i = 1; i != count; ++i) {
+    key += get_bits(deltas, (i - 1) * width, width);
+    set_key(records[i], key);
+    std::memcpy(records[i].hash.data() + sizeof(std::uint64_t), in, tail_size<PwType>);
+    in += tail_size<PwType>;
+  }
+
+  for (auto& pw: records) {
+    std::uint32_t value = 0;
+    for (unsigned shift = 0;; shift += 7) {
+      if (in == end || shift > 28) return false;
+      const auto byte = std::to_integer<std::uint32_t>(*in++);
+      value |= (byte & 0x7FU) << shift;
+      if ((byte & 0x80U) == 0) break;
+    }
+    pw.count = static_cast<std::int32_t>(value);
+  }
+  return in == end;
+}
+
+} // namespace
+
+bool is_packed(const std::filesystem::path& filename) {
+  const auto filesize = std::filesystem::file_size(filename);
+  if (filesize < sizeof(footer)) return false;
+
+  std::ifstream is(filename, std::ios::binary);
+  footer        foot{.magic = {}};
+  is.seekg(static_cast<std::streamoff>(filesize - sizeof(footer)));
+  is.read(reinterpret_cast<char*>(&foot), sizeof(foot)); // NOLINT reincast
+  return is && foot.magic == footer::expected_magic;
+}
+
+template <pw_type PwType>
+writer<PwType>::writer(std::ostream& os, std::size_t block_records)
+    : os_(os), block_records_(block_records) {
+  if (block_records_ == 0) throw std::invalid_argument("packed::writer: block_records must be > 0");
+  os_.exceptions(std::ios::badbit | std::ios::failbit);
+  block_.reserve(block_records_);
+}
+
+template <pw_type PwType>
+void writer<PwType>::write(const PwType& pw) {
+  if (records_ != 0 && pw < last_) {
+    throw std::runtime_error(
+        fmt::format("Cannot write packed db: records are not sorted by hash at record {}.",
+                    records_));
+  }
+  block_.push_back(pw);
+  last_ = pw;
+  ++records_;
+  if (block_.size() == block_records_) write_block();
+}
+
+template <pw_type PwType>
+void writer<PwType>::write_block() {
+  encode_block(block_, buf_);
+  index_.push_back({.key = get_key(block_.front()), .offset = offset_});
+  os_.write(reinterpret_cast<const char*>(buf_.data()), // NOLINT reincast
+            static_cast<std::streamsize>(buf_.size()));
+  offset_ += buf_.size();
+  block_.clear();
+}
+
+template <pw_type PwType>
+void writer<PwType>::finalize() {
+  if (!block_.empty()) write_block();
+
+  const footer foot{.hash_size     = PwType::hash_size,
+                    .block_records = static_cast<std::uint32_t>(block_records_),
+                    .records       = records_,
+                    .blocks        = index_.size(),
+                    .index_offset  = offset_};
+  os_.write(reinterpret_cast<const char*>(index_.data()), // NOLINT reincast
+            static_cast<std::streamsize>(index_.size() * sizeof(index_entry)));
+  os_.write(reinterpret_cast<const char*>(&foot), sizeof(foot)); // NOLINT reincast
+  os_.flush();
+  offset_ += index_.size() * sizeof(index_entry) + sizeof(foot);
+}
+
+template <pw_type PwType>
+database<PwType>::database(std::filesystem::path filename)
+    : filename_(std::move(filename)), reader_(filename_) {
+  const auto filesize = std::filesystem::file_size(filename_);
+  if (filesize < sizeof(footer)) {
+    throw std::runtime_error(fmt::format("{} is not a packed db: too small", filename_));
+  }
+  reader_.read(reinterpret_cast<std::byte*>(&footer_), sizeof(footer_), // NOLINT reincast
+               filesize - sizeof(footer_));
+
+  if (footer_.magic != footer::expected_magic) {
+    throw std::runtime_error(fmt::format("{} is not a packed db", filename_));
+  }
+  if (footer_.version != footer::current_version) {
+    throw std::runtime_error(
+        fmt::format("packed db {} has unsupported version {}", filename_, footer_.version));
+  }
+  if (footer_.hash_size != PwType::hash_size) {
+    throw std::runtime_error(fmt::format("packed db {} has {} byte hashes, not {}. Check the "
+                                         "hash format options.",
+                                         filename_, footer_.hash_size, PwType::hash_size));
+  }
+  if (footer_.block_records == 0 ||
+      footer_.blocks != (footer_.records + footer_.block_records - 1) / footer_.block_records ||
+      footer_.index_offset + footer_.blocks * sizeof(index_entry) + sizeof(footer) != filesize) {
+    throw std::runtime_error(fmt::format("packed db {} is truncated or corrupt", filename_));
+  }
+
+  index_.resize(footer_.blocks);
+  reader_.read(reinterpret_cast<std::byte*>(index_.data()), // NOLINT reincast
+               index_.size() * sizeof(index_entry), footer_.index_offset);
+}
+
+template <pw_type PwType>
+std::size_t database<PwType>::first_block(std::uint64_t key) const {
+  auto iter = std::lower_bound(index_.begin(), index_.end(), key,
+                               [](const index_entry& e, std::uint64_t k) { return e.key < k; });
+  // the block before the first one which starts at or beyond `key` may contain it too
+  return iter == index_.begin() ? 0 : static_cast<std::size_t>(iter - index_.begin()) - 1;
+}
+
+template <pw_type PwType>
+void database<PwType>::read_block(std::size_t block, std::vector<PwType>& records) {
+  if (block >= index_.size()) {
+    throw std::out_of_range(fmt::format("packed db {} has no block {}", filename_, block));
+  }
+  const std::uint64_t begin = index_[block].offset;
+  const std::uint64_t end =
+      block + 1 == index_.size() ? footer_.index_offset : index_[block + 1].offset;
+  if (end < begin) throw corrupt(filename_, block);
+
+  thread_local std::vector<std::byte> bytes; // reused, to avoid an allocation per lookup
+  bytes.resize(end - begin);
+  {
+#ifndef FLAT_FILE_HAS_MMAP
+    const std::lock_guard lock(mutex_);
+#endif
+    reader_.read(bytes.data(), bytes.size(), begin);
+  }
+
+  const std::size_t count = block + 1 == index_.size()
+                                ? footer_.records - block * footer_.block_records
+                                : footer_.block_records;
+  if (!decode_block(bytes.data(), bytes.size(), count, records)) throw corrupt(filename_, block);
+}
+
+template <pw_type PwType>
+std::optional<PwType> database<PwType>::find(const PwType& needle) {
+  thread_local std::vector<PwType> records;
+
+  const std::uint64_t key = get_key(needle);
+  // usually one block, but a run of records with the same key can span blocks
+  for (std::size_t block = first_block(key); block != index_.size() && index_[block].key <= key;
+       ++block) {
+    read_block(block, records);
+    if (auto iter = std::lower_bound(records.begin(), records.end(), needle);
+        iter != records.end()) {
+      if (*iter == needle) return *iter;
+      break; // and later blocks are all greater
+    }
+  }
+  return {};
+}
+
+template <pw_type PwType>
+void database<PwType>::read_range(const PwType& first, const std::optional<PwType>& last,
+                                  std::vector<PwType>& records) {
+  thread_local std::vector<PwType> block_records;
+
+  records.clear();
+  for (std::size_t block = first_block(get_key(first));
+       block != index_.size() && (!last || index_[block].key <= get_key(*last)); ++block) {
+    read_block(block, block_records);
+    auto begin = std::lower_bound(block_records.begin(), block_records.end(), first);
+    auto end   = last ? std::lower_bound(begin, block_records.end(), *last) : block_records.end();
+    records.insert(records.end(), begin, end);
+    if (end != block_records.end()) break; // reached `last`
+  }
+}
+
+template class writer<pawned_pw_sha1>;
+template class writer<pawned_pw_ntlm>;
+template class writer<pawned_pw_sha1t64>;
+
+template class database<pawned_pw_sha1>;
+template class database<pawned_pw_ntlm>;
+template class database<pawned_pw_sha1t64>;
+
+} // namespace hibp::packed
@@ -0,0 +1,394 @@
+#include "paged.hpp"
+#include "arrcmp.hpp"
+#include "flat_file.hpp"
+#include "hibp.hpp"
+#include <algorithm>
+#include <bit>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <filesystem>
+#include <fmt/format.h>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#ifdef HIBP_PAGED_PREAD
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace hibp {
+
+namespace {
+
+using details::page_header;
+using details::paged_header;
+
+constexpr std::size_t min_page_size = 512;
+constexpr std::size_t max_page_size = 1U << 20U;
+
+template <pw_type PwType>
+std::uint64_t to_key(const PwType& pw) {
+  return arrcmp::impl::bytearray_cast<std::uint64_t>(pw.hash.data());
+}
+
+template <pw_type PwType>
+std::size_t page_capacity(std::size_t page_size) {
+  return (page_size - sizeof(page_header)) / sizeof(PwType);
+}
+
+// monotonic in the key, so the buckets are in hash order. For keys in [first_key, last_key] only.
+std::uint64_t bucket_of(const paged_header& header, std::uint64_t key) {
+  return ((key - header.first_key) >> header.shift) * header.scale >> 32U;
+}
+
+template <pw_type PwType>
+std::array<std::byte, 24> to_bytes(const PwType& pw) {
+  std::array<std::byte, 24> bytes{};
+  std::memcpy(bytes.data(), &pw, sizeof(pw));
+  return bytes;
+}
+
+// the calling thread's buffer for one page, aligned to the page size, as O_DIRECT requires
+std::byte* page_buffer(std::size_t page_size) {
+  struct aligned_delete {
+    std::size_t align = 0;
+    void operator()(std::byte* ptr) const { ::operator delete(ptr, std::align_val_t{align}); }
+  };
+  thread_local std::unique_ptr<std::byte, aligned_delete> buffer;
+  if (buffer.get_deleter().align < page_size) {
+    buffer = std::unique_ptr<std::byte, aligned_delete>(
+        static_cast<std::byte*>(::operator new(page_size, std::align_val_t{page_size})),
+        aligned_delete{page_size});
+  }
+  return buffer.get();
+}
+
+void check_page_size(std::size_t page_size) {
+  if (page_size < min_page_size || page_size > max_page_size || !std::has_single_bit(page_size)) {
+    throw std::runtime_error(fmt::format("page size must be a power of 2 from {} to {}, not {}",
+                                         min_page_size, max_page_size, page_size));
+  }
+}
+
+paged_header read_header(const std::filesystem::path& filename) {
+  std::ifstream file(filename, std::ios::binary);
+  if (!file) {
+    throw std::runtime_error(fmt::format("Cannot open paged db '{}'. Because: \"{}\".",
+                                         filename.string(),
+                                         std::strerror(errno))); // NOLINT errno
+  }
+  paged_header header;
+  file.read(reinterpret_cast<char*>(&header), sizeof(header)); // NOLINT reincast
+  if (!file) {
+    throw std::runtime_error(fmt::format("'{}' is not a paged db.", filename.string()));
+  }
+  return header;
+}
+
+// empty if the header describes a sound paged db of PwType records, otherwise the reason why not
+template <pw_type PwType>
+std::string header_problem(const paged_header& header, const std::filesystem::path& filename) {
+  if (header.magic != paged_header{}.magic) return "it is not a paged db";
+  if (header.version != paged_header{}.version) return "it has an unknown version";
+  if (header.hash_size != PwType::hash_size) {
+    return fmt::format("it has {} byte hashes, not {}", header.hash_size, PwType::hash_size);
+  }
+  if (header.page_size < min_page_size || header.page_size > max_page_size ||
+      !std::has_single_bit(header.page_size) || header.buckets == 0 || header.shift > 32 ||
+      header.first_key > header.last_key) {
+    return "it is corrupt";
+  }
+  if (std::filesystem::file_size(filename) !=
+      (1 + header.buckets + header.overflows) * header.page_size) {
+    return "its size does not match";
+  }
+  return {};
+}
+
+// empty if the paged copy is valid for this db, otherwise the reason why not. Like the toc, the
+// check is O(1): the number of records, and the first and last records.
+template <pw_type PwType>
+std::string paged_problem(const std::filesystem::path& db_filename, std::size_t page_size) try {
+  const auto        filename = paged_filename(db_filename);
+  const auto        header   = read_header(filename);
+  const std::string problem  = header_problem<PwType>(header, filename);
+  if (!problem.empty()) return problem;
+  if (header.page_size != page_size) {
+    return fmt::format("built with {} byte pages, not {}", header.page_size, page_size);
+  }
+  flat_file::database<PwType> db(db_filename);
+  if (header.records != db.number_records()) {
+    return fmt::format("built for {} records, but db has {}", header.records, db.number_records());
+  }
+  if (db.number_records() != 0) {
+    const PwType first = db.get_record(0); // copy, as reading back() will reuse the buffer
+    if (header.first != to_bytes(first) || header.last != to_bytes(db.back())) {
+      return "db contents have changed";
+    }
+  }
+  return {};
+} catch (const std::exception& e) {
+  return e.what();
+}
+
+} // namespace
+
+std::filesystem::path paged_filename(const std::filesystem::path& db_filename) {
+  return db_filename.string() + ".paged";
+}
+
+template <pw_type PwType>
+void paged_build(const std::filesystem::path& db_filename, std::size_t page_size) {
+  check_page_size(page_size);
+  const auto filename = paged_filename(db_filename);
+  if (std::filesystem::exists(filename)) {
+    std::cout << fmt::format("loading paged db: {}\n", filename.string());
+    const std::string problem = paged_problem<PwType>(db_filename, page_size);
+    if (problem.empty()) return;
+    std::cout << fmt::format("paged db is invalid for this db ({}), rebuilding\n", problem);
+  }
+#ifdef FLAT_FILE_HAS_MMAP
+  const flat_file::mmap_database<PwType> db(db_filename, flat_file::access_hint::sequential);
+#else
+  flat_file::database<PwType> db(db_filename, (1U << 16U) / sizeof(PwType));
+#endif
+
+  const std::size_t capacity = page_capacity<PwType>(page_size);
+  paged_header      header{.hash_size = PwType::hash_size,
+                           .page_size = static_cast<std::uint32_t>(page_size),
+                           .records   = db.number_records()};
+  header.buckets = 1;
+  if (header.records != 0) {
+    const PwType first = *db.begin();
+    header.first_key   = to_key(first);
+    header.last_key    = to_key(db.back());
+    header.first       = to_bytes(first);
+    header.last        = to_bytes(db.back());
+
+    const std::uint64_t span = header.last_key - header.first_key;
+    while ((span >> header.shift) > 0xFFFF'FFFFULL) ++header.shift;
+    const std::uint64_t span32 = span >> header.shift;
+    const std::uint64_t target = capacity * 3 / 4; // records per bucket, on average
+    header.buckets =
+        std::clamp<std::uint64_t>((header.records + target - 1) / target, 1, span32 + 1);
+    header.scale = (header.buckets << 32U) / (span32 + 1);
+  }
+
+  const auto tmp_filename = filename.string() + ".tmp";
+  {
+    std::ofstream file(tmp_filename, std::ios::binary);
+    if (!file) {
+      throw std::runtime_error(fmt::format("Cannot open '{}' for writing. Because: \"{}\".",
+                                           tmp_filename,
+                                           std::strerror(errno))); // NOLINT errno
+    }
+    std::vector<std::byte> page(page_size);
+    file.write(reinterpret_cast<const char*>(page.data()), // NOLINT reincast, header goes last
+               static_cast<std::streamsize>(page.size()));
+
+    // the pages of the records which do not fit into their bucket's page. They are rare, so they
+    // are held in memory, and written after all the buckets.
+    struct overflow_page {
+      std::vector<PwType> records;
+      bool                last_of_bucket;
+    };
+    std::vector<overflow_page> overflow;
+
+    // writes `count` records from `records` into one page, followed by the page `next`
+    auto write_page = [&](const PwType* records, std::size_t count, std::uint64_t next) {
+      std::fill(page.begin(), page.end(), std::byte{});
+      const page_header ph{.records = static_cast<std::uint32_t>(count),
+                           .next    = static_cast<std::uint32_t>(next)};
+      std::memcpy(page.data(), &ph, sizeof(ph));
+      std::memcpy(page.data() + sizeof(ph), records, count * sizeof(PwType));
+      file.write(reinterpret_cast<const char*>(page.data()), // NOLINT reincast
+                 static_cast<std::streamsize>(page.size()));
+    };
+
+    std::vector<PwType> bucket_records;
+    std::uint64_t       bucket = 0;
+    auto                flush  = [&] {
+      const std::size_t size = bucket_records.size();
+      write_page(bucket_records.data(), std::min(size, capacity),
+                 size > capacity ? 1 + header.buckets + overflow.size() : 0);
+      for (std::size_t pos = capacity; pos < size; pos += capacity) {
+        const std::size_t end = std::min(pos + capacity, size);
+        overflow.push_back({{bucket_records.begin() + static_cast<std::ptrdiff_t>(pos),
+                             bucket_records.begin() + static_cast<std::ptrdiff_t>(end)},
+                            end == size});
+      }
+      bucket_records.clear();
+      ++bucket;
+    };
+
+    std::uint64_t records = 0;
+    PwType        last;
+    for (const auto& pw: db) {
+      if (records != 0 && pw < last) {
+        throw std::runtime_error(fmt::format("Cannot build paged db for {}: records are not "
+                                             "sorted by hash at record {}.",
+                                             db_filename.string(), records));
+      }
+      const std::uint64_t pw_bucket = bucket_of(header, to_key(pw));
+      while (bucket != pw_bucket) flush();
+      bucket_records.push_back(pw);
+      last = pw;
+      ++records;
+    }
+    while (bucket != header.buckets) flush();
+
+    // each bucket's overflow pages are consecutive, so each one's next is the following page
+    header.overflows = overflow.size();
+    if (1 + header.buckets + header.overflows > 0xFFFF'FFFFULL) {
+      throw std::runtime_error(fmt::format("Cannot build paged db for {}: too many pages, use a "
+                                           "larger page size.",
+                                           db_filename.string()));
+    }
+    for (std::size_t i = 0; i != overflow.size(); ++i) {
+      const auto& op = overflow[i];
+      write_page(op.records.data(), op.records.size(),
+                 op.last_of_bucket ? 0 : 1 + header.buckets + i + 1);
+    }
+
+    file.seekp(0);
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header)); // NOLINT reincast
+    if (!file) {
+      throw std::runtime_error(fmt::format("Error writing '{}'.", tmp_filename));
+    }
+  }
+  std::cout << fmt::format("saving paged db: {} ({} buckets, {} overflow pages)\n",
+                           filename.string(), header.buckets, header.overflows);
+  std::filesystem::rename(tmp_filename, filename);
+}
+
+template <pw_type PwType>
+paged_db<PwType>::paged_db(const std::filesystem::path& db_filename, bool direct)
+    : header_(read_header(paged_filename(db_filename))),
+      filename_(paged_filename(db_filename).string()) {
+
+  if (const std::string problem = header_problem<PwType>(header_, filename_); !problem.empty()) {
+    throw std::runtime_error(fmt::format("Cannot use paged db '{}': {}.", filename_, problem));
+  }
+#ifdef HIBP_PAGED_PREAD
+  fd_ = ::open(filename_.c_str(), O_RDONLY | O_CLOEXEC); // NOLINT vararg
+  if (fd_ < 0) {
+    throw std::runtime_error(fmt::format("Cannot open paged db '{}'. Because: \"{}\".", filename_,
+                                         std::strerror(errno))); // NOLINT errno
+  }
+  if (direct) {
+#if defined(O_DIRECT)
+    // not all file systems support it, eg tmpfs, nor pages smaller than the device's blocks
+    const int direct_fd = ::open(filename_.c_str(), O_RDONLY | O_CLOEXEC | O_DIRECT); // NOLINT
+    if (direct_fd >= 0) {
+      if (::pread(direct_fd, page_buffer(header_.page_size), header_.page_size, 0) ==
+          static_cast<ssize_t>(header_.page_size)) {
+        ::close(fd_);
+        fd_     = direct_fd;
+        direct_ = true;
+      } else {
+        ::close(direct_fd);
+      }
+    }
+#elif defined(F_NOCACHE)
+    direct_ = ::fcntl(fd_, F_NOCACHE, 1) != -1; // NOLINT vararg
+#endif
+  }
+#if defined(POSIX_FADV_RANDOM)
+  if (!direct_) ::posix_fadvise(fd_, 0, 0, POSIX_FADV_RANDOM);
+#endif
+#else
+  stream_.open(filename_, std::ios::binary);
+  if (!stream_) {
+    throw std::runtime_error(fmt::format("Cannot open paged db '{}'. Because: \"{}\".", filename_,
+                                         std::strerror(errno))); // NOLINT errno
+  }
+#endif
+}
+
+template <pw_type PwType>
+paged_db<PwType>::~paged_db() {
+#ifdef HIBP_PAGED_PREAD
+  if (fd_ >= 0) ::close(fd_);
+#endif
+}
+
+template <pw_type PwType>
+const std::byte* paged_db<PwType>::read_page(std::uint64_t page) {
+  std::byte*          buffer = page_buffer(header_.page_size);
+  const std::uint64_t offset = page * header_.page_size;
+#ifdef HIBP_PAGED_PREAD
+  std::size_t done = 0;
+  while (done != header_.page_size) {
+    const ssize_t bytes = ::pread(fd_, buffer + done, header_.page_size - done,
+                                  static_cast<off_t>(offset + done));
+    if (bytes < 0 && errno == EINTR) continue; // NOLINT errno
+    if (bytes <= 0) {
+      throw std::runtime_error(
+          fmt::format("Error reading page {} of paged db '{}'. Because: \"{}\".", page, filename_,
+                      bytes == 0 ? "end of file" : std::strerror(errno))); // NOLINT errno
+    }
+    done += static_cast<std::size_t>(bytes);
+  }
+#else
+  const std::lock_guard lock(mutex_);
+  stream_.seekg(static_cast<std::streamoff>(offset));
+  stream_.read(reinterpret_cast<char*>(buffer), header_.page_size); // NOLINT reincast
+  if (!stream_) {
+    stream_.clear();
+    throw std::runtime_error(
+        fmt::format("Error reading page {} of paged db '{}'.", page, filename_));
+  }
+#endif
+  return buffer;
+}
+
+template <pw_type PwType>
+std::optional<PwType> paged_db<PwType>::find(const PwType& needle, std::size_t& reads) {
+  const std::uint64_t key = to_key(needle);
+  if (header_.records == 0 || key < header_.first_key || key > header_.last_key) return {};
+
+  const std::uint64_t pages    = 1 + header_.buckets + header_.overflows;
+  const std::size_t   capacity = page_capacity<PwType>(header_.page_size);
+  std::uint64_t       page     = 1 + bucket_of(header_, key);
+  while (true) {
+    const std::byte* buffer = read_page(page);
+    ++reads;
+    page_header ph;
+    std::memcpy(&ph, buffer, sizeof(ph));
+    if (ph.records > capacity || (ph.next != 0 && (ph.next <= page || ph.next >= pages))) {
+      throw std::runtime_error(
+          fmt::format("paged db '{}' is corrupt at page {}.", filename_, page));
+    }
+    const auto* first = reinterpret_cast<const PwType*>(buffer + sizeof(ph)); // NOLINT reincast
+    const auto* last  = first + ph.records;
+    if (const auto* iter = hibp::lower_bound(first, last, needle); iter != last) {
+      if (*iter == needle) return *iter;
+      return {}; // the later pages of the bucket only hold greater hashes
+    }
+    if (ph.next == 0) return {};
+    page = ph.next;
+  }
+}
+
+template void paged_build<pawned_pw_sha1>(const std::filesystem::path& db_filename,
+                                          std::size_t                  page_size);
+template void paged_build<pawned_pw_ntlm>(const std::filesystem::path& db_filename,
+                                          std::size_t                  page_size);
+template void paged_build<pawned_pw_sha1t64>(const std::filesystem::path& db_filename,
+                                             std::size_t                  page_size);
+
+template class paged_db<pawned_pw_sha1>;
+template class paged_db<pawned_pw_ntlm>;
+template class paged_db<pawned_pw_sha1t64>;
+
+} // namespace hibp
@@ -0,0 +1,241 @@
+#include "split.hpp"
+#include "arrcmp.hpp"
+#include "flat_file.hpp"
+#include "hibp.hpp"
+#include <algorithm>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <filesystem>
+#include <fmt/format.h>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+
+namespace hibp {
+
+namespace {
+
+using details::key128;
+using details::split_has_tail;
+using details::split_key_t;
+
+template <pw_type PwType>
+split_key_t<PwType> to_key(const PwType& pw) {
+  if constexpr (std::is_same_v<split_key_t<PwType>, std::uint64_t>) {
+    return arrcmp::impl::bytearray_cast<std::uint64_t>(pw.hash.data());
+  } else {
+    return {.hi = arrcmp::impl::bytearray_cast<std::uint64_t>(pw.hash.data()),
+            .lo = arrcmp::impl::bytearray_cast<std::uint64_t>(pw.hash.data() + 8)};
+  }
+}
+
+template <pw_type PwType>
+std::uint32_t to_tail(const PwType& pw) {
+  return arrcmp::impl::bytearray_cast<std::uint32_t>(pw.hash.data() + 16);
+}
+
+// the inverse of bytearray_cast
+template <typename T>
+void store_big_endian(std::byte* dest, T value) {
+  if constexpr (std::endian::native == std::endian::little) value = arrcmp::impl::byteswap(value);
+  std::memcpy(dest, &value, sizeof(value));
+}
+
+std::string keys_filename(const std::filesystem::path& db_filename) {
+  return db_filename.string() + ".keys";
+}
+std::string tails_filename(const std::filesystem::path& db_filename) {
+  return db_filename.string() + ".tails";
+}
+std::string counts_filename(const std::filesystem::path& db_filename) {
+  return db_filename.string() + ".counts";
+}
+
+bool split_exists(const std::filesystem::path& db_filename, bool has_tail) {
+  return std::filesystem::exists(keys_filename(db_filename)) &&
+         std::filesystem::exists(counts_filename(db_filename)) &&
+         (!has_tail || std::filesystem::exists(tails_filename(db_filename)));
+}
+
+// empty if the split columns are valid for this db, otherwise the reason why not. Like the toc, the
+// check is O(1): the sizes and the first and last records.
+template <pw_type PwType>
+std::string split_problem(const std::filesystem::path& db_filename) try {
+  flat_file::database<PwType> db(db_filename);
+  split_db<PwType>            split(db_filename); // checks the columns agree with each other
+  if (split.number_records() != db.number_records()) {
+    return fmt::format("built for {} records, but db has {}", split.number_records(),
+                       db.number_records());
+  }
+  if (db.number_records() != 0) {
+    const PwType first = db.get_record(0); // copy, as reading back() will reuse the buffer
+    if (split.get_record(0) != first || split.get_record(0).count != first.count ||
+        split.get_record(db.number_records() - 1) != db.back() ||
+        split.get_record(db.number_records() - 1).count != db.back().count) {
+      return "db contents have changed";
+    }
+  }
+  return {};
+} catch (const std::exception& e) {
+  return e.what(); // eg a truncated column
+}
+
+} // namespace
+
+template <pw_type PwType>
+split_writer<PwType>::split_writer(std::filesystem::path db_filename)
+    : db_filename_(std::move(db_filename)) {
+  keys_.emplace(keys_filename(db_filename_) + ".tmp");
+  if constexpr (split_has_tail<PwType>) tails_.emplace(tails_filename(db_filename_) + ".tmp");
+  counts_.emplace(counts_filename(db_filename_) + ".tmp");
+}
+
+template <pw_type PwType>
+void split_writer<PwType>::add(const PwType& pw) {
+  if (records_ != 0 && pw < last_) {
+    throw std::runtime_error(fmt::format("Cannot build split columns for {}: records are not "
+                                         "sorted by hash at record {}.",
+                                         db_filename_.string(), records_));
+  }
+  keys_->write(to_key(pw));
+  if constexpr (split_has_tail<PwType>) tails_->write(to_tail(pw));
+  counts_->write(pw.count);
+  last_ = pw;
+  ++records_;
+}
+
+template <pw_type PwType>
+void split_writer<PwType>::finalize() {
+  keys_.reset(); // flush and close
+  tails_.reset();
+  counts_.reset();
+  std::cout << fmt::format("saving split columns: {}.(keys|counts)\n", db_filename_.string());
+  // the keys go last, so a reader never sees a complete set of columns which don't belong together
+  std::filesystem::rename(counts_filename(db_filename_) + ".tmp", counts_filename(db_filename_));
+  if constexpr (split_has_tail<PwType>) {
+    std::filesystem::rename(tails_filename(db_filename_) + ".tmp", tails_filename(db_filename_));
+  }
+  std::filesystem::rename(keys_filename(db_filename_) + ".tmp", keys_filename(db_filename_));
+}
+
+template <pw_type PwType>
+void split_build(const std::filesystem::path& db_filename) {
+  if (split_exists(db_filename, split_has_tail<PwType>)) {
+    std::cout << fmt::format("loading split columns: {}.(keys|counts)\n", db_filename.string());
+    const std::string problem = split_problem<PwType>(db_filename);
+    if (problem.empty()) return;
+    std::cout << fmt::format("split columns are invalid for this db ({}), rebuilding\n", problem);
+  }
+#ifdef FLAT_FILE_HAS_MMAP
+  const flat_file::mmap_database<PwType> db(db_filename, flat_file::access_hint::sequential);
+#else
+  flat_file::database<PwType> db(db_filename, (1U << 16U) / sizeof(PwType));
+#endif
+  split_writer<PwType> writer(db_filename);
+  for (const auto& pw: db) writer.add(pw);
+  writer.finalize();
+}
+
+template <pw_type PwType>
+split_db<PwType>::split_db(const std::filesystem::path& db_filename)
+    : keys_(keys_filename(db_filename)), counts_(counts_filename(db_filename)) {
+  records_ = keys_.number_records();
+  if constexpr (split_has_tail<PwType>) {
+    tails_ = std::make_unique<column<std::uint32_t>>(tails_filename(db_filename));
+    if (tails_->number_records() != records_) {
+      throw std::runtime_error(fmt::format("split columns of {} are corrupt: {} keys, but {} tails",
+                                           db_filename.string(), records_,
+                                           tails_->number_records()));
+    }
+  }
+  if (counts_.number_records() != records_) {
+    throw std::runtime_error(fmt::format("split columns of {} are corrupt: {} keys, but {} counts",
+                                         db_filename.string(), records_,
+                                         counts_.number_records()));
+  }
+#ifdef FLAT_FILE_HAS_MMAP
+  keys_.advise(flat_file::access_hint::random);
+  counts_.advise(flat_file::access_hint::random);
+#endif
+}
+
+template <pw_type PwType>
+std::size_t split_db<PwType>::lower_bound(const key_type& key, std::size_t first,
+                                          std::size_t last) {
+#ifdef FLAT_FILE_HAS_MMAP
+  // branch free, over the dense, aligned keys, so the compiler can use conditional moves
+  const key_type* base = keys_.begin() + first;
+  std::size_t     len  = last - first;
+  while (len > 1) {
+    const std::size_t half = len / 2;
+    base += base[half] < key ? half : 0;
+    len -= half;
+  }
+  return static_cast<std::size_t>(base - keys_.begin()) + (len == 1 && *base < key ? 1 : 0);
+#else
+  return static_cast<std::size_t>(
+      std::lower_bound(keys_.begin() + first, keys_.begin() + last, key) - keys_.begin());
+#endif
+}
+
+template <pw_type PwType>
+std::optional<PwType> split_db<PwType>::find(const PwType& needle, std::size_t first,
+                                             std::size_t last) {
+#ifndef FLAT_FILE_HAS_MMAP
+  const std::lock_guard lock(mutex_);
+#endif
+  const key_type key = to_key(needle);
+  for (std::size_t pos = lower_bound(key, first, last);
+       pos != last && keys_.get_record(pos) == key; ++pos) {
+    if constexpr (split_has_tail<PwType>) {
+      const std::uint32_t tail = tails_->get_record(pos);
+      if (tail < to_tail(needle)) continue;
+      if (tail > to_tail(needle)) break;
+    }
+    PwType found = needle;
+    found.count  = counts_.get_record(pos);
+    return found;
+  }
+  return {};
+}
+
+template <pw_type PwType>
+PwType split_db<PwType>::get_record(std::size_t pos) {
+#ifndef FLAT_FILE_HAS_MMAP
+  const std::lock_guard lock(mutex_);
+#endif
+  PwType         pw;
+  const key_type key = keys_.get_record(pos);
+  if constexpr (std::is_same_v<key_type, std::uint64_t>) {
+    store_big_endian(pw.hash.data(), key);
+  } else {
+    store_big_endian(pw.hash.data(), key.hi);
+    store_big_endian(pw.hash.data() + 8, key.lo);
+  }
+  if constexpr (split_has_tail<PwType>) {
+    store_big_endian(pw.hash.data() + 16, tails_->get_record(pos));
+  }
+  pw.count = counts_.get_record(pos);
+  return pw;
+}
+
+template class split_writer<pawned_pw_sha1>;
+template class split_writer<pawned_pw_ntlm>;
+template class split_writer<pawned_pw_sha1t64>;
+
+template void split_build<pawned_pw_sha1>(const std::filesystem::path& db_filename);
+template void split_build<pawned_pw_ntlm>(const std::filesystem::path& db_filename);
+template void split_build<pawned_pw_sha1t64>(const std::filesystem::path& db_filename);
+
+template class split_db<pawned_pw_sha1>;
+template class split_db<pawned_pw_ntlm>;
+template class split_db<pawned_pw_sha1t64>;
+
+} // namespace hibp
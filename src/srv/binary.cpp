@@ -0,0 +1,263 @@
+#include "srv/binary.hpp"
+#include <cerrno>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <fmt/format.h>
+#include <iostream>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+#if __has_include(<sys/un.h>) && !defined(_WIN32)
+#define HIBP_BINARY_SOCKETS
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+namespace hibp::srv::binary {
+
+#ifdef HIBP_BINARY_SOCKETS
+
+namespace {
+
+#ifdef MSG_NOSIGNAL
+constexpr int send_flags = MSG_NOSIGNAL; // a client which has gone is not a SIGPIPE
+#else
+constexpr int send_flags = 0;
+#endif
+
+constexpr std::size_t initial_buffer = 64UL * 1024; // grown for larger frames
+
+// closes `fd`, and throws, with the reason for the failed call which preceded this
+[[noreturn]] void fail(int fd, const std::string& what) {
+  const std::string reason = std::strerror(errno); // NOLINT errno
+  if (fd != -1) ::close(fd);
+  throw std::runtime_error(fmt::format("{}, because '{}'", what, reason));
+}
+
+std::uint32_t load_le(const std::byte* bytes, unsigned size) {
+  std::uint32_t value = 0;
+  for (unsigned i = 0; i != size; ++i) value |= std::to_integer<std::uint32_t>(bytes[i]) << (8 * i);
+  return value;
+}
+
+frame_header load_header(const std::byte* bytes) {
+  return {
+      .format      = std::to_integer<std::uint8_t>(bytes[0]),
+      .digest_size = std::to_integer<std::uint8_t>(bytes[1]),
+      .reserved    = static_cast<std::uint16_t>(load_le(bytes + 2, 2)),
+      .count       = load_le(bytes + 4, 4),
+  };
+}
+
+void append_le(std::vector<std::byte>& out, std::int32_t count) {
+  const auto value = static_cast<std::uint32_t>(count);
+  for (unsigned i = 0; i != 4; ++i) out.push_back(static_cast<std::byte>(value >> (8 * i)));
+}
+
+bool send_all(int fd, std::span<const std::byte> bytes) {
+  while (!bytes.empty()) {
+    const auto sent = ::send(fd, bytes.data(), bytes.size(), send_flags);
+    if (sent < 0) {
+      if (errno == EINTR) continue; // NOLINT errno
+      return false;
+    }
+    bytes = bytes.subspan(static_cast<std::size_t>(sent));
+  }
+  return true;
+}
+
+} // namespace
+
+listener::listener(const std::string& path, std::size_t max_batch, handler handle)
+    : handle_(std::move(handle)), max_batch_(max_batch), path_(path),
+      endpoint_(fmt::format("unix:{}", path)) {
+
+  sockaddr_un addr{};
+  addr.sun_family = AF_UNIX;
+  if (path.size() >= sizeof(addr.sun_path)) {
+    throw std::runtime_error(fmt::format("the binary socket path '{}' is too long", path));
+  }
+  std::memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+  auto* const sockaddr_ptr = reinterpret_cast<sockaddr*>(&addr); // NOLINT reinterpret_cast
+
+  // a socket left behind by a server which was killed, which nothing accepts on any more
+  struct stat st{};
+  if (::lstat(path.c_str(), &st) == 0 && S_ISSOCK(st.st_mode)) {
+    const int probe = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    const bool live = probe != -1 && ::connect(probe, sockaddr_ptr, sizeof(addr)) == 0;
+    if (probe != -1) ::close(probe);
+    if (live) throw std::runtime_error(fmt::format("the binary socket '{}' is in use", path));
+    ::unlink(path.c_str());
+  }
+
+  fd_ = ::socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd_ == -1) fail(fd_, "cannot create the binary socket");
+  if (::bind(fd_, sockaddr_ptr, sizeof(addr)) != 0) {
+    fail(fd_, fmt::format("cannot bind the binary socket to '{}'", path));
+  }
+  start();
+}
+
+listener::listener(const std::string& address, std::uint16_t port, std::size_t max_batch,
+                   handler handle)
+    : handle_(std::move(handle)), max_batch_(max_batch),
+      endpoint_(fmt::format("tcp:{}:{}", address, port)) {
+
+  addrinfo hints{};
+  hints.ai_family   = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags    = AI_PASSIVE;
+
+  addrinfo*  addrs   = nullptr;
+  const auto service = std::to_string(port);
+  if (const int err = ::getaddrinfo(address.c_str(), service.c_str(), &hints, &addrs); err != 0) {
+    throw std::runtime_error(
+        fmt::format("cannot resolve {}, because '{}'", address, ::gai_strerror(err)));
+  }
+  for (const addrinfo* addr = addrs; addr != nullptr; addr = addr->ai_next) {
+    fd_ = ::socket(addr->ai_family, addr->ai_socktype, addr->ai_protocol);
+    if (fd_ == -1) continue;
+    const int one = 1;
+    ::setsockopt(fd_, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if (::bind(fd_, addr->ai_addr, addr->ai_addrlen) == 0) break;
+    ::close(fd_);
+    fd_ = -1;
+  }
+  ::freeaddrinfo(addrs);
+  if (fd_ == -1) fail(fd_, fmt::format("cannot bind the binary port to {}", endpoint_));
+  start();
+}
+
+void listener::start() {
+  if (::listen(fd_, SOMAXCONN) != 0) {
+    if (!path_.empty()) ::unlink(path_.c_str());
+    fail(fd_, fmt::format("cannot listen on {}", endpoint_));
+  }
+  acceptor_ = std::jthread([this](const std::stop_token& stop) { accept(stop); });
+}
+
+listener::~listener() {
+  acceptor_.request_stop();
+  if (acceptor_.joinable()) acceptor_.join();
+  // no more connections are added, and shutting them down wakes their threads
+  for (auto& conn: connections_) ::shutdown(conn.fd, SHUT_RDWR);
+  for (auto& conn: connections_) {
+    conn.thread.join();
+    ::close(conn.fd);
+  }
+  ::close(fd_);
+  if (!path_.empty()) ::unlink(path_.c_str());
+}
+
+void listener::accept(const std::stop_token& stop) {
+  while (!stop.stop_requested()) {
+    pollfd listening{.fd = fd_, .events = POLLIN, .revents = 0};
+    if (::poll(&listening, 1, 200) <= 0) continue; // so a stop is noticed, or EINTR
+
+    const int fd = ::accept(fd_, nullptr, nullptr);
+    if (fd == -1) {
+      // eg out of fds, which closing connections will free, so don't spin
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+      continue;
+    }
+    if (path_.empty()) {
+      const int one = 1;
+      ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    }
+
+    const std::lock_guard lk(mutex_);
+    for (auto it = connections_.begin(); it != connections_.end();) {
+      if (it->done) {
+        it->thread.join();
+        ::close(it->fd);
+        it = connections_.erase(it);
+      } else {
+        ++it;
+      }
+    }
+    auto& conn  = connections_.emplace_back();
+    conn.fd     = fd;
+    conn.thread = std::jthread([this, &conn] {
+      try {
+        serve(conn);
+      } catch (const std::exception& e) {
+        std::cerr << fmt::format("binary: closing a connection on {}: {}\n", endpoint_, e.what());
+      }
+      ::shutdown(conn.fd, SHUT_RDWR); // so the client sees the close now, not when it is reaped
+      conn.done = true;
+    });
+  }
+}
+
+void listener::serve(connection& conn) const {
+  std::vector<std::byte>    in(initial_buffer);
+  std::size_t               begin = 0; // of the frames received, and not served yet
+  std::size_t               end   = 0;
+  std::vector<std::byte>    out;
+  std::vector<std::int32_t> counts;
+  while (true) {
+    // all the complete frames which have arrived, with one write of their responses
+    while (end - begin >= header_size) {
+      const std::byte*   frame  = in.data() + begin;
+      const frame_header header = load_header(frame);
+      if (header.reserved != 0 || header.digest_size == 0 || header.count > max_batch_) {
+        throw std::runtime_error(fmt::format("invalid frame header, format {}, digest_size {}, "
+                                             "count {}",
+                                             header.format, header.digest_size, header.count));
+      }
+      const std::size_t digests_size = std::size_t{header.count} * header.digest_size;
+      if (end - begin < header_size + digests_size) break;
+
+      counts.resize(header.count);
+      handle_(header, {frame + header_size, digests_size}, counts);
+      for (const auto count: counts) append_le(out, count);
+      begin += header_size + digests_size;
+    }
+    if (!out.empty()) {
+      if (!send_all(conn.fd, out)) return;
+      out.clear();
+    }
+
+    // keep any partial frame, at the front, with room for the rest of it
+    std::memmove(in.data(), in.data() + begin, end - begin);
+    end -= begin;
+    begin = 0;
+    if (end == in.size()) in.resize(in.size() * 2);
+
+    const auto got = ::recv(conn.fd, in.data() + end, in.size() - end, 0);
+    if (got < 0 && errno == EINTR) continue; // NOLINT errno
+    if (got <= 0) return;                    // closed by the client, or shut down
+    end += static_cast<std::size_t>(got);
+  }
+}
+
+#else
+
+listener::listener(const std::string& /*path*/, std::size_t max_batch, handler handle)
+    : handle_(std::move(handle)), max_batch_(max_batch) {
+  throw std::runtime_error("the binary protocol is not supported on this platform");
+}
+
+listener::listener(const std::string& /*address*/, std::uint16_t /*port*/, std::size_t max_batch,
+                   handler handle)
+    : handle_(std::move(handle)), max_batch_(max_batch) {
+  throw std::runtime_error("the binary protocol is not supported on this platform");
+}
+
+listener::~listener() = default;
+
+#endif
+
+} // namespace hibp::srv::binary
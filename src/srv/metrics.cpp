@@ -0,0 +1,171 @@
+#include "srv/metrics.hpp"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <fmt/format.h>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace hibp::srv::metrics {
+
+namespace {
+
+constexpr std::array<std::string_view, formats> format_names = {
+    "plain", "sha1", "ntlm", "sha1t64", "mphf", "binfuse16", "binfuse8", "range"};
+
+constexpr std::array<std::string_view, phases> phase_names = {"hash", "search", "response"};
+
+// The counters of every thread which has ever counted anything. They are never freed, so the
+// totals don't go backwards when a thread exits. Only registering and scraping take the lock.
+struct registry_t {
+  std::mutex                                    mutex;
+  std::vector<std::unique_ptr<thread_counters>> threads;
+};
+
+registry_t& registry() {
+  static registry_t reg;
+  return reg;
+}
+
+// only the owning thread writes, so a read-modify-write is not needed
+void add(thread_counters::counter& counter, std::uint64_t value) {
+  counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+}
+
+std::uint64_t nanoseconds(clock::duration duration) {
+  return static_cast<std::uint64_t>(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count());
+}
+
+std::size_t bucket(std::uint64_t ns) {
+  const auto log2 = static_cast<unsigned>(std::bit_width(ns));
+  return std::min(std::size_t{std::max(log2, first_bucket_log2) - first_bucket_log2}, buckets);
+}
+
+// sums one counter across all threads
+template <typename Select>
+std::uint64_t sum(const std::vector<std::unique_ptr<thread_counters>>& threads, Select select) {
+  std::uint64_t total = 0;
+  for (const auto& t: threads) total += select(*t).load(std::memory_order_relaxed);
+  return total;
+}
+
+double seconds(std::uint64_t ns) { return static_cast<double>(ns) / 1e9; }
+
+} // namespace
+
+thread_counters& local() {
+  thread_local thread_counters* counters = [] {
+    auto&                 reg = registry();
+    const std::lock_guard lock(reg.mutex);
+    return reg.threads.emplace_back(std::make_unique<thread_counters>()).get();
+  }();
+  return *counters;
+}
+
+request::request(format fmt) : fmt_(fmt), start_(clock::now()), mark_(start_) {
+  add(local().requests[static_cast<std::size_t>(fmt_)], 1);
+}
+
+void request::mark(phase p) {
+  const auto now = clock::now();
+  add(local().phase_ns[static_cast<std::size_t>(p)], nanoseconds(now - mark_));
+  mark_ = now;
+}
+
+void request::lookup(bool found) const {
+  add(local().lookups[static_cast<std::size_t>(fmt_)][found ? 1 : 0], 1);
+}
+
+void request::reads(std::size_t reads) const {
+  if (reads != 0) add(local().db_reads[static_cast<std::size_t>(fmt_)], reads);
+}
+
+void request::rejected() const {
+  add(local().prefilter_rejects[static_cast<std::size_t>(fmt_)], 1);
+}
+
+void request::done() const {
+  const auto ns       = nanoseconds(clock::now() - start_);
+  auto&      counters = local();
+  add(counters.latency[static_cast<std::size_t>(fmt_)][bucket(ns)], 1);
+  add(counters.latency_ns[static_cast<std::size_t>(fmt_)], ns);
+}
+
+std::string render() {
+  auto&                 reg = registry();
+  const std::lock_guard lock(reg.mutex);
+  const auto&           threads = reg.threads;
+
+  std::string out;
+  auto        it = std::back_inserter(out);
+
+  fmt::format_to(it, "# HELP hibp_requests_total Requests received, by format.\n"
+                     "# TYPE hibp_requests_total counter\n");
+  for (std::size_t f = 0; f != formats; ++f) {
+    fmt::format_to(it, "hibp_requests_total{{format=\"{}\"}} {}\n", format_names[f],
+                   sum(threads, [f](auto& t) -> auto& { return t.requests[f]; }));
+  }
+
+  fmt::format_to(it, "# HELP hibp_lookups_total Needles looked up, by format and result.\n"
+                     "# TYPE hibp_lookups_total counter\n");
+  for (std::size_t f = 0; f != formats; ++f) {
+    for (std::size_t found = 0; found != 2; ++found) {
+      fmt::format_to(it, "hibp_lookups_total{{format=\"{}\",result=\"{}\"}} {}\n",
+                     format_names[f], found != 0 ? "found" : "not_found",
+                     sum(threads, [f, found](auto& t) -> auto& { return t.lookups[f][found]; }));
+    }
+  }
+
+  fmt::format_to(it, "# HELP hibp_db_reads_total Reads of db files, ie buffer refills and "
+                     "cache misses, by request format. Not counted for --mmap.\n"
+                     "# TYPE hibp_db_reads_total counter\n");
+  for (std::size_t f = 0; f != formats; ++f) {
+    fmt::format_to(it, "hibp_db_reads_total{{format=\"{}\"}} {}\n", format_names[f],
+                   sum(threads, [f](auto& t) -> auto& { return t.db_reads[f]; }));
+  }
+
+  fmt::format_to(it, "# HELP hibp_prefilter_rejects_total Needles which the --prefilter proved "
+                     "are not in the db, so were not looked up, by request format.\n"
+                     "# TYPE hibp_prefilter_rejects_total counter\n");
+  for (std::size_t f = 0; f != formats; ++f) {
+    fmt::format_to(it, "hibp_prefilter_rejects_total{{format=\"{}\"}} {}\n", format_names[f],
+                   sum(threads, [f](auto& t) -> auto& { return t.prefilter_rejects[f]; }));
+  }
+
+  fmt::format_to(it, "# HELP hibp_phase_seconds_total Time spent hashing, searching and "
+                     "responding.\n"
+                     "# TYPE hibp_phase_seconds_total counter\n");
+  for (std::size_t p = 0; p != phases; ++p) {
+    fmt::format_to(it, "hibp_phase_seconds_total{{phase=\"{}\"}} {}\n", phase_names[p],
+                   seconds(sum(threads, [p](auto& t) -> auto& { return t.phase_ns[p]; })));
+  }
+
+  fmt::format_to(it, "# HELP hibp_request_duration_seconds Request latency, by format.\n"
+                     "# TYPE hibp_request_duration_seconds histogram\n");
+  for (std::size_t f = 0; f != formats; ++f) {
+    std::uint64_t cumulative = 0;
+    for (std::size_t b = 0; b != buckets + 1; ++b) {
+      cumulative += sum(threads, [f, b](auto& t) -> auto& { return t.latency[f][b]; });
+      const std::string le =
+          b == buckets ? "+Inf" : fmt::format("{}", seconds(1UL << (first_bucket_log2 + b)));
+      fmt::format_to(it, "hibp_request_duration_seconds_bucket{{format=\"{}\",le=\"{}\"}} {}\n",
+                     format_names[f], le, cumulative);
+    }
+    fmt::format_to(it, "hibp_request_duration_seconds_sum{{format=\"{}\"}} {}\n", format_names[f],
+                   seconds(sum(threads, [f](auto& t) -> auto& { return t.latency_ns[f]; })));
+    fmt::format_to(it, "hibp_request_duration_seconds_count{{format=\"{}\"}} {}\n",
+                   format_names[f], cumulative);
+  }
+  return out;
+}
+
+} // namespace hibp::srv::metrics
@@ -1,27 +1,63 @@
 #include "srv/server.hpp"
+#include "srv/binary.hpp"
+#include "srv/metrics.hpp"
 #include "binfuse.hpp"
+#include "digest.hpp"
 #include "flat_file.hpp"
 #include "hibp.hpp"
-#include "ntlm.hpp"
+#include "hot_table.hpp"
+#include "mphf.hpp"
+#include "packed.hpp"
+#include "paged.hpp"
+#include "split.hpp"
 #include "toc.hpp"
+#include "uring.hpp"
 #include <algorithm>
 #include <atomic>
+#include <cctype>
+#include <charconv>
+#include <chrono>
+#include <condition_variable>
+#include <csignal>
+#include <cstddef>
 #include <cstdint>
 #include <cstdlib>
+#include <cstring>
 #include <exception>
+#include <filesystem>
 #include <fmt/format.h>
+#include <fmt/ranges.h>
+#include <functional>
+#include <future>
 #include <iostream>
+#include <list>
 #include <memory>
+#include <mutex>
+#include <numeric>
 #include <optional>
 #include <restinio/http_headers.hpp>
 #include <restinio/http_server_run.hpp>
 #include <restinio/router/express.hpp>
 #include <restinio/traits.hpp>
-#include <sha1.h>
+#include <restinio/uri_helpers.hpp>
+#include <span>
 #include <stdexcept>
+#include <stop_token>
 #include <string>
+#include <string_view>
+#include <thread>
+#include <tuple>
 #include <type_traits>
+#include <unordered_map>
 #include <utility>
+#include <vector>
+#if __has_include(<sys/socket.h>)
+#include <sys/socket.h>
+#endif
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
 
 namespace hibp::srv {
 
@@ -39,20 +75,595 @@ auto respond(int count, auto req) {
   return response.done();
 }
 
+// one count per line, in the order of the request entries
+auto respond_batch(const std::vector<int>& counts, auto req) {
+  const std::string content_type = cli.json ? "application/json" : "text/plain";
+
+  auto response = req->create_response().append_header(
+      restinio::http_field::content_type, fmt::format("{}; charset=utf-8", content_type));
+
+  if (cli.json) {
+    response.set_body(fmt::format("{{\"counts\":[{}]}}", fmt::join(counts, ",")));
+  } else {
+    response.set_body(counts.empty() ? "" : fmt::format("{}\n", fmt::join(counts, "\n")));
+  }
+  return response.done();
+}
+
+// one block cache for all dbs and all threads, when using `--cache-mb`
+flat_file::page_cache& shared_page_cache() {
+  static flat_file::page_cache cache(cli.cache_mb * (1UL << 20U));
+  return cache;
+}
+
+// filters are keyed on the top 64bits of the sha1, so sha1 and sha1t64 records can both be checked
 template <pw_type PwType>
-auto search_and_respond(flat_file::database<PwType>& db, const PwType& needle, auto req) {
-  std::optional<PwType> maybe_ppw;
+  requires(!std::is_same_v<PwType, pawned_pw_ntlm>)
+std::uint64_t to_filter_needle(const PwType& pw) {
+  return arrcmp::impl::bytearray_cast<std::uint64_t>(pw.hash.data());
+}
+
+// the `--prefilter`, shared by the sha1 and sha1t64 dbs
+using prefilter_t = binfuse::sharded_filter16_source;
+
+// all that is served, which a reload replaces, see below
+struct generation_t;
+using generation_ptr = std::shared_ptr<generation_t>;
+
+// A db is either one read-only memory mapping, shared by all threads, or one reader per thread,
+// because those are not thread safe. Per thread readers either share a page_cache (with
+// `--cache-mb`) or have their own small buffers. Optionally, a small "hot" db of the most common
+// records is held in memory in front of it, and/or a binfuse filter rules out most misses. Packed
+// dbs are thread safe, so are always shared, and bypass all of that, except the hot db and filter.
+// With `--split`, lookups search the split columns of the db instead, with `--paged` its paged
+// copy, and with `--uring` they are asynchronous reads of the db, but /range and batches still use
+// the db as above. The toc or pla belongs to the db_source too, so the dbs of two generations can
+// be served at the same time.
+template <pw_type PwType>
+class db_source {
+public:
+  explicit db_source(std::string filename, const std::string& hot_filename = {},
+                     std::shared_ptr<const prefilter_t> prefilter = {})
+      : filename_(std::move(filename)), prefilter_(std::move(prefilter)) {
+    if (!hot_filename.empty() && !filename_.empty()) {
+      hot_db_ = std::make_unique<hibp::hot_table<PwType>>(hot_filename);
+      std::cout << fmt::format("hot db {}: {} records ({:.1f}MB)\n", hot_filename, hot_db_->size(),
+                               static_cast<double>(hot_db_->memory()) / (1UL << 20U));
+    }
+    if (!filename_.empty() && packed::is_packed(filename_)) {
+      packed_ = std::make_unique<packed::database<PwType>>(filename_);
+      std::cout << fmt::format("packed db {}: {} records in {} blocks\n", filename_,
+                               packed_->number_records(), packed_->number_blocks());
+      return;
+    }
+    if (cli.toc && !filename_.empty()) {
+      toc_ = std::make_unique<hibp::toc_index<PwType>>(filename_, cli.toc_bits);
+    }
+    if (cli.pla && !filename_.empty()) {
+      pla_ = std::make_unique<hibp::pla_index<PwType>>(filename_, cli.pla_epsilon);
+    }
+#ifdef FLAT_FILE_HAS_MMAP
+    if (!filename_.empty()) {
+      stamp_ = stamp(filename_);
+      if (cli.mmap) {
+        mmdb_ = std::make_unique<flat_file::mmap_database<PwType>>(filename_,
+                                                                   flat_file::access_hint::random);
+      } else {
+        opened_ = std::make_unique<opened_reader>(filename_);
+      }
+    }
+#endif
+    if (cli.split && !filename_.empty()) {
+      hibp::split_build<PwType>(filename_);
+      split_ = std::make_unique<hibp::split_db<PwType>>(filename_);
+    }
+    if (cli.paged && !filename_.empty()) {
+      hibp::paged_build<PwType>(filename_, cli.page_size);
+      paged_ = std::make_unique<hibp::paged_db<PwType>>(filename_);
+      std::cout << fmt::format("paged db for {}: {} buckets of {} bytes, {} overflow pages{}\n",
+                               filename_, paged_->buckets(), paged_->page_size(),
+                               paged_->overflow_pages(), paged_->direct() ? ", direct io" : "");
+    }
+    if (cli.uring && !filename_.empty()) {
+      uring_ = std::make_unique<hibp::uring_search<PwType>>(filename_, cli.uring_depth);
+    }
+    if (cli.hot_index_mb != 0 && !filename_.empty()) {
+      flat_file::database<PwType> db(filename_, 4096 / sizeof(PwType));
+      hot_ = std::make_unique<flat_file::hot_index<PwType>>(db, cli.hot_index_mb * (1UL << 20U));
+      std::cout << fmt::format("hot index for {}: {} samples, every {} records ({:.1f}MB)\n",
+                               filename_, hot_->size(), hot_->stride(),
+                               static_cast<double>(hot_->memory()) / (1UL << 20U));
+    }
+  }
+
+  explicit operator bool() const { return !filename_.empty(); }
+
+  // nullptr unless the db is in the packed format
+  [[nodiscard]] packed::database<PwType>* packed_db() const { return packed_.get(); }
+
+  // nullptr unless `--split` was given
+  [[nodiscard]] hibp::split_db<PwType>* split_db() const { return split_.get(); }
+
+  // nullptr unless `--paged` was given
+  [[nodiscard]] hibp::paged_db<PwType>* paged_db() const { return paged_.get(); }
+
+  // nullptr unless `--uring` was given
+  [[nodiscard]] hibp::uring_search<PwType>* uring() const { return uring_.get(); }
+
+  // nullptr unless `--toc` was given
+  [[nodiscard]] const hibp::toc_index<PwType>* toc() const { return toc_.get(); }
+
+  // nullptr unless `--pla` was given
+  [[nodiscard]] const hibp::pla_index<PwType>* pla() const { return pla_.get(); }
+
+  // nullptr unless `--hot-index-mb` was given
+  [[nodiscard]] const flat_file::hot_index<PwType>* hot_index() const { return hot_.get(); }
+
+  // nullptr unless a `--hot-*-db` was given
+  [[nodiscard]] const hibp::hot_table<PwType>* hot_db() const { return hot_db_.get(); }
+
+  // false if the prefilter proves that `needle` is not in the db, otherwise it may be
+  [[nodiscard]] bool may_contain(const PwType& needle) const {
+    if constexpr (std::is_same_v<PwType, pawned_pw_ntlm>) {
+      return true;
+    } else {
+      return !prefilter_ || prefilter_->contains(to_filter_needle(needle));
+    }
+  }
+
+#ifdef FLAT_FILE_HAS_MMAP
+  // a mapping of the db: the `--mmap` one, or else one which is only used by the warm-up, to warm
+  // up the page cache, and to hold any `--lock-memory` locks on it, until release_mapping()
+  [[nodiscard]] const flat_file::mmap_database<PwType>& mapping() {
+    if (mmdb_) return *mmdb_;
+    if (!resident_) {
+      if (stamp(filename_) != stamp_) {
+        throw std::runtime_error(fmt::format("{} was replaced while it was opened", filename_));
+      }
+      resident_ = std::make_unique<flat_file::mmap_database<PwType>>(
+          filename_, flat_file::access_hint::random);
+    }
+    return *resident_;
+  }
+
+  // once warmed up, without `--lock-memory`, the page cache stays warm without the mapping
+  void release_mapping() { resident_.reset(); }
+#endif
+
+  // call `func` with the db instance which the calling thread should use
+  template <typename Func>
+  auto visit(Func&& func) {
+#ifdef FLAT_FILE_HAS_MMAP
+    if (mmdb_) return std::forward<Func>(func)(std::as_const(*mmdb_));
+#endif
+    if (cli.cache_mb != 0) {
+      return visit_reader(thread_reader<flat_file::cached_database<PwType>>(shared_page_cache()),
+                          std::forward<Func>(func));
+    }
+    return visit_reader(thread_reader<flat_file::database<PwType>>(4096 / sizeof(PwType)),
+                        std::forward<Func>(func));
+  }
+
+private:
+  std::string                                   filename_;
+  std::uint64_t                                 id_ = next_id();
+  std::unique_ptr<hibp::toc_index<PwType>>      toc_;
+  std::unique_ptr<hibp::pla_index<PwType>>      pla_;
+  std::unique_ptr<flat_file::hot_index<PwType>> hot_;
+  std::unique_ptr<hibp::hot_table<PwType>>      hot_db_;
+  std::shared_ptr<const prefilter_t>            prefilter_;
+  std::unique_ptr<packed::database<PwType>>     packed_;
+  std::unique_ptr<hibp::split_db<PwType>>       split_;
+  std::unique_ptr<hibp::paged_db<PwType>>       paged_;
+  std::unique_ptr<hibp::uring_search<PwType>>   uring_;
+#ifdef FLAT_FILE_HAS_MMAP
+  using stamp_t = std::pair<std::filesystem::file_time_type, std::uintmax_t>;
+
+  stamp_t                                           stamp_;
+  std::unique_ptr<flat_file::mmap_database<PwType>> mmdb_;
+  std::unique_ptr<flat_file::mmap_database<PwType>> resident_;
+
+  // Still reads the file which this db_source was opened on, after it was replaced, eg for a
+  // reload, for threads which only then make their first lookup in it. Not thread safe, so they
+  // take turns, but that is rare, and only until the generation is released.
+  struct opened_reader {
+    explicit opened_reader(const std::string& filename) : db(filename, 4096 / sizeof(PwType)) {}
+
+    std::mutex                  mutex;
+    flat_file::database<PwType> db;
+  };
+  std::unique_ptr<opened_reader> opened_;
+
+  // empty if the file is missing
+  static stamp_t stamp(const std::string& filename) {
+    std::error_code ec;
+    const auto      time = std::filesystem::last_write_time(filename, ec);
+    if (ec) return {};
+    const auto size = std::filesystem::file_size(filename, ec);
+    if (ec) return {};
+    return {time, size};
+  }
+#endif
+
+  // identifies this db_source for the thread_local readers, across reloads
+  static std::uint64_t next_id() {
+    static std::atomic<std::uint64_t> ids{1};
+    return ids++;
+  }
+
+  // The calling thread's own db object (ie set of buffers and pointers) for this db_source, opened
+  // on its first lookup, which also closes its one of a previous generation. One opened after the
+  // db file was replaced, eg for a reload, would read the new file though, so then there is none,
+  // and the `opened_` reader, which still has the file this db_source was opened on, is used
+  // instead. Without mmap, ie on Windows, open files cannot be replaced.
+  template <typename DbType, typename Arg>
+  DbType* thread_reader(Arg&& arg) {
+    thread_local std::pair<std::uint64_t, std::unique_ptr<DbType>> reader;
+    if (reader.first != id_) {
+      reader = {id_, nullptr};
+#ifdef FLAT_FILE_HAS_MMAP
+      if (stamp(filename_) != stamp_) return nullptr;
+#endif
+      reader.second = std::make_unique<DbType>(filename_, std::forward<Arg>(arg));
+#ifdef FLAT_FILE_HAS_MMAP
+      if (stamp(filename_) != stamp_) reader.second.reset(); // replaced while it was opened
+#endif
+    }
+    return reader.second.get();
+  }
+
+  template <typename DbType, typename Func>
+  auto visit_reader(DbType* reader, Func&& func) {
+#ifdef FLAT_FILE_HAS_MMAP
+    if (reader == nullptr) {
+      const std::lock_guard lk(opened_->mutex);
+      return std::forward<Func>(func)(opened_->db);
+    }
+#endif
+    return std::forward<Func>(func)(*reader);
+  }
+};
+
+// [first, last) positions of the db which could contain `needle`, using whichever of the toc, the
+// pla and the hot index of the `source` are enabled. Empty if the needle cannot be in the db.
+template <pw_type PwType>
+std::pair<std::size_t, std::size_t> narrow(const PwType& needle, std::size_t db_size,
+                                           const db_source<PwType>& source) {
+  std::pair<std::size_t, std::size_t> range{0, db_size};
+  if (const auto* toc = source.toc()) {
+    auto chapter = toc->chapter(needle, db_size);
+    if (!chapter) return {0, 0}; // beyond the end of a partial toc, and therefore "not found"
+    range = *chapter;
+  } else if (const auto* pla = source.pla()) {
+    range = pla->window(needle, db_size);
+  }
+  if (const auto* hot = source.hot_index()) {
+    const auto [first, last] = hot->range(needle);
+    range = {std::max(range.first, first), std::min(range.second, last)};
+  }
+  range.first = std::min(range.first, range.second);
+  return range;
+}
 
-  if (cli.toc) {
-    maybe_ppw = hibp::toc_search(db, needle, cli.toc_bits);
+// `func(db)`, counting the reads of the db file which it needed for `mreq`, if the db reads a file
+auto count_reads(auto& db, const metrics::request& mreq, auto&& func) {
+  if constexpr (requires { db.reads(); }) {
+    const auto before = db.reads();
+    auto       result = func(db);
+    mreq.reads(db.reads() - before);
+    return result;
   } else {
-    auto iter = std::lower_bound(db.begin(), db.end(), needle);
-    if (iter != db.end() && *iter == needle) {
-      maybe_ppw = *iter;
+    return func(db);
+  }
+}
+
+template <pw_type PwType>
+std::optional<PwType> lookup(auto& db, const PwType& needle, const db_source<PwType>& source) {
+  const auto [first, last] = narrow(needle, db.number_records(), source);
+  if (first == last) return {};
+  auto begin = db.begin() + first;
+  auto end   = db.begin() + last;
+  // touch the start of a pla window first, so buffered dbs read the whole window in one go
+  if (cli.pla && *begin == needle) return *begin;
+  if (auto iter = hibp::lower_bound(begin, end, needle); iter != end && *iter == needle) {
+    return *iter;
+  }
+  return {};
+}
+
+#ifdef FLAT_FILE_HAS_MMAP
+// A db for record_iterator, over a mapping, which notes the pages of the records it reads
+template <pw_type PwType>
+class page_recorder {
+public:
+  using value_type     = PwType;
+  using const_iterator = flat_file::impl::record_iterator<page_recorder>;
+
+  explicit page_recorder(const flat_file::mmap_database<PwType>& db) : db_(&db) {}
+
+  const PwType& get_record(std::size_t pos) {
+    pages_.push_back(pos * sizeof(PwType) / page_size);
+    return db_->get_record(pos);
+  }
+
+  const_iterator begin() { return {*this, 0}; }
+  const_iterator end() { return {*this, db_->number_records()}; }
+
+  [[nodiscard]] std::size_t           number_records() const { return db_->number_records(); }
+  [[nodiscard]] std::filesystem::path filename() const { return db_->filename(); }
+  [[nodiscard]] const std::vector<std::size_t>& pages() const { return pages_; }
+
+  static constexpr std::size_t page_size = 4096;
+
+private:
+  const flat_file::mmap_database<PwType>* db_;
+  std::vector<std::size_t>                pages_;
+};
+
+// `--warmup`: reads into memory the db pages which the top `levels` levels of all searches visit,
+// whether narrowed by a toc, a pla or a hot index, or not. They are found by making 2^levels evenly
+// spaced searches, on `threads` threads, which read them as they go. With `lock`, those pages are
+// then locked in RAM. Returns the number of pages.
+template <pw_type PwType>
+std::size_t warmup_db(db_source<PwType>& source, unsigned levels, unsigned threads, bool lock) {
+  const auto&       mapping  = source.mapping();
+  const std::size_t searches = std::size_t{1} << levels;
+
+  std::vector<std::vector<std::size_t>> pages(threads);
+  {
+    std::vector<std::jthread> workers;
+    for (unsigned t = 0; t != threads; ++t) {
+      workers.emplace_back([&, t] {
+        page_recorder<PwType> recorder(mapping);
+        for (std::size_t i = t; i < searches; i += threads) {
+          // the middle of the i'th slice of the key space
+          std::uint64_t key = ((2 * i + 1) << (63 - levels));
+          if constexpr (std::endian::native == std::endian::little) {
+            key = arrcmp::impl::byteswap(key);
+          }
+          PwType needle;
+          std::memcpy(needle.hash.data(), &key, sizeof(key));
+          lookup(recorder, needle, source);
+        }
+        pages[t] = recorder.pages();
+      });
+    }
+  }
+  std::vector<std::size_t> all;
+  for (const auto& p: pages) all.insert(all.end(), p.begin(), p.end());
+  std::sort(all.begin(), all.end());
+  all.erase(std::unique(all.begin(), all.end()), all.end());
+
+  if (lock) {
+    // the records which start in each run of consecutive pages
+    constexpr std::size_t page_size = page_recorder<PwType>::page_size;
+    for (std::size_t run = 0; run != all.size();) {
+      std::size_t end = run + 1;
+      while (end != all.size() && all[end] == all[end - 1] + 1) ++end;
+      const std::size_t first = (all[run] * page_size + sizeof(PwType) - 1) / sizeof(PwType);
+      const std::size_t last  = (all[end - 1] + 1) * page_size / sizeof(PwType);
+      mapping.lock(first, last);
+      run = end;
     }
   }
+  return all.size();
+}
+#endif
+
+// Look up a batch of needles with one ordered scan through the db: needles are visited in sorted
+// order and each search gallops forward from where the previous one ended, rather than bisecting
+// the whole db (or chapter) again. Returns counts in the order of `needles`, -1 for not found.
+template <pw_type PwType>
+std::vector<int> lookup_batch(auto& db, const std::vector<PwType>& needles,
+                              const db_source<PwType>& source) {
+  std::vector<std::size_t> order(needles.size());
+  std::iota(order.begin(), order.end(), 0);
+  std::sort(order.begin(), order.end(),
+            [&](std::size_t a, std::size_t b) { return needles[a] < needles[b]; });
+
+  std::vector<int> counts(needles.size(), -1);
+
+  std::size_t start = 0; // needles are sorted, so the db position never goes backwards
+  for (const std::size_t idx: order) {
+    const PwType& needle = needles[idx];
+    auto [first, last]   = narrow(needle, db.number_records(), source);
+    // toc chapters and hot index strides are disjoint, but pla windows may overlap, so then each
+    // needle just searches its own window
+    if (!cli.pla) first = std::max(first, start);
+    if (first >= last) continue;
+    auto iter = flat_file::gallop_lower_bound(db.begin() + first, db.begin() + last, needle);
+    if (iter != db.begin() + last && *iter == needle) counts[idx] = (*iter).count;
+    if (!cli.pla) start = static_cast<std::size_t>(iter - db.begin());
+  }
+  return counts;
+}
+
+// Position of the first record >= `needle`. Unlike lookup(), this must also be exact for needles
+// which are not in the db, so the pla, which only bounds the positions of present records, is not
+// used.
+template <pw_type PwType>
+std::size_t lower_bound_pos(auto& db, const PwType& needle, const db_source<PwType>& source) {
+  std::size_t first = 0;
+  std::size_t last  = db.number_records();
+  if (const auto* toc = source.toc()) {
+    auto chapter = toc->chapter(needle, last);
+    if (!chapter) return last; // beyond the end of a partial toc
+    std::tie(first, last) = *chapter;
+  }
+  if (const auto* hot = source.hot_index()) {
+    const auto [hot_first, hot_last] = hot->range(needle);
+    first                            = std::max(first, hot_first);
+    last                             = std::max(first, std::min(last, hot_last));
+  }
+  return static_cast<std::size_t>(hibp::lower_bound(db.begin() + first, db.begin() + last, needle) -
+                                  db.begin());
+}
+
+// the records [first, last) of any db type, with a single read for buffered dbs
+template <pw_type PwType>
+std::span<const PwType> read_records(auto& db, std::size_t first, std::size_t last,
+                                     std::vector<PwType>& buf) {
+  if constexpr (std::is_pointer_v<decltype(db.begin())>) {
+    return {db.begin() + first, db.begin() + last}; // mmap
+  } else {
+    buf.resize(last - first);
+    db.read(first, buf.size(), buf.data());
+    return buf;
+  }
+}
+
+// the lowest possible record with this 20bit (5 hex digit) prefix
+template <pw_type PwType>
+PwType prefix_to_needle(std::uint32_t prefix) {
+  PwType needle;
+  needle.hash[0] = static_cast<std::byte>(prefix >> 12U);
+  needle.hash[1] = static_cast<std::byte>(prefix >> 4U);
+  needle.hash[2] = static_cast<std::byte>(prefix << 4U);
+  return needle;
+}
+
+// The api.pwnedpasswords.com/range format: "SUFFIX:COUNT\r\n" for each record, except the last,
+// which has no "\r\n". Hex encoded straight from the binary records, into one allocation.
+template <pw_type PwType>
+std::string render_range(std::span<const PwType> records) {
+  constexpr std::size_t max_line = PwType::suffix_str_size + 1 + 11 + 2; // 11 for an int32 count
+
+  std::string body(records.size() * max_line, '\0');
+  char*       out = body.data();
+  for (const auto& pw: records) {
+    *out++ = hex::digit(pw.hash[2] & std::byte{0x0FU}); // the prefix is 2.5 bytes
+    hex::encode<PwType::hash_size - 3>(pw.hash.data() + 3, out);
+    out += 2 * (PwType::hash_size - 3);
+    *out++ = ':';
+    out    = std::to_chars(out, out + 11, pw.count).ptr;
+    *out++ = '\r';
+    *out++ = '\n';
+  }
+  body.resize(records.empty() ? 0 : static_cast<std::size_t>(out - body.data()) - 2);
+  return body;
+}
+
+template <pw_type PwType>
+std::string range_body(db_source<PwType>& source, std::uint32_t prefix,
+                       const metrics::request& mreq) {
+  if (auto* packed_db = source.packed_db()) {
+    thread_local std::vector<PwType> buf;
+    packed_db->read_range(prefix_to_needle<PwType>(prefix),
+                          prefix == 0xFFFFFU
+                              ? std::nullopt
+                              : std::optional<PwType>{prefix_to_needle<PwType>(prefix + 1)},
+                          buf);
+    return render_range<PwType>(buf);
+  }
+  return source.visit([&](auto& ffdb) {
+    return count_reads(ffdb, mreq, [&](auto& db) {
+      const std::size_t first = lower_bound_pos(db, prefix_to_needle<PwType>(prefix), source);
+      const std::size_t last =
+          prefix == 0xFFFFFU ? db.number_records()
+                             : lower_bound_pos(db, prefix_to_needle<PwType>(prefix + 1), source);
+      thread_local std::vector<PwType> buf; // reused, to avoid an allocation per request
+      return render_range<PwType>(read_records(db, first, last, buf));
+    });
+  });
+}
+
+// A small, thread safe LRU cache of rendered /range bodies, for the hottest prefixes, when using
+// `--range-cache`
+class range_cache {
+public:
+  explicit range_cache(std::size_t capacity) : capacity_(capacity) {}
+
+  std::shared_ptr<const std::string> get(std::uint32_t key) {
+    const std::lock_guard lk(mutex_);
+    auto                  found = map_.find(key);
+    if (found == map_.end()) return {};
+    lru_.splice(lru_.begin(), lru_, found->second); // most recently used
+    return found->second->second;
+  }
+
+  void put(std::uint32_t key, std::shared_ptr<const std::string> body) {
+    const std::lock_guard lk(mutex_);
+    if (map_.contains(key)) return; // another thread missed on the same prefix and beat us to it
+    lru_.emplace_front(key, std::move(body));
+    map_.emplace(key, lru_.begin());
+    if (lru_.size() > capacity_) {
+      map_.erase(lru_.back().first);
+      lru_.pop_back();
+    }
+  }
+
+private:
+  using entry_t = std::pair<std::uint32_t, std::shared_ptr<const std::string>>;
+
+  std::size_t                                                    capacity_;
+  std::mutex                                                     mutex_;
+  std::list<entry_t>                                             lru_;
+  std::unordered_map<std::uint32_t, std::list<entry_t>::iterator> map_;
+};
+
+auto server_error(const std::exception& e, auto req) {
+  // TODO log error to std::cerr with thread mutex
+  return req->create_response(restinio::status_internal_server_error())
+      .set_body(e.what())
+      .connection_close()
+      .done();
+}
+
+// responds, and finishes the `mreq` timings
+auto respond_and_time(int count, metrics::request& mreq, auto req) {
+  mreq.lookup(count != -1);
+  mreq.mark(metrics::phase::search);
+  auto status = respond(count, req);
+  mreq.mark(metrics::phase::response);
+  mreq.done();
+  return status;
+}
+
+// `gen` is the generation which `source` belongs to, held until any `--uring` search is done
+template <pw_type PwType>
+auto search_and_respond(const generation_ptr& gen, db_source<PwType>& source, const PwType& needle,
+                        metrics::request mreq, auto req) {
+  if (const auto* hot_db = source.hot_db()) {
+    if (auto hot = hot_db->find(needle)) return respond_and_time(hot->count, mreq, req);
+  }
+  if (!source.may_contain(needle)) { // no disk access
+    mreq.rejected();
+    return respond_and_time(-1, mreq, req);
+  }
+  std::optional<PwType> maybe_ppw;
+  if (auto* packed_db = source.packed_db()) {
+    maybe_ppw = packed_db->find(needle);
+  } else if (auto* split_db = source.split_db()) {
+    const auto [first, last] = narrow(needle, split_db->number_records(), source);
+    maybe_ppw                = split_db->find(needle, first, last);
+  } else if (auto* paged_db = source.paged_db()) {
+    std::size_t reads = 0;
+    maybe_ppw         = paged_db->find(needle, reads);
+    mreq.reads(reads);
+  } else if (auto* uring = source.uring()) {
+    // respond later, from the ring's thread, which frees this one for other requests meanwhile
+    const auto [first, last] = narrow(needle, uring->number_records(), source);
+    uring->find(needle, first, last,
+                [req, mreq, gen](std::optional<PwType> found,
+                                 const std::exception_ptr& error) mutable {
+                  try {
+                    if (error) std::rethrow_exception(error);
+                    respond_and_time(found ? found->count : -1, mreq, req);
+                  } catch (const std::exception& e) {
+                    server_error(e, req);
+                  }
+                });
+    return restinio::request_accepted();
+  } else {
+    maybe_ppw = source.visit([&](auto& ffdb) {
+      return count_reads(ffdb, mreq, [&](auto& db) {
+        return lookup(db, needle, source);
+      });
+    });
+  }
+
   const int count = maybe_ppw ? maybe_ppw->count : -1;
-  return respond(count, req);
+  return respond_and_time(count, mreq, req);
 }
 
 auto bad_request(const std::string& msg, auto req) {
@@ -75,153 +686,791 @@ void uniqefy_plain(std::string& plain_password) {
 }
 
 template <pw_type PwType>
-auto handle_plain_search(flat_file::database<PwType>& sha1_db, std::string plain_password,
-                         auto req) {
+PwType plain_to_needle(std::string plain_password) {
   uniqefy_plain(plain_password);
 
-  PwType needle;
   if constexpr (std::is_same_v<PwType, pawned_pw_ntlm>) {
-    needle.hash = ntlm(plain_password);
+    return PwType{digest::ntlm(plain_password)};
+  } else {
+    // note that sha1t64 can also be constructed from a sha1 digest
+    return PwType{digest::sha1(plain_password)};
+  }
+}
+
+// all of a batch of plain passwords at once, so they are hashed in parallel
+template <typename Needle, typename Digest>
+std::vector<Needle> plain_to_needles(std::vector<std::string>& plain_passwords) {
+  for (auto& plain_password: plain_passwords) uniqefy_plain(plain_password);
+
+  const std::vector<std::string_view> texts(plain_passwords.begin(), plain_passwords.end());
+  std::vector<Digest>                 digests(texts.size());
+  if constexpr (std::is_same_v<Digest, digest::ntlm_t>) {
+    digest::ntlm(texts, digests);
   } else {
-    // note that sha1t64 can also be constructed from sha1 text hash
-    needle = PwType{SHA1{}(plain_password)};
+    digest::sha1(texts, digests);
   }
-  return search_and_respond<PwType>(sha1_db, needle, req);
+  return {digests.begin(), digests.end()};
+}
+
+template <pw_type PwType>
+auto handle_plain_search(const generation_ptr& gen, db_source<PwType>& db,
+                         std::string plain_password, metrics::request mreq, auto req) {
+  const PwType needle = plain_to_needle<PwType>(std::move(plain_password));
+  mreq.mark(metrics::phase::hash);
+  return search_and_respond<PwType>(gen, db, needle, mreq, req);
+}
+
+std::uint64_t plain_to_filter_needle(std::string plain_password) {
+  uniqefy_plain(plain_password);
+  return to_filter_needle(hibp::pawned_pw_sha1t64{digest::sha1(plain_password)});
 }
 
 template <hibp::binfuse_filter_source_type FilterType>
-auto handle_filter_search(FilterType& filter, std::uint64_t needle, auto req) {
+auto handle_filter_search(FilterType& filter, std::uint64_t needle, metrics::request mreq,
+                          auto req) {
+  mreq.mark(metrics::phase::hash);
   const bool result = filter.contains(needle);
   const int  count  = result ? 1 : -1; // stay consistent with other dbs
-  return respond(count, req);
+  return respond_and_time(count, mreq, req);
 }
 
 template <hibp::binfuse_filter_source_type FilterType>
-auto handle_plain_filter_search(FilterType& filter, std::string plain_password, auto req) {
-  uniqefy_plain(plain_password);
-
-  // TODO this is ineffecient, use binary SHA1 directly
-  hibp::pawned_pw_sha1t64 pw{SHA1{}(plain_password)};
-  auto                    needle = arrcmp::impl::bytearray_cast<std::uint64_t>(pw.hash.data());
-  return handle_filter_search(filter, needle, req);
+auto handle_plain_filter_search(FilterType& filter, std::string plain_password,
+                                metrics::request mreq, auto req) {
+  return handle_filter_search(filter, plain_to_filter_needle(std::move(plain_password)), mreq,
+                              req);
 }
 
 template <hibp::binfuse_filter_source_type FilterType>
-auto handle_hash_filter_search(FilterType& filter, const std::string& password, auto req) {
+auto handle_hash_filter_search(FilterType& filter, const std::string& password,
+                               metrics::request mreq, auto req) {
   if (!is_valid_hash<pawned_pw_sha1t64>(password)) {
     return bad_request("Invalid hash provided. Check type of hash.", req);
   }
-  hibp::pawned_pw_sha1t64 pw{password};
-  auto                    needle = arrcmp::impl::bytearray_cast<std::uint64_t>(pw.hash.data());
-  return handle_filter_search(filter, needle, req);
+  return handle_filter_search(filter, to_filter_needle(hibp::pawned_pw_sha1t64{password}), mreq,
+                              req);
 }
 
 template <pw_type PwType>
-auto handle_hash_search(flat_file::database<PwType>& db, const std::string& password, auto req) {
+auto handle_hash_search(const generation_ptr& gen, db_source<PwType>& db,
+                        const std::string& password, metrics::request mreq, auto req) {
 
   if (!is_valid_hash<PwType>(password)) {
     return bad_request("Invalid hash provided. Check type of hash.", req);
   }
   const PwType needle{password};
-  return search_and_respond<PwType>(db, needle, req);
+  mreq.mark(metrics::phase::hash);
+  return search_and_respond<PwType>(gen, db, needle, mreq, req);
+}
+
+// Batch body: one plain password or hash per line. Blank lines are ignored.
+std::vector<std::string> split_batch(std::string_view body) {
+  std::vector<std::string> entries;
+  while (!body.empty()) {
+    const auto       eol  = body.find('\n');
+    std::string_view line = body.substr(0, eol);
+    body.remove_prefix(eol == std::string_view::npos ? body.size() : eol + 1);
+    if (!line.empty() && line.back() == '\r') line.remove_suffix(1);
+    if (!line.empty()) entries.emplace_back(line);
+  }
+  return entries;
+}
+
+// responds to a batch, and finishes the `mreq` timings
+auto respond_batch_and_time(const std::vector<int>& counts, metrics::request& mreq, auto req) {
+  for (const int count: counts) mreq.lookup(count != -1);
+  mreq.mark(metrics::phase::search);
+  auto status = respond_batch(counts, req);
+  mreq.mark(metrics::phase::response);
+  mreq.done();
+  return status;
+}
+
+// the counts of a batch of `needles`, in order, with -1 for those not found. Only the needles which
+// are neither hot, nor ruled out by the prefilter, go to the db.
+template <pw_type PwType>
+std::vector<int> batch_counts(db_source<PwType>& db, const std::vector<PwType>& needles,
+                              const metrics::request& mreq) {
+  const auto*              hot_db = db.hot_db();
+  std::vector<int>         counts(needles.size(), -1);
+  std::vector<PwType>      cold_needles;
+  std::vector<std::size_t> cold_idxs;
+  for (std::size_t i = 0; i != needles.size(); ++i) {
+    if (hot_db != nullptr) {
+      if (auto hot = hot_db->find(needles[i])) {
+        counts[i] = hot->count;
+        continue;
+      }
+    }
+    if (!db.may_contain(needles[i])) {
+      mreq.rejected();
+      continue;
+    }
+    cold_needles.push_back(needles[i]);
+    cold_idxs.push_back(i);
+  }
+  std::vector<int> cold_counts;
+  if (auto* packed_db = db.packed_db()) {
+    cold_counts.reserve(cold_needles.size());
+    for (const auto& needle: cold_needles) {
+      auto found = packed_db->find(needle);
+      cold_counts.push_back(found ? found->count : -1);
+    }
+  } else if (auto* split_db = db.split_db()) {
+    cold_counts.reserve(cold_needles.size());
+    for (const auto& needle: cold_needles) {
+      const auto [first, last] = narrow(needle, split_db->number_records(), db);
+      auto found               = split_db->find(needle, first, last);
+      cold_counts.push_back(found ? found->count : -1);
+    }
+  } else if (auto* paged_db = db.paged_db()) {
+    cold_counts.reserve(cold_needles.size());
+    std::size_t reads = 0;
+    for (const auto& needle: cold_needles) {
+      auto found = paged_db->find(needle, reads);
+      cold_counts.push_back(found ? found->count : -1);
+    }
+    mreq.reads(reads);
+  } else {
+    cold_counts = db.visit([&](auto& ffdb) {
+      return count_reads(ffdb, mreq, [&](auto& fdb) {
+        return lookup_batch(fdb, cold_needles, db);
+      });
+    });
+  }
+  for (std::size_t i = 0; i != cold_idxs.size(); ++i) counts[cold_idxs[i]] = cold_counts[i];
+  return counts;
+}
+
+template <pw_type PwType>
+auto handle_batch_search(db_source<PwType>& db, std::vector<std::string> entries, bool plain,
+                         metrics::request mreq, auto req) {
+  std::vector<PwType> needles;
+  if (plain) {
+    using digest_t =
+        std::conditional_t<std::is_same_v<PwType, pawned_pw_ntlm>, digest::ntlm_t, digest::sha1_t>;
+    needles = plain_to_needles<PwType, digest_t>(entries);
+  } else {
+    needles.reserve(entries.size());
+    for (std::size_t i = 0; i != entries.size(); ++i) {
+      if (!is_valid_hash<PwType>(entries[i])) {
+        return bad_request(
+            fmt::format("Invalid hash provided in entry {}. Check type of hash.", i + 1), req);
+      }
+      needles.emplace_back(entries[i]);
+    }
+  }
+  mreq.mark(metrics::phase::hash);
+  return respond_batch_and_time(batch_counts(db, needles, mreq), mreq, req);
+}
+
+template <hibp::binfuse_filter_source_type FilterType>
+auto handle_batch_filter_search(FilterType& filter, std::vector<std::string> entries, bool plain,
+                                metrics::request mreq, auto req) {
+  std::vector<std::uint64_t> needles;
+  needles.reserve(entries.size());
+  if (plain) {
+    for (const auto& pw: plain_to_needles<pawned_pw_sha1t64, digest::sha1_t>(entries)) {
+      needles.push_back(to_filter_needle(pw));
+    }
+  } else {
+    for (std::size_t i = 0; i != entries.size(); ++i) {
+      if (!is_valid_hash<pawned_pw_sha1t64>(entries[i])) {
+        return bad_request(
+            fmt::format("Invalid hash provided in entry {}. Check type of hash.", i + 1), req);
+      }
+      needles.push_back(to_filter_needle(hibp::pawned_pw_sha1t64{entries[i]}));
+    }
+  }
+  mreq.mark(metrics::phase::hash);
+  std::vector<int> counts;
+  counts.reserve(needles.size());
+  for (const auto needle: needles) counts.push_back(filter.contains(needle) ? 1 : -1);
+  return respond_batch_and_time(counts, mreq, req);
+}
+
+// calls `fn` with the std::type_identity of the PwType which the mphf `db` was built from
+auto visit_mphf_type(const mphf_db& db, auto&& fn) {
+  switch (db.hash_size()) {
+  case pawned_pw_ntlm::hash_size:
+    return fn(std::type_identity<pawned_pw_ntlm>{});
+  case pawned_pw_sha1t64::hash_size:
+    return fn(std::type_identity<pawned_pw_sha1t64>{});
+  default:
+    return fn(std::type_identity<pawned_pw_sha1>{});
+  }
+}
+
+// one read of the mphf db's slots, whether or not the needle is in it
+auto handle_mphf_search(mphf_db& db, std::string password, bool plain, metrics::request mreq,
+                        auto req) {
+  return visit_mphf_type(db, [&]<typename PwType>(std::type_identity<PwType> /*type*/) {
+    if (!plain && !is_valid_hash<PwType>(password)) {
+      return bad_request("Invalid hash provided. Check type of hash.", req);
+    }
+    const PwType needle = plain ? plain_to_needle<PwType>(std::move(password)) : PwType{password};
+    mreq.mark(metrics::phase::hash);
+    const auto found = db.find(needle);
+    mreq.reads(1);
+    return respond_and_time(found.value_or(-1), mreq, req);
+  });
+}
+
+auto handle_batch_mphf_search(mphf_db& db, std::vector<std::string> entries, bool plain,
+                              metrics::request mreq, auto req) {
+  return visit_mphf_type(db, [&]<typename PwType>(std::type_identity<PwType> /*type*/) {
+    std::vector<PwType> needles;
+    if (plain) {
+      using digest_t = std::conditional_t<std::is_same_v<PwType, pawned_pw_ntlm>, digest::ntlm_t,
+                                          digest::sha1_t>;
+      needles = plain_to_needles<PwType, digest_t>(entries);
+    } else {
+      needles.reserve(entries.size());
+      for (std::size_t i = 0; i != entries.size(); ++i) {
+        if (!is_valid_hash<PwType>(entries[i])) {
+          return bad_request(
+              fmt::format("Invalid hash provided in entry {}. Check type of hash.", i + 1), req);
+        }
+        needles.emplace_back(entries[i]);
+      }
+    }
+    mreq.mark(metrics::phase::hash);
+    std::vector<int> counts;
+    counts.reserve(needles.size());
+    for (const auto& needle: needles) counts.push_back(db.find(needle).value_or(-1));
+    mreq.reads(needles.size());
+    return respond_batch_and_time(counts, mreq, req);
+  });
+}
+
+template <pw_type PwType>
+auto handle_range_search(db_source<PwType>& source, const std::string& prefix_str, bool ntlm,
+                         range_cache* cache, metrics::request mreq, auto req) {
+  std::uint32_t prefix{};
+  if (prefix_str.size() != PwType::prefix_str_size ||
+      !std::all_of(prefix_str.begin(), prefix_str.end(),
+                   [](unsigned char c) { return std::isxdigit(c) != 0; })) {
+    return bad_request("The hash prefix was not in a valid format", req);
+  }
+  std::from_chars(prefix_str.data(), prefix_str.data() + prefix_str.size(), prefix, 16);
+
+  const std::uint32_t                key = (ntlm ? 1U << 20U : 0U) | prefix;
+  std::shared_ptr<const std::string> body;
+  if (cache != nullptr) body = cache->get(key);
+  if (!body) {
+    body = std::make_shared<const std::string>(range_body(source, prefix, mreq));
+    if (cache != nullptr) cache->put(key, body);
+  }
+  mreq.mark(metrics::phase::search);
+  auto status = req->create_response()
+                    .append_header(restinio::http_field::content_type, "text/plain; charset=utf-8")
+                    .set_body(*body)
+                    .done();
+  mreq.mark(metrics::phase::response);
+  mreq.done();
+  return status;
+}
+
+// all dbs and filters of one generation
+struct sources_t {
+  db_source<pawned_pw_sha1>    sha1_db;
+  db_source<pawned_pw_ntlm>    ntlm_db;
+  db_source<pawned_pw_sha1t64> sha1t64_db;
+
+  // only single instance across threads for the mphf db and binfuse filters
+  std::unique_ptr<mphf_db>                          mphf;
+  std::unique_ptr<binfuse::sharded_filter16_source> binfuse16_filter;
+  std::unique_ptr<binfuse::sharded_filter8_source>  binfuse8_filter;
+};
+
+// Everything which is served, which a reload replaces as a whole. Each request holds a reference
+// to the generation which it started on, so it finishes on the same dbs, even if a reload swaps in
+// a new generation meanwhile.
+struct generation_t {
+  std::uint64_t                number = 0;
+  sources_t                    sources;
+  std::unique_ptr<range_cache> cache; // `--range-cache`, empty for each generation
+#ifdef FLAT_FILE_HAS_MMAP
+  // the `--warmup` mappings of the filter and toc files, which also hold any `--lock-memory` locks
+  // on them
+  std::vector<flat_file::mmap_database<std::byte>> resident_files{};
+#endif
+};
+
+#ifdef FLAT_FILE_HAS_MMAP
+// `--warmup`: read the whole of each of the `files`, and the top levels of the searches of each
+// flat db, into memory, in parallel, before the generation serves any requests. So the first
+// requests do not wait for the disk, and, with `--lock-memory`, later ones never do. Packed,
+// split and paged dbs are not warmed up.
+void warmup(generation_t& gen, const std::vector<std::string>& files) {
+  using clk        = std::chrono::steady_clock;
+  const auto start = clk::now();
+  const bool lock  = cli.lock_memory;
+
+  std::mutex                            resident_mutex;
+  std::vector<std::future<std::string>> tasks;
+  for (const auto& file: files) {
+    tasks.push_back(std::async(std::launch::async, [&gen, &file, &resident_mutex, lock] {
+      flat_file::mmap_database<std::byte> map(file, flat_file::access_hint::willneed);
+      map.prefault();
+      if (lock) map.lock();
+      const auto size = map.number_records();
+      const std::lock_guard guard(resident_mutex);
+      gen.resident_files.push_back(std::move(map));
+      return fmt::format("{} ({:.1f}MB)", file, static_cast<double>(size) / (1UL << 20U));
+    }));
+  }
+
+  auto warmup_task = [&tasks, lock](auto& source) {
+    if (!source || source.packed_db() != nullptr || source.split_db() != nullptr ||
+        source.paged_db() != nullptr) {
+      return;
+    }
+    tasks.push_back(std::async(std::launch::async, [&source, lock] {
+      const std::size_t pages = warmup_db(source, cli.warmup_depth, cli.threads, lock);
+      const auto        name  = source.mapping().filename().string();
+      if (!lock) source.release_mapping();
+      return fmt::format("{} levels of {}: {} pages ({:.1f}MB)", cli.warmup_depth, name, pages,
+                         static_cast<double>(pages * 4096) / (1UL << 20U));
+    }));
+  };
+  warmup_task(gen.sources.sha1_db);
+  warmup_task(gen.sources.ntlm_db);
+  warmup_task(gen.sources.sha1t64_db);
+
+  // report each one as it completes, but fail on the first error, eg `--lock-memory` over the limit
+  for (std::size_t i = 0; i != tasks.size(); ++i) {
+    std::cout << fmt::format("warm-up {}/{}: {}{}\n", i + 1, tasks.size(), tasks[i].get(),
+                             lock ? ", locked" : "");
+  }
+  std::cout << fmt::format(
+      "warm-up done in {:.2f}s\n",
+      std::chrono::duration_cast<std::chrono::duration<double>>(clk::now() - start).count());
+}
+#endif
+
+// Opens all the dbs and filters given on the command line, and their tocs, plas or split columns,
+// which are validated against the dbs, and rebuilt if they are stale. Any problem throws, so a
+// failed reload leaves the current generation in place. With `warm`, also warms up the new
+// generation, before anything is served from it.
+std::unique_ptr<generation_t> make_generation(std::uint64_t number, [[maybe_unused]] bool warm) {
+  std::shared_ptr<const prefilter_t> prefilter;
+  if (!cli.prefilter_filename.empty()) {
+    prefilter = std::make_shared<const prefilter_t>(cli.prefilter_filename);
+  }
+
+  auto gen = std::make_unique<generation_t>(generation_t{
+      .number  = number,
+      .sources = {
+          db_source<pawned_pw_sha1>{cli.sha1_db_filename, cli.hot_sha1_db_filename, prefilter},
+          db_source<pawned_pw_ntlm>{cli.ntlm_db_filename, cli.hot_ntlm_db_filename},
+          db_source<pawned_pw_sha1t64>{cli.sha1t64_db_filename, cli.hot_sha1t64_db_filename,
+                                       prefilter},
+          cli.mphf_db_filename.empty() ? std::unique_ptr<mphf_db>{}
+                                       : std::make_unique<mphf_db>(cli.mphf_db_filename),
+          cli.binfuse16_filter_filename.empty()
+              ? std::unique_ptr<binfuse::sharded_filter16_source>{}
+              : std::make_unique<binfuse::sharded_filter16_source>(cli.binfuse16_filter_filename),
+          cli.binfuse8_filter_filename.empty()
+              ? std::unique_ptr<binfuse::sharded_filter8_source>{}
+              : std::make_unique<binfuse::sharded_filter8_source>(cli.binfuse8_filter_filename)},
+      .cache = cli.range_cache == 0 ? std::unique_ptr<range_cache>{}
+                                    : std::make_unique<range_cache>(cli.range_cache)});
+
+#ifdef FLAT_FILE_HAS_MMAP
+  if (warm) {
+    std::vector<std::string> files;
+    for (const auto& filter: {cli.binfuse16_filter_filename, cli.binfuse8_filter_filename,
+                              cli.prefilter_filename}) {
+      if (!filter.empty()) files.push_back(filter);
+    }
+    if (cli.toc) {
+      for (const auto& db: {cli.sha1_db_filename, cli.ntlm_db_filename, cli.sha1t64_db_filename}) {
+        if (!db.empty() && !packed::is_packed(db)) {
+          files.push_back(hibp::toc_filename(db, cli.toc_bits));
+        }
+      }
+    }
+    warmup(*gen, files);
+  }
+#endif
+  return gen;
+}
+
+// The generation being served. A reload swaps in the next one, RCU style: requests which hold a
+// reference to the previous one finish on it undisturbed.
+//
+// Each thread keeps its own reference to the generation it last served, and only takes the lock to
+// refresh it when the atomic generation number has moved on, so requests share no writes, not even
+// to a reference count. A generation is freed when the last reference to it is dropped, ie once
+// each thread which served it has started a request on a later one, or exited, and any `--uring`
+// searches on it are done. That is on the reaper thread, never on a `--uring` ring thread, which
+// cannot free its own ring.
+class generations {
+public:
+  explicit generations(std::unique_ptr<generation_t> first) { replace(std::move(first)); }
+
+  generations(const generations& other)            = delete;
+  generations& operator=(const generations& other) = delete;
+  generations(generations&& other)                 = delete;
+  generations& operator=(generations&& other)      = delete;
+
+  // after all the server threads have stopped, so their references have gone
+  ~generations() {
+    const std::lock_guard lk(mutex_);
+    current_.reset();
+  }
+
+  // The current generation, for the whole of a request, ie until the calling thread's next call.
+  // There is only one `generations`, so one reference per thread.
+  [[nodiscard]] const generation_ptr& current() const {
+    thread_local generation_ptr cached;
+    if (!cached || cached->number != number_.load(std::memory_order_acquire)) {
+      const std::lock_guard lk(mutex_);
+      cached = current_;
+    }
+    return cached;
+  }
+
+  // of the current generation, without taking a reference to it
+  [[nodiscard]] std::uint64_t number() const { return number_.load(std::memory_order_acquire); }
+
+  // makes `next` current. The previous one is freed when its last reference is dropped.
+  void replace(std::unique_ptr<generation_t> next) {
+    const std::uint64_t   number = next->number;
+    const std::lock_guard lk(mutex_);
+    current_ = generation_ptr(next.release(), [this](generation_t* gen) { retire(gen); });
+    number_.store(number, std::memory_order_release);
+  }
+
+private:
+  mutable std::mutex          mutex_;
+  generation_ptr              current_; // guarded by mutex_
+  std::atomic<std::uint64_t>  number_{0};
+  std::mutex                  retired_mutex_;
+  std::condition_variable_any retired_cv_;
+  std::vector<generation_t*>  retired_; // guarded by retired_mutex_
+  std::jthread                reaper_{[this](const std::stop_token& stop) { reap(stop); }};
+
+  // the deleter of each generation, on whichever thread dropped its last reference
+  void retire(generation_t* gen) {
+    {
+      const std::lock_guard lk(retired_mutex_);
+      retired_.push_back(gen);
+    }
+    retired_cv_.notify_one();
+  }
+
+  // frees the retired generations, and, once stopped, any which are left
+  void reap(const std::stop_token& stop) {
+    while (true) {
+      std::vector<generation_t*> freeing;
+      {
+        std::unique_lock lk(retired_mutex_);
+        if (!retired_cv_.wait(lk, stop, [this] { return !retired_.empty(); })) return; // stopped
+        freeing.swap(retired_);
+      }
+      for (auto* gen: freeing) {
+        const bool reloaded = gen->number != number();
+        const auto number   = gen->number;
+        delete gen; // NOLINT owning memory, from replace()
+        if (reloaded) {
+          std::cout << fmt::format("reload: released generation {}\n", number) << std::flush;
+        }
+      }
+    }
+  }
+};
+
+// Reloads on its own thread, for SIGHUP and POST /admin/reload, while the server threads serve the
+// current generation. The new one is fully opened and warmed up before it is swapped in, so there
+// is no latency spike. Requests which arrive while a reload is being prepared share the next one.
+class reloader {
+public:
+  // called with the number of the generation which was being loaded, and an error message if it
+  // failed
+  using callback = std::function<void(std::uint64_t number, const std::string& error)>;
+
+  explicit reloader(std::shared_ptr<generations> gens)
+      : gens_(std::move(gens)), thread_([this](const std::stop_token& stop) { run(stop); }) {}
+
+  void request(callback done) {
+    {
+      const std::lock_guard lk(mutex_);
+      pending_.push_back(std::move(done));
+    }
+    cv_.notify_one();
+  }
+
+private:
+  std::shared_ptr<generations> gens_;
+  std::mutex                   mutex_;
+  std::condition_variable_any  cv_;
+  std::vector<callback>        pending_;
+  std::jthread                 thread_; // last, so it is stopped before the rest is destroyed
+
+  void run(const std::stop_token& stop) {
+    while (true) {
+      std::vector<callback> waiting;
+      {
+        std::unique_lock lk(mutex_);
+        if (!cv_.wait(lk, stop, [this] { return !pending_.empty(); })) return; // stopped
+        waiting.swap(pending_);
+      }
+      const std::uint64_t number = gens_->number() + 1;
+      std::cout << fmt::format("reload: loading generation {}\n", number);
+      std::string error;
+      try {
+        gens_->replace(make_generation(number, true));
+        std::cout << fmt::format("reload: serving generation {}\n", number) << std::flush;
+      } catch (const std::exception& e) {
+        error = e.what();
+        std::cerr << fmt::format("reload: generation {} failed, still serving generation {}: {}\n",
+                                 number, number - 1, error);
+      }
+      for (auto& done: waiting) done(number, error);
+    }
+  }
+};
+
+auto bad_format(auto req) {
+  return req->create_response(restinio::status_not_found())
+      .set_body("Bad format specified.")
+      .connection_close()
+      .done();
 }
 
 // NOLINTNEXTLINE cognitive complexity
-auto get_router(const std::string& sha1_db_filename, const std::string& ntlm_db_filename,
-                const std::string& sha1t64_db_filename,
-                const std::string& binfuse16_filter_filename,
-                const std::string& binfuse8_filter_filename) {
+auto get_router(const std::shared_ptr<generations>& gens,
+                const std::shared_ptr<reloader>&    reloads) {
+
   auto router = std::make_unique<restinio::router::express_router_t<>>();
-  router->http_get(R"(/check/:format/:password)", [&](auto req, auto params) {
+  router->http_get(R"(/check/:format/:password)", [gens](auto req, auto params) {
     try {
-      // unique db object (ie set of buffers and pointers) per thread and per db file supplied
-      using sha1_db_t = flat_file::database<pawned_pw_sha1>;
-      thread_local auto sha1_db =
-          sha1_db_filename.empty()
-              ? std::unique_ptr<sha1_db_t>{}
-              : std::make_unique<sha1_db_t>(sha1_db_filename, 4096 / sizeof(hibp::pawned_pw_sha1));
-
-      using ntlm_db_t = flat_file::database<pawned_pw_ntlm>;
-      thread_local auto ntlm_db =
-          ntlm_db_filename.empty()
-              ? std::unique_ptr<ntlm_db_t>{}
-              : std::make_unique<ntlm_db_t>(ntlm_db_filename, 4096 / sizeof(hibp::pawned_pw_ntlm));
-
-      using sha1t64_db_t = flat_file::database<pawned_pw_sha1t64>;
-      thread_local auto sha1t64_db =
-          sha1t64_db_filename.empty()
-              ? std::unique_ptr<sha1t64_db_t>{}
-              : std::make_unique<sha1t64_db_t>(sha1t64_db_filename,
-                                               4096 / sizeof(hibp::pawned_pw_sha1t64));
-
-      // only single instance across threads for binfuse filters
-      static auto binfuse16_filter =
-          binfuse16_filter_filename.empty()
-              ? std::unique_ptr<binfuse::sharded_filter16_source>{}
-              : std::make_unique<binfuse::sharded_filter16_source>(binfuse16_filter_filename);
-
-      static auto binfuse8_filter =
-          binfuse8_filter_filename.empty()
-              ? std::unique_ptr<binfuse::sharded_filter8_source>{}
-              : std::make_unique<binfuse::sharded_filter8_source>(binfuse8_filter_filename);
+      const auto& gen = gens->current();
+      auto& [sha1_db, ntlm_db, sha1t64_db, mphf, binfuse16_filter, binfuse8_filter] = gen->sources;
 
       const std::string password{params["password"]};
 
       if (params["format"] == "plain") {
+        const metrics::request mreq{metrics::format::plain};
         if (sha1_db) {
-          return handle_plain_search(*sha1_db, password, req);
+          return handle_plain_search(gen, sha1_db, password, mreq, req);
         }
         if (ntlm_db) {
-          return handle_plain_search(*ntlm_db, password, req);
+          return handle_plain_search(gen, ntlm_db, password, mreq, req);
         }
         if (sha1t64_db) {
-          return handle_plain_search(*sha1t64_db, password, req);
+          return handle_plain_search(gen, sha1t64_db, password, mreq, req);
+        }
+        if (mphf) {
+          return handle_mphf_search(*mphf, password, true, mreq, req);
         }
         if (binfuse16_filter) {
-          return handle_plain_filter_search(*binfuse16_filter, password, req);
+          return handle_plain_filter_search(*binfuse16_filter, password, mreq, req);
         }
         if (binfuse8_filter) {
-          return handle_plain_filter_search(*binfuse8_filter, password, req);
+          return handle_plain_filter_search(*binfuse8_filter, password, mreq, req);
         }
-        return fail_missing_db_for_format(
-            req, "--sha1-db, --ntlm-db, --sha1t64-db, --binfuse16-filter or --binfuse8-filter, ",
-            "/check/plain");
+        return fail_missing_db_for_format(req,
+                                          "--sha1-db, --ntlm-db, --sha1t64-db, --mphf-db, "
+                                          "--binfuse16-filter or --binfuse8-filter, ",
+                                          "/check/plain");
       }
       if (params["format"] == "sha1") {
         if (!sha1_db) return fail_missing_db_for_format(req, "--sha1-db", "/check/sha1");
-        return handle_hash_search(*sha1_db, password, req);
+        return handle_hash_search(gen, sha1_db, password,
+                                  metrics::request{metrics::format::sha1}, req);
       }
       if (params["format"] == "ntlm") {
         if (!ntlm_db) return fail_missing_db_for_format(req, "--ntlm-db", "/check/ntlm");
-        return handle_hash_search(*ntlm_db, password, req);
+        return handle_hash_search(gen, ntlm_db, password,
+                                  metrics::request{metrics::format::ntlm}, req);
       }
       if (params["format"] == "sha1t64") {
         if (!sha1t64_db) return fail_missing_db_for_format(req, "--sha1t64-db", "/check/sha1t64");
-        return handle_hash_search(*sha1t64_db, password, req);
+        return handle_hash_search(gen, sha1t64_db, password,
+                                  metrics::request{metrics::format::sha1t64}, req);
+      }
+      if (params["format"] == "mphf") {
+        if (!mphf) return fail_missing_db_for_format(req, "--mphf-db", "/check/mphf");
+        return handle_mphf_search(*mphf, password, false, metrics::request{metrics::format::mphf},
+                                  req);
       }
       if (params["format"] == "binfuse16") {
         if (!binfuse16_filter)
           return fail_missing_db_for_format(req, "--binfuse16-filter", "/check/binfuse16");
-        return handle_hash_filter_search(*binfuse16_filter, password, req);
+        return handle_hash_filter_search(
+            *binfuse16_filter, password, metrics::request{metrics::format::binfuse16}, req);
       }
       if (params["format"] == "binfuse8") {
         if (!binfuse8_filter)
           return fail_missing_db_for_format(req, "--binfuse8-filter", "/check/binfuse8");
-        return handle_hash_filter_search(*binfuse8_filter, password, req);
+        return handle_hash_filter_search(
+            *binfuse8_filter, password, metrics::request{metrics::format::binfuse8}, req);
       }
-      return req->create_response(restinio::status_not_found())
-          .set_body("Bad format specified.")
-          .connection_close()
-          .done();
+      return bad_format(req);
     } catch (const std::exception& e) {
-      // TODO log error to std::cerr with thread mutex
-      return req->create_response(restinio::status_internal_server_error())
-          .set_body(e.what())
-          .connection_close()
-          .done();
+      return server_error(e, req);
     }
   });
 
+  // batch lookups: POST one plain password or hash per line, get one count per line back
+  router->http_post(R"(/check/:format)", [gens](auto req, auto params) {
+    try {
+      const auto& gen = gens->current();
+      auto& [sha1_db, ntlm_db, sha1t64_db, mphf, binfuse16_filter, binfuse8_filter] = gen->sources;
+
+      std::vector<std::string> entries = split_batch(req->body());
+      if (entries.size() > cli.max_batch) {
+        return bad_request(
+            fmt::format("Too many entries in batch: {}. Maximum is {}, see --max-batch.",
+                        entries.size(), cli.max_batch),
+            req);
+      }
+
+      if (params["format"] == "plain") {
+        const metrics::request mreq{metrics::format::plain};
+        if (sha1_db) {
+          return handle_batch_search(sha1_db, std::move(entries), true, mreq, req);
+        }
+        if (ntlm_db) {
+          return handle_batch_search(ntlm_db, std::move(entries), true, mreq, req);
+        }
+        if (sha1t64_db) {
+          return handle_batch_search(sha1t64_db, std::move(entries), true, mreq, req);
+        }
+        if (mphf) {
+          return handle_batch_mphf_search(*mphf, std::move(entries), true, mreq, req);
+        }
+        if (binfuse16_filter) {
+          return handle_batch_filter_search(*binfuse16_filter, std::move(entries), true, mreq,
+                                            req);
+        }
+        if (binfuse8_filter) {
+          return handle_batch_filter_search(*binfuse8_filter, std::move(entries), true, mreq,
+                                            req);
+        }
+        return fail_missing_db_for_format(req,
+                                          "--sha1-db, --ntlm-db, --sha1t64-db, --mphf-db, "
+                                          "--binfuse16-filter or --binfuse8-filter, ",
+                                          "/check/plain");
+      }
+      if (params["format"] == "sha1") {
+        if (!sha1_db) return fail_missing_db_for_format(req, "--sha1-db", "/check/sha1");
+        return handle_batch_search(sha1_db, std::move(entries), false,
+                                   metrics::request{metrics::format::sha1}, req);
+      }
+      if (params["format"] == "ntlm") {
+        if (!ntlm_db) return fail_missing_db_for_format(req, "--ntlm-db", "/check/ntlm");
+        return handle_batch_search(ntlm_db, std::move(entries), false,
+                                   metrics::request{metrics::format::ntlm}, req);
+      }
+      if (params["format"] == "sha1t64") {
+        if (!sha1t64_db) return fail_missing_db_for_format(req, "--sha1t64-db", "/check/sha1t64");
+        return handle_batch_search(sha1t64_db, std::move(entries), false,
+                                   metrics::request{metrics::format::sha1t64}, req);
+      }
+      if (params["format"] == "mphf") {
+        if (!mphf) return fail_missing_db_for_format(req, "--mphf-db", "/check/mphf");
+        return handle_batch_mphf_search(*mphf, std::move(entries), false,
+                                        metrics::request{metrics::format::mphf}, req);
+      }
+      if (params["format"] == "binfuse16") {
+        if (!binfuse16_filter)
+          return fail_missing_db_for_format(req, "--binfuse16-filter", "/check/binfuse16");
+        return handle_batch_filter_search(*binfuse16_filter, std::move(entries), false,
+                                          metrics::request{metrics::format::binfuse16}, req);
+      }
+      if (params["format"] == "binfuse8") {
+        if (!binfuse8_filter)
+          return fail_missing_db_for_format(req, "--binfuse8-filter", "/check/binfuse8");
+        return handle_batch_filter_search(*binfuse8_filter, std::move(entries), false,
+                                          metrics::request{metrics::format::binfuse8}, req);
+      }
+      return bad_format(req);
+    } catch (const std::exception& e) {
+      return server_error(e, req);
+    }
+  });
+
+  // compatible with api.pwnedpasswords.com/range/:prefix, including `?mode=ntlm`
+  router->http_get(R"(/range/:prefix)", [gens](auto req, auto params) {
+    try {
+      const auto& gen     = gens->current();
+      auto&       sources = gen->sources;
+
+      const metrics::request mreq{metrics::format::range};
+      const auto        query = restinio::parse_query(req->header().query());
+      const bool        ntlm  = query.has("mode") && query["mode"] == "ntlm";
+      const std::string prefix{params["prefix"]};
+      if (ntlm) {
+        if (!sources.ntlm_db)
+          return fail_missing_db_for_format(req, "--ntlm-db", "/range?mode=ntlm");
+        return handle_range_search(sources.ntlm_db, prefix, true, gen->cache.get(), mreq, req);
+      }
+      if (!sources.sha1_db) return fail_missing_db_for_format(req, "--sha1-db", "/range");
+      return handle_range_search(sources.sha1_db, prefix, false, gen->cache.get(), mreq, req);
+    } catch (const std::exception& e) {
+      return server_error(e, req);
+    }
+  });
+
+  // hit and miss counts of the hot dbs, eg to size them
+  router->http_get(R"(/stats/hot)", [gens](auto req, auto /*params*/) {
+    const auto&              gen = gens->current();
+    std::vector<std::string> stats;
+    auto add_stats = [&](const std::string& format, const auto* hot_db) {
+      if (hot_db == nullptr) return;
+      const auto hits   = hot_db->hits();
+      const auto misses = hot_db->misses();
+      stats.push_back(cli.json ? fmt::format(R"("{}":{{"hits":{},"misses":{}}})", format, hits,
+                                             misses)
+                               : fmt::format("{} hits={} misses={}", format, hits, misses));
+    };
+    add_stats("sha1", gen->sources.sha1_db.hot_db());
+    add_stats("ntlm", gen->sources.ntlm_db.hot_db());
+    add_stats("sha1t64", gen->sources.sha1t64_db.hot_db());
+
+    auto response = req->create_response().append_header(
+        restinio::http_field::content_type,
+        fmt::format("{}; charset=utf-8", cli.json ? "application/json" : "text/plain"));
+    if (cli.json) {
+      response.set_body(fmt::format("{{{}}}", fmt::join(stats, ",")));
+    } else {
+      response.set_body(stats.empty() ? "" : fmt::format("{}\n", fmt::join(stats, "\n")));
+    }
+    return response.done();
+  });
+
+  // request, lookup and db read counts, and latencies, in the Prometheus text format
+  router->http_get(R"(/metrics)", [](auto req, auto /*params*/) {
+    return req->create_response()
+        .append_header(restinio::http_field::content_type, "text/plain; version=0.0.4")
+        .set_body(metrics::render())
+        .done();
+  });
+
+  // `--admin-reload`: reloads, as SIGHUP does, and responds once the new generation is served
+  if (cli.admin_reload) {
+    router->http_post(R"(/admin/reload)", [reloads](auto req, auto /*params*/) {
+      reloads->request([req](std::uint64_t number, const std::string& error) {
+        if (!error.empty()) {
+          server_error(std::runtime_error(error), req);
+          return;
+        }
+        req->create_response()
+            .append_header(
+                restinio::http_field::content_type,
+                fmt::format("{}; charset=utf-8", cli.json ? "application/json" : "text/plain"))
+            .set_body(cli.json ? fmt::format(R"({{"generation":{}}})", number)
+                               : fmt::format("generation {}\n", number))
+            .done();
+      });
+      return restinio::request_accepted(); // responds from the reloader's thread
+    });
+  }
+
   router->non_matched_request_handler([](auto req) {
     return req->create_response(restinio::status_not_found()).connection_close().done();
   });
@@ -229,7 +1478,204 @@ auto get_router(const std::string& sha1_db_filename, const std::string& ntlm_db_
   return router;
 }
 
+// The binary protocol, see srv/binary.hpp. Its frames are looked up in the current generation,
+// like http requests, and are batches, so they take the same path as POST /check/:format, on the
+// connection's thread.
+
+// the raw digests of a frame, which must be the size of the hashes of the db
+template <pw_type PwType>
+std::vector<PwType> binary_needles(const binary::frame_header& header,
+                                   std::span<const std::byte> digests) {
+  if (header.digest_size != PwType::hash_size) {
+    throw std::runtime_error(fmt::format("format {} needs digests of {} bytes, not {}",
+                                         header.format, PwType::hash_size, header.digest_size));
+  }
+  std::vector<PwType> needles(header.count);
+  for (std::size_t i = 0; i != needles.size(); ++i) {
+    std::memcpy(needles[i].hash.data(), digests.data() + i * PwType::hash_size, PwType::hash_size);
+  }
+  return needles;
+}
+
+// fills the frame's `counts`, and finishes the `mreq` timings, except for the response, which is
+// written for all the frames which arrived together
+void binary_counts_and_time(const std::vector<int>& found, std::span<std::int32_t> counts,
+                            metrics::request& mreq) {
+  for (std::size_t i = 0; i != counts.size(); ++i) {
+    counts[i] = found[i];
+    mreq.lookup(found[i] != -1);
+  }
+  mreq.mark(metrics::phase::search);
+  mreq.done();
+}
+
+template <pw_type PwType>
+void binary_search(db_source<PwType>& db, const binary::frame_header& header,
+                   std::span<const std::byte> digests, std::span<std::int32_t> counts,
+                   metrics::format format) {
+  metrics::request mreq{format};
+  const auto       needles = binary_needles<PwType>(header, digests);
+  mreq.mark(metrics::phase::hash);
+  binary_counts_and_time(batch_counts(db, needles, mreq), counts, mreq);
+}
+
+void binary_mphf_search(mphf_db& db, const binary::frame_header& header,
+                        std::span<const std::byte> digests, std::span<std::int32_t> counts) {
+  visit_mphf_type(db, [&]<typename PwType>(std::type_identity<PwType> /*type*/) {
+    metrics::request mreq{metrics::format::mphf};
+    const auto       needles = binary_needles<PwType>(header, digests);
+    mreq.mark(metrics::phase::hash);
+    std::vector<int> found;
+    found.reserve(needles.size());
+    for (const auto& needle: needles) found.push_back(db.find(needle).value_or(-1));
+    mreq.reads(needles.size());
+    binary_counts_and_time(found, counts, mreq);
+  });
+}
+
+// the filters are keyed on the leading 64bits of the sha1, so take sha1t64 digests
+template <hibp::binfuse_filter_source_type FilterType>
+void binary_filter_search(FilterType& filter, const binary::frame_header& header,
+                          std::span<const std::byte> digests, std::span<std::int32_t> counts,
+                          metrics::format format) {
+  metrics::request mreq{format};
+  const auto       needles = binary_needles<pawned_pw_sha1t64>(header, digests);
+  mreq.mark(metrics::phase::hash);
+  std::vector<int> found;
+  found.reserve(needles.size());
+  for (const auto& needle: needles) {
+    found.push_back(filter.contains(to_filter_needle(needle)) ? 1 : -1);
+  }
+  binary_counts_and_time(found, counts, mreq);
+}
+
+binary::handler binary_handler(const std::shared_ptr<generations>& gens) {
+  return [gens](const binary::frame_header& header, std::span<const std::byte> digests,
+                std::span<std::int32_t> counts) {
+    const auto& gen = gens->current();
+    auto& [sha1_db, ntlm_db, sha1t64_db, mphf, binfuse16_filter, binfuse8_filter] = gen->sources;
+
+    const auto missing = [&](const std::string& option) {
+      return std::runtime_error(fmt::format("format {} needs {}", header.format, option));
+    };
+    switch (static_cast<binary::format>(header.format)) {
+    case binary::format::sha1:
+      if (!sha1_db) throw missing("--sha1-db");
+      return binary_search(sha1_db, header, digests, counts, metrics::format::sha1);
+    case binary::format::ntlm:
+      if (!ntlm_db) throw missing("--ntlm-db");
+      return binary_search(ntlm_db, header, digests, counts, metrics::format::ntlm);
+    case binary::format::sha1t64:
+      if (!sha1t64_db) throw missing("--sha1t64-db");
+      return binary_search(sha1t64_db, header, digests, counts, metrics::format::sha1t64);
+    case binary::format::mphf:
+      if (!mphf) throw missing("--mphf-db");
+      return binary_mphf_search(*mphf, header, digests, counts);
+    case binary::format::binfuse16:
+      if (!binfuse16_filter) throw missing("--binfuse16-filter");
+      return binary_filter_search(*binfuse16_filter, header, digests, counts,
+                                  metrics::format::binfuse16);
+    case binary::format::binfuse8:
+      if (!binfuse8_filter) throw missing("--binfuse8-filter");
+      return binary_filter_search(*binfuse8_filter, header, digests, counts,
+                                  metrics::format::binfuse8);
+    }
+    throw std::runtime_error(fmt::format("unknown format {}", header.format));
+  };
+}
+
+// pins the calling thread to the `index`th of the cpus it may run on, so its readers and their
+// buffers stay in that core's caches, and are allocated from its NUMA node
+void pin_to_core([[maybe_unused]] unsigned index) {
+#ifdef __linux__
+  cpu_set_t allowed;
+  CPU_ZERO(&allowed);
+  if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) return;
+  const auto cpus = static_cast<unsigned>(CPU_COUNT(&allowed));
+  for (unsigned cpu = 0, nth = 0; cpu != CPU_SETSIZE; ++cpu) {
+    if (CPU_ISSET(cpu, &allowed) && nth++ == index % cpus) {
+      cpu_set_t one;
+      CPU_ZERO(&one);
+      CPU_SET(cpu, &one);
+      pthread_setaffinity_np(pthread_self(), sizeof(one), &one);
+      return;
+    }
+  }
+#endif
+}
+
+// --reuse-port: one single threaded server per thread, each with its own listening socket on the
+// same port, so there is no shared acceptor, and the kernel spreads the connections over them.
+// Each server keeps its own reference to the current generation, see `generations`, and its own
+// per thread db readers, but they all share the generation's dbs, filters and `--range-cache`, and
+// the `--cache-mb` page cache.
+void run_reuse_port([[maybe_unused]] const std::shared_ptr<generations>& gens,
+                    [[maybe_unused]] const std::shared_ptr<reloader>&    reloads) {
+#ifdef SO_REUSEPORT
+  struct single_thread_traits : public restinio::default_single_thread_traits_t {
+    using request_handler_t = restinio::router::express_router_t<>;
+  };
+  using reuse_port_option =
+      restinio::asio_ns::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT>;
+
+  // an io_context for each server, as stopping them all is how the first failure of any one, eg to
+  // bind its socket, or a SIGINT, ends the process, rather than leaving the others serving
+  std::vector<std::unique_ptr<restinio::asio_ns::io_context>> contexts;
+  for (unsigned i = 0; i != cli.threads; ++i) {
+    contexts.push_back(std::make_unique<restinio::asio_ns::io_context>(1));
+  }
+  auto stop_all = [&contexts] {
+    for (auto& context: contexts) context->stop();
+  };
+  restinio::asio_ns::signal_set interrupts(*contexts.front(), SIGINT);
+  interrupts.async_wait([&](const auto& error, int /*signal*/) {
+    if (!error) stop_all();
+  });
+
+  std::mutex         exception_mutex;
+  std::exception_ptr exception;
+  {
+    std::vector<std::jthread> servers;
+    for (unsigned i = 0; i != cli.threads; ++i) {
+      servers.emplace_back([&, i] {
+        try {
+          pin_to_core(i);
+          restinio::http_server_t<single_thread_traits> server{
+              restinio::external_io_context(*contexts[i]),
+              restinio::server_settings_t<single_thread_traits>{}
+                  .address(cli.bind_address)
+                  .port(cli.port)
+                  .acceptor_options_setter([](restinio::acceptor_options_t& options) {
+                    options.set_option(reuse_port_option{true});
+                  })
+                  .request_handler(get_router(gens, reloads))};
+          server.open_sync();
+          contexts[i]->run();
+        } catch (...) {
+          {
+            const std::lock_guard lk(exception_mutex);
+            if (!exception) exception = std::current_exception();
+          }
+          stop_all();
+        }
+      });
+    }
+  } // wait here until all servers have stopped
+  if (exception) std::rethrow_exception(exception);
+#else
+  throw std::runtime_error("--reuse-port is not supported on this platform");
+#endif
+}
+
 void run_server() {
+#ifdef SIGHUP
+  // reloads the dbs and filters, see `hup_watcher` below
+  sigset_t hup;
+  sigemptyset(&hup);
+  sigaddset(&hup, SIGHUP);
+  pthread_sigmask(SIG_BLOCK, &hup, nullptr);
+#endif
+
   // Launching a server with custom traits.
   struct my_server_traits : public restinio::default_traits_t {
     using request_handler_t = restinio::router::express_router_t<>;
@@ -243,6 +1689,8 @@ void run_server() {
     plain_using = "ntlm db";
   } else if (!cli.sha1t64_db_filename.empty()) {
     plain_using = "sha1t64 db";
+  } else if (!cli.mphf_db_filename.empty()) {
+    plain_using = "mphf db";
   } else if (!cli.binfuse16_filter_filename.empty()) {
     plain_using = "binfuse16 filter";
   } else if (!cli.binfuse8_filter_filename.empty()) {
@@ -265,6 +1713,10 @@ void run_server() {
   if (!cli.sha1t64_db_filename.empty()) {
     std::cout << fmt::format("{}/check/sha1t64/CBFDAC6008F9CAB4\n", server);
   }
+  if (!cli.mphf_db_filename.empty()) {
+    std::cout << fmt::format("{}/check/mphf/<a hash of the type the mphf db was built from>\n",
+                             server);
+  }
   if (!cli.binfuse16_filter_filename.empty()) {
     std::cout << fmt::format("{}/check/binfuse16/CBFDAC6008F9CAB4\n", server);
   }
@@ -272,12 +1724,45 @@ void run_server() {
     std::cout << fmt::format("{}/check/binfuse8/CBFDAC6008F9CAB4\n", server);
   }
 
+  auto gens    = std::make_shared<generations>(make_generation(1, cli.warmup || cli.lock_memory));
+  auto reloads = std::make_shared<reloader>(gens);
+
+#ifdef SIGHUP
+  // SIGHUP was blocked before any other threads were started, which inherit that, so only this
+  // thread receives it
+  std::jthread hup_watcher([&hup, reloads](const std::stop_token& stop) {
+    const timespec poll{.tv_sec = 0, .tv_nsec = 200'000'000};
+    while (!stop.stop_requested()) {
+      if (sigtimedwait(&hup, nullptr, &poll) == SIGHUP) {
+        reloads->request([](std::uint64_t /*number*/, const std::string& /*error*/) {});
+      }
+    }
+  });
+#endif
+
+  // the binary protocol, alongside http, until the http server stops
+  std::vector<std::unique_ptr<binary::listener>> binary_listeners;
+  if (!cli.binary_socket.empty()) {
+    binary_listeners.push_back(std::make_unique<binary::listener>(
+        cli.binary_socket, cli.max_batch, binary_handler(gens)));
+  }
+  if (cli.binary_port != 0) {
+    binary_listeners.push_back(std::make_unique<binary::listener>(
+        cli.bind_address, cli.binary_port, cli.max_batch, binary_handler(gens)));
+  }
+  for (const auto& listener: binary_listeners) {
+    std::cout << fmt::format("Binary protocol on {}\n", listener->endpoint()) << std::flush;
+  }
+
+  if (cli.reuse_port) {
+    run_reuse_port(gens, reloads);
+    return;
+  }
+
   auto settings = restinio::on_thread_pool<my_server_traits>(cli.threads)
                       .address(cli.bind_address)
                       .port(cli.port)
-                      .request_handler(get_router(
-                          cli.sha1_db_filename, cli.ntlm_db_filename, cli.sha1t64_db_filename,
-                          cli.binfuse16_filter_filename, cli.binfuse8_filter_filename));
+                      .request_handler(get_router(gens, reloads));
 
   restinio::run(std::move(settings));
 }
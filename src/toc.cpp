@@ -1,131 +1,364 @@
 #include "toc.hpp"
-#include "arrcmp.hpp"
 #include "flat_file.hpp"
 #include "hibp.hpp"
 #include <algorithm>
+#include <array>
 #include <cmath>
 #include <cstddef>
 #include <cstdint>
 #include <cstdlib>
+#include <cstring>
 #include <filesystem>
 #include <fmt/format.h>
 #include <fmt/std.h> // IWYU pragma: keep
 #include <fstream>
+#include <ios>
 #include <iostream>
 #include <limits>
 #include <optional>
 #include <ostream>
 #include <stdexcept>
 #include <string>
+#include <utility>
 #include <vector>
 
 namespace hibp {
 
 namespace details {
 
-using toc_entry = std::uint32_t; // limited to 4Billion pws. will throw when too big
-
-// one instance per type of pw
+// .toc file format: a toc_header, followed by `entries` record positions of `entry_size` (4 or 8)
+// bytes each, in native byte order. Entry `i` is the position of the first record with prefix
+// `i`. Validity for a given db is checked in O(1), from the header and the first and last db
+// records.
+struct toc_header {
+  static constexpr std::array<char, 8> expected_magic  = {'H', 'I', 'B', 'P', 'T', 'O', 'C', '\0'};
+  static constexpr std::uint32_t       current_version = 2;
+
+  std::array<char, 8> magic          = expected_magic;
+  std::uint32_t       version        = current_version;
+  std::uint32_t       record_size    = 0;
+  std::uint32_t       bits           = 0;
+  std::uint32_t       entry_size     = 0;
+  std::uint64_t       db_records     = 0;
+  std::uint64_t       db_fingerprint = 0; // of the first and last records
+  std::uint64_t       entries        = 0;
+};
+static_assert(sizeof(toc_header) == 48);
+
+// FNV-1a over the first and last records. Together with the record count this catches a db
+// which was replaced or modified since the toc was written, without reading the whole db.
 template <pw_type PwType>
-std::vector<toc_entry> toc;
+std::uint64_t fingerprint(std::uint64_t records, const PwType& first, const PwType& last) {
+  std::uint64_t hash = 0xcbf29ce484222325ULL;
+  if (records == 0) return hash;
+  for (const PwType* pw: {&first, &last}) {
+    std::array<std::byte, sizeof(PwType)> bytes{};
+    std::memcpy(bytes.data(), pw, sizeof(PwType));
+    for (auto b: bytes) {
+      hash ^= std::to_integer<std::uint64_t>(b);
+      hash *= 0x100000001b3ULL;
+    }
+  }
+  return hash;
+}
 
+// empty if the db still has the `records` and `fingerprint` an index was built for, otherwise the
+// reason why not
 template <pw_type PwType>
-std::uint32_t pw_to_prefix(const PwType& pw, unsigned bits) {
-  return arrcmp::impl::bytearray_cast<std::uint32_t>(pw.hash.data()) >>
-         (sizeof(toc_entry) * 8 - bits);
+std::string db_problem(const std::filesystem::path& db_filename, std::uint64_t records,
+                       std::uint64_t db_fingerprint) {
+  flat_file::database<PwType> db(db_filename);
+  const std::size_t           db_records = db.number_records();
+  if (records != db_records)
+    return fmt::format("built for {} records, but db has {}", records, db_records);
+  if (db_records != 0) {
+    const PwType first = db.get_record(0); // copy, as reading back() will reuse the buffer
+    if (db_fingerprint != fingerprint(db_records, first, db.back()))
+      return "db contents have changed";
+  }
+  return {};
 }
 
-template <pw_type PwType>
-void build(const std::filesystem::path& db_path, unsigned bits) {
-  // big buffer for sequential read
-  flat_file::database<PwType> db(db_path, (1U << 16U) / sizeof(PwType));
+// a loaded .toc file, memory mapped where possible
+class toc_table {
+public:
+  toc_table() = default;
+
+  explicit toc_table(const std::filesystem::path& toc_filename) {
+    const auto filesize = static_cast<std::size_t>(std::filesystem::file_size(toc_filename));
+    if (filesize < sizeof(toc_header)) return; // leaves magic invalid
+
+#ifdef FLAT_FILE_HAS_MMAP
+    map_.emplace(toc_filename, flat_file::access_hint::willneed);
+    const std::byte* data = map_->begin();
+#else
+    buf_.resize(filesize);
+    auto toc_stream = std::ifstream(toc_filename, std::ios_base::binary);
+    toc_stream.exceptions(std::ios::badbit | std::ios::failbit);
+    toc_stream.read(reinterpret_cast<char*>(buf_.data()), // NOLINT reincast
+                    static_cast<std::streamsize>(filesize));
+    const std::byte* data = buf_.data();
+#endif
+    std::memcpy(&header_, data, sizeof(toc_header));
+    entries_   = data + sizeof(toc_header);
+    file_size_ = filesize;
+  }
 
-  std::size_t toc_entries = 1UL << bits; // default = 1Mega entries (just like the files)
+  [[nodiscard]] const toc_header& header() const { return header_; }
+  [[nodiscard]] std::size_t       size() const { return entries_ ? header_.entries : 0; }
 
-  auto last_pw_prefix = pw_to_prefix(db.back(), bits);
-  if (last_pw_prefix + 1 < toc_entries) {
-    std::cout << fmt::format("Warning: DB is partial, reduced size toc.\n");
-    toc_entries = last_pw_prefix + 1;
+  std::size_t operator[](std::size_t idx) const {
+    if (header_.entry_size == sizeof(std::uint32_t)) return entry<std::uint32_t>(idx);
+    return entry<std::uint64_t>(idx);
   }
 
-  const std::size_t db_size = db.number_records();
-  if (db_size > std::numeric_limits<toc_entry>::max()) {
-    throw std::runtime_error(fmt::format("Fatal: ToC value type is too small for this db"));
+  // empty if valid for this db, otherwise the reason why not
+  template <pw_type PwType>
+  [[nodiscard]] std::string problem(const std::filesystem::path& db_filename,
+                                    unsigned                     bits) const {
+    if (header_.magic != toc_header::expected_magic) return "not a table of contents file";
+    if (header_.version != toc_header::current_version)
+      return fmt::format("unsupported version {}", header_.version);
+    if (header_.record_size != sizeof(PwType))
+      return fmt::format("record size {}, not {}", header_.record_size, sizeof(PwType));
+    if (header_.bits != bits) return fmt::format("built for {} bits, not {}", header_.bits, bits);
+    if (header_.entry_size != sizeof(std::uint32_t) && header_.entry_size != sizeof(std::uint64_t))
+      return fmt::format("invalid entry size {}", header_.entry_size);
+    if (header_.entries > (1ULL << bits) ||
+        file_size_ != sizeof(toc_header) + header_.entries * header_.entry_size)
+      return "truncated or corrupt";
+
+    return db_problem<PwType>(db_filename, header_.db_records, header_.db_fingerprint);
   }
-  const std::size_t toc_entry_size = db_size / toc_entries;
+
+private:
+  toc_header header_{.magic = {}};
+#ifdef FLAT_FILE_HAS_MMAP
+  std::optional<flat_file::mmap_database<std::byte>> map_;
+#else
+  std::vector<std::byte> buf_;
+#endif
+  const std::byte* entries_   = nullptr;
+  std::size_t      file_size_ = 0;
+
+  template <typename EntryType>
+  [[nodiscard]] std::size_t entry(std::size_t idx) const {
+    EntryType value{};
+    std::memcpy(&value, entries_ + idx * sizeof(EntryType), sizeof(EntryType)); // native order
+    return static_cast<std::size_t>(value);
+  }
+};
+
+// for toc_chapter(), one instance per type of pw
+template <pw_type PwType>
+toc_table toc;
+
+void print_stats(std::size_t db_size, unsigned bits, std::size_t toc_entries,
+                 std::size_t entry_size) {
+  const std::size_t toc_entry_size = toc_entries == 0 ? 0 : db_size / toc_entries;
   std::cout << fmt::format("{:30s} {:15d} records\n", "DB size", db_size);
   std::cout << fmt::format("{:30s} {:15.0f} per query\n", "Max disk reads without ToC",
                            std::ceil(std::log2(db_size)));
   std::cout << fmt::format("{:30s} {:15d}\n", "Number of bits in ToC prefix", bits);
   std::cout << fmt::format("{:30s} {:15d} ({:.1f}MB consumed)\n", "Number of ToC entries",
                            toc_entries,
-                           static_cast<double>(toc_entries * sizeof(toc_entry)) / pow(2, 20));
+                           static_cast<double>(toc_entries * entry_size) / pow(2, 20));
   std::cout << fmt::format("{:30s} {:15d} records in db (avg)\n", "Each ToC entry covers",
                            toc_entry_size);
   std::cout << fmt::format("{:30s} {:15.0f} per query\n", "Max disk reads with ToC",
                            std::ceil(std::log2(toc_entry_size)));
-  toc<PwType>.reserve(toc_entries);
-
-  toc_entry last_pos = 0;
-  for (std::uint32_t prefix = 0; prefix != toc_entries; prefix++) {
-    auto found_iter = std::find_if(db.begin() + last_pos, db.end(), [=](const PwType& pw) {
-      return pw_to_prefix(pw, bits) == prefix;
-    });
-    if (found_iter == db.end()) {
-      throw std::runtime_error(fmt::format("Missing prefix {:05X}. There must be a gap. Probably "
-                                           "corrupt data. Cannot build table of contents",
-                                           prefix));
-    }
-    last_pos = static_cast<toc_entry>(found_iter - db.begin()); // range checked above
-    toc<PwType>.push_back(last_pos);
-    if (prefix % 1000 == 0) {
+}
+
+// rescan an existing db, for when the toc was not written together with the db
+template <pw_type PwType>
+void build(const std::filesystem::path& db_path, unsigned bits) {
+#ifdef FLAT_FILE_HAS_MMAP
+  const flat_file::mmap_database<PwType> db(db_path, flat_file::access_hint::sequential);
+#else
+  // big buffer for sequential read
+  flat_file::database<PwType> db(db_path, (1U << 16U) / sizeof(PwType));
+#endif
+
+  toc_writer<PwType> writer(db_path, bits);
+
+  const std::size_t db_size = db.number_records();
+  std::size_t       count   = 0;
+  for (const auto& pw: db) {
+    writer.add(pw);
+    if (++count % (1UL << 20U) == 0) {
       std::cout << fmt::format("{:30s} {:14.1f}%\r", "Building table of contents",
-                               prefix * 100 / static_cast<double>(toc_entries))
+                               static_cast<double>(count) * 100 / static_cast<double>(db_size))
                 << std::flush;
     }
   }
   std::cout << "\n";
+  writer.finalize();
 }
 
 template <pw_type PwType>
-void save(const std::filesystem::path& toc_filename) {
-  std::cout << fmt::format("saving table of contents: {}\n", toc_filename);
-  auto toc_stream = std::ofstream(toc_filename, std::ios_base::binary);
-  toc_stream.write(reinterpret_cast<char*>(toc<PwType>.data()), // NOLINT reincast
-                   static_cast<std::streamsize>(sizeof(toc_entry) * toc<PwType>.size()));
+std::optional<std::pair<std::size_t, std::size_t>>
+chapter(const toc_table& table, const PwType& needle, unsigned bits, std::size_t db_size) {
+  const std::uint32_t pw_prefix = pw_to_prefix(needle, bits);
+
+  if (pw_prefix >= table.size()) {
+    return {}; // must be partial db & toc, and therefore "not found"
+  }
+
+  const std::size_t begin_offset = table[pw_prefix];
+  const std::size_t end_offset = pw_prefix + 1 < table.size() ? table[pw_prefix + 1] : db_size;
+
+  return std::pair{begin_offset, end_offset};
 }
 
+// .pla file format: a pla_header, followed by `segments` pla_segments in native byte order.
+struct pla_header {
+  static constexpr std::array<char, 8> expected_magic  = {'H', 'I', 'B', 'P', 'P', 'L', 'A', '\0'};
+  static constexpr std::uint32_t       current_version = 1;
+
+  std::array<char, 8> magic          = expected_magic;
+  std::uint32_t       version        = current_version;
+  std::uint32_t       record_size    = 0;
+  std::uint32_t       epsilon        = 0;
+  std::uint32_t       max_run        = 0; // longest run of records with the same key
+  std::uint64_t       db_records     = 0;
+  std::uint64_t       db_fingerprint = 0; // of the first and last records
+  std::uint64_t       segments       = 0;
+};
+static_assert(sizeof(pla_header) == 48);
+
+// a loaded .pla file. Small, so always read into memory.
+class pla_model {
+public:
+  pla_model() = default;
+
+  explicit pla_model(const std::filesystem::path& pla_filename) {
+    const auto filesize = static_cast<std::size_t>(std::filesystem::file_size(pla_filename));
+    if (filesize < sizeof(pla_header)) return; // leaves magic invalid
+
+    auto pla_stream = std::ifstream(pla_filename, std::ios_base::binary);
+    pla_stream.exceptions(std::ios::badbit | std::ios::failbit);
+    pla_stream.read(reinterpret_cast<char*>(&header_), sizeof(pla_header)); // NOLINT reincast
+    if (filesize != sizeof(pla_header) + header_.segments * sizeof(pla_segment)) {
+      header_.segments = 0; // problem() will report this as corrupt
+      return;
+    }
+    segments_.resize(header_.segments);
+    pla_stream.read(reinterpret_cast<char*>(segments_.data()), // NOLINT reincast
+                    static_cast<std::streamsize>(segments_.size() * sizeof(pla_segment)));
+  }
+
+  [[nodiscard]] const pla_header& header() const { return header_; }
+
+  // empty if valid for this db, otherwise the reason why not
+  template <pw_type PwType>
+  [[nodiscard]] std::string problem(const std::filesystem::path& db_filename,
+                                    unsigned                     epsilon) const {
+    if (header_.magic != pla_header::expected_magic) return "not a pla index file";
+    if (header_.version != pla_header::current_version)
+      return fmt::format("unsupported version {}", header_.version);
+    if (header_.record_size != sizeof(PwType))
+      return fmt::format("record size {}, not {}", header_.record_size, sizeof(PwType));
+    if (header_.epsilon != epsilon)
+      return fmt::format("built for epsilon {}, not {}", header_.epsilon, epsilon);
+    if (segments_.size() != header_.segments || (header_.db_records != 0 && segments_.empty()))
+      return "truncated or corrupt";
+    return db_problem<PwType>(db_filename, header_.db_records, header_.db_fingerprint);
+  }
+
+  [[nodiscard]] std::pair<std::size_t, std::size_t> window(std::uint64_t key,
+                                                           std::size_t   db_size) const {
+    auto seg = std::upper_bound(segments_.begin(), segments_.end(), key,
+                                [](std::uint64_t k, const pla_segment& s) { return k < s.key; });
+    if (seg == segments_.begin()) return {0, 0}; // before the first record => not found
+    --seg;
+
+    const double pred = static_cast<double>(seg->pos) +
+                        seg->slope * static_cast<double>(key - seg->key);
+    // +1 on each side absorbs floating point rounding in the fit and in `pred`
+    const double eps   = static_cast<double>(header_.epsilon) + 1;
+    const double size  = static_cast<double>(db_size);
+    const double begin = std::clamp(std::floor(pred) - eps, 0.0, size);
+    const double end   = std::clamp(std::ceil(pred) + eps + header_.max_run, begin, size);
+    return {static_cast<std::size_t>(begin), static_cast<std::size_t>(end)};
+  }
+
+private:
+  pla_header               header_{.magic = {}};
+  std::vector<pla_segment> segments_;
+};
+
+// for pla_window(), one instance per type of pw
 template <pw_type PwType>
-void load(const std::filesystem::path& toc_filename) {
-  std::cout << fmt::format("loading table of contents: {}\n", toc_filename);
-  const auto toc_file_size = static_cast<std::size_t>(std::filesystem::file_size(toc_filename));
-  auto       toc_stream    = std::ifstream(toc_filename, std::ios_base::binary);
-  toc<PwType>              = std::vector<toc_entry>(toc_file_size / sizeof(toc_entry));
-  toc_stream.read(reinterpret_cast<char*>(toc<PwType>.data()), // NOLINT reincast
-                  static_cast<std::streamsize>(toc_file_size));
+pla_model pla;
+
+inline std::string pla_filename(const std::filesystem::path& db_filename, unsigned epsilon) {
+  return fmt::format("{}.{}.pla", db_filename.string(), epsilon);
 }
 
+// The same full scan of the db as for the toc
 template <pw_type PwType>
-std::optional<PwType> search(flat_file::database<PwType>& db, const PwType& needle, unsigned bits) {
-  const std::uint32_t pw_prefix = pw_to_prefix(needle, bits);
+void pla_rebuild(const std::filesystem::path& db_path, unsigned epsilon) {
+#ifdef FLAT_FILE_HAS_MMAP
+  const flat_file::mmap_database<PwType> db(db_path, flat_file::access_hint::sequential);
+#else
+  flat_file::database<PwType> db(db_path, (1U << 16U) / sizeof(PwType));
+#endif
 
-  if (pw_prefix >= toc<PwType>.size()) {
-    return {}; // must be partial db & toc, and therefore "not found"
+  pla_writer<PwType> writer(db_path, epsilon);
+
+  const std::size_t db_size = db.number_records();
+  std::size_t       count   = 0;
+  for (const auto& pw: db) {
+    writer.add(pw);
+    if (++count % (1UL << 20U) == 0) {
+      std::cout << fmt::format("{:30s} {:14.1f}%\r", "Building pla index",
+                               static_cast<double>(count) * 100 / static_cast<double>(db_size))
+                << std::flush;
+    }
   }
+  std::cout << "\n";
+  writer.finalize();
+}
 
-  const std::size_t begin_offset = toc<PwType>[pw_prefix];
-  const std::size_t end_offset =
-      pw_prefix + 1 < toc<PwType>.size() ? toc<PwType>[pw_prefix + 1] : db.number_records();
+// the toc of a db, if it is valid for the db, otherwise (re)built and saved first
+template <pw_type PwType>
+toc_table load_toc(const std::filesystem::path& db_filename, unsigned bits) {
+  const std::string filename = toc_filename(db_filename, bits);
+
+  if (std::filesystem::exists(filename)) {
+    std::cout << fmt::format("loading table of contents: {}\n", filename);
+    toc_table         table(filename);
+    const std::string problem = table.problem<PwType>(db_filename, bits);
+    if (problem.empty()) return table;
+    std::cout << fmt::format("table of contents is invalid for this db ({}), rebuilding\n",
+                             problem);
+  }
+  build<PwType>(db_filename, bits);
+  return toc_table(filename);
+}
 
-  if (auto iter = std::lower_bound(db.begin() + begin_offset, db.begin() + end_offset, needle);
-      iter != db.end() && *iter == needle) {
-    return *iter; // found!
+// the pla of a db, if it is valid for the db, otherwise (re)built and saved first
+template <pw_type PwType>
+pla_model load_pla(const std::filesystem::path& db_filename, unsigned epsilon) {
+  const std::string filename = pla_filename(db_filename, epsilon);
+
+  if (std::filesystem::exists(filename)) {
+    std::cout << fmt::format("loading pla index: {}\n", filename);
+    pla_model         model(filename);
+    const std::string problem = model.problem<PwType>(db_filename, epsilon);
+    if (problem.empty()) return model;
+    std::cout << fmt::format("pla index is invalid for this db ({}), rebuilding\n", problem);
   }
-  return {}; // not found;
+  pla_rebuild<PwType>(db_filename, epsilon);
+  return pla_model(filename);
 }
 
 } // namespace details
 
+std::string toc_filename(const std::filesystem::path& db_filename, unsigned bits) {
+  return fmt::format("{}.{}.toc", db_filename.string(), bits);
+}
+
 // TOC: "Table of contents"
 //
 // bit masks the needle's pw_hash to index into a table of db positions
@@ -133,24 +366,129 @@ std::optional<PwType> search(flat_file::database<PwType>& db, const PwType& need
 // but all in a single file and therefore much lower syscall i/o overhead
 template <pw_type PwType>
 void toc_build(const std::filesystem::path& db_filename, unsigned bits) {
+  details::toc<PwType> = details::load_toc<PwType>(db_filename, bits);
+}
+
+template <pw_type PwType>
+toc_index<PwType>::toc_index(const std::filesystem::path& db_filename, unsigned bits)
+    : table_(std::make_shared<const details::toc_table>(
+          details::load_toc<PwType>(db_filename, bits))),
+      bits_(bits) {}
 
-  const std::string toc_filename = fmt::format("{}.{}.toc", db_filename.string(), bits);
+template <pw_type PwType>
+std::optional<std::pair<std::size_t, std::size_t>>
+toc_index<PwType>::chapter(const PwType& needle, std::size_t db_size) const {
+  return details::chapter(*table_, needle, bits_, db_size);
+}
 
-  if (!std::filesystem::exists(toc_filename) || (std::filesystem::last_write_time(toc_filename) <=
-                                                 std::filesystem::last_write_time(db_filename))) {
+template <pw_type PwType>
+void toc_writer<PwType>::finalize() {
+  if (entries_.size() < (1UL << bits_)) {
+    std::cout << fmt::format("Warning: DB is partial, reduced size toc.\n");
+  }
 
-    details::build<PwType>(db_filename, bits);
-    details::save<PwType>(toc_filename);
-  } else {
-    details::load<PwType>(toc_filename);
+  details::toc_header header;
+  header.record_size    = sizeof(PwType);
+  header.bits           = bits_;
+  header.entry_size     = records_ > std::numeric_limits<std::uint32_t>::max()
+                              ? sizeof(std::uint64_t)
+                              : sizeof(std::uint32_t);
+  header.db_records     = records_;
+  header.db_fingerprint = details::fingerprint(records_, first_, last_);
+  header.entries        = entries_.size();
+
+  details::print_stats(records_, bits_, entries_.size(), header.entry_size);
+
+  const std::string filename     = toc_filename(db_filename_, bits_);
+  const std::string tmp_filename = filename + ".tmp";
+  std::cout << fmt::format("saving table of contents: {}\n", filename);
+  {
+    auto toc_stream = std::ofstream(tmp_filename, std::ios_base::binary);
+    if (!toc_stream) {
+      throw std::runtime_error(fmt::format("Error opening '{}' for writing. Because: \"{}\".",
+                                           tmp_filename,
+                                           std::strerror(errno))); // NOLINT errno
+    }
+    toc_stream.exceptions(std::ios::badbit | std::ios::failbit);
+    toc_stream.write(reinterpret_cast<const char*>(&header), // NOLINT reincast
+                     sizeof(header));
+    if (header.entry_size == sizeof(std::uint64_t)) {
+      toc_stream.write(reinterpret_cast<const char*>(entries_.data()), // NOLINT reincast
+                       static_cast<std::streamsize>(sizeof(std::uint64_t) * entries_.size()));
+    } else {
+      const std::vector<std::uint32_t> narrow(entries_.begin(), entries_.end()); // range checked
+      toc_stream.write(reinterpret_cast<const char*>(narrow.data()), // NOLINT reincast
+                       static_cast<std::streamsize>(sizeof(std::uint32_t) * narrow.size()));
+    }
   }
+  // atomic replace, so concurrent readers never see a partial toc
+  std::filesystem::rename(tmp_filename, filename);
 }
 
 template <pw_type PwType>
-std::optional<PwType> toc_search(flat_file::database<PwType>& db, const PwType& needle,
-                                 unsigned bits) {
+std::optional<std::pair<std::size_t, std::size_t>> toc_chapter(const PwType& needle, unsigned bits,
+                                                               std::size_t db_size) {
+  return details::chapter(details::toc<PwType>, needle, bits, db_size);
+}
 
-  return details::search(db, needle, bits);
+template <pw_type PwType>
+void pla_build(const std::filesystem::path& db_filename, unsigned epsilon) {
+  details::pla<PwType> = details::load_pla<PwType>(db_filename, epsilon);
+}
+
+template <pw_type PwType>
+pla_index<PwType>::pla_index(const std::filesystem::path& db_filename, unsigned epsilon)
+    : model_(std::make_shared<const details::pla_model>(
+          details::load_pla<PwType>(db_filename, epsilon))) {}
+
+template <pw_type PwType>
+std::pair<std::size_t, std::size_t> pla_index<PwType>::window(const PwType& needle,
+                                                              std::size_t   db_size) const {
+  return model_->window(details::pw_to_key(needle), db_size);
+}
+
+template <pw_type PwType>
+void pla_writer<PwType>::finalize() {
+  if (records_ != 0) close_segment();
+
+  details::pla_header header;
+  header.record_size    = sizeof(PwType);
+  header.epsilon        = epsilon_;
+  header.max_run        = static_cast<std::uint32_t>(max_run_);
+  header.db_records     = records_;
+  header.db_fingerprint = details::fingerprint(records_, first_, last_);
+  header.segments       = segments_.size();
+
+  const std::size_t bytes = segments_.size() * sizeof(details::pla_segment);
+  std::cout << fmt::format("{:30s} {:15d} records\n", "DB size", records_);
+  std::cout << fmt::format("{:30s} {:15d} ({:.1f}MB consumed)\n", "Number of pla segments",
+                           segments_.size(), static_cast<double>(bytes) / pow(2, 20));
+  std::cout << fmt::format("{:30s} {:15d} records (max)\n", "Each search window covers",
+                           2 * (epsilon_ + 1) + 1 + max_run_);
+
+  const std::string pla_filename = details::pla_filename(db_filename_, epsilon_);
+  const std::string tmp_filename = pla_filename + ".tmp";
+  std::cout << fmt::format("saving pla index: {}\n", pla_filename);
+  {
+    auto pla_stream = std::ofstream(tmp_filename, std::ios_base::binary);
+    if (!pla_stream) {
+      throw std::runtime_error(fmt::format("Error opening '{}' for writing. Because: \"{}\".",
+                                           tmp_filename,
+                                           std::strerror(errno))); // NOLINT errno
+    }
+    pla_stream.exceptions(std::ios::badbit | std::ios::failbit);
+    pla_stream.write(reinterpret_cast<const char*>(&header), // NOLINT reincast
+                     sizeof(header));
+    pla_stream.write(reinterpret_cast<const char*>(segments_.data()), // NOLINT reincast
+                     static_cast<std::streamsize>(bytes));
+  }
+  // atomic replace, so concurrent readers never see a partial index
+  std::filesystem::rename(tmp_filename, pla_filename);
+}
+
+template <pw_type PwType>
+std::pair<std::size_t, std::size_t> pla_window(const PwType& needle, std::size_t db_size) {
+  return details::pla<PwType>.window(details::pw_to_key(needle), db_size);
 }
 
 // explicit instantiations for public API
@@ -160,25 +498,61 @@ std::optional<PwType> toc_search(flat_file::database<PwType>& db, const PwType&
 template void toc_build<hibp::pawned_pw_sha1>(const std::filesystem::path& db_filename,
                                               unsigned                     bits);
 
-template std::optional<hibp::pawned_pw_sha1>
-toc_search<hibp::pawned_pw_sha1>(flat_file::database<hibp::pawned_pw_sha1>& db,
-                                 const hibp::pawned_pw_sha1& needle, unsigned bits);
+template std::optional<std::pair<std::size_t, std::size_t>>
+toc_chapter<hibp::pawned_pw_sha1>(const hibp::pawned_pw_sha1& needle, unsigned bits,
+                                  std::size_t db_size);
+
+template class toc_writer<hibp::pawned_pw_sha1>;
+template class toc_index<hibp::pawned_pw_sha1>;
+
+template void pla_build<hibp::pawned_pw_sha1>(const std::filesystem::path& db_filename,
+                                              unsigned                     epsilon);
+
+template std::pair<std::size_t, std::size_t>
+pla_window<hibp::pawned_pw_sha1>(const hibp::pawned_pw_sha1& needle, std::size_t db_size);
+
+template class pla_writer<hibp::pawned_pw_sha1>;
+template class pla_index<hibp::pawned_pw_sha1>;
 
 // ntlm
 
 template void toc_build<hibp::pawned_pw_ntlm>(const std::filesystem::path& db_filename,
                                               unsigned                     bits);
 
-template std::optional<hibp::pawned_pw_ntlm>
-toc_search<hibp::pawned_pw_ntlm>(flat_file::database<hibp::pawned_pw_ntlm>& db,
-                                 const hibp::pawned_pw_ntlm& needle, unsigned bits);
+template std::optional<std::pair<std::size_t, std::size_t>>
+toc_chapter<hibp::pawned_pw_ntlm>(const hibp::pawned_pw_ntlm& needle, unsigned bits,
+                                  std::size_t db_size);
+
+template class toc_writer<hibp::pawned_pw_ntlm>;
+template class toc_index<hibp::pawned_pw_ntlm>;
+
+template void pla_build<hibp::pawned_pw_ntlm>(const std::filesystem::path& db_filename,
+                                              unsigned                     epsilon);
+
+template std::pair<std::size_t, std::size_t>
+pla_window<hibp::pawned_pw_ntlm>(const hibp::pawned_pw_ntlm& needle, std::size_t db_size);
+
+template class pla_writer<hibp::pawned_pw_ntlm>;
+template class pla_index<hibp::pawned_pw_ntlm>;
 
 // sha1t64
 template void toc_build<hibp::pawned_pw_sha1t64>(const std::filesystem::path& db_filename,
                                                  unsigned                     bits);
 
-template std::optional<hibp::pawned_pw_sha1t64>
-toc_search<hibp::pawned_pw_sha1t64>(flat_file::database<hibp::pawned_pw_sha1t64>& db,
-                                    const hibp::pawned_pw_sha1t64& needle, unsigned bits);
+template std::optional<std::pair<std::size_t, std::size_t>>
+toc_chapter<hibp::pawned_pw_sha1t64>(const hibp::pawned_pw_sha1t64& needle, unsigned bits,
+                                     std::size_t db_size);
+
+template class toc_writer<hibp::pawned_pw_sha1t64>;
+template class toc_index<hibp::pawned_pw_sha1t64>;
+
+template void pla_build<hibp::pawned_pw_sha1t64>(const std::filesystem::path& db_filename,
+                                                 unsigned                     epsilon);
+
+template std::pair<std::size_t, std::size_t>
+pla_window<hibp::pawned_pw_sha1t64>(const hibp::pawned_pw_sha1t64& needle, std::size_t db_size);
+
+template class pla_writer<hibp::pawned_pw_sha1t64>;
+template class pla_index<hibp::pawned_pw_sha1t64>;
 
 } // namespace hibp
@@ -0,0 +1,463 @@
+#include "uring.hpp"
+#include "hibp.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <filesystem>
+#include <fmt/format.h>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <utility>
+
+#if __has_include(<linux/io_uring.h>)
+#define HIBP_HAS_IO_URING
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <deque>
+#include <fcntl.h>
+#include <iterator>
+#include <linux/io_uring.h>
+#include <mutex>
+#include <string>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+#endif
+
+namespace hibp {
+
+#ifdef HIBP_HAS_IO_URING
+
+namespace {
+
+std::runtime_error sys_error(const std::string& what, int err = errno) { // NOLINT errno
+  return std::runtime_error(fmt::format("{}, because '{}'", what, std::strerror(err)));
+}
+
+// A minimal io_uring: only what the searches need, from the raw syscalls, so that there is no
+// dependency on liburing. Not thread safe, it is only used by the thread which runs it.
+class ring {
+public:
+  explicit ring(unsigned entries) {
+    io_uring_params params{};
+    fd_ = static_cast<int>(::syscall(__NR_io_uring_setup, entries, &params));
+    if (fd_ < 0) throw sys_error("cannot create io_uring");
+    try {
+      if ((params.features & IORING_FEAT_FAST_POLL) == 0) {
+        throw std::runtime_error("io_uring needs Linux 5.7 or later");
+      }
+      sq_entries_ = params.sq_entries;
+
+      sq_size_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+      cq_size_ = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+      const bool single_mmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+      if (single_mmap) sq_size_ = cq_size_ = std::max(sq_size_, cq_size_);
+
+      sq_        = map(sq_size_, IORING_OFF_SQ_RING);
+      cq_        = single_mmap ? sq_ : map(cq_size_, IORING_OFF_CQ_RING);
+      sqes_size_ = params.sq_entries * sizeof(io_uring_sqe);
+      sqes_      = static_cast<io_uring_sqe*>(map(sqes_size_, IORING_OFF_SQES));
+
+      sq_head_  = field<unsigned>(sq_, params.sq_off.head);
+      sq_tail_  = field<unsigned>(sq_, params.sq_off.tail);
+      sq_mask_  = *field<unsigned>(sq_, params.sq_off.ring_mask);
+      sq_array_ = field<unsigned>(sq_, params.sq_off.array);
+      cq_head_  = field<unsigned>(cq_, params.cq_off.head);
+      cq_tail_  = field<unsigned>(cq_, params.cq_off.tail);
+      cq_mask_  = *field<unsigned>(cq_, params.cq_off.ring_mask);
+      cqes_     = field<io_uring_cqe>(cq_, params.cq_off.cqes);
+    } catch (...) {
+      unmap();
+      throw;
+    }
+  }
+
+  ring(const ring& other)            = delete;
+  ring& operator=(const ring& other) = delete;
+  ring(ring&& other)                 = delete;
+  ring& operator=(ring&& other)      = delete;
+
+  ~ring() { unmap(); }
+
+  [[nodiscard]] unsigned entries() const { return sq_entries_; }
+
+  // queues a read into `buf`, which must stay valid until its completion. False if the queue is
+  // full.
+  bool read(int fd, void* buf, std::size_t size, std::uint64_t offset, std::uint64_t user_data) {
+    const unsigned tail = *sq_tail_; // only this thread writes the tail
+    if (tail - std::atomic_ref(*sq_head_).load(std::memory_order_acquire) == sq_entries_) {
+      return false;
+    }
+    const unsigned idx = tail & sq_mask_;
+    io_uring_sqe&  sqe = sqes_[idx]; // NOLINT pointer arithmetic
+    sqe                = io_uring_sqe{};
+    sqe.opcode         = IORING_OP_READ;
+    sqe.fd             = fd;
+    sqe.addr           = reinterpret_cast<std::uintptr_t>(buf); // NOLINT reincast
+    sqe.len            = static_cast<std::uint32_t>(size);
+    sqe.off            = offset;
+    sqe.user_data      = user_data;
+    sq_array_[idx]     = idx; // NOLINT pointer arithmetic
+    std::atomic_ref(*sq_tail_).store(tail + 1, std::memory_order_release);
+    ++unsubmitted_;
+    return true;
+  }
+
+  // submits all queued reads and waits for at least one completion
+  void submit_and_wait() {
+    while (true) {
+      const long ret = ::syscall(__NR_io_uring_enter, fd_, unsubmitted_, 1U, IORING_ENTER_GETEVENTS,
+                                 nullptr, 0);
+      if (ret >= 0) {
+        unsubmitted_ -= static_cast<unsigned>(ret);
+        return;
+      }
+      if (errno == EINTR) continue;                  // NOLINT errno
+      if (errno == EAGAIN || errno == EBUSY) return; // completions need reaping first NOLINT errno
+      throw sys_error("io_uring_enter failed");
+    }
+  }
+
+  // calls `func(user_data, result)` for each completion
+  template <typename Func>
+  void reap(Func&& func) {
+    unsigned       head = *cq_head_; // only this thread writes the head
+    const unsigned tail = std::atomic_ref(*cq_tail_).load(std::memory_order_acquire);
+    for (; head != tail; ++head) {
+      const io_uring_cqe& cqe = cqes_[head & cq_mask_]; // NOLINT pointer arithmetic
+      func(cqe.user_data, cqe.res);
+    }
+    std::atomic_ref(*cq_head_).store(head, std::memory_order_release);
+  }
+
+private:
+  int                 fd_ = -1;
+  unsigned            sq_entries_{};
+  unsigned            unsubmitted_ = 0;
+  std::size_t         sq_size_{};
+  std::size_t         cq_size_{};
+  std::size_t         sqes_size_{};
+  void*               sq_   = nullptr;
+  void*               cq_   = nullptr;
+  io_uring_sqe*       sqes_ = nullptr;
+  unsigned*           sq_head_{};
+  unsigned*           sq_tail_{};
+  unsigned            sq_mask_{};
+  unsigned*           sq_array_{};
+  unsigned*           cq_head_{};
+  unsigned*           cq_tail_{};
+  unsigned            cq_mask_{};
+  const io_uring_cqe* cqes_{};
+
+  void* map(std::size_t size, std::uint64_t offset) const {
+    void* addr = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_,
+                        static_cast<off_t>(offset));
+    if (addr == MAP_FAILED) throw sys_error("cannot mmap io_uring"); // NOLINT cstyle cast in macro
+    return addr;
+  }
+
+  template <typename T>
+  static T* field(void* base, std::uint32_t offset) {
+    return reinterpret_cast<T*>(static_cast<char*>(base) + offset); // NOLINT reincast
+  }
+
+  void unmap() {
+    if (sqes_ != nullptr) ::munmap(sqes_, sqes_size_);
+    if (cq_ != nullptr && cq_ != sq_) ::munmap(cq_, cq_size_);
+    if (sq_ != nullptr) ::munmap(sq_, sq_size_);
+    if (fd_ >= 0) ::close(fd_);
+    sqes_ = nullptr;
+    cq_ = sq_ = nullptr;
+    fd_ = -1;
+  }
+};
+
+// closes the file descriptor
+struct unique_fd {
+  int fd;
+
+  explicit unique_fd(int descriptor) : fd(descriptor) {}
+  unique_fd(const unique_fd& other)            = delete;
+  unique_fd& operator=(const unique_fd& other) = delete;
+  unique_fd(unique_fd&& other)                 = delete;
+  unique_fd& operator=(unique_fd&& other)      = delete;
+  ~unique_fd() {
+    if (fd >= 0) ::close(fd);
+  }
+};
+
+} // namespace
+
+bool uring_available() {
+  static const bool available = [] {
+    try {
+      const ring probe(1);
+      return true;
+    } catch (const std::exception&) {
+      return false; // eg an old kernel, or io_uring disabled by seccomp or sysctl
+    }
+  }();
+  return available;
+}
+
+template <pw_type PwType>
+struct uring_search<PwType>::impl {
+  // about one disk page of records, which are read together
+  static constexpr std::size_t window = 4096 / sizeof(PwType);
+
+  struct search {
+    PwType                         needle;
+    std::size_t                    lo; // all records before lo are < needle
+    std::size_t                    hi; // all records from hi onwards are >= needle
+    std::size_t                    last;
+    std::optional<PwType>          at_hi{}; // the record at hi, once read
+    callback                       done;
+    std::size_t                    buf_first = 0; // of the records being read
+    std::size_t                    buf_size  = 0;
+    std::array<PwType, window + 1> buf{};
+  };
+
+  static constexpr std::uint64_t wakeup = 0; // user_data of the eventfd read
+
+  std::filesystem::path filename;
+  std::size_t           records;
+  unique_fd             db_fd;
+  unique_fd             event_fd;
+  ring                  uring;
+  unsigned              max_inflight;
+  unsigned              inflight = 0;
+  std::uint64_t         event_count{};
+  bool                  event_armed = false;
+
+  std::mutex                           mutex;
+  std::vector<std::unique_ptr<search>> incoming; // guarded by mutex
+  std::exception_ptr                   broken;   // guarded by mutex
+  std::atomic<bool>                    stop = false;
+
+  std::deque<std::unique_ptr<search>>  waiting; // for a free slot
+  std::jthread                         thread;
+
+  impl(std::filesystem::path db_filename, unsigned queue_depth)
+      : filename(std::move(db_filename)),
+        records(std::filesystem::file_size(filename) / sizeof(PwType)),
+        db_fd(::open(filename.c_str(), O_RDONLY | O_CLOEXEC)), // NOLINT vararg
+        event_fd(::eventfd(0, EFD_CLOEXEC)), uring(queue_depth + 1),
+        max_inflight(uring.entries() - 1) { // one slot for the eventfd
+    if (db_fd.fd < 0) throw sys_error(fmt::format("cannot open db: {}", filename.string()));
+    if (event_fd.fd < 0) throw sys_error("cannot create eventfd");
+    thread = std::jthread([this] { run(); });
+  }
+
+  impl(const impl& other)            = delete;
+  impl& operator=(const impl& other) = delete;
+  impl(impl&& other)                 = delete;
+  impl& operator=(impl&& other)      = delete;
+
+  ~impl() {
+    stop = true;
+    wake();
+    thread.join();
+  }
+
+  void wake() const {
+    const std::uint64_t   one = 1;
+    [[maybe_unused]] auto ret = ::write(event_fd.fd, &one, sizeof(one)); // only fails on overflow
+  }
+
+  void find(const PwType& needle, std::size_t first, std::size_t last, callback done) {
+    last  = std::min(last, records);
+    first = std::min(first, last);
+    if (first == last) {
+      done({}, {});
+      return;
+    }
+    auto srch = std::make_unique<search>(
+        search{.needle = needle, .lo = first, .hi = last, .last = last, .done = std::move(done)});
+    std::exception_ptr error;
+    {
+      const std::lock_guard lock(mutex);
+      error = broken;
+      if (!error) incoming.push_back(std::move(srch));
+    }
+    if (error) {
+      srch->done({}, error);
+      return;
+    }
+    wake();
+  }
+
+  // reads the next window of records for a search, or false if there is no free slot
+  bool submit(search& srch) {
+    if (inflight == max_inflight) return false;
+    if (srch.hi - srch.lo <= window) {
+      // the rest fits in one read
+      srch.buf_first = srch.lo;
+      srch.buf_size  = srch.hi - srch.lo;
+    } else {
+      // the records of the disk page containing the middle
+      const std::size_t mid   = srch.lo + (srch.hi - srch.lo) / 2;
+      const std::size_t page  = mid * sizeof(PwType) / 4096 * 4096;
+      const std::size_t first = std::max(srch.lo, (page + sizeof(PwType) - 1) / sizeof(PwType));
+      const std::size_t last  = std::min(srch.hi, std::max(first + window, mid + 1));
+      srch.buf_first          = first;
+      srch.buf_size           = last - first;
+    }
+    const auto user_data = reinterpret_cast<std::uintptr_t>(&srch); // NOLINT reincast
+    const bool queued    = uring.read(db_fd.fd, srch.buf.data(), srch.buf_size * sizeof(PwType),
+                                      srch.buf_first * sizeof(PwType), user_data);
+    if (queued) ++inflight;
+    return queued;
+  }
+
+  // handles a completed read, the search is either finished, or submits its next read
+  void advance(std::unique_ptr<search> srch, int result) {
+    if (result < 0) {
+      srch->done({}, std::make_exception_ptr(
+                         sys_error(fmt::format("cannot read db: {}", filename.string()), -result)));
+      return;
+    }
+    if (static_cast<std::size_t>(result) != srch->buf_size * sizeof(PwType)) {
+      srch->done({}, std::make_exception_ptr(std::runtime_error(fmt::format(
+                         "short read of db: {}, has it been truncated?", filename.string()))));
+      return;
+    }
+    const auto begin = srch->buf.begin();
+    const auto end   = begin + static_cast<std::ptrdiff_t>(srch->buf_size);
+    const auto iter  = std::lower_bound(begin, end, srch->needle);
+    if (iter == begin && srch->buf_first != srch->lo) {
+      srch->hi    = srch->buf_first;
+      srch->at_hi = *begin;
+    } else if (iter == end && srch->buf_first + srch->buf_size != srch->hi) {
+      srch->lo = srch->buf_first + srch->buf_size;
+    } else {
+      // found the lower bound
+      if (iter != end) {
+        srch->done(*iter == srch->needle ? std::optional{*iter} : std::nullopt, {});
+      } else {
+        const bool found = srch->hi != srch->last && srch->at_hi && *srch->at_hi == srch->needle;
+        srch->done(found ? srch->at_hi : std::nullopt, {});
+      }
+      return;
+    }
+    if (submit(*srch)) {
+      srch.release(); // NOLINT owned by the ring, until the read completes
+    } else {
+      waiting.push_back(std::move(srch));
+    }
+  }
+
+  void arm_wakeup() {
+    event_armed = uring.read(event_fd.fd, &event_count, sizeof(event_count), 0, wakeup);
+  }
+
+  void run() {
+    try {
+      arm_wakeup();
+      while (!stop) {
+        uring.submit_and_wait();
+        uring.reap([&](std::uint64_t user_data, int result) {
+          if (user_data == wakeup) {
+            event_armed = false;
+            const std::lock_guard lock(mutex);
+            std::move(incoming.begin(), incoming.end(), std::back_inserter(waiting));
+            incoming.clear();
+            return;
+          }
+          --inflight;
+          std::unique_ptr<search> srch(reinterpret_cast<search*>(user_data)); // NOLINT reincast
+          try {
+            advance(std::move(srch), result);
+          } catch (...) {
+            // a callback threw, which it must not, but the other searches can carry on
+          }
+        });
+        // oldest first, while there are free slots
+        while (!waiting.empty() && submit(*waiting.front())) {
+          waiting.front().release(); // NOLINT owned by the ring, until the read completes
+          waiting.pop_front();
+        }
+        if (!event_armed) arm_wakeup();
+      }
+    } catch (...) {
+      // the ring itself failed, so fail everything, and all later searches
+      {
+        const std::lock_guard lock(mutex);
+        broken = std::current_exception();
+        std::move(incoming.begin(), incoming.end(), std::back_inserter(waiting));
+        incoming.clear();
+      }
+      for (auto& srch: waiting) srch->done({}, std::current_exception());
+      waiting.clear();
+    }
+    // reads in flight point at their searches, so wait for them, before those are freed
+    while (inflight != 0) {
+      try {
+        uring.submit_and_wait();
+      } catch (...) {
+        return; // nothing more can be done, so leak the searches rather than free them in use
+      }
+      uring.reap([&](std::uint64_t user_data, int /*result*/) {
+        if (user_data == wakeup) return;
+        --inflight;
+        delete reinterpret_cast<search*>(user_data); // NOLINT reincast, owning
+      });
+    }
+  }
+};
+
+template <pw_type PwType>
+uring_search<PwType>::uring_search(const std::filesystem::path& db_filename, unsigned queue_depth)
+    : impl_(std::make_unique<impl>(db_filename, queue_depth)) {}
+
+template <pw_type PwType>
+void uring_search<PwType>::find(const PwType& needle, std::size_t first, std::size_t last,
+                                callback done) {
+  impl_->find(needle, first, last, std::move(done));
+}
+
+template <pw_type PwType>
+std::size_t uring_search<PwType>::number_records() const {
+  return impl_->records;
+}
+
+#else // no io_uring
+
+bool uring_available() { return false; }
+
+template <pw_type PwType>
+struct uring_search<PwType>::impl {};
+
+template <pw_type PwType>
+uring_search<PwType>::uring_search(const std::filesystem::path& db_filename,
+                                   unsigned /*queue_depth*/) {
+  throw std::runtime_error(
+      fmt::format("cannot search {} with io_uring, it is only available on Linux",
+                  db_filename.string()));
+}
+
+template <pw_type PwType>
+void uring_search<PwType>::find(const PwType& /*needle*/, std::size_t /*first*/,
+                                std::size_t /*last*/, callback /*done*/) {}
+
+template <pw_type PwType>
+std::size_t uring_search<PwType>::number_records() const {
+  return 0;
+}
+
+#endif
+
+template <pw_type PwType>
+uring_search<PwType>::~uring_search() = default;
+
+template class uring_search<pawned_pw_sha1>;
+template class uring_search<pawned_pw_ntlm>;
+template class uring_search<pawned_pw_sha1t64>;
+
+} // namespace hibp
@@ -3,17 +3,79 @@
 #include "restinio/router/express.hpp"
 #include "restinio/sendfile.hpp"
 #include "restinio/traits.hpp"
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
 #include <exception>
 #include <filesystem>
+#include <fstream>
 #include <iostream>
+#include <iterator>
 #include <memory>
 #include <restinio/all.hpp>
 #include <stdexcept>
 #include <string>
+#include <string_view>
 #include <utility>
+#include <zlib.h>
+#ifdef HIBP_USE_BROTLI
+#include <brotli/encode.h>
+#endif
 
 namespace fs = std::filesystem;
 
+// the coding to respond with, if any, for an `accept_encoding` header: br when built with brotli,
+// else gzip, like the real api, so that hibp-download's decoding is tested
+std::string_view content_encoding(std::string_view accept_encoding) {
+  std::string accepted(accept_encoding);
+  std::transform(accepted.begin(), accepted.end(), accepted.begin(),
+                 [](unsigned char c) { return std::tolower(c); });
+  auto accepts = [&accepted](std::string_view coding) {
+    std::string_view rest = accepted;
+    while (!rest.empty()) {
+      const std::size_t comma = std::min(rest.find(','), rest.size());
+      std::string_view  token = rest.substr(0, std::min(rest.find(';'), comma)); // no q values
+      rest.remove_prefix(std::min(comma + 1, rest.size()));
+      while (token.starts_with(' ')) token.remove_prefix(1);
+      while (token.ends_with(' ')) token.remove_suffix(1);
+      if (token == coding) return true;
+    }
+    return false;
+  };
+#ifdef HIBP_USE_BROTLI
+  if (accepts("br")) return "br";
+#endif
+  if (accepts("gzip")) return "gzip";
+  return {};
+}
+
+// with the `encoding` from content_encoding()
+std::string compress([[maybe_unused]] std::string_view encoding, const std::string& body) {
+#ifdef HIBP_USE_BROTLI
+  if (encoding == "br") {
+    std::string out(BrotliEncoderMaxCompressedSize(body.size()), '\0');
+    std::size_t size = out.size();
+    BrotliEncoderCompress(BROTLI_DEFAULT_QUALITY, BROTLI_DEFAULT_WINDOW, BROTLI_MODE_TEXT,
+                          body.size(), reinterpret_cast<const std::uint8_t*>(body.data()), // NOLINT
+                          &size, reinterpret_cast<std::uint8_t*>(out.data()));            // NOLINT
+    out.resize(size);
+    return out;
+  }
+#endif
+  z_stream zs{};
+  deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY); // gzip
+  std::string in = body; // zlib's next_in is not const
+  std::string out(deflateBound(&zs, static_cast<uLong>(in.size())), '\0');
+  zs.next_in   = reinterpret_cast<Bytef*>(in.data());  // NOLINT reinterpret_cast
+  zs.avail_in  = static_cast<uInt>(in.size());
+  zs.next_out  = reinterpret_cast<Bytef*>(out.data()); // NOLINT reinterpret_cast
+  zs.avail_out = static_cast<uInt>(out.size());
+  deflate(&zs, Z_FINISH);
+  out.resize(zs.total_out);
+  deflateEnd(&zs);
+  return out;
+}
+
 auto get_router(const fs::path& static_dir) {
   auto router = std::make_unique<restinio::router::express_router_t<>>();
 
@@ -29,8 +91,30 @@ auto get_router(const fs::path& static_dir) {
     }
 
     if (fs::exists(file_path) && fs::is_regular_file(file_path)) {
+      // like most static file servers, so `hibp-download --update` can be tested
+      const std::string etag =
+          "\"" + std::to_string(fs::file_size(file_path)) + "-" +
+          std::to_string(fs::last_write_time(file_path).time_since_epoch().count()) + "\"";
+      if (req->header().opt_value_of(restinio::http_field::if_none_match) == etag) {
+        return req->create_response(restinio::status_not_modified())
+            .append_header(restinio::http_field::etag, etag)
+            .done();
+      }
+      const auto encoding = content_encoding(
+          req->header().opt_value_of(restinio::http_field::accept_encoding).value_or(""));
+      if (!encoding.empty()) {
+        std::ifstream     file(file_path, std::ios::binary);
+        const std::string body{std::istreambuf_iterator<char>(file), {}};
+        return req->create_response()
+            .append_header(restinio::http_field::content_type, "text/plain; charset=utf-8")
+            .append_header(restinio::http_field::content_encoding, std::string(encoding))
+            .append_header(restinio::http_field::etag, etag)
+            .set_body(compress(encoding, body))
+            .done();
+      }
       return req->create_response()
           .append_header(restinio::http_field::content_type, "text/plain; charset=utf-8")
+          .append_header(restinio::http_field::etag, etag)
           .set_body(restinio::sendfile(file_path))
           .done();
     }
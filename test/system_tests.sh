@@ -78,6 +78,36 @@ testLocalDownloadSha1t64() {
     th_assertTrueWithNoOutput ${rtrn} "${stdoutF}" "${stderrF}"
 }
 
+# toc written inline, while downloading
+
+testLocalDownloadTocSha1() {
+    $builddir/hibp-download --testing $tmpdir/hibp_inline_toc.sha1.bin --limit 256 --no-progress --toc --toc-bits=18 >/dev/null 2>${stderrF}
+    cmp $datadir/hibp_test.sha1.bin.18.toc $tmpdir/hibp_inline_toc.sha1.bin.18.toc >${stdoutF} 2>>${stderrF}
+    rtrn=$?
+    th_assertTrueWithNoOutput ${rtrn} "${stdoutF}" "${stderrF}"
+}
+
+testLocalDownloadTocNtlm() {
+    $builddir/hibp-download --testing $tmpdir/hibp_inline_toc.ntlm.bin --ntlm --limit 256 --no-progress --toc --toc-bits=18 >/dev/null 2>${stderrF}
+    cmp $datadir/hibp_test.ntlm.bin.18.toc $tmpdir/hibp_inline_toc.ntlm.bin.18.toc >${stdoutF} 2>>${stderrF}
+    rtrn=$?
+    th_assertTrueWithNoOutput ${rtrn} "${stdoutF}" "${stderrF}"
+}
+
+# several outputs from one download
+
+testLocalDownloadFanout() {
+    $builddir/hibp-download --testing --limit 256 --no-progress --toc --toc-bits=18 \
+			    --out-sha1 $tmpdir/hibp_fanout.sha1.bin --out-sha1t64 $tmpdir/hibp_fanout.sha1t64.bin \
+			    --out-binfuse16 $tmpdir/hibp_fanout.binfuse16.bin >/dev/null 2>${stderrF}
+    cmp $datadir/hibp_test.sha1.bin $tmpdir/hibp_fanout.sha1.bin >${stdoutF} 2>>${stderrF} &&
+	cmp $datadir/hibp_test.sha1t64.bin $tmpdir/hibp_fanout.sha1t64.bin >>${stdoutF} 2>>${stderrF} &&
+	cmp $datadir/hibp_test.sha1.bin.18.toc $tmpdir/hibp_fanout.sha1.bin.18.toc >>${stdoutF} 2>>${stderrF}
+    rtrn=$?
+    th_assertTrueWithNoOutput ${rtrn} "${stdoutF}" "${stderrF}"
+    assertTrue "no binfuse16 filter was written" "[ -s $tmpdir/hibp_fanout.binfuse16.bin ]"
+}
+
 # check local download
 
 testLocalDownloadCmpSha1() {
@@ -98,6 +128,39 @@ testLocalDownloadCmpSha1t64() {
     th_assertTrueWithNoOutput ${rtrn} "${stdoutF}" "${stderrF}"
 }
 
+# stop part way, and resume from the journal's last checkpoint
+
+testLocalDownloadResumeSha1() {
+    rm -f $tmpdir/hibp_resume.sha1.bin*
+    $builddir/hibp-download --testing $tmpdir/hibp_resume.sha1.bin --limit 100 --no-progress >/dev/null 2>${stderrF}
+    head -c 1000 /dev/zero >> $tmpdir/hibp_resume.sha1.bin # a partial write, after the checkpoint
+    $builddir/hibp-download --testing $tmpdir/hibp_resume.sha1.bin --limit 256 --no-progress --resume >/dev/null 2>>${stderrF}
+    cmp $datadir/hibp_test.sha1.bin $tmpdir/hibp_resume.sha1.bin >${stdoutF} 2>>${stderrF}
+    rtrn=$?
+    assertTrue "resumed sha1 db is different" ${rtrn}
+}
+
+testLocalDownloadResumeTxt() {
+    rm -f $tmpdir/hibp_resume*.txt*
+    $builddir/hibp-download --testing $tmpdir/hibp_resume_full.txt --txt-out --limit 256 --no-progress >/dev/null 2>${stderrF}
+    $builddir/hibp-download --testing $tmpdir/hibp_resume.txt --txt-out --limit 100 --no-progress >/dev/null 2>>${stderrF}
+    $builddir/hibp-download --testing $tmpdir/hibp_resume.txt --txt-out --limit 256 --no-progress --resume >/dev/null 2>>${stderrF}
+    cmp $tmpdir/hibp_resume_full.txt $tmpdir/hibp_resume.txt >${stdoutF} 2>>${stderrF}
+    rtrn=$?
+    assertTrue "resumed text download is different" ${rtrn}
+}
+
+# refresh a local download, where nothing has changed since, using the mock server's ETags
+
+testLocalUpdateSha1() {
+    $builddir/hibp-download --testing $tmpdir/hibp_update.sha1.bin --limit 256 --no-progress >/dev/null 2>&1
+    $builddir/hibp-download --testing $tmpdir/hibp_update.sha1.bin --limit 256 --no-progress --update >/dev/null 2>${stderrF}
+    assertContains "update did not find all files unchanged" "$(cat ${stderrF})" "0 changed and 256 unchanged files"
+    cmp $datadir/hibp_test.sha1.bin $tmpdir/hibp_update.sha1.bin >${stdoutF} 2>${stderrF}
+    rtrn=$?
+    th_assertTrueWithNoOutput ${rtrn} "${stdoutF}" "${stderrF}"
+}
+
 # live download
 
 testDownloadSha1() {
@@ -173,6 +236,96 @@ testTopnCmpSha1t64() {
     th_assertTrueWithNoOutput ${rtrn} "${stdoutF}" "${stderrF}"
 }
 
+# more threads than topn, each of which merges several times, so the floor skips most records
+testTopnManyThreads() {
+    $builddir/hibp-topn $datadir/hibp_topn.sha1.bin -o $tmpdir/hibp_top10_ref.sha1.bin --topn 10 --threads 1 >/dev/null 2>&1
+    $builddir/hibp-topn $datadir/hibp_test.sha1.bin -o $tmpdir/hibp_top10.sha1.bin --topn 10 --threads 32 >/dev/null 2>&1
+    cmp $tmpdir/hibp_top10_ref.sha1.bin $tmpdir/hibp_top10.sha1.bin >${stdoutF} 2>${stderrF}
+    rtrn=$?
+    th_assertTrueWithNoOutput ${rtrn} "${stdoutF}" "${stderrF}"
+}
+
+# diff and patch: topn is a subset of the full db, so patching it with the diff restores the full db
+
+testDiffPatchSha1() {
+    $builddir/hibp-diff $datadir/hibp_topn.sha1.bin $datadir/hibp_test.sha1.bin >$tmpdir/topn_to_full.diff 2>${stderrF}
+    assertTrue "hibp-diff failed: $(cat ${stderrF})" $?
+    $builddir/hibp-patch $datadir/hibp_topn.sha1.bin $tmpdir/topn_to_full.diff $tmpdir/hibp_patched.sha1.bin >/dev/null 2>&1
+    cmp $datadir/hibp_test.sha1.bin $tmpdir/hibp_patched.sha1.bin >${stdoutF} 2>${stderrF}
+    rtrn=$?
+    th_assertTrueWithNoOutput ${rtrn} "${stdoutF}" "${stderrF}"
+}
+
+testDiffPatchNtlm() {
+    $builddir/hibp-diff --ntlm $datadir/hibp_topn.ntlm.bin $datadir/hibp_test.ntlm.bin >$tmpdir/topn_to_full.diff 2>${stderrF}
+    assertTrue "hibp-diff failed: $(cat ${stderrF})" $?
+    $builddir/hibp-patch --ntlm $datadir/hibp_topn.ntlm.bin - $tmpdir/hibp_patched.ntlm.bin <$tmpdir/topn_to_full.diff >/dev/null 2>&1
+    cmp $datadir/hibp_test.ntlm.bin $tmpdir/hibp_patched.ntlm.bin >${stdoutF} 2>${stderrF}
+    rtrn=$?
+    th_assertTrueWithNoOutput ${rtrn} "${stdoutF}" "${stderrF}"
+}
+
+# convert
+
+testConvertRoundTripSha1() {
+    $builddir/hibp-convert --bin-to-txt -i $datadir/hibp_test.sha1.bin -o $tmpdir/hibp_convert.sha1.txt 2>/dev/null
+    $builddir/hibp-convert --txt-to-bin --threads=3 -i $tmpdir/hibp_convert.sha1.txt -o $tmpdir/hibp_convert.sha1.bin 2>/dev/null
+    cmp $datadir/hibp_test.sha1.bin $tmpdir/hibp_convert.sha1.bin >${stdoutF} 2>${stderrF}
+    rtrn=$?
+    th_assertTrueWithNoOutput ${rtrn} "${stdoutF}" "${stderrF}"
+}
+
+testConvertNtlmStdin() {
+    $builddir/hibp-convert --ntlm --bin-to-txt -i $datadir/hibp_test.ntlm.bin --stdout 2>/dev/null |
+	$builddir/hibp-convert --ntlm --txt-to-bin --stdin -o $tmpdir/hibp_convert.ntlm.bin 2>/dev/null
+    cmp $datadir/hibp_test.ntlm.bin $tmpdir/hibp_convert.ntlm.bin >${stdoutF} 2>${stderrF}
+    rtrn=$?
+    th_assertTrueWithNoOutput ${rtrn} "${stdoutF}" "${stderrF}"
+}
+
+testConvertSha1t64() {
+    # full sha1 text, eg from the api, truncates to the sha1t64 db
+    $builddir/hibp-convert --bin-to-txt -i $datadir/hibp_test.sha1.bin --stdout 2>/dev/null |
+	$builddir/hibp-convert --sha1t64 --txt-to-bin --stdin -o $tmpdir/hibp_convert.sha1t64.bin 2>/dev/null
+    cmp $datadir/hibp_test.sha1t64.bin $tmpdir/hibp_convert.sha1t64.bin >${stdoutF} 2>${stderrF}
+    rtrn=$?
+    th_assertTrueWithNoOutput ${rtrn} "${stdoutF}" "${stderrF}"
+}
+
+testConvertLimit() {
+    lines=$($builddir/hibp-convert --sha1t64 --bin-to-txt -i $datadir/hibp_test.sha1t64.bin --stdout --limit=1000 2>/dev/null | wc -l)
+    assertEquals "--limit did not limit the records" "1000" "${lines}"
+}
+
+# audit
+
+testAuditSha1() {
+    # every record of the topn db must be found, with the same count
+    $builddir/hibp-convert --bin-to-txt -i $datadir/hibp_topn.sha1.bin -o $tmpdir/hibp_audit.sha1.txt 2>/dev/null
+    sort -R $tmpdir/hibp_audit.sha1.txt > $tmpdir/hibp_audit_in.sha1.txt
+    echo "00001131628B741FF755AAC0E7C66D26A7C72083" >> $tmpdir/hibp_audit_in.sha1.txt # absent
+    $builddir/hibp-audit $datadir/hibp_test.sha1.bin -i $tmpdir/hibp_audit_in.sha1.txt -o $tmpdir/hibp_audit_out.sha1.txt 2>/dev/null
+    cmp $tmpdir/hibp_audit.sha1.txt $tmpdir/hibp_audit_out.sha1.txt >${stdoutF} 2>${stderrF}
+    rtrn=$?
+    th_assertTrueWithNoOutput ${rtrn} "${stdoutF}" "${stderrF}"
+}
+
+testAuditNtlmDiskSort() {
+    # --max-memory=1 (MB) forces the ~230k hashes to be sorted on disk
+    $builddir/hibp-convert --ntlm --bin-to-txt -i $datadir/hibp_test.ntlm.bin -o $tmpdir/hibp_audit.ntlm.txt 2>/dev/null
+    sort -R $tmpdir/hibp_audit.ntlm.txt > $tmpdir/hibp_audit_in.ntlm.txt
+    $builddir/hibp-audit --ntlm --max-memory=1 $datadir/hibp_test.ntlm.bin -i $tmpdir/hibp_audit_in.ntlm.txt -o $tmpdir/hibp_audit_out.ntlm.txt 2>/dev/null
+    cmp $tmpdir/hibp_audit.ntlm.txt $tmpdir/hibp_audit_out.ntlm.txt >${stdoutF} 2>${stderrF}
+    rtrn=$?
+    th_assertTrueWithNoOutput ${rtrn} "${stdoutF}" "${stderrF}"
+}
+
+testAuditPlain() {
+    pawned=$(printf "truelove15\nnot pawned, surely?\n" | $builddir/hibp-audit --plain --stdin --stdout $datadir/hibp_test.sha1.bin 2>/dev/null)
+    sha1=$(printf "truelove15" | sha1sum | cut -d' ' -f1 | tr a-f A-F)
+    assertEquals "hibp-audit --plain did not find the one pawned password" "${sha1}:1002" "${pawned}"
+}
+
 # search topn
 
 testSearchPlainSha1() {
@@ -226,7 +379,7 @@ testSearchPlainSha1Toc() {
     count=$($builddir/hibp-search --toc --toc-bits=$bits $tmpdir/hibp_test.sha1.bin "${plain}" | grep '^found' | cut -d: -f2)
     assertEquals "count for plain pw '${plain}' of '${count}' was wrong" "${correct_count}" "${count}"
     toc_size=$(echo $(wc -c $tmpdir/hibp_test.sha1.bin.$bits.toc) | cut -d' ' -f1)
-    correct_toc_size=256
+    correct_toc_size=304 # 48 byte header + 64 entries
     assertEquals "toc size of ${toc_size} wrong" "${correct_toc_size}" "${toc_size}"
 }
 
@@ -237,7 +390,7 @@ testSearchPlainNtlmToc() {
     count=$($builddir/hibp-search --toc --toc-bits=$bits --ntlm $tmpdir/hibp_test.ntlm.bin "${plain}" | grep '^found' | cut -d: -f2)
     assertEquals "count for plain pw '${plain}' of '${count}' was wrong" "${correct_count}" "${count}"
     toc_size=$(echo $(wc -c $tmpdir/hibp_test.ntlm.bin.$bits.toc) | cut -d' ' -f1)
-    correct_toc_size=256
+    correct_toc_size=304 # 48 byte header + 64 entries
     assertEquals "toc size of ${toc_size} wrong" "${correct_toc_size}" "${toc_size}"
 }
 
@@ -257,6 +410,66 @@ testSearchHashNtlmToc() {
     assertEquals "count for plain pw '${plain}' of '${count}' was wrong" "${correct_count}" "${count}"
 }
 
+# search topn with --hot-index-mb
+
+testSearchHashSha1HotIndex() {
+    hash="00001131628B741FF755AAC0E7C66D26A7C72082"
+    correct_count="1002"
+    count=$($builddir/hibp-search --hot-index-mb=1 --hash $tmpdir/hibp_test.sha1.bin "${hash}" | grep '^found' | cut -d: -f2)
+    assertEquals "count for hash pw '${hash}' of '${count}' was wrong" "${correct_count}" "${count}"
+}
+
+testSearchHashSha1HotIndexToc() {
+    hash="00001131628B741FF755AAC0E7C66D26A7C72082"
+    correct_count="1002"
+    count=$($builddir/hibp-search --hot-index-mb=1 --toc --toc-bits=18 --hash $tmpdir/hibp_test.sha1.bin "${hash}" | grep '^found' | cut -d: -f2)
+    assertEquals "count for hash pw '${hash}' of '${count}' was wrong" "${correct_count}" "${count}"
+    count=$($builddir/hibp-search --hot-index-mb=1 --pla --hash $tmpdir/hibp_test.sha1.bin "${hash}" | grep '^found' | cut -d: -f2)
+    assertEquals "count for hash pw '${hash}' of '${count}' was wrong" "${correct_count}" "${count}"
+}
+
+testSearchPagedRejectsIndexes() {
+    for index in --split --toc --pla --hot-index-mb=1; do
+	$builddir/hibp-search --paged ${index} --hash $tmpdir/hibp_test.sha1.bin 00001131628B741FF755AAC0E7C66D26A7C72082 >/dev/null 2>&1
+	assertFalse "--paged ${index} was accepted" $?
+    done
+}
+
+# search with --split
+
+testSearchHashSha1Split() {
+    hash="00001131628B741FF755AAC0E7C66D26A7C72082"
+    correct_count="1002"
+    count=$($builddir/hibp-search --split --hash $tmpdir/hibp_test.sha1.bin "${hash}" | grep '^found' | cut -d: -f2)
+    assertEquals "count for hash pw '${hash}' of '${count}' was wrong" "${correct_count}" "${count}"
+}
+
+testSearchHashSha1t64SplitToc() {
+    hash="00001131628B741F"
+    correct_count="1002"
+    count=$($builddir/hibp-search --split --toc --toc-bits=18 --sha1t64 --hash $tmpdir/hibp_test.sha1t64.bin "${hash}" | grep '^found' | cut -d: -f2)
+    assertEquals "count for hash pw '${hash}' of '${count}' was wrong" "${correct_count}" "${count}"
+}
+
+# packed db, downloaded and searched
+
+testLocalDownloadPackedSha1t64() {
+    $builddir/hibp-download --testing $tmpdir/hibp_test.sha1t64.pak --sha1t64 --packed --limit 256 --no-progress >${stdoutF} 2>${stderrF}
+    rtrn=$?
+    th_assertTrueWithNoOutput ${rtrn} "${stdoutF}" "${stderrF}"
+}
+
+testSearchHashSha1t64Packed() {
+    hash="00001131628B741F"
+    correct_count="1002"
+    count=$($builddir/hibp-search --sha1t64 --hash $tmpdir/hibp_test.sha1t64.pak "${hash}" | grep '^found' | cut -d: -f2)
+    assertEquals "count for hash pw '${hash}' of '${count}' was wrong" "${correct_count}" "${count}"
+
+    hash="00001131628B741E"
+    count=$($builddir/hibp-search --sha1t64 --hash $tmpdir/hibp_test.sha1t64.pak "${hash}" | grep -c '^not found')
+    assertEquals "hash pw '${hash}' should not be found" "1" "${count}"
+}
+
 # ensure toc accuracy
 testTocCmpSha1() {
     cmp $datadir/hibp_test.sha1.bin.18.toc $tmpdir/hibp_test.sha1.bin.18.toc >${stdoutF} 2>${stderrF}
@@ -350,6 +563,296 @@ testServerSha1t64() {
     assertEquals "count for sha1t64 pw '${sha1t64}' of '${count}' was wrong" "${correct_count}" "${count}"
 }
 
+testServerHotDb() {
+    $builddir/hibp-server --sha1-db=$datadir/hibp_test.sha1.bin \
+			  --hot-sha1-db=$tmpdir/hibp_topn.sha1.bin --port=8083 1>/dev/null &
+    hot_server_pid=$!
+
+    sha1="00001131628B741FF755AAC0E7C66D26A7C72082" # in topn
+    correct_count="1002"
+    count=$(curl -s --retry 20 --retry-connrefused --retry-delay 1 http://localhost:8083/check/sha1/${sha1})
+    assertEquals "count for hot sha1 pw '${sha1}' of '${count}' was wrong" "${correct_count}" "${count}"
+
+    sha1="00000008C4037D3E893F8E1FA7BAD32B9F60948C" # not in topn, but in the db
+    correct_count="3"
+    count=$(curl -s http://localhost:8083/check/sha1/${sha1})
+    assertEquals "count for cold sha1 pw '${sha1}' of '${count}' was wrong" "${correct_count}" "${count}"
+
+    correct_stats="sha1 hits=1 misses=1"
+    stats=$(curl -s http://localhost:8083/stats/hot)
+    assertEquals "hot db stats of '${stats}' were wrong" "${correct_stats}" "${stats}"
+
+    kill $hot_server_pid
+}
+
+testServerPrefilter() {
+    $builddir/hibp-download --testing --binfuse16-out $tmpdir/hibp_prefilter.binfuse16.bin --limit 256 --no-progress >/dev/null 2>&1
+    $builddir/hibp-server --sha1-db=$datadir/hibp_test.sha1.bin \
+			  --prefilter=$tmpdir/hibp_prefilter.binfuse16.bin --port=8084 1>/dev/null &
+    prefilter_server_pid=$!
+
+    sha1="00001131628B741FF755AAC0E7C66D26A7C72082" # positive => exact count from db
+    correct_count="1002"
+    count=$(curl -s --retry 20 --retry-connrefused --retry-delay 1 http://localhost:8084/check/sha1/${sha1})
+    assertEquals "count for sha1 pw '${sha1}' of '${count}' was wrong" "${correct_count}" "${count}"
+
+    # negative, and no record starts with its first 64 bits, which the prefilter keys on
+    reads_before=$(curl -s http://localhost:8084/metrics | grep '^hibp_db_reads_total{format="sha1"}')
+    sha1="00001131628B7420F755AAC0E7C66D26A7C72082"
+    correct_count="-1"
+    count=$(curl -s http://localhost:8084/check/sha1/${sha1})
+    assertEquals "count for sha1 pw '${sha1}' of '${count}' was wrong" "${correct_count}" "${count}"
+
+    metrics=$(curl -s http://localhost:8084/metrics)
+    assertContains "the prefilter did not reject '${sha1}'" "${metrics}" 'hibp_prefilter_rejects_total{format="sha1"} 1'
+    assertContains "the db was read for '${sha1}'" "${metrics}" "${reads_before}"
+
+    kill $prefilter_server_pid
+}
+
+testServerPrefilterBuilt() {
+    $builddir/hibp-build-filter --binfuse16 --threads=4 -i $datadir/hibp_test.sha1.bin \
+			       -o $tmpdir/hibp_built.binfuse16.bin >/dev/null 2>&1
+    $builddir/hibp-server --sha1-db=$datadir/hibp_test.sha1.bin \
+			  --prefilter=$tmpdir/hibp_built.binfuse16.bin --port=8088 1>/dev/null &
+    built_server_pid=$!
+
+    sha1="00001131628B741FF755AAC0E7C66D26A7C72082" # positive => exact count from db
+    correct_count="1002"
+    count=$(curl -s --retry 20 --retry-connrefused --retry-delay 1 http://localhost:8088/check/sha1/${sha1})
+    assertEquals "count for sha1 pw '${sha1}' of '${count}' was wrong" "${correct_count}" "${count}"
+
+    # negative, and no record starts with its first 64 bits, which the prefilter keys on
+    reads_before=$(curl -s http://localhost:8088/metrics | grep '^hibp_db_reads_total{format="sha1"}')
+    sha1="00001131628B7420F755AAC0E7C66D26A7C72082"
+    correct_count="-1"
+    count=$(curl -s http://localhost:8088/check/sha1/${sha1})
+    assertEquals "count for sha1 pw '${sha1}' of '${count}' was wrong" "${correct_count}" "${count}"
+
+    metrics=$(curl -s http://localhost:8088/metrics)
+    assertContains "the prefilter did not reject '${sha1}'" "${metrics}" 'hibp_prefilter_rejects_total{format="sha1"} 1'
+    assertContains "the db was read for '${sha1}'" "${metrics}" "${reads_before}"
+
+    kill $built_server_pid
+}
+
+testServerMphf() {
+    $builddir/hibp-build-mphf --threads=4 -i $datadir/hibp_test.sha1.bin \
+			     -o $tmpdir/hibp_test.sha1.mphf >/dev/null 2>&1
+    $builddir/hibp-server --mphf-db=$tmpdir/hibp_test.sha1.mphf --port=8091 1>/dev/null &
+    mphf_server_pid=$!
+
+    sha1="00001131628B741FF755AAC0E7C66D26A7C72082"
+    correct_count="1002"
+    count=$(curl -s --retry 20 --retry-connrefused --retry-delay 1 http://localhost:8091/check/mphf/${sha1})
+    assertEquals "count for sha1 pw '${sha1}' of '${count}' was wrong" "${correct_count}" "${count}"
+
+    sha1="00001131628B741FF755AAC0E7C66D26A7C72083" # negative
+    correct_count="-1"
+    count=$(curl -s http://localhost:8091/check/mphf/${sha1})
+    assertEquals "count for sha1 pw '${sha1}' of '${count}' was wrong" "${correct_count}" "${count}"
+
+    plain="truelove15" # plain passwords use the mphf db, when there is no other db
+    correct_count="1002"
+    count=$(curl -s http://localhost:8091/check/plain/${plain})
+    assertEquals "count for plain pw '${plain}' of '${count}' was wrong" "${correct_count}" "${count}"
+
+    kill $mphf_server_pid
+}
+
+testServerPaged() {
+    cp $datadir/hibp_test.sha1.bin $tmpdir/hibp_paged.sha1.bin # the pages are built alongside
+    $builddir/hibp-server --sha1-db=$tmpdir/hibp_paged.sha1.bin --paged --port=8092 1>/dev/null &
+    paged_server_pid=$!
+
+    sha1="00001131628B741FF755AAC0E7C66D26A7C72082"
+    correct_count="1002"
+    count=$(curl -s --retry 20 --retry-connrefused --retry-delay 1 http://localhost:8092/check/sha1/${sha1})
+    assertEquals "count for sha1 pw '${sha1}' of '${count}' was wrong" "${correct_count}" "${count}"
+
+    sha1="00001131628B741FF755AAC0E7C66D26A7C72083" # negative
+    correct_count="-1"
+    count=$(curl -s http://localhost:8092/check/sha1/${sha1})
+    assertEquals "count for sha1 pw '${sha1}' of '${count}' was wrong" "${correct_count}" "${count}"
+
+    kill $paged_server_pid
+}
+
+testServerBinary() {
+    $builddir/hibp-server --sha1-db=$datadir/hibp_test.sha1.bin \
+			  --ntlm-db=$datadir/hibp_test.ntlm.bin \
+			  --port=8093 --binary-socket=$tmpdir/hibp.sock --binary-port=8094 1>/dev/null &
+    binary_server_pid=$!
+    curl -s --retry 20 --retry-connrefused --retry-delay 1 http://localhost:8093/check/sha1/00001131628B741FF755AAC0E7C66D26A7C72082 >/dev/null
+
+    results=$($builddir/hibp-loadgen --sha1-db=$datadir/hibp_test.sha1.bin \
+				     --ntlm-db=$datadir/hibp_test.ntlm.bin \
+				     --format sha1 --format ntlm --binary-socket=$tmpdir/hibp.sock \
+				     --hit-ratio=1 -c4 --pipeline=8 -d1 --json 2>/dev/null)
+    assertContains "binary socket got errors" "${results}" '"errors":0,'
+    assertContains "binary socket did not find all the hits" "${results}" '"found_percent":100.00'
+    assertNotContains "binary socket got no responses" "${results}" '"responses":0,'
+
+    results=$($builddir/hibp-loadgen --sha1-db=$datadir/hibp_test.sha1.bin \
+				     --format sha1 --binary --port=8094 \
+				     --hit-ratio=0 -c2 -d1 --json 2>/dev/null)
+    assertContains "binary port got errors" "${results}" '"errors":0,'
+    assertContains "binary port found misses" "${results}" '"found_percent":0.00'
+    assertNotContains "binary port got no responses" "${results}" '"responses":0,'
+
+    kill $binary_server_pid
+}
+
+testServerUring() {
+    $builddir/hibp-server --sha1-db=$datadir/hibp_test.sha1.bin --uring --threads=2 \
+			  --port=8085 1>/dev/null 2>${stderrF} &
+    uring_server_pid=$!
+
+    sha1="00001131628B741FF755AAC0E7C66D26A7C72082"
+    correct_count="1002"
+    count=$(curl -s --retry 20 --retry-connrefused --retry-delay 1 http://localhost:8085/check/sha1/${sha1})
+    if grep -q "io_uring" ${stderrF}; then
+	startSkipping # io_uring is unavailable or disabled here
+    fi
+    assertEquals "count for sha1 pw '${sha1}' of '${count}' was wrong" "${correct_count}" "${count}"
+
+    sha1="00001131628B741FF755AAC0E7C66D26A7C72083"
+    correct_count="-1"
+    count=$(curl -s http://localhost:8085/check/sha1/${sha1})
+    assertEquals "count for sha1 pw '${sha1}' of '${count}' was wrong" "${correct_count}" "${count}"
+
+    kill $uring_server_pid 2>/dev/null
+    endSkipping
+}
+
+testServerReusePort() {
+    $builddir/hibp-server --sha1-db=$datadir/hibp_test.sha1.bin --reuse-port --threads=2 \
+			  --port=8089 1>/dev/null &
+    reuse_port_server_pid=$!
+
+    sha1="00001131628B741FF755AAC0E7C66D26A7C72082"
+    correct_count="1002"
+    for i in 1 2 3 4; do # several connections, so likely to reach both servers
+	count=$(curl -s --retry 20 --retry-connrefused --retry-delay 1 http://localhost:8089/check/sha1/${sha1})
+	assertEquals "count for sha1 pw '${sha1}' of '${count}' was wrong" "${correct_count}" "${count}"
+    done
+
+    kill $reuse_port_server_pid
+}
+
+testServerWarmup() {
+    $builddir/hibp-server --sha1-db=$datadir/hibp_test.sha1.bin --mmap --warmup --threads=2 \
+			  --port=8086 1>${stdoutF} 2>${stderrF} &
+    warmup_server_pid=$!
+
+    sha1="00001131628B741FF755AAC0E7C66D26A7C72082"
+    correct_count="1002"
+    count=$(curl -s --retry 20 --retry-connrefused --retry-delay 1 http://localhost:8086/check/sha1/${sha1})
+    assertEquals "count for sha1 pw '${sha1}' of '${count}' was wrong" "${correct_count}" "${count}"
+    assertContains "warm-up was not reported" "$(cat ${stdoutF})" "warm-up done"
+
+    kill $warmup_server_pid 2>/dev/null
+}
+
+testServerReload() {
+    cp $datadir/hibp_test.sha1.bin $tmpdir/hibp_reload.sha1.bin
+    $builddir/hibp-server --sha1-db=$tmpdir/hibp_reload.sha1.bin --admin-reload \
+			  --port=8087 1>${stdoutF} 2>${stderrF} &
+    reload_server_pid=$!
+
+    sha1="000FFFFFD56B07568C4D263BC67901F95171539A" # the last in the db
+    correct_count="2"
+    count=$(curl -s --retry 20 --retry-connrefused --retry-delay 1 http://localhost:8087/check/sha1/${sha1})
+    assertEquals "count for sha1 pw '${sha1}' of '${count}' was wrong" "${correct_count}" "${count}"
+
+    # replace the db with its first 40000 records, by renaming over it
+    head -c 960000 $datadir/hibp_test.sha1.bin > $tmpdir/hibp_reload.sha1.bin.new
+    mv $tmpdir/hibp_reload.sha1.bin.new $tmpdir/hibp_reload.sha1.bin
+    response=$(curl -s -X POST http://localhost:8087/admin/reload)
+    assertEquals "response for reload of '${response}' was wrong" "generation 2" "${response}"
+
+    correct_count="-1"
+    count=$(curl -s http://localhost:8087/check/sha1/${sha1})
+    assertEquals "count for sha1 pw '${sha1}' of '${count}' was wrong" "${correct_count}" "${count}"
+
+    sha1="000000005AD76BD555C1D6D771DE417A4B87E4B4" # still in the db
+    correct_count="10"
+    count=$(curl -s http://localhost:8087/check/sha1/${sha1})
+    assertEquals "count for sha1 pw '${sha1}' of '${count}' was wrong" "${correct_count}" "${count}"
+
+    cp $datadir/hibp_test.sha1.bin $tmpdir/hibp_reload.sha1.bin.new
+    mv $tmpdir/hibp_reload.sha1.bin.new $tmpdir/hibp_reload.sha1.bin
+    kill -HUP $reload_server_pid
+    sha1="000FFFFFD56B07568C4D263BC67901F95171539A"
+    correct_count="2"
+    for i in {1..20}; do
+	count=$(curl -s http://localhost:8087/check/sha1/${sha1})
+	[[ "${count}" == "${correct_count}" ]] && break
+	sleep 0.5
+    done
+    assertEquals "count for sha1 pw '${sha1}' of '${count}' was wrong" "${correct_count}" "${count}"
+
+    kill $reload_server_pid 2>/dev/null
+}
+
+testServerBatchSha1() {
+    batch="00001131628B741FF755AAC0E7C66D26A7C72083
+00001131628B741FF755AAC0E7C66D26A7C72082
+
+00001131628B741FF755AAC0E7C66D26A7C72082"
+    correct_counts="-1
+1002
+1002"
+    counts=$(curl -s --data-binary "${batch}" http://localhost:8082/check/sha1)
+    assertEquals "counts for sha1 batch of '${counts}' were wrong" "${correct_counts}" "${counts}"
+
+    batch="00001131628B741FF755AAC0E7C66D26A7C72082
+00001131628B741FF755AAC0E7C66D26A7C7208G"
+    correct_counts="Invalid hash provided in entry 2. Check type of hash."
+    counts=$(curl -s --data-binary "${batch}" http://localhost:8082/check/sha1)
+    assertEquals "counts for sha1 batch of '${counts}' were wrong" "${correct_counts}" "${counts}"
+}
+
+testServerBatchPlain() {
+    batch="password123
+truelove15"
+    correct_counts="-1
+1002"
+    counts=$(curl -s --data-binary "${batch}" http://localhost:8082/check/plain)
+    assertEquals "counts for plain batch of '${counts}' were wrong" "${correct_counts}" "${counts}"
+}
+
+testServerRange() {
+    range=$(curl -s http://localhost:8082/range/00001)
+    assertEquals "sha1 range for prefix 00001 was wrong" "$(cat $datadir/sha1/00001)" "${range}"
+
+    range=$(curl -s "http://localhost:8082/range/00001?mode=ntlm")
+    assertEquals "ntlm range for prefix 00001 was wrong" "$(cat $datadir/ntlm/00001)" "${range}"
+
+    correct_response="The hash prefix was not in a valid format"
+    response=$(curl -s http://localhost:8082/range/0000G)
+    assertEquals "response for invalid prefix of '${response}' was wrong" "${correct_response}" "${response}"
+}
+
+testServerMetrics() {
+    curl -s http://localhost:8082/check/sha1/00001131628B741FF755AAC0E7C66D26A7C72082 >/dev/null
+    curl -s http://localhost:8082/check/sha1/00001131628B741FF755AAC0E7C66D26A7C72083 >/dev/null
+    metrics=$(curl -s http://localhost:8082/metrics)
+    assertContains "no sha1 requests in /metrics" "${metrics}" 'hibp_requests_total{format="sha1"}'
+    assertContains "no found sha1 lookups in /metrics" "${metrics}" 'hibp_lookups_total{format="sha1",result="found"}'
+    assertContains "no latency histogram in /metrics" "${metrics}" 'hibp_request_duration_seconds_bucket{format="sha1",le="+Inf"}'
+    assertNotContains "sha1 requests were not counted" "${metrics}" 'hibp_requests_total{format="sha1"} 0'
+}
+
+testLoadgen() {
+    results=$($builddir/hibp-loadgen --sha1-db=$datadir/hibp_test.sha1.bin \
+				     --ntlm-db=$datadir/hibp_test.ntlm.bin \
+				     --format sha1:2 --format ntlm --format sha1t64 \
+				     --hit-ratio=1 -c4 --pipeline=2 -d1 --json 2>/dev/null)
+    assertContains "hibp-loadgen got errors" "${results}" '"errors":0,'
+    assertContains "hibp-loadgen did not find all the hits" "${results}" '"found_percent":100.00'
+    assertNotContains "hibp-loadgen got no responses" "${results}" '"responses":0,'
+}
 
 . $projdir/ext/shunit2/shunit2
 
@@ -1,7 +1,12 @@
 #include "arrcmp.hpp"
+#include "hex.hpp"
 #include "gtest/gtest.h"
+#include <algorithm>
 #include <array>
+#include <cctype>
 #include <cstddef>
+#include <cstring>
+#include <random>
 #include <string>
 #include <utility>
 #include <vector>
@@ -65,3 +70,88 @@ void test_set() {
 TEST(arrcmp, arrays) {                         // NOLINT
   test_set<1, 2 * arrcmp::impl::maxvec - 1>(); // TODO auto detect the largest MM register
 }
+
+// records of `Stride` bytes with a `KeyBytes` key, many of which share their leading 8 bytes
+template <std::size_t KeyBytes, std::size_t Stride>
+void test_block_lower_bound(arrcmp::isa kernel) {
+  using key_type = std::array<std::byte, KeyBytes>;
+
+  std::mt19937_64                         generator{42}; // NOLINT magic
+  std::uniform_int_distribution<unsigned> byte_dist(0, 3);
+
+  for (std::size_t count: {0UL, 1UL, 3UL, 7UL, 8UL, 31UL, 32UL, 33UL, 100UL, 1000UL}) {
+    std::vector<key_type> keys(count);
+    for (auto& key: keys) {
+      for (auto& b: key) b = std::byte(byte_dist(generator)); // small alphabet => many ties
+    }
+    std::sort(keys.begin(), keys.end());
+
+    std::vector<std::byte> records(count * Stride, std::byte{0xAA}); // NOLINT magic
+    for (std::size_t i = 0; i != count; ++i) {
+      std::memcpy(&records[i * Stride], keys[i].data(), KeyBytes);
+    }
+
+    for (std::size_t i = 0; i != 200; ++i) {
+      key_type needle;
+      for (auto& b: needle) b = std::byte(byte_dist(generator));
+      if (count != 0 && i % 2 == 0) needle = keys[i % count]; // present
+      const auto expected = static_cast<std::size_t>(
+          std::lower_bound(keys.begin(), keys.end(), needle) - keys.begin());
+      SCOPED_TRACE("KeyBytes=" + std::to_string(KeyBytes) + ", count=" + std::to_string(count) +
+                   ", kernel=" + std::to_string(static_cast<int>(kernel)));
+      EXPECT_EQ((arrcmp::block_lower_bound<KeyBytes, Stride>(records.data(), count, needle.data(),
+                                                             kernel)),
+                expected);
+    }
+  }
+}
+
+TEST(arrcmp, block_lower_bound) { // NOLINT
+  for (auto kernel: {arrcmp::isa::scalar, arrcmp::isa::avx2, arrcmp::isa::avx512}) {
+    if (kernel > arrcmp::best_isa()) continue; // not supported by this cpu
+    test_block_lower_bound<20, 24>(kernel); // sha1
+    test_block_lower_bound<16, 20>(kernel); // ntlm
+    test_block_lower_bound<8, 12>(kernel);  // sha1t64
+  }
+}
+
+template <std::size_t N>
+void test_hex() {
+  std::mt19937_64                         generator{std::random_device{}()};
+  std::uniform_int_distribution<unsigned> distribution(0, 255);
+
+  for (int rep = 0; rep != 1000; ++rep) {
+    std::array<std::byte, N> bytes{};
+    for (auto& b: bytes) b = static_cast<std::byte>(distribution(generator));
+
+    std::array<char, 2 * N> expected{};
+    hibp::hex::impl::encode_scalar(bytes.data(), expected.data(), N);
+
+    for (auto kernel: {hibp::hex::isa::scalar, hibp::hex::isa::ssse3, hibp::hex::isa::avx2}) {
+      if (kernel > hibp::hex::best_isa()) continue;
+
+      std::array<char, 2 * N> chars{};
+      hibp::hex::encode<N>(bytes.data(), chars.data(), kernel);
+      EXPECT_EQ(chars, expected);
+
+      std::array<std::byte, N> decoded{};
+      hibp::hex::decode<N>(chars.data(), decoded.data(), kernel);
+      EXPECT_EQ(decoded, bytes);
+
+      std::string lower(chars.begin(), chars.end());
+      std::transform(lower.begin(), lower.end(), lower.begin(),
+                     [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+      hibp::hex::decode<N>(lower.data(), decoded.data(), kernel);
+      EXPECT_EQ(decoded, bytes);
+    }
+  }
+}
+
+TEST(hex, round_trip) { // NOLINT
+  test_hex<5>();
+  test_hex<8>();
+  test_hex<13>();
+  test_hex<16>();
+  test_hex<17>();
+  test_hex<20>();
+}
@@ -0,0 +1,170 @@
+#include "srv/binary.hpp"
+#include "gtest/gtest.h"
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <netinet/in.h>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <vector>
+
+namespace binary = hibp::srv::binary;
+
+// counts = format * 1000 + the first byte of each digest, or throws for format 99
+void echo(const binary::frame_header& header, std::span<const std::byte> digests,
+          std::span<std::int32_t> counts) {
+  if (header.format == 99) throw std::runtime_error("no db for format 99");
+  for (std::size_t i = 0; i != counts.size(); ++i) {
+    counts[i] = header.format * 1000 + std::to_integer<int>(digests[i * header.digest_size]);
+  }
+}
+
+class BinaryTest : public testing::Test {
+protected:
+  std::filesystem::path testtmpdir{
+      std::filesystem::canonical(std::filesystem::current_path() / "tmp")};
+  std::string socket_path{(testtmpdir / "binary.sock").string()};
+
+  [[nodiscard]] int connect_unix() const {
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    std::memcpy(addr.sun_path, socket_path.c_str(), socket_path.size() + 1);
+    const int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    EXPECT_EQ(::connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)), 0); // NOLINT
+    return fd;
+  }
+
+  static int connect_tcp(std::uint16_t port) {
+    sockaddr_in addr{};
+    addr.sin_family      = AF_INET;
+    addr.sin_port        = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    const int fd         = ::socket(AF_INET, SOCK_STREAM, 0);
+    EXPECT_EQ(::connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)), 0); // NOLINT
+    return fd;
+  }
+
+  // a frame of `count` digests, the ith starting with byte i
+  static std::vector<std::byte> frame(std::uint8_t format, std::uint8_t digest_size,
+                                      std::uint32_t count) {
+    std::vector<std::byte> bytes(binary::header_size + std::size_t{count} * digest_size);
+    bytes[0] = static_cast<std::byte>(format);
+    bytes[1] = static_cast<std::byte>(digest_size);
+    for (unsigned i = 0; i != 4; ++i) bytes[4 + i] = static_cast<std::byte>(count >> (8 * i));
+    for (std::uint32_t i = 0; i != count; ++i) {
+      bytes[binary::header_size + std::size_t{i} * digest_size] = static_cast<std::byte>(i);
+    }
+    return bytes;
+  }
+
+  static void send_all(int fd, const std::vector<std::byte>& bytes) {
+    EXPECT_EQ(::send(fd, bytes.data(), bytes.size(), 0), static_cast<ssize_t>(bytes.size()));
+  }
+
+  // the next `n` counts, or fewer if the connection was closed
+  static std::vector<std::int32_t> recv_counts(int fd, std::size_t n) {
+    std::vector<std::byte> bytes(n * 4);
+    std::size_t            got = 0;
+    while (got != bytes.size()) {
+      const auto r = ::recv(fd, bytes.data() + got, bytes.size() - got, 0);
+      if (r <= 0) break;
+      got += static_cast<std::size_t>(r);
+    }
+    std::vector<std::int32_t> counts(got / 4);
+    for (std::size_t i = 0; i != counts.size(); ++i) {
+      std::uint32_t value = 0;
+      for (unsigned b = 0; b != 4; ++b) {
+        value |= std::to_integer<std::uint32_t>(bytes[i * 4 + b]) << (8 * b);
+      }
+      counts[i] = static_cast<std::int32_t>(value);
+    }
+    return counts;
+  }
+};
+
+TEST_F(BinaryTest, unix_socket_pipelined) {
+  const binary::listener listener(socket_path, 100, echo);
+  const int              fd = connect_unix();
+
+  // three frames in one write, so they are served together
+  auto bytes = frame(1, 20, 1);
+  for (const auto& more: {frame(2, 16, 3), frame(3, 8, 2)}) {
+    bytes.insert(bytes.end(), more.begin(), more.end());
+  }
+  send_all(fd, bytes);
+  EXPECT_EQ(recv_counts(fd, 6), (std::vector<std::int32_t>{1000, 2000, 2001, 2002, 3000, 3001}));
+
+  // and one frame, in two parts
+  bytes = frame(3, 8, 2);
+  send_all(fd, {bytes.begin(), bytes.begin() + 5});
+  send_all(fd, {bytes.begin() + 5, bytes.end()});
+  EXPECT_EQ(recv_counts(fd, 2), (std::vector<std::int32_t>{3000, 3001}));
+  ::close(fd);
+}
+
+TEST_F(BinaryTest, tcp_port) {
+  const binary::listener listener("127.0.0.1", 8095, 100, echo);
+  const int              fd = connect_tcp(8095);
+  send_all(fd, frame(5, 8, 2));
+  EXPECT_EQ(recv_counts(fd, 2), (std::vector<std::int32_t>{5000, 5001}));
+  ::close(fd);
+}
+
+TEST_F(BinaryTest, frames_larger_than_the_buffer) {
+  const binary::listener listener(socket_path, 10'000, echo);
+  const int              fd = connect_unix();
+  send_all(fd, frame(1, 20, 10'000)); // 200kB
+  const auto counts = recv_counts(fd, 10'000);
+  ASSERT_EQ(counts.size(), 10'000);
+  EXPECT_EQ(counts[255], 1255);
+  EXPECT_EQ(counts[256], 1000); // the first byte wraps
+  ::close(fd);
+}
+
+TEST_F(BinaryTest, errors_close_the_connection) {
+  const binary::listener listener(socket_path, 100, echo);
+
+  int fd = connect_unix();
+  send_all(fd, frame(99, 8, 1)); // the handler throws
+  EXPECT_TRUE(recv_counts(fd, 1).empty());
+  ::close(fd);
+
+  fd = connect_unix();
+  send_all(fd, frame(1, 20, 101)); // > max_batch
+  EXPECT_TRUE(recv_counts(fd, 1).empty());
+  ::close(fd);
+
+  // and the listener still serves other connections
+  fd = connect_unix();
+  send_all(fd, frame(1, 20, 1));
+  EXPECT_EQ(recv_counts(fd, 1), (std::vector<std::int32_t>{1000}));
+  ::close(fd);
+}
+
+TEST_F(BinaryTest, stale_socket_is_replaced) {
+  std::filesystem::remove(socket_path);
+  {
+    // a socket file which nothing listens on, as left by a server which was killed
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    std::memcpy(addr.sun_path, socket_path.c_str(), socket_path.size() + 1);
+    const int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    ASSERT_EQ(::bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)), 0); // NOLINT
+    ::close(fd);
+  }
+  ASSERT_TRUE(std::filesystem::exists(socket_path));
+  {
+    const binary::listener listener(socket_path, 100, echo);
+    EXPECT_THROW(binary::listener(socket_path, 100, echo), std::runtime_error); // in use
+    const int fd = connect_unix();
+    send_all(fd, frame(4, 16, 1));
+    EXPECT_EQ(recv_counts(fd, 1), (std::vector<std::int32_t>{4000}));
+    ::close(fd);
+  }
+  EXPECT_FALSE(std::filesystem::exists(socket_path)); // removed by the listener
+}
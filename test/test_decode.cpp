@@ -0,0 +1,152 @@
+#include "dnl/decode.hpp"
+#include "gtest/gtest.h"
+#include <cstddef>
+#include <cstdint>
+#include <fmt/format.h>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <zlib.h>
+#ifdef HIBP_USE_BROTLI
+#include <brotli/encode.h>
+#endif
+
+using hibp::dnl::decode;
+
+// like a range file from the api, which is what gets downloaded
+std::vector<char> range_text() {
+  std::string text;
+  for (unsigned i = 0; i != 2000; ++i) {
+    text += fmt::format("{:035X}:{}\r\n", std::uint64_t{i} * 0x9E3779B97F4A7C15U, i % 97 + 1);
+  }
+  return {text.begin(), text.end()};
+}
+
+// `window_bits` as for deflateInit2: 15 + 16 for gzip, 15 for zlib, -15 for raw deflate. By value,
+// as zlib's next_in is not const.
+std::vector<char> deflated(std::vector<char> plain, int window_bits) {
+  z_stream zs{};
+  EXPECT_EQ(deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, window_bits, 8,
+                         Z_DEFAULT_STRATEGY),
+            Z_OK);
+  std::vector<char> out(deflateBound(&zs, static_cast<uLong>(plain.size())) + 32);
+  zs.next_in   = reinterpret_cast<Bytef*>(plain.data()); // NOLINT reinterpret_cast
+  zs.avail_in  = static_cast<uInt>(plain.size());
+  zs.next_out  = reinterpret_cast<Bytef*>(out.data()); // NOLINT reinterpret_cast
+  zs.avail_out = static_cast<uInt>(out.size());
+  EXPECT_EQ(deflate(&zs, Z_FINISH), Z_STREAM_END);
+  out.resize(zs.total_out);
+  deflateEnd(&zs);
+  return out;
+}
+
+TEST(decode, identity) { // NOLINT
+  const auto plain  = range_text();
+  auto       buffer = plain;
+  decode("", buffer);
+  EXPECT_EQ(buffer, plain);
+  decode("identity", buffer);
+  EXPECT_EQ(buffer, plain);
+}
+
+TEST(decode, gzip_round_trip) { // NOLINT
+  const auto plain  = range_text();
+  auto       buffer = deflated(plain, 15 + 16);
+  EXPECT_LT(buffer.size(), plain.size());
+  decode("gzip", buffer);
+  EXPECT_EQ(buffer, plain);
+}
+
+TEST(decode, encoding_is_case_insensitive) { // NOLINT
+  const auto plain  = range_text();
+  auto       buffer = deflated(plain, 15 + 16);
+  decode("GZip", buffer);
+  EXPECT_EQ(buffer, plain);
+
+  buffer = deflated(plain, 15 + 16);
+  decode("X-GZIP", buffer);
+  EXPECT_EQ(buffer, plain);
+}
+
+TEST(decode, deflate_zlib_wrapped_and_raw) { // NOLINT
+  const auto plain  = range_text();
+  auto       buffer = deflated(plain, 15);
+  decode("deflate", buffer);
+  EXPECT_EQ(buffer, plain);
+
+  buffer = deflated(plain, -15);
+  decode("Deflate", buffer);
+  EXPECT_EQ(buffer, plain);
+}
+
+TEST(decode, gzip_truncated_throws) { // NOLINT
+  auto buffer = deflated(range_text(), 15 + 16);
+  buffer.resize(buffer.size() / 2);
+  EXPECT_THROW(decode("gzip", buffer), std::runtime_error);
+
+  buffer = deflated(range_text(), 15 + 16);
+  buffer.resize(buffer.size() - 4); // just the length in the trailer
+  EXPECT_THROW(decode("gzip", buffer), std::runtime_error);
+}
+
+TEST(decode, gzip_corrupt_throws) { // NOLINT
+  auto buffer = deflated(range_text(), 15 + 16);
+  for (std::size_t i = 20; i < buffer.size(); i += 7) buffer[i] = static_cast<char>(~buffer[i]);
+  EXPECT_THROW(decode("gzip", buffer), std::runtime_error);
+
+  std::vector<char> not_gzip = range_text(); // eg an identity body, labelled as gzip
+  EXPECT_THROW(decode("gzip", not_gzip), std::runtime_error);
+}
+
+TEST(decode, unsupported_encoding_throws) { // NOLINT
+  auto buffer = range_text();
+  EXPECT_THROW(decode("compress", buffer), std::runtime_error);
+  EXPECT_THROW(decode("zstd", buffer), std::runtime_error);
+  EXPECT_THROW(decode("gzip, br", buffer), std::runtime_error); // only one coding is sent
+  EXPECT_EQ(buffer, range_text());                               // and it is untouched
+}
+
+#ifdef HIBP_USE_BROTLI
+
+std::vector<char> brotlied(const std::vector<char>& plain) {
+  std::vector<char> out(BrotliEncoderMaxCompressedSize(plain.size()));
+  std::size_t       size = out.size();
+  EXPECT_EQ(BrotliEncoderCompress(BROTLI_DEFAULT_QUALITY, BROTLI_DEFAULT_WINDOW, BROTLI_MODE_TEXT,
+                                  plain.size(),
+                                  reinterpret_cast<const std::uint8_t*>(plain.data()), // NOLINT
+                                  &size, reinterpret_cast<std::uint8_t*>(out.data())), // NOLINT
+            BROTLI_TRUE);
+  out.resize(size);
+  return out;
+}
+
+TEST(decode, br_round_trip) { // NOLINT
+  const auto plain  = range_text();
+  auto       buffer = brotlied(plain);
+  EXPECT_LT(buffer.size(), plain.size());
+  decode("br", buffer);
+  EXPECT_EQ(buffer, plain);
+
+  buffer = brotlied(plain);
+  decode("BR", buffer);
+  EXPECT_EQ(buffer, plain);
+}
+
+TEST(decode, br_truncated_or_corrupt_throws) { // NOLINT
+  auto buffer = brotlied(range_text());
+  buffer.resize(buffer.size() / 2);
+  EXPECT_THROW(decode("br", buffer), std::runtime_error);
+
+  buffer = brotlied(range_text());
+  for (std::size_t i = 4; i < buffer.size(); i += 5) buffer[i] = static_cast<char>(~buffer[i]);
+  EXPECT_THROW(decode("br", buffer), std::runtime_error);
+}
+
+#else
+
+TEST(decode, br_unsupported_throws) { // NOLINT
+  auto buffer = range_text();
+  EXPECT_THROW(decode("br", buffer), std::runtime_error);
+}
+
+#endif
@@ -246,3 +246,96 @@ TEST_F(DiffTestSha1, diffCombo1) {
             "I:00000003:0000000000000000000000000000000000000050:50\n",
             diff.str());
 }
+
+TEST_F(DiffTestSha1, diffConsecutive) {
+  create_new({
+      "0000000000000000000000000000000000000010:10",
+      "0000000000000000000000000000000000000015:15",
+      "0000000000000000000000000000000000000016:16",
+      "0000000000000000000000000000000000000020:21",
+      "0000000000000000000000000000000000000030:30",
+  });
+
+  std::stringstream diff;
+  hibp::diffutils::run_diff<hibp::pawned_pw_sha1>(old_path, new_path, diff);
+
+  EXPECT_EQ("I:00000001:0000000000000000000000000000000000000015:15\n"
+            "I:00000001:0000000000000000000000000000000000000016:16\n"
+            "U:00000001:0000000000000000000000000000000000000020:21\n",
+            diff.str());
+}
+
+TEST_F(DiffTestSha1, diffChapters) {
+  {
+    std::ofstream                                  old_stream{old_path, std::ios_base::binary};
+    flat_file::stream_writer<hibp::pawned_pw_sha1> oldw{old_stream};
+    oldw.write(hibp::pawned_pw_sha1{"0000000000000000000000000000000000000010:10"});
+    oldw.write(hibp::pawned_pw_sha1{"8000000000000000000000000000000000000010:10"});
+    oldw.write(hibp::pawned_pw_sha1{"FF00000000000000000000000000000000000010:10"});
+  }
+  create_new({
+      "0000000000000000000000000000000000000010:11",
+      "7F00000000000000000000000000000000000010:5",
+      "8000000000000000000000000000000000000010:10",
+      "8000000000000000000000000000000000000020:20",
+      "FF00000000000000000000000000000000000010:12",
+      "FFFF000000000000000000000000000000000010:13",
+  });
+
+  std::stringstream diff;
+  hibp::diffutils::run_diff<hibp::pawned_pw_sha1>(old_path, new_path, diff, 4);
+
+  EXPECT_EQ("U:00000000:0000000000000000000000000000000000000010:11\n"
+            "I:00000001:7F00000000000000000000000000000000000010:5\n"
+            "I:00000002:8000000000000000000000000000000000000020:20\n"
+            "U:00000002:FF00000000000000000000000000000000000010:12\n"
+            "I:00000003:FFFF000000000000000000000000000000000010:13\n",
+            diff.str());
+}
+
+TEST_F(DiffTestSha1, patchCombo1) {
+  create_new({
+      "0000000000000000000000000000000000000005:5",
+      "0000000000000000000000000000000000000010:10",
+      "0000000000000000000000000000000000000020:25",
+      "0000000000000000000000000000000000000027:27",
+      "0000000000000000000000000000000000000030:30",
+      "0000000000000000000000000000000000000040:40",
+      "0000000000000000000000000000000000000050:50",
+  });
+
+  std::stringstream diff;
+  hibp::diffutils::run_diff<hibp::pawned_pw_sha1>(old_path, new_path, diff);
+
+  const auto patched_path = testtmpdir / "patched.sha1.bin";
+  {
+    std::ofstream patched{patched_path, std::ios_base::binary};
+    EXPECT_EQ(5, hibp::diffutils::run_patch<hibp::pawned_pw_sha1>(old_path, diff, patched));
+  }
+
+  std::ifstream      patched{patched_path, std::ios_base::binary};
+  std::ifstream      expected{new_path, std::ios_base::binary};
+  std::ostringstream patched_bytes;
+  std::ostringstream expected_bytes;
+  patched_bytes << patched.rdbuf();
+  expected_bytes << expected.rdbuf();
+  EXPECT_EQ(expected_bytes.str(), patched_bytes.str());
+}
+
+TEST_F(DiffTestSha1, patchBadHunks) {
+  for (const auto* bad: {
+           "X:00000000:0000000000000000000000000000000000000005:5\n",  // type
+           "I:0000000G:0000000000000000000000000000000000000005:5\n",  // pos
+           "I:00000004:0000000000000000000000000000000000000005:5\n",  // beyond OLD
+           "U:00000001:0000000000000000000000000000000000000030:31\n", // not OLD's hash
+           "I:00000001:0000000000000000000000000000000000000025:25\n", // out of order
+           "I:00000002:0000000000000000000000000000000000000025:25\n"
+           "I:00000001:0000000000000000000000000000000000000015:15\n",
+       }) {
+    std::stringstream diff{bad};
+    std::stringstream patched;
+    EXPECT_THROW(hibp::diffutils::run_patch<hibp::pawned_pw_sha1>(old_path, diff, patched),
+                 std::runtime_error)
+        << bad;
+  }
+}
@@ -0,0 +1,107 @@
+#include "digest.hpp"
+#include "hex.hpp"
+#include "gtest/gtest.h"
+#include <array>
+#include <cstddef>
+#include <random>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+using hibp::digest::isa;
+
+template <std::size_t N>
+std::string to_hex(const std::array<std::byte, N>& digest) {
+  std::string hex(N * 2, '\0');
+  hibp::hex::encode<N>(digest.data(), hex.data());
+  return hex;
+}
+
+// random passwords either side of the one block limits, with 2, 3 and 4 byte UTF-8 chars
+std::vector<std::string> random_passwords(std::size_t count) {
+  std::mt19937_64                       gen{42}; // NOLINT not crypto
+  std::uniform_int_distribution<int>    len(0, 130);
+  std::uniform_int_distribution<int>    ascii(' ', '~');
+  std::uniform_int_distribution<int>    kind(0, 19);
+  const std::array<std::string_view, 3> multi = {"\xc3\xa4", "\xe2\x82\xac", "\xf0\x9f\x98\x80"};
+
+  std::vector<std::string> pws;
+  for (std::size_t i = 0; i != count; ++i) {
+    std::string pw;
+    for (int j = len(gen); j > 0; --j) {
+      const int k = kind(gen);
+      if (k < 3) {
+        pw += multi[static_cast<std::size_t>(k)];
+      } else {
+        pw += static_cast<char>(ascii(gen));
+      }
+    }
+    pws.push_back(pw);
+  }
+  return pws;
+}
+
+TEST(digest, sha1) { // NOLINT
+  EXPECT_EQ(to_hex(hibp::digest::sha1("")), "DA39A3EE5E6B4B0D3255BFEF95601890AFD80709");
+  EXPECT_EQ(to_hex(hibp::digest::sha1("abc")), "A9993E364706816ABA3E25717850C26C9CD0D89D");
+  EXPECT_EQ(to_hex(hibp::digest::sha1("password")), "5BAA61E4C9B93F3F0682250B6CF8331B7EE68FD8");
+  // 56 bytes, so the length needs a second block
+  EXPECT_EQ(to_hex(hibp::digest::sha1("abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq")),
+            "84983E441C3BD26EBAAE4AA1F95129E5E54670F1");
+  EXPECT_EQ(to_hex(hibp::digest::sha1(std::string(1'000'000, 'a'))),
+            "34AA973CD4C4DAA4F61EEB2BDBAD27316534016F");
+  EXPECT_EQ(to_hex(hibp::digest::sha1("p\xc3\xa4ssw\xc3\xb6rd")),
+            "F517DDF1D32A112FF1AD55C66D1B12CB38E7E8F7");
+
+  // with and without SHA-NI
+  for (const auto& pw: random_passwords(500)) {
+    EXPECT_EQ(hibp::digest::sha1(pw), hibp::digest::sha1_scalar(pw)) << pw;
+  }
+}
+
+TEST(digest, ntlm) { // NOLINT
+  EXPECT_EQ(to_hex(hibp::digest::ntlm("")), "31D6CFE0D16AE931B73C59D7E0C089C0");
+  EXPECT_EQ(to_hex(hibp::digest::ntlm("password")), "8846F7EAEE8FB117AD06BDD830B7586C");
+  EXPECT_EQ(to_hex(hibp::digest::ntlm("p\xc3\xa4ssw\xc3\xb6rd")),
+            "0553152250AC01ADB4213CB9938663E4");
+  EXPECT_EQ(to_hex(hibp::digest::ntlm("\xe2\x82\xac")), "030926B781938DB4365D46ADC7CFBCB8");
+  EXPECT_EQ(to_hex(hibp::digest::ntlm("\xf0\x9f\x98\x80")), // a surrogate pair in UTF-16
+            "4B58A10CC20A4E7D808D218E1F80AABC");
+  // 54 and 56 bytes of UTF-16, either side of the one block limit
+  EXPECT_EQ(to_hex(hibp::digest::ntlm(std::string(27, 'x'))), "0AE2AC07BA42FB76E0D9E5852D00E83F");
+  EXPECT_EQ(to_hex(hibp::digest::ntlm(std::string(28, 'x'))), "E4E10A22597EFD64AD85EC18C948CBF2");
+}
+
+TEST(digest, invalid_utf8) { // NOLINT
+  // a bad lead byte, truncated, overlong, a surrogate, a bad continuation, and beyond U+10FFFF
+  for (const std::string_view invalid:
+       {"\xff", "abc\xc3", "\xc0\xaf", "\xed\xa0\x80", "\xe2\x28\xa1", "\xf4\x90\x80\x80"}) {
+    EXPECT_THROW(hibp::digest::ntlm(invalid), std::range_error);
+  }
+}
+
+TEST(digest, multi_buffer) { // NOLINT
+  const auto                          pws = random_passwords(1000);
+  const std::vector<std::string_view> texts(pws.begin(), pws.end());
+
+  for (const auto kernel: {isa::scalar, isa::avx2, isa::avx512}) {
+    if (kernel > hibp::digest::best_isa()) continue;
+    SCOPED_TRACE(static_cast<int>(kernel));
+
+    // also a partial set of lanes at the end
+    for (const std::size_t count: {std::size_t{0}, std::size_t{5}, texts.size()}) {
+      const std::span<const std::string_view> some(texts.data(), count);
+
+      std::vector<hibp::digest::sha1_t> sha1s(count);
+      hibp::digest::sha1(some, sha1s, kernel);
+      std::vector<hibp::digest::ntlm_t> ntlms(count);
+      hibp::digest::ntlm(some, ntlms, kernel);
+      for (std::size_t i = 0; i != count; ++i) {
+        EXPECT_EQ(sha1s[i], hibp::digest::sha1_scalar(some[i])) << some[i];
+        EXPECT_EQ(ntlms[i], hibp::digest::ntlm(some[i])) << some[i];
+      }
+    }
+  }
+}
@@ -1,14 +1,33 @@
 #include "flat_file.hpp"
 #include "hibp.hpp"
+#include "hot_table.hpp"
+#include "mphf.hpp"
+#include "packed.hpp"
+#include "paged.hpp"
+#include "split.hpp"
 #include "toc.hpp"
+#include "uring.hpp"
 #include "gtest/gtest.h"
+#include <algorithm>
+#include <array>
 #include <cstddef>
+#include <cstdint>
 #include <filesystem>
+#include <fmt/format.h>
+#include <fstream>
+#include <iterator>
+#include <latch>
+#include <optional>
 #include <random>
 #include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
 #include <type_traits>
+#include <utility>
+#include <vector>
 
-template <hibp::pw_type PwType>
+template <hibp::pw_type PwType, typename DbType = flat_file::database<PwType>>
 void run_search(bool toc, unsigned toc_bits = 0) { // NOLINT complexity
   auto testdatadir =
       std::filesystem::canonical(std::filesystem::current_path() / "data");
@@ -29,7 +48,17 @@ void run_search(bool toc, unsigned toc_bits = 0) { // NOLINT complexity
     hibp::toc_build<PwType>(db_path, toc_bits);
   }
 
-  flat_file::database<PwType> db(db_path, 4096 / sizeof(PwType));
+  auto db = [&] {
+    if constexpr (std::is_same_v<DbType, flat_file::database<PwType>>) {
+      return DbType(db_path, 4096 / sizeof(PwType));
+    } else if constexpr (std::is_same_v<DbType, flat_file::cached_database<PwType>>) {
+      // deliberately tiny, to exercise replacement
+      static flat_file::page_cache cache(1U << 16U);
+      return DbType(db_path, cache);
+    } else {
+      return DbType(db_path);
+    }
+  }();
 
   std::mt19937_64                            generator{std::random_device{}()};
   std::uniform_int_distribution<std::size_t> distribution(0, db.number_records() - 1);
@@ -79,3 +108,824 @@ TEST(hibp_integration, toc_search_ntlm) { // NOLINT
 TEST(hibp_integration, toc_search_sha1t64) { // NOLINT
   run_search<hibp::pawned_pw_sha1t64>(true, 18);
 }
+
+#ifdef FLAT_FILE_HAS_MMAP
+
+TEST(hibp_integration, mmap_search_sha1) { // NOLINT
+  run_search<hibp::pawned_pw_sha1, flat_file::mmap_database<hibp::pawned_pw_sha1>>(false);
+}
+
+TEST(hibp_integration, mmap_search_ntlm) { // NOLINT
+  run_search<hibp::pawned_pw_ntlm, flat_file::mmap_database<hibp::pawned_pw_ntlm>>(false);
+}
+
+TEST(hibp_integration, mmap_search_sha1t64) { // NOLINT
+  run_search<hibp::pawned_pw_sha1t64, flat_file::mmap_database<hibp::pawned_pw_sha1t64>>(false);
+}
+
+TEST(hibp_integration, mmap_toc_search_sha1) { // NOLINT
+  run_search<hibp::pawned_pw_sha1, flat_file::mmap_database<hibp::pawned_pw_sha1>>(true, 18);
+}
+
+TEST(hibp_integration, mmap_toc_search_ntlm) { // NOLINT
+  run_search<hibp::pawned_pw_ntlm, flat_file::mmap_database<hibp::pawned_pw_ntlm>>(true, 18);
+}
+
+TEST(hibp_integration, mmap_toc_search_sha1t64) { // NOLINT
+  run_search<hibp::pawned_pw_sha1t64, flat_file::mmap_database<hibp::pawned_pw_sha1t64>>(true,
+                                                                                          18);
+}
+
+TEST(hibp_integration, mmap_prefault_and_lock) { // NOLINT
+  using PwType = hibp::pawned_pw_sha1;
+  auto db_path = std::filesystem::canonical(std::filesystem::current_path() / "data") /
+                 "hibp_test.sha1.bin";
+
+  const flat_file::mmap_database<PwType> db(db_path);
+  flat_file::database<PwType>            reference_db(db_path);
+
+  db.prefault();         // the whole db
+  db.prefault(100, 100); // empty ranges are fine
+  db.prefault(100, 50);  // also when reversed
+  db.lock(1000, 2000);   // a few pages, within even a small `ulimit -l`
+  db.lock(0, 0);
+
+  // still reads the same records
+  for (std::size_t pos = 0; pos < db.number_records(); pos += 997) {
+    EXPECT_EQ(db.get_record(pos), reference_db.get_record(pos));
+  }
+}
+
+#endif
+
+TEST(hibp_integration, cached_search_sha1) { // NOLINT
+  run_search<hibp::pawned_pw_sha1, flat_file::cached_database<hibp::pawned_pw_sha1>>(false);
+}
+
+TEST(hibp_integration, cached_search_ntlm) { // NOLINT
+  run_search<hibp::pawned_pw_ntlm, flat_file::cached_database<hibp::pawned_pw_ntlm>>(false);
+}
+
+TEST(hibp_integration, cached_toc_search_sha1t64) { // NOLINT
+  run_search<hibp::pawned_pw_sha1t64, flat_file::cached_database<hibp::pawned_pw_sha1t64>>(true,
+                                                                                            18);
+}
+
+TEST(hibp_integration, cached_search_threads) { // NOLINT
+  using PwType = hibp::pawned_pw_sha1;
+  auto db_path = std::filesystem::canonical(std::filesystem::current_path() / "data") /
+                 "hibp_test.sha1.bin";
+
+  flat_file::database<PwType> reference_db(db_path); // single threaded source of truth
+  flat_file::page_cache       cache(1U << 16U);      // small, so threads fight over slots
+
+  std::vector<PwType> needles;
+  std::mt19937_64     generator{std::random_device{}()};
+  std::uniform_int_distribution<std::size_t> distribution(0, reference_db.number_records() - 1);
+  for (std::size_t i = 0; i != 2000; ++i) {
+    needles.push_back(reference_db.get_record(distribution(generator)));
+  }
+
+  std::vector<int> failures(4);
+  {
+    std::vector<std::jthread> threads;
+    for (std::size_t t = 0; t != failures.size(); ++t) {
+      threads.emplace_back([&, t] {
+        flat_file::cached_database<PwType> db(db_path, cache);
+        for (const auto& needle: needles) {
+          auto iter = std::lower_bound(db.begin(), db.end(), needle);
+          if (iter == db.end() || *iter != needle || iter->count != needle.count) failures[t]++;
+        }
+      });
+    }
+  }
+  for (auto f: failures) EXPECT_EQ(f, 0);
+}
+
+TEST(hibp_integration, gallop_search_sorted_needles) { // NOLINT
+  using PwType = hibp::pawned_pw_sha1;
+  auto db_path = std::filesystem::canonical(std::filesystem::current_path() / "data") /
+                 "hibp_test.sha1.bin";
+
+  flat_file::database<PwType> db(db_path, 4096 / sizeof(PwType));
+
+  std::vector<PwType> needles;
+  std::mt19937_64     generator{std::random_device{}()};
+  std::uniform_int_distribution<std::size_t> distribution(0, db.number_records() - 1);
+  for (std::size_t i = 0; i != 1000; ++i) {
+    PwType needle = db.get_record(distribution(generator));
+    if (i % 2 == 0) needle.hash.back() ^= std::byte{0x01}; // most likely absent
+    needles.push_back(needle);
+  }
+  std::sort(needles.begin(), needles.end());
+
+  // each search starts where the previous one ended, as in the server's batch lookup
+  auto start = db.begin();
+  for (const auto& needle: needles) {
+    auto expected = std::lower_bound(db.begin(), db.end(), needle);
+    auto iter     = flat_file::gallop_lower_bound(start, db.end(), needle);
+    EXPECT_EQ(iter.pos(), expected.pos());
+    start = iter;
+  }
+  EXPECT_EQ(flat_file::gallop_lower_bound(db.end(), db.end(), needles.front()), db.end());
+}
+
+TEST(hibp_integration, toc_writer_matches_toc_build) { // NOLINT
+  using PwType     = hibp::pawned_pw_sha1;
+  auto testdatadir = std::filesystem::canonical(std::filesystem::current_path() / "data");
+  auto tmpdir      = std::filesystem::current_path() / "tmp";
+  auto db_path     = testdatadir / "hibp_test.sha1.bin";
+  auto tmp_db_path = tmpdir / "toc_writer.sha1.bin";
+  std::filesystem::create_directories(tmpdir);
+
+  // as if written inline by hibp-download / hibp-sort / hibp-convert
+  {
+    flat_file::database<PwType> db(db_path, 4096 / sizeof(PwType));
+    hibp::toc_writer<PwType>    writer(tmp_db_path, 18);
+    for (const auto& pw: db) writer.add(pw);
+    writer.finalize();
+  }
+
+  auto slurp = [](const std::filesystem::path& path) {
+    std::ifstream is(path, std::ios::binary);
+    return std::string(std::istreambuf_iterator<char>(is), {});
+  };
+  EXPECT_EQ(slurp(tmp_db_path.string() + ".18.toc"), slurp(db_path.string() + ".18.toc"));
+  std::filesystem::remove(tmp_db_path.string() + ".18.toc");
+}
+
+TEST(hibp_integration, toc_writer_rejects_unsorted) { // NOLINT
+  hibp::toc_writer<hibp::pawned_pw_sha1> writer("unused.sha1.bin", 18);
+  writer.add(hibp::pawned_pw_sha1{"0000F00000000000000000000000000000000000"});
+  EXPECT_THROW(writer.add(hibp::pawned_pw_sha1{"0000000000000000000000000000000000000000"}),
+               std::runtime_error);
+}
+
+// Copies the test db `db_name` into tmp, as `tmp_name`, and calls `build` with its path. Then drops
+// the first half of the copy, so every position in a stale index of it would be wrong, and calls
+// `build` again. Returns the path of the copy, and the records which are left in it.
+template <hibp::pw_type PwType>
+std::pair<std::filesystem::path, std::vector<PwType>>
+build_then_change_db(const std::string& db_name, const std::string& tmp_name, const auto& build) {
+  auto testdatadir = std::filesystem::canonical(std::filesystem::current_path() / "data");
+  auto tmpdir      = std::filesystem::current_path() / "tmp";
+  auto tmp_db_path = tmpdir / tmp_name;
+  std::filesystem::create_directories(tmpdir);
+
+  std::filesystem::copy_file(testdatadir / db_name, tmp_db_path,
+                             std::filesystem::copy_options::overwrite_existing);
+  build(tmp_db_path);
+
+  std::vector<PwType> records;
+  {
+    flat_file::database<PwType> db(tmp_db_path, 4096 / sizeof(PwType));
+    std::copy(db.begin() + db.number_records() / 2, db.end(), std::back_inserter(records));
+  }
+  {
+    auto writer = flat_file::file_writer<PwType>(tmp_db_path.string());
+    for (const auto& pw: records) writer.write(pw);
+  }
+
+  build(tmp_db_path);
+  return {tmp_db_path, records};
+}
+
+TEST(hibp_integration, toc_rebuilt_when_db_changes) { // NOLINT
+  using PwType                      = hibp::pawned_pw_sha1;
+  const auto [tmp_db_path, records] = build_then_change_db<PwType>(
+      "hibp_test.sha1.bin", "toc_stale.sha1.bin",
+      [](const auto& path) { hibp::toc_build<PwType>(path, 18); });
+
+  flat_file::database<PwType> db(tmp_db_path, 4096 / sizeof(PwType));
+  for (std::size_t i = 0; i < records.size(); i += 97) {
+    auto maybe_ppw = hibp::toc_search(db, records[i], 18);
+    ASSERT_TRUE(maybe_ppw);
+    EXPECT_EQ(maybe_ppw->count, records[i].count);
+  }
+  std::filesystem::remove(tmp_db_path);
+  std::filesystem::remove(tmp_db_path.string() + ".18.toc");
+}
+
+// every record must be found, within the guaranteed window
+template <hibp::pw_type PwType>
+void run_pla_search(const std::string& db_name, unsigned epsilon) {
+  auto testdatadir = std::filesystem::canonical(std::filesystem::current_path() / "data");
+  auto tmpdir      = std::filesystem::current_path() / "tmp";
+  auto tmp_db_path = tmpdir / ("pla_" + db_name); // keep the .pla out of the test data
+  std::filesystem::create_directories(tmpdir);
+  std::filesystem::copy_file(testdatadir / db_name, tmp_db_path,
+                             std::filesystem::copy_options::overwrite_existing);
+
+  hibp::pla_build<PwType>(tmp_db_path, epsilon);
+  flat_file::database<PwType> db(tmp_db_path, 4096 / sizeof(PwType));
+  for (std::size_t i = 0; i != db.number_records(); ++i) {
+    const PwType needle = db.get_record(i);
+    SCOPED_TRACE(fmt::format("record {}", i));
+    const auto [first, last] = hibp::pla_window(needle, db.number_records());
+    EXPECT_LE(first, i);
+    EXPECT_GT(last, i);
+    EXPECT_LE(last - first, 2 * (epsilon + 1) + 2); // test data has no repeated 64bit keys
+    auto maybe_ppw = hibp::pla_search(db, needle);
+    ASSERT_TRUE(maybe_ppw);
+    EXPECT_EQ(maybe_ppw->count, needle.count);
+  }
+  PwType absent;
+  absent.hash.fill(std::byte{0x00});
+  EXPECT_FALSE(hibp::pla_search(db, absent));
+
+  std::filesystem::remove(tmp_db_path);
+  std::filesystem::remove(fmt::format("{}.{}.pla", tmp_db_path.string(), epsilon));
+}
+
+TEST(hibp_integration, pla_search_sha1) { // NOLINT
+  run_pla_search<hibp::pawned_pw_sha1>("hibp_test.sha1.bin", 64);
+}
+
+TEST(hibp_integration, pla_search_ntlm) { // NOLINT
+  run_pla_search<hibp::pawned_pw_ntlm>("hibp_test.ntlm.bin", 64);
+}
+
+TEST(hibp_integration, pla_search_sha1t64_small_epsilon) { // NOLINT
+  run_pla_search<hibp::pawned_pw_sha1t64>("hibp_test.sha1t64.bin", 2);
+}
+
+TEST(hibp_integration, pla_rebuilt_when_db_changes) { // NOLINT
+  using PwType                      = hibp::pawned_pw_sha1;
+  const auto [tmp_db_path, records] = build_then_change_db<PwType>(
+      "hibp_test.sha1.bin", "pla_stale.sha1.bin",
+      [](const auto& path) { hibp::pla_build<PwType>(path, 16); });
+
+  flat_file::database<PwType> db(tmp_db_path, 4096 / sizeof(PwType));
+  for (std::size_t i = 0; i < records.size(); i += 97) {
+    auto maybe_ppw = hibp::pla_search(db, records[i]);
+    ASSERT_TRUE(maybe_ppw);
+    EXPECT_EQ(maybe_ppw->count, records[i].count);
+  }
+  std::filesystem::remove(tmp_db_path);
+  std::filesystem::remove(tmp_db_path.string() + ".16.pla");
+}
+
+// eg the old and the new generation of a db, while hibp-server reloads it
+TEST(hibp_integration, indexes_of_two_dbs_at_once) { // NOLINT
+  using PwType     = hibp::pawned_pw_sha1;
+  auto testdatadir = std::filesystem::canonical(std::filesystem::current_path() / "data");
+  auto tmpdir      = std::filesystem::current_path() / "tmp";
+  auto old_db_path = tmpdir / "index_old.sha1.bin";
+  auto new_db_path = tmpdir / "index_new.sha1.bin";
+  std::filesystem::create_directories(tmpdir);
+
+  std::filesystem::copy_file(testdatadir / "hibp_test.sha1.bin", old_db_path,
+                             std::filesystem::copy_options::overwrite_existing);
+  std::vector<PwType> records;
+  {
+    flat_file::database<PwType> db(old_db_path, 4096 / sizeof(PwType));
+    std::copy(db.begin() + db.number_records() / 2, db.end(), std::back_inserter(records));
+  }
+  {
+    auto writer = flat_file::file_writer<PwType>(new_db_path.string());
+    for (const auto& pw: records) writer.write(pw);
+  }
+
+  const hibp::toc_index<PwType> old_toc(old_db_path, 18);
+  const hibp::pla_index<PwType> old_pla(old_db_path, 16);
+  const hibp::toc_index<PwType> new_toc(new_db_path, 18);
+  const hibp::pla_index<PwType> new_pla(new_db_path, 16);
+
+  flat_file::database<PwType> old_db(old_db_path, 4096 / sizeof(PwType));
+  flat_file::database<PwType> new_db(new_db_path, 4096 / sizeof(PwType));
+  for (std::size_t i = 0; i < records.size(); i += 97) {
+    const std::size_t old_pos = old_db.number_records() / 2 + i;
+    for (auto [first, last]: {*old_toc.chapter(records[i], old_db.number_records()),
+                              old_pla.window(records[i], old_db.number_records())}) {
+      EXPECT_LE(first, old_pos);
+      EXPECT_GT(last, old_pos);
+    }
+    for (auto [first, last]: {*new_toc.chapter(records[i], new_db.number_records()),
+                              new_pla.window(records[i], new_db.number_records())}) {
+      EXPECT_LE(first, i);
+      EXPECT_GT(last, i);
+    }
+  }
+  for (const auto& path: {old_db_path, new_db_path}) {
+    std::filesystem::remove(path);
+    std::filesystem::remove(path.string() + ".18.toc");
+    std::filesystem::remove(path.string() + ".16.pla");
+  }
+}
+
+TEST(hibp_integration, pla_writer_rejects_unsorted) { // NOLINT
+  hibp::pla_writer<hibp::pawned_pw_sha1> writer("unused.sha1.bin", 64);
+  writer.add(hibp::pawned_pw_sha1{"0000F00000000000000000000000000000000000"});
+  EXPECT_THROW(writer.add(hibp::pawned_pw_sha1{"0000000000000000000000000000000000000000"}),
+               std::runtime_error);
+}
+
+// the range must always contain the lower_bound, for any budget, and for present or absent needles
+TEST(hibp_integration, hot_index_range_contains_lower_bound) { // NOLINT
+  using PwType = hibp::pawned_pw_sha1;
+  auto db_path = std::filesystem::canonical(std::filesystem::current_path() / "data") /
+                 "hibp_test.sha1.bin";
+
+  flat_file::database<PwType> db(db_path, 4096 / sizeof(PwType));
+
+  std::mt19937_64                            generator{std::random_device{}()};
+  std::uniform_int_distribution<std::size_t> distribution(0, db.number_records() - 1);
+
+  for (const std::size_t budget: {1UL, 1000UL, 100'000UL, 100'000'000UL}) {
+    const flat_file::hot_index<PwType> hot(db, budget);
+    SCOPED_TRACE(fmt::format("budget {}, stride {}", budget, hot.stride()));
+    EXPECT_LE(hot.memory(), std::max(budget, sizeof(PwType) * 2 + sizeof(std::uint32_t) * 2));
+
+    std::vector<PwType> needles{db.get_record(0), db.back()};
+    needles.front().hash.fill(std::byte{0x00}); // before the first record
+    needles.back().hash.fill(std::byte{0xFF});  // after the last record
+    for (std::size_t i = 0; i != 1000; ++i) {
+      PwType needle = db.get_record(distribution(generator));
+      if (i % 2 == 0) needle.hash.back() ^= std::byte{0x01}; // most likely absent
+      needles.push_back(needle);
+    }
+    for (const auto& needle: needles) {
+      const auto expected      = std::lower_bound(db.begin(), db.end(), needle).pos();
+      const auto [first, last] = hot.range(needle);
+      EXPECT_LE(first, expected);
+      EXPECT_TRUE(expected < last || expected == db.number_records());
+      EXPECT_LE(last - first, hot.stride());
+    }
+  }
+}
+
+TEST(hibp_integration, hot_table_find) { // NOLINT
+  using PwType = hibp::pawned_pw_sha1;
+  auto db_path = std::filesystem::canonical(std::filesystem::current_path() / "data") /
+                 "hibp_test.sha1.bin";
+
+  const hibp::hot_table<PwType> hot(db_path);
+  flat_file::database<PwType>   db(db_path, 4096 / sizeof(PwType));
+  EXPECT_EQ(hot.size(), db.number_records());
+
+  std::size_t finds = 0;
+  for (std::size_t i = 0; i < db.number_records(); i += 97, ++finds) {
+    PwType needle = db.get_record(i);
+    auto   found  = hot.find(needle);
+    ASSERT_TRUE(found);
+    EXPECT_EQ(found->count, needle.count);
+
+    needle.hash.back() ^= std::byte{0x01}; // most likely absent, and same slot
+    EXPECT_EQ(hot.find(needle).has_value(),
+              std::binary_search(db.begin(), db.end(), needle));
+  }
+  EXPECT_EQ(hot.hits() + hot.misses(), 2 * finds);
+}
+
+TEST(hibp_integration, bulk_read_matches_records) { // NOLINT
+  auto db_path =
+      std::filesystem::canonical(std::filesystem::current_path() / "data") / "hibp_test.sha1.bin";
+
+  flat_file::database<hibp::pawned_pw_sha1>        db(db_path, 4096 / sizeof(hibp::pawned_pw_sha1));
+  flat_file::page_cache                            cache(1U << 16U);
+  flat_file::cached_database<hibp::pawned_pw_sha1> cached_db(db_path, cache);
+
+  std::vector<hibp::pawned_pw_sha1> buf(1000);
+  std::vector<hibp::pawned_pw_sha1> cached_buf(1000);
+  db.read(12345, buf.size(), buf.data());
+  cached_db.read(12345, cached_buf.size(), cached_buf.data());
+  for (std::size_t i = 0; i != buf.size(); ++i) {
+    EXPECT_EQ(buf[i], db.get_record(12345 + i));
+    EXPECT_EQ(cached_buf[i], buf[i]);
+  }
+  EXPECT_THROW(db.read(db.number_records() - 1, 2, buf.data()), std::runtime_error);    // NOLINT
+  EXPECT_THROW(cached_db.read(db.number_records(), 1, buf.data()), std::runtime_error); // NOLINT
+}
+
+// every record must be found, and the whole db and any range must read back exactly
+template <hibp::pw_type PwType>
+void run_packed_search(const std::string& db_name, std::size_t block_records) {
+  auto testdatadir = std::filesystem::canonical(std::filesystem::current_path() / "data");
+  auto tmpdir      = std::filesystem::current_path() / "tmp";
+  auto packed_path = tmpdir / ("packed_" + db_name);
+  std::filesystem::create_directories(tmpdir);
+
+  flat_file::database<PwType> db(testdatadir / db_name, 4096 / sizeof(PwType));
+  {
+    std::ofstream                os(packed_path, std::ios::binary);
+    hibp::packed::writer<PwType> writer(os, block_records);
+    for (const auto& pw: db) writer.write(pw);
+    writer.finalize();
+  }
+  EXPECT_TRUE(hibp::packed::is_packed(packed_path));
+  EXPECT_FALSE(hibp::packed::is_packed(testdatadir / db_name));
+
+  hibp::packed::database<PwType> packed(packed_path);
+  ASSERT_EQ(packed.number_records(), db.number_records());
+  if (block_records >= 64) { // otherwise the block overheads dominate
+    EXPECT_LT(std::filesystem::file_size(packed_path), std::filesystem::file_size(db.filename()));
+  }
+
+  std::vector<PwType> all;
+  std::vector<PwType> block;
+  for (std::size_t i = 0; i != packed.number_blocks(); ++i) {
+    packed.read_block(i, block);
+    all.insert(all.end(), block.begin(), block.end());
+  }
+  ASSERT_TRUE(std::equal(all.begin(), all.end(), db.begin(), db.end(),
+                         [](const PwType& a, const PwType& b) {
+                           return a == b && a.count == b.count;
+                         }));
+
+  for (std::size_t i = 0; i < all.size(); i += 7) {
+    SCOPED_TRACE(fmt::format("record {}", i));
+    auto maybe_ppw = packed.find(all[i]);
+    ASSERT_TRUE(maybe_ppw);
+    EXPECT_EQ(maybe_ppw->count, all[i].count);
+
+    PwType absent = all[i];
+    absent.hash.back() ^= std::byte{0x01}; // most likely absent
+    EXPECT_EQ(packed.find(absent).has_value(),
+              std::binary_search(all.begin(), all.end(), absent));
+  }
+
+  std::vector<PwType> range;
+  for (std::size_t first = 0; first < all.size(); first += all.size() / 10) {
+    const std::size_t last = std::min(first + 1000, all.size() - 1);
+    packed.read_range(all[first], all[last], range);
+    EXPECT_TRUE(std::equal(range.begin(), range.end(),
+                           all.begin() + static_cast<std::ptrdiff_t>(first),
+                           all.begin() + static_cast<std::ptrdiff_t>(last)));
+  }
+  packed.read_range(all[all.size() - 10], {}, range);
+  EXPECT_EQ(range.size(), 10);
+
+  EXPECT_THROW(hibp::packed::database<hibp::pawned_pw_ntlm>{packed_path}, std::runtime_error);
+  std::filesystem::remove(packed_path);
+}
+
+TEST(hibp_integration, packed_search_sha1) { // NOLINT
+  run_packed_search<hibp::pawned_pw_sha1>("hibp_test.sha1.bin", 256);
+}
+
+TEST(hibp_integration, packed_search_sha1t64_small_blocks) { // NOLINT
+  run_packed_search<hibp::pawned_pw_sha1t64>("hibp_test.sha1t64.bin", 3);
+}
+
+TEST(hibp_integration, packed_writer_rejects_unsorted) { // NOLINT
+  std::ostringstream                         os;
+  hibp::packed::writer<hibp::pawned_pw_sha1> writer(os, 2);
+  writer.write(hibp::pawned_pw_sha1{"0000F00000000000000000000000000000000000"});
+  writer.write(hibp::pawned_pw_sha1{"0000F00000000000000000000000000000000001"});
+  EXPECT_THROW(writer.write(hibp::pawned_pw_sha1{"0000000000000000000000000000000000000000"}),
+               std::runtime_error);
+}
+
+template <hibp::pw_type PwType>
+void run_split_search(const std::string& db_name) {
+  auto testdatadir = std::filesystem::canonical(std::filesystem::current_path() / "data");
+  auto tmpdir      = std::filesystem::current_path() / "tmp";
+  auto tmp_db_path = tmpdir / ("split_" + db_name); // keep the columns out of the test data
+  std::filesystem::create_directories(tmpdir);
+  std::filesystem::copy_file(testdatadir / db_name, tmp_db_path,
+                             std::filesystem::copy_options::overwrite_existing);
+
+  hibp::split_build<PwType>(tmp_db_path);
+  EXPECT_EQ(std::filesystem::file_size(tmp_db_path.string() + ".keys"),
+            std::filesystem::file_size(tmp_db_path) / sizeof(PwType) *
+                sizeof(hibp::details::split_key_t<PwType>));
+
+  hibp::split_db<PwType>      split(tmp_db_path);
+  flat_file::database<PwType> db(tmp_db_path, 4096 / sizeof(PwType));
+  ASSERT_EQ(split.number_records(), db.number_records());
+  for (std::size_t i = 0; i != db.number_records(); ++i) {
+    const PwType needle = db.get_record(i);
+    SCOPED_TRACE(fmt::format("record {}", i));
+    auto maybe_ppw = split.find(needle);
+    ASSERT_TRUE(maybe_ppw);
+    EXPECT_EQ(maybe_ppw->count, needle.count);
+    EXPECT_TRUE(split.find(needle, i, i + 1));
+    EXPECT_FALSE(split.find(needle, i + 1, split.number_records()));
+    if (i % 101 == 0) {
+      EXPECT_EQ(split.get_record(i), needle);
+
+      PwType absent = needle;
+      absent.hash.back() ^= std::byte{0x01}; // only differs in the tail for sha1
+      EXPECT_EQ(split.find(absent).has_value(),
+                std::binary_search(db.begin(), db.end(), absent));
+    }
+  }
+  PwType absent;
+  absent.hash.fill(std::byte{0xFF});
+  EXPECT_FALSE(split.find(absent));
+
+  for (const auto* ext: {".keys", ".tails", ".counts"}) {
+    std::filesystem::remove(tmp_db_path.string() + ext);
+  }
+  std::filesystem::remove(tmp_db_path);
+}
+
+TEST(hibp_integration, split_search_sha1) { // NOLINT
+  run_split_search<hibp::pawned_pw_sha1>("hibp_test.sha1.bin");
+}
+
+TEST(hibp_integration, split_search_ntlm) { // NOLINT
+  run_split_search<hibp::pawned_pw_ntlm>("hibp_test.ntlm.bin");
+}
+
+TEST(hibp_integration, split_search_sha1t64) { // NOLINT
+  run_split_search<hibp::pawned_pw_sha1t64>("hibp_test.sha1t64.bin");
+}
+
+TEST(hibp_integration, split_rebuilt_when_db_changes) { // NOLINT
+  using PwType                      = hibp::pawned_pw_sha1t64;
+  const auto [tmp_db_path, records] = build_then_change_db<PwType>(
+      "hibp_test.sha1t64.bin", "split_stale.sha1t64.bin",
+      [](const auto& path) { hibp::split_build<PwType>(path); });
+
+  hibp::split_db<PwType> split(tmp_db_path);
+  EXPECT_EQ(split.number_records(), records.size());
+  EXPECT_EQ(split.get_record(0), records.front());
+
+  std::filesystem::remove(tmp_db_path);
+  std::filesystem::remove(tmp_db_path.string() + ".keys");
+  std::filesystem::remove(tmp_db_path.string() + ".counts");
+}
+
+template <hibp::pw_type PwType>
+void run_mphf_search(const std::string& db_name, unsigned threads) {
+  auto testdatadir   = std::filesystem::canonical(std::filesystem::current_path() / "data");
+  auto tmpdir        = std::filesystem::current_path() / "tmp";
+  auto tmp_mphf_path = tmpdir / ("mphf_" + db_name);
+  std::filesystem::create_directories(tmpdir);
+
+  hibp::mphf_build<PwType>(testdatadir / db_name, tmp_mphf_path, threads);
+
+  hibp::mphf_db               mphf(tmp_mphf_path);
+  flat_file::database<PwType> db(testdatadir / db_name, 4096 / sizeof(PwType));
+  ASSERT_EQ(mphf.number_records(), db.number_records());
+  EXPECT_EQ(mphf.hash_size(), PwType::hash_size);
+  EXPECT_LT(mphf.function_size() * 8, db.number_records() * 6); // a few bits per record
+  for (std::size_t i = 0; i != db.number_records(); ++i) {
+    const PwType needle = db.get_record(i);
+    SCOPED_TRACE(fmt::format("record {}", i));
+    auto count = mphf.find(needle);
+    ASSERT_TRUE(count);
+    EXPECT_EQ(*count, needle.count);
+    if (i % 101 == 0) {
+      PwType absent = needle;
+      absent.hash.back() ^= std::byte{0x01};
+      EXPECT_EQ(mphf.find(absent).has_value(), std::binary_search(db.begin(), db.end(), absent));
+    }
+  }
+  PwType absent;
+  absent.hash.fill(std::byte{0xFF});
+  EXPECT_FALSE(mphf.find(absent));
+
+  const std::array<std::byte, PwType::hash_size + 1> wrong_size{};
+  EXPECT_THROW(mphf.find(wrong_size), std::runtime_error);
+
+  std::filesystem::remove(tmp_mphf_path);
+}
+
+TEST(hibp_integration, mphf_search_sha1) { // NOLINT
+  run_mphf_search<hibp::pawned_pw_sha1>("hibp_test.sha1.bin", 0);
+}
+
+TEST(hibp_integration, mphf_search_ntlm) { // NOLINT
+  run_mphf_search<hibp::pawned_pw_ntlm>("hibp_test.ntlm.bin", 1);
+}
+
+TEST(hibp_integration, mphf_search_sha1t64) { // NOLINT
+  run_mphf_search<hibp::pawned_pw_sha1t64>("hibp_test.sha1t64.bin", 3);
+}
+
+TEST(hibp_integration, mphf_rejects_other_files) { // NOLINT
+  auto testdatadir = std::filesystem::canonical(std::filesystem::current_path() / "data");
+  EXPECT_THROW(hibp::mphf_db{testdatadir / "hibp_test.sha1.bin"}, std::runtime_error);
+}
+
+TEST(hibp_integration, mphf_build_rejects_unsorted_dbs) { // NOLINT
+  using PwType       = hibp::pawned_pw_sha1;
+  auto testdatadir   = std::filesystem::canonical(std::filesystem::current_path() / "data");
+  auto tmpdir        = std::filesystem::current_path() / "tmp";
+  auto tmp_db_path   = tmpdir / "mphf_unsorted.sha1.bin";
+  auto tmp_mphf_path = tmpdir / "mphf_unsorted.sha1.mphf";
+  std::filesystem::create_directories(tmpdir);
+
+  std::vector<PwType> records;
+  {
+    flat_file::database<PwType> db(testdatadir / "hibp_test.sha1.bin", 4096 / sizeof(PwType));
+    std::copy(db.begin(), db.end(), std::back_inserter(records));
+  }
+  ASSERT_GT(records.size(), 2);
+  ASSERT_EQ(records[0].hash[0], records[1].hash[0]); // in the same shard
+
+  const auto write_db = [&] {
+    auto writer = flat_file::file_writer<PwType>(tmp_db_path.string());
+    for (const auto& pw: records) writer.write(pw);
+  };
+
+  std::swap(records[0], records[1]);
+  write_db();
+  EXPECT_THROW(hibp::mphf_build<PwType>(tmp_db_path, tmp_mphf_path), std::runtime_error);
+  EXPECT_FALSE(std::filesystem::exists(tmp_mphf_path));
+
+  records[0] = records[1];
+  write_db();
+  EXPECT_THROW(hibp::mphf_build<PwType>(tmp_db_path, tmp_mphf_path), std::runtime_error);
+
+  std::filesystem::remove(tmp_db_path);
+}
+
+template <hibp::pw_type PwType>
+void run_paged_search(const std::string& db_name, std::size_t page_size) {
+  auto testdatadir = std::filesystem::canonical(std::filesystem::current_path() / "data");
+  auto tmpdir      = std::filesystem::current_path() / "tmp";
+  auto tmp_db_path = tmpdir / ("paged_" + db_name); // keep the pages out of the test data
+  std::filesystem::create_directories(tmpdir);
+  std::filesystem::copy_file(testdatadir / db_name, tmp_db_path,
+                             std::filesystem::copy_options::overwrite_existing);
+
+  hibp::paged_build<PwType>(tmp_db_path, page_size);
+  hibp::paged_db<PwType>      paged(tmp_db_path);
+  flat_file::database<PwType> db(tmp_db_path, 4096 / sizeof(PwType));
+  ASSERT_EQ(paged.number_records(), db.number_records());
+  EXPECT_EQ(paged.page_size(), page_size);
+  EXPECT_EQ(std::filesystem::file_size(hibp::paged_filename(tmp_db_path)),
+            (1 + paged.buckets() + paged.overflow_pages()) * page_size);
+
+  std::size_t reads = 0;
+  for (std::size_t i = 0; i != db.number_records(); ++i) {
+    const PwType needle = db.get_record(i);
+    SCOPED_TRACE(fmt::format("record {}", i));
+    auto maybe_ppw = paged.find(needle, reads);
+    ASSERT_TRUE(maybe_ppw);
+    EXPECT_EQ(maybe_ppw->count, needle.count);
+    if (i % 101 == 0) {
+      PwType absent = needle;
+      absent.hash.back() ^= std::byte{0x01}; // only differs in the tail for sha1
+      EXPECT_EQ(paged.find(absent).has_value(), std::binary_search(db.begin(), db.end(), absent));
+    }
+  }
+  // nearly always one page per lookup, a little more where buckets overflowed
+  EXPECT_LE(reads, db.number_records() + paged.overflow_pages() * page_size / sizeof(PwType));
+  PwType absent;
+  absent.hash.fill(std::byte{0xFF});
+  EXPECT_FALSE(paged.find(absent, reads));
+
+  std::filesystem::remove(hibp::paged_filename(tmp_db_path));
+  std::filesystem::remove(tmp_db_path);
+}
+
+TEST(hibp_integration, paged_search_sha1) { // NOLINT
+  run_paged_search<hibp::pawned_pw_sha1>("hibp_test.sha1.bin", 4096);
+}
+
+TEST(hibp_integration, paged_search_ntlm) { // NOLINT
+  run_paged_search<hibp::pawned_pw_ntlm>("hibp_test.ntlm.bin", 4096);
+}
+
+TEST(hibp_integration, paged_search_sha1t64_small_pages) { // NOLINT
+  run_paged_search<hibp::pawned_pw_sha1t64>("hibp_test.sha1t64.bin", 512); // many overflows
+}
+
+TEST(hibp_integration, paged_rebuilt_when_db_changes) { // NOLINT
+  using PwType                      = hibp::pawned_pw_sha1t64;
+  const auto [tmp_db_path, records] = build_then_change_db<PwType>(
+      "hibp_test.sha1t64.bin", "paged_stale.sha1t64.bin",
+      [](const auto& path) { hibp::paged_build<PwType>(path); });
+  {
+    hibp::paged_db<PwType> paged(tmp_db_path);
+    EXPECT_EQ(paged.number_records(), records.size());
+    EXPECT_TRUE(paged.find(records.front()));
+    EXPECT_TRUE(paged.find(records.back()));
+  }
+
+  hibp::paged_build<PwType>(tmp_db_path, 1024); // another page size is rebuilt too
+  EXPECT_EQ(hibp::paged_db<PwType>(tmp_db_path).page_size(), 1024);
+  EXPECT_THROW(hibp::paged_build<PwType>(tmp_db_path, 1000), std::runtime_error);
+
+  std::filesystem::remove(hibp::paged_filename(tmp_db_path));
+  std::filesystem::remove(tmp_db_path);
+}
+
+// the records of a test db, in a random order
+template <hibp::pw_type PwType>
+std::vector<PwType> shuffled_records(const std::string& db_name) {
+  auto testdatadir = std::filesystem::canonical(std::filesystem::current_path() / "data");
+  flat_file::database<PwType> db(testdatadir / db_name, 4096 / sizeof(PwType));
+  std::vector<PwType>         records(db.begin(), db.end());
+  std::mt19937                gen(42); // NOLINT deterministic
+  std::shuffle(records.begin(), records.end(), gen);
+  return records;
+}
+
+// the test dbs only hold the first 256 of the prefix files, so their leading 12 bits are all zero
+void run_radix_disksort(unsigned zero_bits, std::size_t max_memory, unsigned threads) {
+  using PwType     = hibp::pawned_pw_sha1;
+  auto testdatadir = std::filesystem::canonical(std::filesystem::current_path() / "data");
+  auto tmpdir      = std::filesystem::current_path() / "tmp";
+  auto tmp_db_path = tmpdir / "radix_shuffled.sha1.bin";
+  std::filesystem::create_directories(tmpdir);
+
+  const auto records = shuffled_records<PwType>("hibp_test.sha1.bin");
+  {
+    auto writer = flat_file::file_writer<PwType>(tmp_db_path.string());
+    for (const auto& pw: records) writer.write(pw);
+  }
+
+  std::vector<PwType>         written; // by on_write
+  flat_file::database<PwType> db(tmp_db_path);
+  const std::string           sorted_filename = db.radix_disksort(
+      [&](const PwType& pw) { return hibp::details::pw_to_key(pw) << zero_bits; }, {}, max_memory,
+      [&](const PwType& pw) { written.push_back(pw); }, threads);
+  EXPECT_EQ(sorted_filename, tmp_db_path.string() + ".sorted");
+
+  flat_file::database<PwType> sorted(sorted_filename, 4096 / sizeof(PwType));
+  flat_file::database<PwType> expected(testdatadir / "hibp_test.sha1.bin", 4096 / sizeof(PwType));
+  const auto                  same = [](const PwType& a, const PwType& b) {
+    return a == b && a.count == b.count;
+  };
+  EXPECT_TRUE(std::equal(sorted.begin(), sorted.end(), expected.begin(), expected.end(), same));
+  EXPECT_TRUE(std::equal(written.begin(), written.end(), expected.begin(), expected.end(), same));
+
+  for (const auto& entry: std::filesystem::directory_iterator(tmpdir)) {
+    EXPECT_EQ(entry.path().string().find(".partition."), std::string::npos) << entry.path();
+  }
+  std::filesystem::remove(tmp_db_path);
+  std::filesystem::remove(sorted_filename);
+}
+
+TEST(hibp_integration, radix_disksort) { // NOLINT
+  run_radix_disksort(12, 1'000'000, 4); // 32 partitions over 4 threads
+}
+
+TEST(hibp_integration, radix_disksort_skewed_keys) { // NOLINT
+  run_radix_disksort(0, 1'000'000, 4); // all in the first partition, which is merge sorted
+}
+
+template <hibp::pw_type PwType>
+void run_uring_search(const std::string& db_name, unsigned queue_depth) {
+  if (!hibp::uring_available()) GTEST_SKIP() << "io_uring is not available";
+
+  auto testdatadir = std::filesystem::canonical(std::filesystem::current_path() / "data");
+  flat_file::database<PwType> db(testdatadir / db_name, 4096 / sizeof(PwType));
+  const std::vector<PwType>   records(db.begin(), db.end());
+
+  // every 5th record is searched for in the whole db, in its own one record range, and in the range
+  // after it. And with a changed hash, which is mostly absent.
+  struct result {
+    std::optional<PwType> whole;
+    std::optional<PwType> own;
+    std::optional<PwType> after;
+    std::optional<PwType> absent;
+  };
+  constexpr std::size_t step     = 5;
+  const std::size_t     searched = (records.size() + step - 1) / step;
+  std::vector<result>   results(records.size());
+  std::latch            done(static_cast<std::ptrdiff_t>(searched * 4 + 1));
+
+  {
+    hibp::uring_search<PwType> uring(testdatadir / db_name, queue_depth);
+    ASSERT_EQ(uring.number_records(), records.size());
+
+    auto into = [&](std::optional<PwType>& slot) {
+      return [&](std::optional<PwType> found, const std::exception_ptr& error) {
+        EXPECT_FALSE(error);
+        slot = found;
+        done.count_down();
+      };
+    };
+    std::vector<std::jthread> threads;
+    for (std::size_t t = 0; t != 4; ++t) {
+      threads.emplace_back([&, t] {
+        for (std::size_t i = t * step; i < records.size(); i += 4 * step) {
+          PwType absent = records[i];
+          absent.hash.back() ^= std::byte{0x01};
+          uring.find(records[i], 0, records.size(), into(results[i].whole));
+          uring.find(records[i], i, i + 1, into(results[i].own));
+          uring.find(records[i], i + 1, records.size(), into(results[i].after));
+          uring.find(absent, 0, records.size(), into(results[i].absent));
+        }
+      });
+    }
+    threads.clear(); // join
+    done.arrive_and_wait();
+  }
+
+  for (std::size_t i = 0; i < records.size(); i += step) {
+    SCOPED_TRACE(fmt::format("record {}", i));
+    ASSERT_TRUE(results[i].whole);
+    EXPECT_EQ(results[i].whole->count, records[i].count);
+    EXPECT_TRUE(results[i].own);
+    EXPECT_FALSE(results[i].after);
+    PwType absent = records[i];
+    absent.hash.back() ^= std::byte{0x01};
+    EXPECT_EQ(results[i].absent.has_value(),
+              std::binary_search(records.begin(), records.end(), absent));
+  }
+}
+
+TEST(hibp_integration, uring_search_sha1) { // NOLINT
+  run_uring_search<hibp::pawned_pw_sha1>("hibp_test.sha1.bin", 256);
+}
+
+TEST(hibp_integration, uring_search_sha1t64_shallow_queue) { // NOLINT
+  run_uring_search<hibp::pawned_pw_sha1t64>("hibp_test.sha1t64.bin", 4); // most wait for a slot
+}